@@ -23,17 +23,22 @@
 
 using namespace std;
 
-CAsyncCopier::CAsyncCopier(const std::string& sourcePath, const std::string& destinationPath, MojServiceMessage* msg) :
+CAsyncCopier::CAsyncCopier(const std::string& sourcePath, const std::string& destinationPath, MojServiceMessage* msg,
+			   CFsStats* fsStats, uint64_t size) :
 	  m_msg(msg)
 	, m_destinationPath(destinationPath)
 	, m_sourceFile(Gio::File::create_for_path(sourcePath))
 	, m_destinationFile(Gio::File::create_for_path(destinationPath))
 	, m_ready(sigc::mem_fun(*this, &CAsyncCopier::Ready))
+	, m_fsStats(fsStats)
+	, m_size(size)
+	, m_start(0)
 {
 }
 
 void CAsyncCopier::StartCopy()
 {
+	m_start = CMetrics::Now();
 	m_sourceFile->copy_async(m_destinationFile, m_ready);
 }
 
@@ -52,6 +57,11 @@ void CAsyncCopier::Ready(Glib::RefPtr< Gio::AsyncResult >& r)
                 what = err.what();
         } catch (...) {
         }
+
+        if (m_fsStats != NULL) {
+                m_fsStats->Record(FsCopy, CMetrics::Now() - m_start, !copyWorked,
+                                  s_fsMetadataBytes + (m_size + s_blockSize - 1) / s_blockSize * s_blockSize);
+        }
         
         if (copyWorked) {
                 err = m_msg->replySuccess(reply);                
@@ -26,10 +26,14 @@ LICENSE@@@ */
 
 #include "core/MojService.h"
 #include "luna/MojLunaMessage.h"
+#include "FsStats.h"
 
 class CAsyncCopier : public boost::noncopyable {
  public:
-	CAsyncCopier(const std::string& sourcePath, const std::string& destinationPath, MojServiceMessage* msg);
+	// The copy is counted in fsStats, if not NULL, as writing size
+	// bytes
+	CAsyncCopier(const std::string& sourcePath, const std::string& destinationPath, MojServiceMessage* msg,
+		     CFsStats* fsStats = NULL, uint64_t size = 0);
 	
 	void StartCopy();
     void Ready(Glib::RefPtr< Gio::AsyncResult >&);
@@ -40,6 +44,9 @@ private:
 	Glib::RefPtr<Gio::File> m_sourceFile;
  	Glib::RefPtr<Gio::File> m_destinationFile;
 	Gio::SlotAsyncReady m_ready;
+	CFsStats* m_fsStats;
+	uint64_t m_size;
+	uint64_t m_start;
 };
 
 #endif
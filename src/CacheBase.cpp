@@ -327,7 +327,8 @@ CleanupDir(const std::string& pathname, std::string& msgText) {
   return success;
 }
 
-static cacheSize_t s_dirSum;
+// nftw doesn't pass any state to Sum so the total is kept per thread
+static __thread cacheSize_t s_dirSum;
 static int
 Sum(const char* fpath, const struct stat* sb, int flag, struct FTW* ftwbuf) {
 
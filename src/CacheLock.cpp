@@ -0,0 +1,107 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "CacheLock.h"
+
+CCacheMutex::CCacheMutex() {
+
+  pthread_mutexattr_t attr;
+  ::pthread_mutexattr_init(&attr);
+  ::pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  ::pthread_mutex_init(&m_mutex, &attr);
+  ::pthread_mutexattr_destroy(&attr);
+}
+
+CCacheMutex::~CCacheMutex() {
+
+  ::pthread_mutex_destroy(&m_mutex);
+}
+
+void
+CCacheMutex::Lock() {
+
+  ::pthread_mutex_lock(&m_mutex);
+}
+
+void
+CCacheMutex::Unlock() {
+
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+CCacheRWLock::CCacheRWLock() : m_readers(0), m_writerDepth(0) {
+
+  ::pthread_mutex_init(&m_mutex, NULL);
+  ::pthread_cond_init(&m_cond, NULL);
+}
+
+CCacheRWLock::~CCacheRWLock() {
+
+  ::pthread_cond_destroy(&m_cond);
+  ::pthread_mutex_destroy(&m_mutex);
+}
+
+// A reader only waits for an active writer, never for a waiting one,
+// so a thread that already holds the shared side can always take it
+// again.  The writer taking the shared side just nests.
+void
+CCacheRWLock::ReadLock() {
+
+  ::pthread_mutex_lock(&m_mutex);
+  if ((m_writerDepth > 0) && ::pthread_equal(m_writer, ::pthread_self())) {
+    m_writerDepth++;
+  } else {
+    while (m_writerDepth > 0) {
+      ::pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    m_readers++;
+  }
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+void
+CCacheRWLock::WriteLock() {
+
+  ::pthread_mutex_lock(&m_mutex);
+  if ((m_writerDepth > 0) && ::pthread_equal(m_writer, ::pthread_self())) {
+    m_writerDepth++;
+  } else {
+    while ((m_writerDepth > 0) || (m_readers > 0)) {
+      ::pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    m_writer = ::pthread_self();
+    m_writerDepth = 1;
+  }
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+// While there is a writer every hold on the lock belongs to it, as
+// readers can't get in and a reader can't become the writer.
+void
+CCacheRWLock::Unlock() {
+
+  ::pthread_mutex_lock(&m_mutex);
+  if (m_writerDepth > 0) {
+    if (--m_writerDepth == 0) {
+      ::pthread_cond_broadcast(&m_cond);
+    }
+  } else if (--m_readers == 0) {
+    ::pthread_cond_broadcast(&m_cond);
+  }
+  ::pthread_mutex_unlock(&m_mutex);
+}
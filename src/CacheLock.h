@@ -0,0 +1,133 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __CACHE_LOCK_H__
+#define __CACHE_LOCK_H__
+
+#include <pthread.h>
+
+// The locks used to make the cache set safe for concurrent callers.
+// They are always taken in this order and a lock later in the order
+// is never held while taking an earlier one:
+//
+//   1. CFileCacheSet type lock.  Shared by every operation and held
+//      exclusively while a type is defined, changed or deleted, or
+//      while the cache tree is walked at startup.
+//   2. CFileCacheSet space lock.  Held by the inserts and resizes
+//      that grow the cache, so that finding the space and using it
+//      can't be split by another thread, and by the cleanup that
+//      makes space across all types.
+//   3. CFileCacheSet snapshot lock.  Held while the snapshot is
+//      rebuilt, which takes the lock of each changed type in turn.
+//   4. CFileCache lock.  One per type, held while the type or any of
+//      its objects is read or changed.  A thread never holds more than
+//      one of these, so the cleanup across types releases the lock of
+//      the type it is making space for and takes the lock of each
+//      type in turn.
+//   5. CFileCacheSet id map, listener, sequence number, age,
+//      filesystem stats and removal locks, and the lock of each
+//      request trace.
+//      These are only held to copy or update the data they protect.
+//
+// The I/O completions run without the type lock so they only take
+// the lock of the object's type and must not call anything that
+// takes the type lock.  The snapshot they changed is published once
+// that lock is released.  Listeners are called with the locks held
+// and must not call back into the cache set at all.
+
+// A mutex that the thread holding it may take again
+class CCacheMutex {
+ public:
+  CCacheMutex();
+  ~CCacheMutex();
+
+  void Lock();
+  void Unlock();
+
+ private:
+  CCacheMutex& operator=(const CCacheMutex&);
+  CCacheMutex(const CCacheMutex&);
+
+  pthread_mutex_t m_mutex;
+};
+
+// A lock shared by readers and held exclusively by one writer.  Both
+// may be taken again by the thread holding them and the writer may
+// also take the shared side, but a reader can't become the writer.
+// Readers are preferred so a thread taking the shared side again
+// can't be blocked by a waiting writer.
+class CCacheRWLock {
+ public:
+  CCacheRWLock();
+  ~CCacheRWLock();
+
+  void ReadLock();
+  void WriteLock();
+  void Unlock();
+
+ private:
+  CCacheRWLock& operator=(const CCacheRWLock&);
+  CCacheRWLock(const CCacheRWLock&);
+
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  int m_readers;
+  // How many times the writer has taken the lock, 0 when there isn't
+  // one
+  int m_writerDepth;
+  pthread_t m_writer;
+};
+
+// Scoped holders for the locks above
+class CCacheMutexGuard {
+ public:
+  CCacheMutexGuard(CCacheMutex& mutex) : m_mutex(mutex) { m_mutex.Lock(); }
+  ~CCacheMutexGuard() { m_mutex.Unlock(); }
+
+ private:
+  CCacheMutexGuard& operator=(const CCacheMutexGuard&);
+  CCacheMutexGuard(const CCacheMutexGuard&);
+
+  CCacheMutex& m_mutex;
+};
+
+class CCacheReadGuard {
+ public:
+  CCacheReadGuard(CCacheRWLock& lock) : m_lock(lock) { m_lock.ReadLock(); }
+  ~CCacheReadGuard() { m_lock.Unlock(); }
+
+ private:
+  CCacheReadGuard& operator=(const CCacheReadGuard&);
+  CCacheReadGuard(const CCacheReadGuard&);
+
+  CCacheRWLock& m_lock;
+};
+
+class CCacheWriteGuard {
+ public:
+  CCacheWriteGuard(CCacheRWLock& lock) : m_lock(lock) { m_lock.WriteLock(); }
+  ~CCacheWriteGuard() { m_lock.Unlock(); }
+
+ private:
+  CCacheWriteGuard& operator=(const CCacheWriteGuard&);
+  CCacheWriteGuard(const CCacheWriteGuard&);
+
+  CCacheRWLock& m_lock;
+};
+
+#endif /* __CACHE_LOCK_H__ */
@@ -19,6 +19,7 @@
 #include "CacheObject.h"
 #include "FileCache.h"
 #include "FileCacheSet.h"
+#include "IOWorkerPool.h"
 
 MojLogger CCacheObject::s_log(_T("filecache.cacheobject"));
 static MojLogger s_cleanuplog(_T("filecache.cacheobject"));
@@ -29,70 +30,140 @@ CCacheObject::CCacheObject(CFileCache* fileCache,
 			   paramValue_t cost,
 			   paramValue_t lifetime,
 			   bool written,
-			   bool dirType): m_id(id)
+			   bool dirType,
+			   const std::string& key,
+			   paramValue_t maxAge): m_id(id)
 					, m_fileCache(fileCache)
 					, m_size(size)
+					, m_persistedSize(size)
 					, m_cost(cost)
 					, m_lifetime(lifetime)
+					, m_maxAge(maxAge)
 					, m_subscriptionCount(0)
+					, m_readerCount(0)
 					, m_filename(filename)
+					, m_key(key)
 					, m_written(written)
 					, m_expired(false)
 					, m_dirType(dirType)
+					, m_creating(false)
+					, m_opening(false)
+					, m_finalizing(false)
 {
 
   MojLogTrace(s_log);
 
-  m_creationTime = m_lastAccessTime = ::time(0);
+  m_creationTime = m_lastAccessTime = GetFileCacheSet()->Now();
   if (m_cost > s_maxCost) m_cost = s_maxCost;
   if (m_lifetime < 1) m_lifetime = 1;
+  if (m_maxAge < 0) m_maxAge = 0;
 }
 
 CCacheObject::~CCacheObject() {
 
   MojLogTrace(s_log);
+}
 
-  const std::string pathname(GetPathname());
-  if (pathname.size() > 0) {
-    if (m_dirType) {
-      MojLogDebug(s_log, _T("~CCacheObject: Cleaning directory '%s'."),
-		  pathname.c_str());
-      std::string msgText;
-      if (CleanupDir(pathname, msgText)) {
-	MojLogDebug(s_log,
-		    _T("~CCacheObject: cleaned '%s' to delete object '%llu'."),
-		    pathname.c_str(), m_id);
-      } else {
-	MojLogNotice(s_log, _T("~CCacheObject: Failed to clean '%s'."),
-		    pathname.c_str());
-	if (!msgText.empty()) {
-	  MojLogError(s_log, _T("~CCacheObject: %s."), msgText.c_str());
-	}
-      }
-    } else {
-      int retVal = ::unlink(pathname.c_str());
-      if ((retVal != 0) && (errno != ENOENT)) {
-	int savedErrno = errno;
-	MojLogNotice(s_log, _T("~CCacheObject: Failed to unlink '%s' (%s)."),
-		     pathname.c_str(), ::strerror(savedErrno));
-      } else {
-	MojLogDebug(s_log,
-		    _T("~CCacheObject: Unlinked '%s' to delete object '%llu'."),
-		    pathname.c_str(), m_id);
-	const std::string dirpath(GetDirname(pathname));
-	retVal = ::rmdir(dirpath.c_str());
-	if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
-	  // This should also never happen.  If it does we will just print
-	  // out the error as there isn't anything we can do about it.
-	  int savedErrno = errno;
-	  MojLogError(s_log,
-		      _T("~CCacheObject: Failed to rmdir directory '%s' (%s)."),
-		      dirpath.c_str(), ::strerror(savedErrno));
-	}
-      }
+// The jobs the cache objects hand to the I/O workers.  Each one
+// carries the pathname it works on, which also selects the worker.
+// The insert waits on the create, so its stages, and the time it
+// waited for a worker, are added to the trace of the request.
+class CCreateObjectJob : public CIOJob {
+ public:
+  CCreateObjectJob(CCacheObject* object, const std::string& pathname)
+    : CIOJob(pathname), m_object(object), m_created(false),
+      m_request(CRequestTrace::GetCurrent()), m_queued(0) {
+    if (m_request != NULL) {
+      m_request->AddRef();
+      m_queued = CMetrics::Now();
     }
   }
-}
+  ~CCreateObjectJob() {
+    if (m_request != NULL) {
+      m_request->Release();
+    }
+  }
+
+  void Run() {
+    CRequestScope scope(m_request);
+    if (m_request != NULL) {
+      m_request->AddSpan("queued", 0, m_queued, CMetrics::Now() - m_queued);
+    }
+    m_created = m_object->CreateOnDisk(m_pathname);
+  }
+  void Complete() { m_object->CreateDone(m_created); }
+  void Simulate() { m_created = true; }
+
+ private:
+  CCacheObject* m_object;
+  bool m_created;
+  CRequestTrace* m_request;
+  uint64_t m_queued;
+};
+
+class COpenObjectJob : public CIOJob {
+ public:
+  COpenObjectJob(CCacheObject* object, const std::string& pathname)
+    : CIOJob(pathname), m_object(object), m_opened(false) {}
+
+  void Run() { m_opened = m_object->OpenOnDisk(m_pathname); }
+  void Complete() { m_object->OpenDone(m_opened); }
+  void Simulate() { m_opened = true; }
+
+ private:
+  CCacheObject* m_object;
+  bool m_opened;
+};
+
+class CFinalizeObjectJob : public CIOJob {
+ public:
+  CFinalizeObjectJob(CCacheObject* object, const std::string& pathname,
+		     cacheSize_t persistedSize)
+    : CIOJob(pathname), m_object(object), m_finalized(false),
+      m_size(object->GetSize()), m_persistedSize(persistedSize) {}
+
+  void Run() {
+    m_finalized = m_object->FinalizeOnDisk(m_pathname, m_size,
+					   m_persistedSize);
+  }
+  void Complete() { m_object->FinalizeDone(m_finalized, m_size); }
+  void Simulate() { m_finalized = true; }
+
+ private:
+  CCacheObject* m_object;
+  bool m_finalized;
+  cacheSize_t m_size;
+  const cacheSize_t m_persistedSize;
+};
+
+// The object is gone by the time this runs so it only keeps what it
+// needs to remove the file
+class CRemoveObjectJob : public CIOJob {
+ public:
+  CRemoveObjectJob(CFileCacheSet* cacheSet, const cachedObjectId_t objId,
+		   const std::string& pathname, bool dirType,
+		   CFsStats* fsStats)
+    : CIOJob(pathname), m_cacheSet(cacheSet), m_objId(objId),
+      m_dirType(dirType), m_fsStats(fsStats), m_removed(false) {}
+
+  void Run() {
+    m_removed = CCacheObject::RemoveFromDisk(m_objId, m_pathname, m_dirType,
+					     m_fsStats);
+  }
+  void Complete() {
+    if (!m_removed) {
+      m_cacheSet->ObjectRemovalFailed();
+    }
+  }
+  void Simulate() { m_removed = true; }
+
+ private:
+  CFileCacheSet* m_cacheSet;
+  const cachedObjectId_t m_objId;
+  const bool m_dirType;
+  CFsStats* m_fsStats;
+  bool m_removed;
+};
 
 bool
 CCacheObject::CreateObject(const std::string& pathname) {
@@ -106,7 +177,7 @@ CCacheObject::CreateObject(const std::string& pathname) {
     MojLogDebug(s_log,
 		_T("Initialize: Created cache directory '%s' for object '%llu'."),
 		pathname.c_str(), m_id);
-    retVal = ::mkdir(pathname.c_str(), s_dirPerms);
+    retVal = FsMkdirCall(GetFsStats(), pathname, s_dirPerms);
     if (retVal != 0) {	
       int savedErrno = errno;
       MojLogError(s_log,
@@ -115,22 +186,20 @@ CCacheObject::CreateObject(const std::string& pathname) {
       success = false;
     }
   } else {
-    FILE *fp = ::fopen(pathname.c_str(), "w");
-    if (fp == NULL) {
+    retVal = FsCreateCall(GetFsStats(), pathname);
+    if (retVal != 0) {
       int savedErrno = errno;
       MojLogError(s_log, _T("Initialize: Failed to create file '%s' (%s)."),
 		  pathname.c_str(), ::strerror(savedErrno));
       success = false;
     } else {
-      ::fclose(fp);
-    
       MojLogDebug(s_log,
 		  _T("Initialize: Created cache file '%s' for object '%llu'."),
 		  pathname.c_str(), m_id);
 
       // Now set the permissions on the file so we can write the
       // extended attributes.
-      retVal = ::chmod(pathname.c_str(), s_fileRWPerms);
+      retVal = FsChmodCall(GetFsStats(), pathname, s_fileRWPerms);
       if (retVal != 0) {	
 	int savedErrno = errno;
 	MojLogError(s_log,
@@ -154,8 +223,9 @@ CCacheObject::SetFilenameAttribute(const std::string& pathname) {
 
   bool success = true;
   // Add the real filename as an extended attribute
-  int retVal = FC_setxattr(pathname.c_str(), "user.f", m_filename.c_str(),
-			   m_filename.length() + 1, XATTR_CREATE);
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.f",
+			     m_filename.c_str(), m_filename.length() + 1,
+			     XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -171,8 +241,57 @@ CCacheObject::SetFilenameAttribute(const std::string& pathname) {
   return success;
 }
 
+bool
+CCacheObject::SetKeyAttribute(const std::string& pathname) {
+
+  MojLogTrace(s_log);
+
+  bool success = true;
+  // Add the client key as an extended attribute
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.k",
+			     m_key.c_str(), m_key.length() + 1, XATTR_CREATE);
+  if (retVal != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("Initialize: Failed to set key as attribute on '%s' (%s)."),
+		pathname.c_str(), ::strerror(savedErrno));
+    success = false;
+  } else {
+    MojLogDebug(s_log,
+		_T("Initialize: Set user.k attribute on '%s' to '%s'."),
+		pathname.c_str(), m_key.c_str());
+  }
+
+  return success;
+}
+
+bool
+CCacheObject::SetMaxAgeAttribute(const std::string& pathname) {
+
+  MojLogTrace(s_log);
+
+  bool success = true;
+  // Add the maximum age as an extended attribute
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.a",
+			     &m_maxAge, sizeof(m_maxAge), XATTR_CREATE);
+  if (retVal != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("Initialize: Failed to set maximum age as attribute on '%s' (%s)."),
+		pathname.c_str(), ::strerror(savedErrno));
+    success = false;
+  } else {
+    MojLogDebug(s_log,
+		_T("Initialize: Set user.a attribute on '%s' to '%d'."),
+		pathname.c_str(), m_maxAge);
+  }
+
+  return success;
+}
+
 bool
 CCacheObject::SetSizeAttribute(const std::string& pathname,
+			       cacheSize_t size,
 			       const std::string& logname,
 			       const bool replace) {
 
@@ -180,9 +299,9 @@ CCacheObject::SetSizeAttribute(const std::string& pathname,
 
   bool success = true;
   // Add the size as an extended attribute
-  int retVal = FC_setxattr(pathname.c_str(), "user.s", &m_size,
-			   sizeof(m_size),
-			   replace ? XATTR_REPLACE : XATTR_CREATE);
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.s",
+			     &size, sizeof(size),
+			     replace ? XATTR_REPLACE : XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -192,7 +311,7 @@ CCacheObject::SetSizeAttribute(const std::string& pathname,
   } else {
     MojLogDebug(s_log,
 		_T("%s: Set user.s attribute on '%s' to '%d'."),
-		logname.c_str(), pathname.c_str(), m_size);
+		logname.c_str(), pathname.c_str(), size);
   }
 
   return success;
@@ -205,8 +324,8 @@ CCacheObject::SetCostAttribute(const std::string& pathname) {
 
   bool success = true;
   // Add the cost as an extended attribute
-  int retVal = FC_setxattr(pathname.c_str(), "user.c", &m_cost,
-			   sizeof(m_cost), XATTR_CREATE);
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.c",
+			     &m_cost, sizeof(m_cost), XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -229,8 +348,8 @@ CCacheObject::SetLifetimeAttribute(const std::string& pathname) {
 
   bool success = true;
   // Add the lifetime as an extended attribute
-  int retVal = FC_setxattr(pathname.c_str(), "user.l", &m_lifetime,
-			   sizeof(m_lifetime), XATTR_CREATE);
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.l",
+			     &m_lifetime, sizeof(m_lifetime), XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -248,6 +367,7 @@ CCacheObject::SetLifetimeAttribute(const std::string& pathname) {
 
 bool
 CCacheObject::SetWrittenAttribute(const std::string& pathname,
+				  bool written,
 				  const std::string& logname,
 				  const bool replace) {
   
@@ -256,10 +376,10 @@ CCacheObject::SetWrittenAttribute(const std::string& pathname,
   bool success = true;
 
   // Add the written flag as an extended attribute.
-  int writtenVal = m_written ? 1 : 0;
-  int retVal = FC_setxattr(pathname.c_str(), "user.w", &writtenVal,
-			   sizeof(writtenVal),
-			   replace ? XATTR_REPLACE : XATTR_CREATE);
+  int writtenVal = written ? 1 : 0;
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.w",
+			     &writtenVal, sizeof(writtenVal),
+			     replace ? XATTR_REPLACE : XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -275,7 +395,7 @@ CCacheObject::SetWrittenAttribute(const std::string& pathname,
   if (success) {
     // Now set the permissions on the file so it can't be written,
     // they will be changed to read-write during the first subscribe.
-    retVal = ::chmod(pathname.c_str(), s_fileROPerms);
+    retVal = FsChmodCall(GetFsStats(), pathname, s_fileROPerms);
     if (retVal != 0) {	
       int savedErrno = errno;
       MojLogError(s_log,
@@ -300,8 +420,8 @@ CCacheObject::SetDirTypeAttribute(const std::string& pathname) {
 
   // Add the dirType flag as an extended attribute.
   int dirtypeVal = m_dirType ? 1 : 0;
-  int retVal = FC_setxattr(pathname.c_str(), "user.d", &dirtypeVal,
-			   sizeof(dirtypeVal), XATTR_CREATE);
+  int retVal = FsSetxattrCall(GetFsStats(), pathname, "user.d",
+			     &dirtypeVal, sizeof(dirtypeVal), XATTR_CREATE);
   if (retVal != 0) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -317,6 +437,10 @@ CCacheObject::SetDirTypeAttribute(const std::string& pathname) {
   return success;
 }
 
+// For a new object this starts creating the file and setting its
+// attributes on an I/O worker.  The object can't be subscribed or
+// removed until that completes.  A failed create is reported to the
+// cache, which expires the object.
 bool
 CCacheObject::Initialize(bool isNew) {
 
@@ -324,22 +448,54 @@ CCacheObject::Initialize(bool isNew) {
 
   bool success = true;
   if (isNew) {
-    const std::string pathname(GetPathname(true));
+    const std::string pathname(GetPathname());
     if (pathname.empty()) {
       MojLogError(s_log, _T("Initialize: Failed to get pathname."));
       success = false;
+    } else {
+      // If the job runs in line, the object may have been expired
+      // and deleted by the time Submit returns
+      m_creating = true;
+      GetFileCacheSet()->SubmitIO(new CCreateObjectJob(this, pathname));
     }
-  
-    // Now create the file and set the permissions and extended
-    // attributes
-    if (success) {
-      success = CreateObject(pathname);
+  }
+
+  return success;
+}
+
+// Create the file and set the permissions and extended attributes.
+// This runs on an I/O worker.
+bool
+CCacheObject::CreateOnDisk(const std::string& pathname) {
+
+  MojLogTrace(s_log);
+
+  // Make sure the directory exists and set the correct directory
+  // permissions
+  bool success = true;
+  const std::string dirpath(GetDirname(pathname));
+  {
+    CTraceSpan span("mkdir");
+    if ((FsMkdirCall(GetFsStats(), dirpath, s_dirPerms) != 0) &&
+	(errno != EEXIST)) {
+      int savedErrno = errno;
+      MojLogError(s_log,
+		  _T("Initialize: Failed to create directory '%s' (%s)."),
+		  dirpath.c_str(), ::strerror(savedErrno));
+      success = false;
     }
+  }
+  if (success) {
+    CTraceSpan span("create");
+    success = CreateObject(pathname);
+  }
+  {
+    CTraceSpan span("metadata");
     if (success) {
       success = SetFilenameAttribute(pathname);
     }
     if (success) {
-      success = SetSizeAttribute(pathname, std::string("Initialize"));
+      success = SetSizeAttribute(pathname, m_size, std::string("Initialize"));
     }
     if (success) {
       success = SetCostAttribute(pathname);
@@ -350,14 +506,38 @@ CCacheObject::Initialize(bool isNew) {
     if (success) {
       success = SetDirTypeAttribute(pathname);
     }
+    if (success && !m_key.empty()) {
+      success = SetKeyAttribute(pathname);
+    }
+    if (success && (m_maxAge > 0)) {
+      success = SetMaxAgeAttribute(pathname);
+    }
     if (success) {
-      success = SetWrittenAttribute(pathname, std::string("Initialize"));
+      success = SetWrittenAttribute(pathname, m_written,
+				    std::string("Initialize"));
     }
   }
 
   return success;
 }
 
+void
+CCacheObject::CreateDone(bool created) {
+
+  MojLogTrace(s_log);
+
+  // Completions come from the main loop rather than through a call on
+  // the cache so they take the lock of the type themselves, and
+  // publish the snapshot once it is released
+  CSnapshotBatch batch(GetFileCacheSet());
+  CCacheMutexGuard guard(m_fileCache->GetLock());
+  MojLogDebug(s_log, _T("CreateDone: Object '%llu' %s."), m_id,
+	      created ? "created" : "could not be created");
+  m_creating = false;
+  // This may expire and delete the object
+  m_fileCache->ObjectCreated(m_id, created);
+}
+
 const std::string 
 CCacheObject::GetFileCacheType() {
 
@@ -368,37 +548,47 @@ CCacheObject::GetFileCacheType() {
 
 // This will increment the subscribe count and return the path to
 // the file backing this object.  If the object doesn't exist, this
-// will return an empty string.
+// will return an empty string.  The writer's file is made writable on
+// an I/O worker and the cache is told once that is done.
 std::string
-CCacheObject::Subscribe(std::string& msgText) {
+CCacheObject::Subscribe(std::string& msgText, bool streamReader) {
 
   MojLogTrace(s_log);
 
   std::string pathname("");
   if (!isExpired()) {
-    if (m_written || (m_subscriptionCount == 0)) {
+    if (streamReader && m_dirType) {
+      msgText = "Failed, streaming not allowed on directory types";
+      MojLogError(s_log,
+		  _T("Subscribe: %s for object '%llu'."),
+		  msgText.c_str(), m_id);
+    } else if (m_creating) {
+      msgText = "Failed, object is still being created";
+      MojLogError(s_log,
+		  _T("Subscribe: %s for object '%llu'."),
+		  msgText.c_str(), m_id);
+    } else if (m_written || streamReader ||
+	       ((m_subscriptionCount == m_readerCount) && !m_finalizing)) {
       pathname = GetPathname();
-      if (!m_written) {
-	// Now set the permissions on the file so it can be written,
-	// it will be changed to read-only during the unsubscribe.
-	int retVal = ::chmod(pathname.c_str(),
-			     (m_dirType ? s_dirObjPerms : s_fileRWPerms));
-	if (retVal != 0) {	
-	  int savedErrno = errno;
-	  MojLogError(s_log,
-		      _T("Subscribe: Failed to change permissions on '%s' (%s)."),
-		      pathname.c_str(), ::strerror(savedErrno));
-	  pathname.clear();
-	} else {
-	  MojLogDebug(s_log,
-		      _T("Subscribe: Permissions set on '%s' to allow write."),
-		      pathname.c_str());
-	}
-      }
       if (!pathname.empty()) {
 	MojLogInfo(s_log,
 		   _T("Subscribe: subscription taken on object '%llu'."), m_id);
 	m_subscriptionCount++;
+	if (streamReader) {
+	  m_readerCount++;
+	} else if (!m_written) {
+	  // The file is made writable for the writer on an I/O worker,
+	  // it will be changed to read-only during the unsubscribe.  If
+	  // the job runs in line and fails, the object has been expired
+	  // by the time Submit returns.
+	  m_opening = true;
+	  GetFileCacheSet()->SubmitIO(new COpenObjectJob(this, pathname));
+	  if (m_expired) {
+	    m_subscriptionCount--;
+	    msgText = "Failed, object could not be made writable";
+	    pathname.clear();
+	  }
+	}
       }
     } else {
       msgText = "Failed, only one writer allowed";
@@ -416,95 +606,184 @@ CCacheObject::Subscribe(std::string& msgText) {
   return pathname;
 }
 
+// Set the permissions on the file so the writer can write it.  This
+// runs on an I/O worker.
+bool
+CCacheObject::OpenOnDisk(const std::string& pathname) {
+
+  MojLogTrace(s_log);
+
+  bool success = true;
+  if (FsChmodCall(GetFsStats(), pathname,
+		  m_dirType ? s_dirObjPerms : s_fileRWPerms) != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("Subscribe: Failed to change permissions on '%s' (%s)."),
+		pathname.c_str(), ::strerror(savedErrno));
+    success = false;
+  } else {
+    MojLogDebug(s_log,
+		_T("Subscribe: Permissions set on '%s' to allow write."),
+		pathname.c_str());
+  }
+
+  return success;
+}
+
+void
+CCacheObject::OpenDone(bool opened) {
+
+  MojLogTrace(s_log);
+
+  CSnapshotBatch batch(GetFileCacheSet());
+  CCacheMutexGuard guard(m_fileCache->GetLock());
+  MojLogDebug(s_log, _T("OpenDone: Object '%llu' %s."), m_id,
+	      opened ? "opened" : "could not be opened");
+  m_opening = false;
+  // This may expire the object, which stays until the writer lets go
+  m_fileCache->ObjectOpened(m_id, opened);
+}
+
 void
-CCacheObject::UnSubscribe() {
+CCacheObject::UnSubscribe(bool streamReader) {
 
   MojLogTrace(s_log);
 
   m_subscriptionCount--;
 
   bool suceeded = true;
-  const std::string pathname(GetPathname());
-
-  if (m_dirType) {
+  if (streamReader) {
+    // Readers never change the object, only the writer finalizes it
+    m_readerCount--;
+    MojLogDebug(s_log,
+		_T("UnSubscribe: streaming reader released object '%llu'."),
+		m_id);
+  } else if (m_dirType) {
     // By setting suceeded = false, it will be marked as expired and
     // set for deletion below
     MojLogDebug(s_log,
-		_T("UnSubscribe: Directory '%s' marked Expired."),
-		pathname.c_str());
+		_T("UnSubscribe: Directory for object '%llu' marked Expired."),
+		m_id);
     suceeded = false;
   } else if (!m_written) {
     // Check if this is the first subscription where the file gets
-    // written
+    // written.  Checking the size and syncing the file can take a
+    // while so that is left to an I/O worker and the release is
+    // completed when it is done.
+    const std::string pathname(GetPathname());
     if (!pathname.empty()) {
-      // Make sure the size is correct
-      struct stat buf;
-      if (::stat(pathname.c_str(), &buf) != 0) {
-	int savedErrno = errno;
-	MojLogError(s_log,
-		    _T("UnSubscribe: Failed to stat file '%s' (%s)."),
-		    pathname.c_str(), ::strerror(savedErrno));
-	suceeded = false;
-      } else {
-	cacheSize_t size = (cacheSize_t) buf.st_size;
+      m_finalizing = true;
+      GetFileCacheSet()->SubmitIO(new CFinalizeObjectJob(this, pathname,
+							  m_persistedSize));
+      return;
+    }
+    MojLogError(s_log, _T("UnSubscribe: Failed to get pathname."));
+    suceeded = false;
+  }
+  UnSubscribed(suceeded, m_size, streamReader);
+}
+
+// Make sure the size is correct, sync the file and then persist the
+// written flag by reseting the extended attribute, this makes it a
+// valid file for deserialize.  size is updated if the file is smaller
+// than the space allocated, and persisted if it is no longer the
+// persistedSize the file was created with.  This runs on an I/O
+// worker.
+bool
+CCacheObject::FinalizeOnDisk(const std::string& pathname, cacheSize_t& size,
+			     cacheSize_t persistedSize) {
+
+  MojLogTrace(s_log);
 
-	if (size > m_size) {
-	  MojLogError(s_log,
-		      _T("UnSubscribe: File '%s' is larger than space allocated, expiring."),
-		      pathname.c_str());
-	  suceeded = false;
+  bool suceeded = true;
+  struct stat buf;
+  if (::stat(pathname.c_str(), &buf) != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("UnSubscribe: Failed to stat file '%s' (%s)."),
+		pathname.c_str(), ::strerror(savedErrno));
+    suceeded = false;
+  } else {
+    cacheSize_t fileSize = (cacheSize_t) buf.st_size;
+
+    if (fileSize > size) {
+      MojLogError(s_log,
+		  _T("UnSubscribe: File '%s' is larger than space allocated, expiring."),
+		  pathname.c_str());
+      suceeded = false;
 
-	  // This should be enabled when the tests can be fixed as the
-	  // best thing to do is to remove any zero length files
+      // This should be enabled when the tests can be fixed as the
+      // best thing to do is to remove any zero length files
 #if 0
-	} else if (size == 0) {
-	  MojLogError(s_log,
-		      _T("UnSubscribe: File '%s' is empty, expiring."),
-		      pathname.c_str());
-	  m_size = 0;
-	  suceeded = false;
-#endif
-	} else if (size < m_size) {
-	  // If the real size is smaller, reset the specified size to
-	  // the real size and persist the value
-	  MojLogDebug(s_log,
-		      _T("UnSubscribe: Resetting object size of '%llu' from '%d' to '%d'."),
-		      m_id, m_size, size);
-	  m_size = size;
-	  suceeded = SetSizeAttribute(pathname, std::string("UnSubscribe"),
-				      true);
-	}
-      }
-    } else {
-      MojLogError(s_log, _T("UnSubscribe: Failed to get pathname."));
+    } else if (fileSize == 0) {
+      MojLogError(s_log,
+		  _T("UnSubscribe: File '%s' is empty, expiring."),
+		  pathname.c_str());
+      size = 0;
       suceeded = false;
+#endif
+    } else if (fileSize < size) {
+      // If the real size is smaller, reset the specified size to
+      // the real size
+      MojLogDebug(s_log,
+		  _T("UnSubscribe: Resetting object size of '%llu' from '%d' to '%d'."),
+		  m_id, size, fileSize);
+      size = fileSize;
     }
+  }
 
-    if (suceeded) {
-      std::string msgText;
-      suceeded = SyncFile(pathname, msgText);
-      MojLogDebug(s_log, _T("UnSubscribe: SyncFile was %s."),
-		  suceeded ? "successful" : "unsuccessful");
-      if (!suceeded && !msgText.empty()) {
-	MojLogError(s_log, _T("UnSubscribe: %s"), msgText.c_str());
-      }
-    }
+  if (suceeded && (size != persistedSize)) {
+    suceeded = SetSizeAttribute(pathname, size, std::string("UnSubscribe"),
+				true);
+  }
 
-    // Now persist the written flag by reseting the extended
-    // attribute, this makes it a valid file for deserialize
-    if (suceeded) {
-      m_written = true;
-      suceeded = SetWrittenAttribute(pathname, std::string("UnSubscribe"),
-				     true);
-      if (!suceeded) {
-	m_written = false;
-      }
+  if (suceeded) {
+    std::string msgText;
+    suceeded = FsSyncCall(GetFsStats(), pathname, size, msgText);
+    MojLogDebug(s_log, _T("UnSubscribe: SyncFile was %s."),
+		suceeded ? "successful" : "unsuccessful");
+    if (!suceeded && !msgText.empty()) {
+      MojLogError(s_log, _T("UnSubscribe: %s"), msgText.c_str());
     }
   }
+
+  if (suceeded) {
+    suceeded = SetWrittenAttribute(pathname, true,
+				   std::string("UnSubscribe"), true);
+  }
+
+  return suceeded;
+}
+
+void
+CCacheObject::FinalizeDone(bool finalized, cacheSize_t size) {
+
+  MojLogTrace(s_log);
+
+  CSnapshotBatch batch(GetFileCacheSet());
+  CCacheMutexGuard guard(m_fileCache->GetLock());
+  m_finalizing = false;
+  const cacheSize_t origSize = m_size;
+  m_size = size;
+  if (finalized) {
+    m_written = true;
+    m_persistedSize = size;
+  }
+  UnSubscribed(finalized, origSize, false);
+}
+
+// Complete the release of a subscription and tell the cache about it
+void
+CCacheObject::UnSubscribed(bool suceeded, cacheSize_t origSize,
+			   bool streamReader) {
+
+  MojLogTrace(s_log);
+
   MojLogDebug(s_log,
 	      _T("UnSubscribe: subscription released on object '%llu'."),
 	      m_id);
-  
+
+  const bool failed = !suceeded && !m_expired;
   if (!suceeded) {
     // Mark this expired and remove it from the FileCacheSet id map so
     // it will be orphaned and cleaned up next time we reap orphans
@@ -514,6 +793,15 @@ CCacheObject::UnSubscribe() {
   } else {
     UpdateAccessTime();
   }
+  m_fileCache->ObjectUnSubscribed(m_id, origSize, failed, !streamReader);
+}
+
+time_t
+CCacheObject::UpdateAccessTime() {
+
+  m_lastAccessTime = GetFileCacheSet()->Now();
+
+  return m_lastAccessTime;
 }
 
 // This updates the access time without needing to subscribe, it's
@@ -527,7 +815,9 @@ CCacheObject::Touch() {
 }
 
 // The FileCache::Resize will have already checked for space so this
-// just sets the new size and persists it.
+// just sets the new size.  An object that isn't written yet is removed
+// at startup, so the size only has to be persisted when the writer
+// lets go and the object is finalized on an I/O worker.
 cacheSize_t
 CCacheObject::Resize(cacheSize_t newSize) {
 
@@ -535,20 +825,14 @@ CCacheObject::Resize(cacheSize_t newSize) {
 
   // Since you can only resize a file while it's being written, we can
   // check and just return the saved size if already written
-  if (!m_written && (m_subscriptionCount == 1)) {
-
-    const std::string pathname(GetPathname());
-    int savedSize = m_size;
+  if (!m_written && ((m_subscriptionCount - m_readerCount) == 1)) {
     m_size = newSize;
-    if (!SetSizeAttribute(pathname, std::string("Resize"), true)) {
-      m_size = savedSize;
-    }
   } else {
     if (m_written) {
       MojLogWarning(s_log,
 		    _T("Resize: Operation not allowed on written object '%llu'."),
 		    m_id);
-    } else if (m_subscriptionCount == 0) {
+    } else if (m_subscriptionCount == m_readerCount) {
       MojLogWarning(s_log,
 		    _T("Resize: Operation not allowed on unsubscribed object '%llu'."),
 		    m_id);
@@ -558,6 +842,37 @@ CCacheObject::Resize(cacheSize_t newSize) {
   return m_size;
 }
 
+// Returns the number of bytes currently in the file backing this
+// object or -1 if the file can't be read.
+cacheSize_t
+CCacheObject::GetBytesAvailable() {
+
+  MojLogTrace(s_log);
+
+  const std::string pathname(GetPathname());
+
+  return pathname.empty() ? -1 : GetBytesAvailable(pathname);
+}
+
+cacheSize_t
+CCacheObject::GetBytesAvailable(const std::string& pathname) {
+
+  MojLogTrace(s_log);
+
+  cacheSize_t size = -1;
+  struct stat buf;
+  if (::stat(pathname.c_str(), &buf) != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("GetBytesAvailable: Failed to stat file '%s' (%s)."),
+		pathname.c_str(), ::strerror(savedErrno));
+  } else {
+    size = (cacheSize_t) buf.st_size;
+  }
+
+  return size;
+}
+
 bool
 CCacheObject::Expire() {
 
@@ -565,57 +880,73 @@ CCacheObject::Expire() {
 
   bool successful = true;
   m_expired = true;
-  if (m_subscriptionCount > 0) {
+  if ((m_subscriptionCount > 0) || isIOPending()) {
     MojLogInfo(s_log,
-	       _T("Expire: Subscribed, cannot remove expired object."));
+	       _T("Expire: Subscribed or busy, cannot remove expired object."));
     successful = false;
   } else if (m_filename.size() > 0) {
-    const std::string pathname(GetPathname());
-    if (m_dirType) {
-      std::string msgText;
-      successful = CleanupDir(pathname, msgText);
-      if (successful) {
-	MojLogDebug(s_log,
-		    _T("Expire: Cleaned directory '%s' to expire object '%llu'."),
-		    pathname.c_str(), m_id);
-      } else {
-	MojLogError(s_log,
-		    _T("Expire: Failed to clean directory '%s'."),
-		    pathname.c_str());
-	if (!msgText.empty()) {
-	  MojLogDebug(s_log, _T("Expire: %s."), msgText.c_str());
-	}
-      }
+    // The file is removed by an I/O worker.  If that fails the cache
+    // set won't save its state, so the next start walks the tree and
+    // takes anything left behind back into account.
+    GetFileCacheSet()->SubmitIO(new CRemoveObjectJob(GetFileCacheSet(), m_id,
+						     GetPathname(), m_dirType,
+						     GetFsStats()));
+  } else {
+    MojLogDebug(s_log, _T("Expire: No filename to remove."));
+    successful = false;
+  }
+
+  return successful;
+}
+
+// Remove the file or directory backing an object and its directory
+// if that is now empty.  This runs on an I/O worker.
+bool
+CCacheObject::RemoveFromDisk(const cachedObjectId_t objId,
+			     const std::string& pathname, bool dirType,
+			     CFsStats* fsStats) {
+
+  MojLogTrace(s_log);
+
+  bool successful = true;
+  if (dirType) {
+    std::string msgText;
+    successful = FsRemoveTreeCall(fsStats, pathname, msgText);
+    if (successful) {
+      MojLogDebug(s_log,
+		  _T("Expire: Cleaned directory '%s' to expire object '%llu'."),
+		  pathname.c_str(), objId);
     } else {
-      int retVal = ::unlink(pathname.c_str());
-      if (retVal != 0) {
-	// This should never happen but if it does, the timer worker
-	// method will walk the caches and look for these to try to
-	// cleanup
-	int savedErrno = errno;
-	MojLogError(s_log,
-		    _T("Expire: Failed to unlink file '%s' (%s)."),
-		    pathname.c_str(), ::strerror(savedErrno));
-	successful = false;
-      } else {
-	MojLogDebug(s_log,
-		    _T("Expire: unlinked file '%s' to expire object '%llu'."),
-		    pathname.c_str(), m_id);
+      MojLogError(s_log,
+		  _T("Expire: Failed to clean directory '%s'."),
+		  pathname.c_str());
+      if (!msgText.empty()) {
+	MojLogDebug(s_log, _T("Expire: %s."), msgText.c_str());
       }
     }
-    const std::string dirpath(GetDirname(pathname));
-    int retVal = ::rmdir(dirpath.c_str());
-    if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
-      // This should also never happen.  If it does we will just print
-      // out the error as there isn't anything we can do about it.
+  } else {
+    int retVal = FsUnlinkCall(fsStats, pathname);
+    if ((retVal != 0) && (errno != ENOENT)) {
       int savedErrno = errno;
       MojLogError(s_log,
-		  _T("Expire: Failed to rmdir directory '%s' (%s)."),
-		  dirpath.c_str(), ::strerror(savedErrno));
+		  _T("Expire: Failed to unlink file '%s' (%s)."),
+		  pathname.c_str(), ::strerror(savedErrno));
+      successful = false;
+    } else {
+      MojLogDebug(s_log,
+		  _T("Expire: unlinked file '%s' to expire object '%llu'."),
+		  pathname.c_str(), objId);
     }
-  } else {
-    MojLogDebug(s_log, _T("Expire: No filename to remove."));
-    successful = false;
+  }
+  const std::string dirpath(GetDirectoryFromPath(pathname));
+  int retVal = FsRmdirCall(fsStats, dirpath);
+  if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
+    // This should also never happen.  If it does we will just print
+    // out the error as there isn't anything we can do about it.
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("Expire: Failed to rmdir directory '%s' (%s)."),
+		dirpath.c_str(), ::strerror(savedErrno));
   }
 
   return successful;
@@ -678,6 +1009,14 @@ CCacheObject::GetFileCacheSet() {
   return m_fileCache->GetFileCacheSet();
 }
 
+// The filesystem calls made for the object are counted against its
+// type
+CFsStats*
+CCacheObject::GetFsStats() {
+
+  return m_fileCache->GetFsStats();
+}
+
 const std::string
 CCacheObject::GetPathname(bool createDir) {
 
@@ -703,7 +1042,8 @@ CCacheObject::GetCacheCost() {
   MojLogTrace(s_log);
 
   paramValue_t cost;
-  paramValue_t age = (paramValue_t) (::time(0) - m_lastAccessTime);
+  paramValue_t age = (paramValue_t) (GetFileCacheSet()->Now() -
+				     m_lastAccessTime);
   if (age < m_lifetime) {
     MojLogDebug(s_log,
 		_T("GetCacheCost: Age < lifetime, setting cost to max"));
@@ -20,15 +20,7 @@ LICENSE@@@ */
 #define __CACHE_OBJECT_H__
 
 #include "CacheBase.h"
-
-inline int FC_setxattr(const char* path, const char* name, const void* value,
-		       size_t size, int options) {
-#ifdef MOJ_MAC
-  return ::setxattr(path, name, value, size, 0, options);
-#else
-  return ::setxattr(path, name, value, size, options);
-#endif // #ifdef MOJ_MAC
-}
+#include "FsStats.h"
 
 class CFileCache;
 class CFileCacheSet;
@@ -41,43 +33,71 @@ class CCacheObject {
 	       const std::string& filename,
 	       cacheSize_t size, paramValue_t cost = 0,
 	       paramValue_t lifetime = 0, bool written = false,
-	       bool dirType = false);
+	       bool dirType = false, const std::string& key = std::string(),
+	       paramValue_t maxAge = 0);
 
   ~CCacheObject();
 
+  // For a new object this starts creating the file and setting its
+  // attributes on an I/O worker.  The object can't be subscribed or
+  // removed until that completes.  A failed create is reported to the
+  // cache, which expires the object.
   bool Initialize(bool isNew);
 
   cachedObjectId_t GetId() { return m_id; }
 
   time_t GetCreationTime() { return m_creationTime; }
   time_t GetLastAccessTime() { return m_lastAccessTime; }
-  time_t UpdateAccessTime() {
-    m_lastAccessTime = ::time(0);
-    return m_lastAccessTime;
+  time_t UpdateAccessTime();
+
+  // Used when a saved cache set is adopted at startup
+  void RestoreTimes(time_t creationTime, time_t lastAccessTime) {
+    m_creationTime = creationTime;
+    m_lastAccessTime = lastAccessTime;
   }
 
   cacheSize_t GetSize() { return m_size; }
   paramValue_t GetCost() { return m_cost; }
   paramValue_t GetLifetime() { return m_lifetime; }
+  // The seconds the object can go unused before it is expired, or 0
+  paramValue_t GetMaxAge() { return m_maxAge; }
   paramValue_t GetCacheCost();
 
   // This will increment the subscribe count and return the path to
   // the file backing this object.  If the object doesn't exist, this
-  // will return an empty string.
-  std::string Subscribe(std::string& msgText);
+  // will return an empty string.  A streamReader subscription is
+  // allowed while the object is still being written and is only
+  // granted read access.  The writer's file is made writable on an
+  // I/O worker and the cache is told once that is done.
+  std::string Subscribe(std::string& msgText, bool streamReader = false);
   paramValue_t GetSubscriptionCount() { return m_subscriptionCount; }
+  paramValue_t GetReaderCount() { return m_readerCount; }
 
-  // This will decrement the subscribe count
-  void UnSubscribe();
+  // This will decrement the subscribe count.  The streamReader flag
+  // must match the one used to subscribe.  When the writer lets go,
+  // the file is checked, synced and marked written on an I/O worker
+  // and the cache is told once that is done.
+  void UnSubscribe(bool streamReader = false);
 
   // This updates the access time without needing to subscribe, it's
   // like using touch on an existing file
   time_t Touch();
 
+  // The new size is persisted when the writer lets go and the object
+  // is finalized
   cacheSize_t Resize(cacheSize_t newSize);
 
+  // Returns the number of bytes currently in the file backing this
+  // object or -1 if the file can't be read.  The pathname form is for
+  // reading it on an I/O worker, without the object.
+  cacheSize_t GetBytesAvailable();
+  static cacheSize_t GetBytesAvailable(const std::string& pathname);
+
   std::string GetFileName() { return m_filename; }
 
+  // The optional client supplied key the object can be looked up by
+  const std::string& GetKey() { return m_key; }
+
   // This will set the expire flag and return whether the object is
   // currently subscribed so the caller knows whether the next cache
   // cleaning pass will be guaranteeded to remove this item.
@@ -87,6 +107,28 @@ class CCacheObject {
   bool isWritten() { return m_written; }
   bool isDirType() { return m_dirType; }
 
+  // An object with I/O in progress is pinned like a subscribed one
+  bool isCreating() { return m_creating; }
+  bool isOpening() { return m_opening; }
+  bool isFinalizing() { return m_finalizing; }
+  bool isIOPending() { return m_creating || m_opening || m_finalizing; }
+
+  // These do the blocking work for the jobs run on the I/O workers.
+  // They only read values that can't change while the job is
+  // pending.
+  bool CreateOnDisk(const std::string& pathname);
+  bool OpenOnDisk(const std::string& pathname);
+  bool FinalizeOnDisk(const std::string& pathname, cacheSize_t& size,
+		      cacheSize_t persistedSize);
+  static bool RemoveFromDisk(const cachedObjectId_t objId,
+			     const std::string& pathname, bool dirType,
+			     CFsStats* fsStats);
+
+  // And these apply the results back on the main loop
+  void CreateDone(bool created);
+  void OpenDone(bool opened);
+  void FinalizeDone(bool finalized, cacheSize_t size);
+
   // Validate a subscribed file that is writable.  For now, just ensure
   // the file size is <= the specified size, otherwise log it as an
   // error.
@@ -101,30 +143,46 @@ class CCacheObject {
 
   std::string GetDirname(const std::string& pathname);
   CFileCacheSet* GetFileCacheSet();
+  // The filesystem calls made for the object are counted against its
+  // type
+  CFsStats* GetFsStats();
   bool CreateObject(const std::string& pathname);
   bool SetFilenameAttribute(const std::string& pathname);
-  bool SetSizeAttribute(const std::string& pathname, const std::string& logname,
-			const bool replace=false);
+  bool SetSizeAttribute(const std::string& pathname, cacheSize_t size,
+			const std::string& logname, const bool replace=false);
   bool SetCostAttribute(const std::string& pathname);
   bool SetLifetimeAttribute(const std::string& pathname);
-  bool SetWrittenAttribute(const std::string& pathname, const std::string& logname,
-			   const bool replace=false);
+  bool SetWrittenAttribute(const std::string& pathname, bool written,
+			   const std::string& logname, const bool replace=false);
   bool SetDirTypeAttribute(const std::string& pathname);
+  bool SetKeyAttribute(const std::string& pathname);
+  bool SetMaxAgeAttribute(const std::string& pathname);
+  void UnSubscribed(bool succeeded, cacheSize_t origSize, bool streamReader);
 
   const cachedObjectId_t m_id;
 
   CFileCache* m_fileCache;
 
   cacheSize_t m_size;
+  // The size last written to the file's attributes
+  cacheSize_t m_persistedSize;
   paramValue_t m_cost;
   paramValue_t m_lifetime;
+  paramValue_t m_maxAge;
   paramValue_t m_subscriptionCount;
+  // The subscriptions included in m_subscriptionCount that were taken
+  // by streaming readers rather than the writer
+  paramValue_t m_readerCount;
 
   std::string m_filename;
+  std::string m_key;
 
   bool m_written;
   bool m_expired;
   bool m_dirType;
+  bool m_creating;
+  bool m_opening;
+  bool m_finalizing;
 
   time_t m_creationTime;
   time_t m_lastAccessTime;
@@ -0,0 +1,143 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "CacheSnapshot.h"
+#include "FileCacheSet.h"
+
+#include <sched.h>
+
+__thread int CSnapshotBatch::s_depth = 0;
+
+// Returns the type or NULL if it wasn't defined
+const CTypeSnapshot*
+CCacheSnapshot::GetType(const std::string& typeName) const {
+
+  std::map<std::string, typeSnapshotPtr_t>::const_iterator iter;
+  iter = m_types.find(typeName);
+  if (iter != m_types.end()) {
+    return (*iter).second.get();
+  }
+
+  return NULL;
+}
+
+// Returns the object or NULL if it couldn't be found by id.  There
+// are only a few types so each one is searched.
+const CObjectSnapshot*
+CCacheSnapshot::GetObject(const cachedObjectId_t objId) const {
+
+  std::map<std::string, typeSnapshotPtr_t>::const_iterator iter;
+  iter = m_types.begin();
+  while (iter != m_types.end()) {
+    const CObjectSnapshot* objSnapshot = (*iter).second->GetObject(objId);
+    if (objSnapshot != NULL) {
+      return objSnapshot;
+    }
+    ++iter;
+  }
+
+  return NULL;
+}
+
+// Returns the object or NULL if it couldn't be found by id
+const CObjectSnapshot*
+CTypeSnapshot::GetObject(const cachedObjectId_t objId) const {
+
+  std::map<cachedObjectId_t, objectChunkPtr_t>::const_iterator iter;
+  iter = m_chunks.find(GetSnapshotChunk(objId));
+  if (iter != m_chunks.end()) {
+    objectSnapshotMap_t::const_iterator objIter = (*iter).second->find(objId);
+    if (objIter != (*iter).second->end()) {
+      return &(*objIter).second;
+    }
+  }
+
+  return NULL;
+}
+
+CSnapshotHolder::CSnapshotHolder() : m_current(new CCacheSnapshot())
+  , m_epoch(0) {
+
+  m_readers[0] = 0;
+  m_readers[1] = 0;
+}
+
+CSnapshotHolder::~CSnapshotHolder() {
+
+  delete m_current;
+}
+
+// The epoch is checked again after registering.  If it moved, the
+// writer may already have stopped waiting for that slot so the
+// reader registers again in the new one.
+int
+CSnapshotHolder::EnterRead() {
+
+  for (;;) {
+    const int epoch = __sync_add_and_fetch(&m_epoch, 0);
+    const int slot = epoch & 1;
+    __sync_add_and_fetch(&m_readers[slot], 1);
+    if (__sync_add_and_fetch(&m_epoch, 0) == epoch) {
+      return slot;
+    }
+    __sync_sub_and_fetch(&m_readers[slot], 1);
+  }
+}
+
+void
+CSnapshotHolder::ExitRead(int slot) {
+
+  __sync_sub_and_fetch(&m_readers[slot], 1);
+}
+
+const CCacheSnapshot*
+CSnapshotHolder::Current() {
+
+  return __sync_fetch_and_add(&m_current, 0);
+}
+
+// Any reader that can still see the old snapshot registered in the
+// epoch being left, so once that slot drains the old one is free.
+// The readers only copy a few values out so this wait is short.
+void
+CSnapshotHolder::Publish(CCacheSnapshot* snapshot) {
+
+  // The swap is a full barrier so the contents of the snapshot are
+  // visible before it is
+  CCacheSnapshot* old = __sync_fetch_and_add(&m_current, 0);
+  while (!__sync_bool_compare_and_swap(&m_current, old, snapshot)) {
+    old = __sync_fetch_and_add(&m_current, 0);
+  }
+  const int slot = (__sync_fetch_and_add(&m_epoch, 1)) & 1;
+  while (__sync_add_and_fetch(&m_readers[slot], 0) > 0) {
+    ::sched_yield();
+  }
+  delete old;
+}
+
+CSnapshotBatch::CSnapshotBatch(CFileCacheSet* cacheSet) : m_cacheSet(cacheSet) {
+
+  s_depth++;
+}
+
+CSnapshotBatch::~CSnapshotBatch() {
+
+  if (--s_depth == 0) {
+    m_cacheSet->PublishSnapshot();
+  }
+}
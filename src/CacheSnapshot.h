@@ -0,0 +1,163 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __CACHE_SNAPSHOT_H__
+#define __CACHE_SNAPSHOT_H__
+
+#include "CacheBase.h"
+#include "boost/shared_ptr.hpp"
+
+class CFileCacheSet;
+
+// The status and size queries are answered from a snapshot of the
+// cache set so they never wait for the locks held by an insert that
+// is making space.  A snapshot is never changed once published.  The
+// writers build a new one at the end of each call that changed the
+// cache set and swap it in, and the old one is freed once no reader
+// can still be using it.
+
+// The attributes of an object that can be read from a snapshot
+class CObjectSnapshot {
+ public:
+  CObjectSnapshot() : m_size(0), m_written(false) {}
+
+  cacheSize_t m_size;
+  bool m_written;
+  std::string m_filename;
+};
+
+// The objects of a type are kept in chunks of consecutive sequence
+// numbers, the low bits of their ids.  A chunk that hasn't changed is
+// shared by the snapshots that follow so a change to one object only
+// copies the chunk it is in.
+static const cachedObjectId_t s_snapshotChunkSize = 64;
+
+inline cachedObjectId_t
+GetSnapshotChunk(const cachedObjectId_t objId) {
+  return (objId & s_maxPossibleSeqNum) / s_snapshotChunkSize;
+}
+
+typedef std::map<cachedObjectId_t, CObjectSnapshot> objectSnapshotMap_t;
+typedef boost::shared_ptr<const objectSnapshotMap_t> objectChunkPtr_t;
+
+// One type in a snapshot.  Only the objects that can still be found
+// by id are kept but the totals include expired objects that are
+// still subscribed, the same as CFileCache::GetCacheStatus.
+class CTypeSnapshot {
+ public:
+  CTypeSnapshot() : m_size(0), m_numObjects(0) {}
+
+  // Returns the object or NULL if it couldn't be found by id
+  const CObjectSnapshot* GetObject(const cachedObjectId_t objId) const;
+
+  cacheSize_t m_size;
+  paramValue_t m_numObjects;
+  // Keyed by GetSnapshotChunk.  An empty chunk is dropped.
+  std::map<cachedObjectId_t, objectChunkPtr_t> m_chunks;
+};
+
+// A type that hasn't changed is shared by the snapshots that follow
+// so only the changed types are copied.
+typedef boost::shared_ptr<const CTypeSnapshot> typeSnapshotPtr_t;
+
+class CCacheSnapshot {
+ public:
+  CCacheSnapshot() : m_generation(0), m_size(0), m_numObjects(0)
+    , m_sumOfLoWatermarks(0) {}
+
+  // Returns the type or NULL if it wasn't defined
+  const CTypeSnapshot* GetType(const std::string& typeName) const;
+
+  // Returns the object or NULL if it couldn't be found by id
+  const CObjectSnapshot* GetObject(const cachedObjectId_t objId) const;
+
+  // Counts the snapshots published, so a copy can tell if it is
+  // out of date
+  uint64_t m_generation;
+  std::map<std::string, typeSnapshotPtr_t> m_types;
+  cacheSize_t m_size;
+  paramValue_t m_numObjects;
+  cacheSize_t m_sumOfLoWatermarks;
+};
+
+// Holds the current snapshot.  A reader registers in the current
+// epoch, which only costs an atomic increment, before it loads the
+// snapshot.  Publishing moves to the next epoch and waits for the
+// readers of the last one to leave before freeing the old snapshot,
+// so only the writer ever waits.  Publish calls must be serialized.
+class CSnapshotHolder {
+ public:
+  CSnapshotHolder();
+  ~CSnapshotHolder();
+
+  // Returns the epoch slot to pass to ExitRead
+  int EnterRead();
+  void ExitRead(int slot);
+
+  // Only valid between EnterRead and ExitRead, or for the writer
+  const CCacheSnapshot* Current();
+
+  // Takes ownership of the snapshot
+  void Publish(CCacheSnapshot* snapshot);
+
+ private:
+  CSnapshotHolder& operator=(const CSnapshotHolder&);
+  CSnapshotHolder(const CSnapshotHolder&);
+
+  CCacheSnapshot* m_current;
+  int m_epoch;
+  // The readers in each of the last two epochs
+  int m_readers[2];
+};
+
+// Scoped read of the current snapshot
+class CSnapshotReader {
+ public:
+  CSnapshotReader(CSnapshotHolder& holder) : m_holder(holder)
+    , m_slot(holder.EnterRead()) {
+  }
+  ~CSnapshotReader() { m_holder.ExitRead(m_slot); }
+
+  const CCacheSnapshot* Get() { return m_holder.Current(); }
+
+ private:
+  CSnapshotReader& operator=(const CSnapshotReader&);
+  CSnapshotReader(const CSnapshotReader&);
+
+  CSnapshotHolder& m_holder;
+  const int m_slot;
+};
+
+// Marks a call that may change the cache set.  Calls nest, so the
+// snapshot is only published when the outermost one on a thread
+// ends.  It has to be declared before any lock guard in the call so
+// it ends after they have been released.
+class CSnapshotBatch {
+ public:
+  CSnapshotBatch(CFileCacheSet* cacheSet);
+  ~CSnapshotBatch();
+
+ private:
+  CSnapshotBatch& operator=(const CSnapshotBatch&);
+  CSnapshotBatch(const CSnapshotBatch&);
+
+  CFileCacheSet* m_cacheSet;
+  static __thread int s_depth;
+};
+
+#endif /* __CACHE_SNAPSHOT_H__ */
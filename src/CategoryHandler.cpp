@@ -20,9 +20,12 @@
 #include "FileCacheError.h"
 #include "AsyncFileCopier.h"
 #include "CacheBase.h"
+#include "CacheObject.h"
+#include "IOWorkerPool.h"
 
 #include "sandbox.h"
 #include "boost/filesystem.hpp"
+#include <algorithm>
 #include <sstream>
 
 namespace fs = boost::filesystem;
@@ -34,6 +37,10 @@ const CategoryHandler::Method CategoryHandler::s_privMethods[] = {
   {_T("ChangeType"), (Callback) &CategoryHandler::ChangeType},
   {_T("DeleteType"), (Callback) &CategoryHandler::DeleteType},
   {_T("CopyCacheObject"), (Callback) &CategoryHandler::CopyCacheObject},
+  {_T("ListCacheObjects"), (Callback) &CategoryHandler::ListCacheObjects},
+  {_T("SetTraceRecording"), (Callback) &CategoryHandler::SetTraceRecording},
+  {_T("GetStartupProfile"), (Callback) &CategoryHandler::GetStartupProfile},
+  {_T("GetMetrics"), (Callback) &CategoryHandler::GetMetrics},
   {NULL, NULL}
 };
 
@@ -43,6 +50,7 @@ const CategoryHandler::Method CategoryHandler::s_pubMethods[] = {
   {_T("ResizeCacheObject"), (Callback) &CategoryHandler::ResizeCacheObject},
   {_T("ExpireCacheObject"), (Callback) &CategoryHandler::ExpireCacheObject},
   {_T("SubscribeCacheObject"), (Callback) &CategoryHandler::SubscribeCacheObject},
+  {_T("LookupOrInsertCacheObject"), (Callback) &CategoryHandler::LookupOrInsertCacheObject},
   {_T("TouchCacheObject"), (Callback) &CategoryHandler::TouchCacheObject},
   {_T("GetCacheStatus"), (Callback) &CategoryHandler::GetCacheStatus},
   {_T("GetCacheTypeStatus"), (Callback) &CategoryHandler::GetCacheTypeStatus},
@@ -50,20 +58,124 @@ const CategoryHandler::Method CategoryHandler::s_pubMethods[] = {
   {_T("GetCacheObjectFilename"), (Callback) &CategoryHandler::GetCacheObjectFilename},
   {_T("GetCacheTypes"), (Callback) &CategoryHandler::GetCacheTypes},
   {_T("GetVersion"), (Callback) &CategoryHandler::GetVersion},
+  {_T("WatchCacheEvents"), (Callback) &CategoryHandler::WatchCacheEvents},
   {NULL, NULL}
 };
 
+// The names of the ExpireReasons in events and stats
+static const char* const s_expireReasonNames[ExpireNumReasons] = {
+  "explicit", "capacity", "orphan", "aged"
+};
+
+// The methods timed in the metrics, by the op their requests are
+// traced as
+static const struct {
+  TraceOp m_op;
+  const char* m_name;
+} s_metricMethods[] = {
+  {TraceDefineType, "DefineType"},
+  {TraceChangeType, "ChangeType"},
+  {TraceDeleteType, "DeleteType"},
+  {TraceDescribeType, "DescribeType"},
+  {TraceInsertCacheObject, "InsertCacheObject"},
+  {TraceResizeCacheObject, "ResizeCacheObject"},
+  {TraceExpireCacheObject, "ExpireCacheObject"},
+  {TraceSubscribeCacheObject, "SubscribeCacheObject"},
+  {TraceLookupOrInsertCacheObject, "LookupOrInsertCacheObject"},
+  {TraceTouchCacheObject, "TouchCacheObject"},
+  {TraceCopyCacheObject, "CopyCacheObject"},
+  {TraceGetCacheStatus, "GetCacheStatus"},
+  {TraceGetCacheTypeStatus, "GetCacheTypeStatus"},
+  {TraceListCacheObjects, "ListCacheObjects"},
+  {TraceGetCacheObjectSize, "GetCacheObjectSize"},
+  {TraceGetCacheObjectFilename, "GetCacheObjectFilename"},
+  {TraceGetCacheTypes, "GetCacheTypes"},
+  {TraceGetVersion, "GetVersion"},
+  {TraceWatchCacheEvents, "WatchCacheEvents"},
+  {TraceSetTraceRecording, "SetTraceRecording"},
+  {TraceGetStartupProfile, "GetStartupProfile"},
+  {TraceGetMetrics, "GetMetrics"}
+};
+static const size_t s_numMetricMethods = sizeof(s_metricMethods) /
+  sizeof(s_metricMethods[0]);
+
 CategoryHandler::CategoryHandler(CFileCacheSet* cacheSet)
-  : m_fileCacheSet(cacheSet) {
+  : m_fileCacheSet(cacheSet),
+    m_workerTimer(0),
+    m_workerInterval(s_minWorkerInterval),
+    m_workerBacklog(0),
+    m_ageTimer(0),
+    m_ageTimerDue(0),
+    m_streamTimer(0),
+    m_orphansReported(false),
+    m_agingDue(0),
+    m_listenerIdle(0),
+    m_metricsTimer(0),
+    m_heartbeatTimer(0) {
 
   MojLogTrace(s_log);
 
-  SetupWorkerTimer();
+  for (size_t i = 0; i < s_numMetricMethods; i++) {
+    const size_t op = (size_t) s_metricMethods[i].m_op;
+    if (op >= m_opMetrics.size()) {
+      m_opMetrics.resize(op + 1, 0);
+    }
+    m_opMetrics[op] = m_metrics.AddPath("method", s_metricMethods[i].m_name);
+  }
+  m_workerMetrics = m_metrics.AddPath("task", "worker");
+  m_cleanerMetrics = m_metrics.AddPath("task", "cleaner");
+  m_ageMetrics = m_metrics.AddPath("task", "expireAged");
+
+  // The worker timer is only started once there is work for it
+  g_timeout_add_seconds(120, &CleanerCallback, this);
+  m_requestTracer.Start((uint64_t) m_fileCacheSet->GetSlowRequestTime() * 1000,
+			m_fileCacheSet->GetRequestTraceFile());
+  if (m_fileCacheSet->GetStallTime() > 0) {
+    m_loopWatchdog.Start((uint64_t) s_loopHeartbeatInterval * 1000,
+			 (uint64_t) m_fileCacheSet->GetStallTime() * 1000);
+    m_heartbeatTimer = g_timeout_add(s_loopHeartbeatInterval,
+				     &HeartbeatCallback, this);
+  }
+  const std::string& metricsFile = m_fileCacheSet->GetMetricsFile();
+  if (!metricsFile.empty() && (m_fileCacheSet->GetMetricsInterval() > 0)) {
+    MojLogInfo(s_log, _T("CategoryHandler: Writing metrics to '%s' every %d seconds."),
+	       metricsFile.c_str(), m_fileCacheSet->GetMetricsInterval());
+    m_metricsTimer =
+      g_timeout_add_seconds((guint) m_fileCacheSet->GetMetricsInterval(),
+			    &MetricsCallback, this);
+  }
+  m_fileCacheSet->AddListener(this);
+  // Objects found at startup may already have maximum age deadlines
+  const time_t due = m_fileCacheSet->NextAgingDue();
+  if (due != 0) {
+    SetupAgeTimer(due);
+  }
 }
 
 CategoryHandler::~CategoryHandler() {
 
   MojLogTrace(s_log);
+
+  m_fileCacheSet->RemoveListener(this);
+  if (m_workerTimer != 0) {
+    g_source_remove(m_workerTimer);
+  }
+  if (m_ageTimer != 0) {
+    g_source_remove(m_ageTimer);
+  }
+  if (m_listenerIdle != 0) {
+    g_source_remove(m_listenerIdle);
+  }
+  if (m_metricsTimer != 0) {
+    g_source_remove(m_metricsTimer);
+  }
+  if (m_heartbeatTimer != 0) {
+    g_source_remove(m_heartbeatTimer);
+  }
+  for (EventWatcherMap::iterator it = m_watchers.begin();
+       it != m_watchers.end(); ++it) {
+    it->second->Stop();
+  }
 }
 
 MojErr
@@ -84,6 +196,7 @@ MojErr
 CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceDefineType, msg);
 
   MojString typeName;
   MojInt64 loWatermark = 0;
@@ -91,10 +204,12 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
   MojInt64 size = 0;
   MojInt64 cost = 0;
   MojInt64 lifetime = 0;
+  MojInt64 maxAge = 0;
   bool dirType = false;
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   MojLogDebug(s_log, _T("DefineType: new type '%s' to be defined."),
 	      typeName.data());
 
@@ -105,6 +220,7 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
   payload.get(_T("size"), size);
   payload.get(_T("cost"), cost);
   payload.get(_T("lifetime"), lifetime);
+  payload.get(_T("maxAge"), maxAge);
   payload.get(_T("dirType"), dirType);
 
   std::string msgText;
@@ -123,6 +239,9 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
   } else if (lifetime < 0) {
     msgText = "DefineType: Invalid params: lifetime must not be negative.";
     MojLogError(s_log, _T("%s"), msgText.c_str());
+  } else if (maxAge < 0) {
+    msgText = "DefineType: Invalid params: maxAge must not be negative.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
   } else if (loWatermark <= 0) {
     msgText = "DefineType: Invalid params: loWatermark must be greater than 0.";
     MojLogError(s_log, _T("%s"), msgText.c_str());
@@ -134,17 +253,18 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
     MojLogError(s_log, _T("%s"), msgText.c_str());
   }
   if (!msgText.empty()) {
+    trace.SetResult(FCInvalidParams);
     err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
   } else {
     MojLogDebug(s_log, _T("DefineType: params: loWatermark = '%lld', hiWatermark = '%lld',"),
 		loWatermark, hiWatermark);
-    MojLogDebug(s_log, _T("DefineType: params: size = '%lld', cost = '%lld', lifetime = '%lld'."),
-		size, cost, lifetime);
+    MojLogDebug(s_log, _T("DefineType: params: size = '%lld', cost = '%lld', lifetime = '%lld', maxAge = '%lld'."),
+		size, cost, lifetime, maxAge);
 
     CCacheParamValues params((cacheSize_t) loWatermark,
 			     (cacheSize_t) hiWatermark,
 			     (cacheSize_t) size, (paramValue_t) cost,
-			     (paramValue_t) lifetime);
+			     (paramValue_t) lifetime, (paramValue_t) maxAge);
 
     if (m_fileCacheSet->TypeExists(std::string(typeName.data()))) {
       msgText = "DefineType: Type '";
@@ -173,10 +293,12 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
 		    (long long int) params.GetCost(),
 		    (long long int) params.GetLifetime());
 	msgText += "has different configuration.";
+	trace.SetResult(FCConfigurationError);
 	err = msg->replyError((MojErr) FCConfigurationError, msgText.c_str());
       } else {
 #endif
 	msgText += "already exists.";
+	trace.SetResult(FCExistsError);
 	err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
 #ifdef NEEDS_CONFIGURATOR_FIX
       }
@@ -184,8 +306,10 @@ CategoryHandler::DefineType(MojServiceMessage* msg, MojObject& payload) {
     } else {
       if (m_fileCacheSet->DefineType(msgText, std::string(typeName.data()),
 				     &params, dirType)) {
+	trace.SetResult(FCErrorNone);
 	err = msg->replySuccess();
       } else {
+	trace.SetResult(FCDefineError);
 	err = msg->replyError((MojErr) FCDefineError, msgText.c_str());
       }
     }
@@ -199,6 +323,7 @@ MojErr
 CategoryHandler::ChangeType(MojServiceMessage* msg, MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceChangeType, msg);
 
   MojString typeName;
   MojInt64 loWatermark = 0;
@@ -206,9 +331,11 @@ CategoryHandler::ChangeType(MojServiceMessage* msg, MojObject& payload) {
   MojInt64 size = 0;
   MojInt64 cost = 0;
   MojInt64 lifetime = 0;
+  MojInt64 maxAge = 0;
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   MojLogDebug(s_log, _T("ChangeType: existing type '%s' to be changed."),
 	      typeName.data());
 
@@ -217,6 +344,7 @@ CategoryHandler::ChangeType(MojServiceMessage* msg, MojObject& payload) {
   payload.get(_T("size"), size);
   payload.get(_T("cost"), cost);
   payload.get(_T("lifetime"), lifetime);
+  payload.get(_T("maxAge"), maxAge);
 
   std::string msgText;
   if (size < 0) {
@@ -228,6 +356,9 @@ CategoryHandler::ChangeType(MojServiceMessage* msg, MojObject& payload) {
   } else if (lifetime < 0) {
     msgText = "ChangeType: Invalid params: lifetime must not be negative.";
     MojLogError(s_log, _T("%s"), msgText.c_str());
+  } else if (maxAge < 0) {
+    msgText = "ChangeType: Invalid params: maxAge must not be negative.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
   } else if (loWatermark < 0) {
     msgText = "ChangeType: Invalid params: loWatermark must be greater than 0.";
     MojLogError(s_log, _T("%s"), msgText.c_str());
@@ -236,22 +367,25 @@ CategoryHandler::ChangeType(MojServiceMessage* msg, MojObject& payload) {
     MojLogError(s_log, _T("%s"), msgText.c_str());
   }
   if (!msgText.empty()) {
+    trace.SetResult(FCInvalidParams);
     err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
   } else {
     MojLogDebug(s_log, _T("ChangeType: params: loWatermark = '%lld', hiWatermark = '%lld',"),
 		loWatermark, hiWatermark);
-    MojLogDebug(s_log, _T("ChangeType: params: size = '%lld', cost = '%lld', lifetime = '%lld'."),
-		size, cost, lifetime);
+    MojLogDebug(s_log, _T("ChangeType: params: size = '%lld', cost = '%lld', lifetime = '%lld', maxAge = '%lld'."),
+		size, cost, lifetime, maxAge);
 
     CCacheParamValues params((cacheSize_t) loWatermark,
 			     (cacheSize_t) hiWatermark,
 			     (cacheSize_t) size, (paramValue_t) cost,
-			     (paramValue_t) lifetime);
+			     (paramValue_t) lifetime, (paramValue_t) maxAge);
 
     if (m_fileCacheSet->ChangeType(msgText, std::string(typeName.data()),
 				   &params)) {
+      trace.SetResult(FCErrorNone);
       err = msg->replySuccess();
     } else {
+      trace.SetResult(FCChangeError);
       err = msg->replyError((MojErr) FCChangeError, msgText.c_str());
     }
   }
@@ -264,12 +398,14 @@ MojErr
 CategoryHandler::DeleteType(MojServiceMessage* msg, MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceDeleteType, msg);
 
   MojString typeName;
   MojInt64 freedSpace = 0;
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   MojLogDebug(s_log, _T("DeleteType: existing type '%s' to be deleted."),
 	      typeName.data());
 
@@ -282,8 +418,10 @@ CategoryHandler::DeleteType(MojServiceMessage* msg, MojObject& payload) {
     MojObject reply;
     err = reply.putInt(_T("freedSpace"), freedSpace);
     MojErrCheck(err);
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess(reply);
   } else {
+    trace.SetResult(FCDeleteError);
     err = msg->replyError((MojErr) FCDeleteError, msgText.c_str());
   }
   MojErrCheck(err);
@@ -296,11 +434,13 @@ CategoryHandler::DescribeType(MojServiceMessage* msg,
 			      MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceDescribeType, msg);
 
   MojString typeName;
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   MojLogDebug(s_log, _T("DescribeType: existing type '%s' to be queried."),
 	      typeName.data());
 
@@ -324,11 +464,15 @@ CategoryHandler::DescribeType(MojServiceMessage* msg,
     MojErrCheck(err);
     err = reply.putInt(_T("lifetime"), (MojInt64) params.GetLifetime());
     MojErrCheck(err);
+    err = reply.putInt(_T("maxAge"), (MojInt64) params.GetMaxAge());
+    MojErrCheck(err);
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess(reply);
   } else {
     std::string msgText("DescribeType: Type '");
     msgText += typeName.data();
     msgText += "' does not exists.";
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
 
@@ -342,20 +486,160 @@ CategoryHandler::InsertCacheObject(MojServiceMessage* msg,
                                    MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceInsertCacheObject, msg);
 
   MojString typeName, fileName;
   MojInt64 size = 0;
   MojInt64 cost = 0;
   MojInt64 lifetime = 0;
+  MojInt64 maxAge = 0;
   bool subscribed = false;
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   err = payload.getRequired(_T("fileName"), fileName);
   MojErrCheck(err);
   MojLogDebug(s_log, _T("InsertCacheObject: inserting object into type '%s' for file '%s',"),
               typeName.data(), fileName.data());
 
+  MojString key;
+  std::string msgText(CheckInsertParams(std::string("InsertCacheObject"),
+                                        payload, typeName, fileName, size,
+                                        cost, lifetime, maxAge, subscribed,
+                                        key));
+  if (!msgText.empty()) {
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCInvalidParams);
+    err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
+  } else {
+    cachedObjectId_t objId =
+      m_fileCacheSet->InsertCacheObject(msgText, std::string(typeName.data()),
+                                        std::string(fileName.data()),
+                                        (cacheSize_t) size,
+                                        (paramValue_t) cost,
+                                        (paramValue_t) lifetime,
+                                        std::string(key.data()),
+                                        (paramValue_t) maxAge);
+
+    MojLogDebug(s_log, _T("InsertCacheObject: new object id = %llu."), objId);
+    if (objId > 0) {
+      const std::string type(typeName.data());
+      // The reply may wait for the file, but the object is in
+      trace.SetObject(objId, type, (cacheSize_t) size);
+      trace.SetResult(FCErrorNone);
+      if (m_fileCacheSet->isObjectBeingCreated(type, objId)) {
+        // Reply once the I/O workers have created the file
+        PendingInsertPtr insert(new PendingInsert(*this, msg, objId, type,
+                                                  std::string(fileName.data()),
+                                                  subscribed, false));
+        MojAllocCheck(insert.get());
+        m_pendingInserts[objId] = insert;
+      } else {
+        err = ReplyInsert(msg, objId, type, std::string(fileName.data()),
+                          subscribed);
+      }
+    } else {
+      trace.SetResult(FCExistsError);
+      err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
+    }
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+// Reply to an insert once the file for the new object exists,
+// subscribing the client to it if requested.
+MojErr
+CategoryHandler::ReplyInsert(MojServiceMessage* msg,
+                             const cachedObjectId_t objId,
+                             const std::string& typeName,
+                             const std::string& fileName, bool subscribed) {
+
+  MojLogTrace(s_log);
+
+  CTraceSpan span("reply");
+  MojErr err = MojErrNone;
+  std::string msgText;
+  MojString pathName;
+  MojObject reply;
+  SubscriptionPtr opening;
+  if (subscribed) {
+    const std::string fpath(m_fileCacheSet->SubscribeCacheObject(msgText, objId));
+    if (!fpath.empty()) {
+      err = pathName.assign(fpath.c_str());
+      MojErrCheck(err);
+      MojRefCountedPtr<Subscription> cancelHandler(new Subscription(*this,
+                                                   msg,
+                                                   pathName,
+                                                   objId,
+                                                   typeName));
+      MojAllocCheck(cancelHandler.get());
+      AddSubscription(cancelHandler);
+      if (m_fileCacheSet->isObjectBeingOpened(typeName, objId)) {
+        opening = cancelHandler;
+      }
+      MojLogDebug(s_log, _T("InsertCacheObject: subscribed new object '%s'."),
+                  fpath.c_str());
+      err = reply.putBool(_T("subscribed"), true);
+      MojErrCheck(err);
+    } else if (!msgText.empty()) {
+      msgText = "SubscribeCacheObject: " + msgText;
+      MojLogError(s_log, _T("%s"), msgText.c_str());
+    }
+  } else {
+    const std::string dirBase(m_fileCacheSet->GetBaseDirName());
+    err = pathName.assign(BuildPathname(objId, dirBase, typeName,
+                                        fileName).c_str());
+    MojErrCheck(err);
+  }
+  err = reply.putString(_T("pathName"), pathName);
+  MojErrCheck(err);
+
+  if (opening.get() != NULL) {
+    // Reply once the I/O workers have made the file writable
+    opening->SetPendingReply("InsertCacheObject", reply);
+  } else {
+    err = msg->replySuccess(reply);
+    MojErrCheck(err);
+  }
+
+  return MojErrNone;
+}
+
+MojErr
+CategoryHandler::CancelPendingInsert(PendingInsert* insert) {
+
+  MojLogTrace(s_log);
+
+  PendingInsertMap::iterator it =
+    m_pendingInserts.find(insert->GetObjectId());
+  if ((it != m_pendingInserts.end()) && (it->second.get() == insert)) {
+    MojLogInfo(s_log,
+	       _T("CancelPendingInsert: Client left before object '%llu' was created."),
+	       insert->GetObjectId());
+    // This may release the last reference to insert
+    m_pendingInserts.erase(it);
+  }
+
+  return MojErrNone;
+}
+
+// Read and validate the parameters common to the methods that insert
+// objects.  Any parameters not given are set to the type defaults.
+// Returns an error message if the parameters are not valid.
+std::string
+CategoryHandler::CheckInsertParams(const std::string& method,
+                                   MojObject& payload,
+                                   const MojString& typeName,
+                                   const MojString& fileName,
+                                   MojInt64& size, MojInt64& cost,
+                                   MojInt64& lifetime, MojInt64& maxAge,
+                                   bool& subscribed, MojString& key) {
+
+  MojLogTrace(s_log);
+
   std::string msgText;
   if (m_fileCacheSet->TypeExists(std::string(typeName.data()))) {
     CCacheParamValues params =
@@ -367,7 +651,7 @@ CategoryHandler::InsertCacheObject(MojServiceMessage* msg,
         if (param.type() == MojObject::TypeBool) {
           subscribed = param.boolValue();
         } else {
-          msgText = "InsertCacheObject: Invalid params: subscribe must be boolean.";
+          msgText = method + ": Invalid params: subscribe must be boolean.";
           break;
         }
       }
@@ -377,7 +661,7 @@ CategoryHandler::InsertCacheObject(MojServiceMessage* msg,
         if (param.type() == MojObject::TypeInt) {
           size = param.intValue();
         } else {
-          msgText = "InsertCacheObject: Invalid params: size must be integer.";
+          msgText = method + ": Invalid params: size must be integer.";
           break;
         }
       } else {
@@ -388,7 +672,7 @@ CategoryHandler::InsertCacheObject(MojServiceMessage* msg,
         if (param.type() == MojObject::TypeInt) {
           cost = param.intValue();
         } else {
-          msgText = "InsertCacheObject: Invalid params: cost must be integer.";
+          msgText = method + ": Invalid params: cost must be integer.";
           break;
         }
       } else {
@@ -399,85 +683,63 @@ CategoryHandler::InsertCacheObject(MojServiceMessage* msg,
         if (param.type() == MojObject::TypeInt) {
           lifetime = param.intValue();
         } else {
-          msgText = "InsertCacheObject: Invalid params: lifetime must be integer.";
+          msgText = method + ": Invalid params: lifetime must be integer.";
           break;
         }
       } else {
         lifetime = params.GetLifetime();
       }
 
+      if (payload.get(_T("maxAge"), param)) {
+        if (param.type() == MojObject::TypeInt) {
+          maxAge = param.intValue();
+        } else {
+          msgText = method + ": Invalid params: maxAge must be integer.";
+          break;
+        }
+      } else {
+        maxAge = params.GetMaxAge();
+      }
+
+      if (payload.get(_T("key"), param)) {
+        if (param.type() == MojObject::TypeString) {
+          if (param.stringValue(key) != MojErrNone) {
+            msgText = method + ": Invalid params: key could not be read.";
+            break;
+          }
+        } else {
+          msgText = method + ": Invalid params: key must be a string.";
+          break;
+        }
+      }
+
       MojLogDebug(s_log,
-                  _T("InsertCacheObject: params: size = '%lld', cost = '%lld', lifetime = '%lld'."),
-                  size, cost, lifetime);
+                  _T("%s: params: size = '%lld', cost = '%lld', lifetime = '%lld', maxAge = '%lld'."),
+                  method.c_str(), size, cost, lifetime, maxAge);
 
       if (size <= 0) {
-        msgText = "InsertCacheObject: Invalid params: size must be greater than 0.";
+        msgText = method + ": Invalid params: size must be greater than 0.";
       } else if ((size <= GetFilesystemFileSize(1)) &&
         m_fileCacheSet->isTypeDirType(typeName.data())) {
-        msgText = "InsertCacheObject: Invalid params: size must be greater than 1 block when dirType = true.";
+        msgText = method + ": Invalid params: size must be greater than 1 block when dirType = true.";
       } else if ((cost < 0) || (cost > 100)) {
-        msgText = "InsertCacheObject: Invalid params: cost must be in the range of 0 to 100.";
+        msgText = method + ": Invalid params: cost must be in the range of 0 to 100.";
       } else if (lifetime < 0) {
-        msgText = "InsertCacheObject: Invalid params: lifetime must not be negative.";
+        msgText = method + ": Invalid params: lifetime must not be negative.";
+      } else if (maxAge < 0) {
+        msgText = method + ": Invalid params: maxAge must not be negative.";
       } else if (fileName.find(_T("/")) != MojInvalidIndex) {
-        msgText = "InsertCacheObject: Invalid params: fileName must not contain a '/'.";
+        msgText = method + ": Invalid params: fileName must not contain a '/'.";
+      } else if (key.length() > (MojSize) s_maxKeyLength) {
+        msgText = method + ": Invalid params: key must be 1024 characters or less.";
       }
     } while (false);
   } else {
-    msgText = "InsertCacheObject: No type '" + std::string(typeName.data())
+    msgText = method + ": No type '" + std::string(typeName.data())
       + "' defined.";
   }
-  if (!msgText.empty()) {
-    MojLogError(s_log, _T("%s"), msgText.c_str());
-    err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
-  } else {
-    cachedObjectId_t objId =
-      m_fileCacheSet->InsertCacheObject(msgText, std::string(typeName.data()),
-                                        std::string(fileName.data()),
-                                        (cacheSize_t) size,
-                                        (paramValue_t) cost,
-                                        (paramValue_t) lifetime);
-
-    MojLogDebug(s_log, _T("InsertCacheObject: new object id = %llu."), objId);
-    if (objId > 0) {
-      MojString pathName;
-      MojObject reply;
-      if (subscribed) {
-        const std::string fpath(m_fileCacheSet->SubscribeCacheObject(msgText, objId));
-        if (!fpath.empty()) {
-          err = pathName.assign(fpath.c_str());
-          MojErrCheck(err);
-          MojRefCountedPtr<Subscription> cancelHandler(new Subscription(*this,
-                                                       msg,
-                                                       pathName));
-          MojAllocCheck(cancelHandler.get());
-          m_subscribers.push_back(cancelHandler.get());
-          MojLogDebug(s_log, _T("InsertCacheObject: subscribed new object '%s'."),
-                      fpath.c_str());
-          err = reply.putBool(_T("subscribed"), true);
-          MojErrCheck(err);
-        } else if (!msgText.empty()) {
-          msgText = "SubscribeCacheObject: " + msgText;
-          MojLogError(s_log, _T("%s"), msgText.c_str());
-        }
-      } else {
-        const std::string dirBase(m_fileCacheSet->GetBaseDirName());
-        err = pathName.assign(BuildPathname(objId, dirBase,
-                              std::string(typeName.data()),
-                              std::string(fileName.data())).c_str());
-        MojErrCheck(err);
-      }
-      err = reply.putString(_T("pathName"), pathName);
-      MojErrCheck(err);
-
-      err = msg->replySuccess(reply);
-    } else {
-      err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
-    }
-  }
-  MojErrCheck(err);
 
-  return MojErrNone;
+  return msgText;
 }
 
 MojErr
@@ -485,6 +747,7 @@ CategoryHandler::ResizeCacheObject(MojServiceMessage* msg,
 				   MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceResizeCacheObject, msg);
 
   MojString pathName;
   MojInt64 newSize;
@@ -494,11 +757,13 @@ CategoryHandler::ResizeCacheObject(MojServiceMessage* msg,
 
   err = payload.getRequired(_T("newSize"), newSize);
   MojErrCheck(err);
+  trace.SetPath(pathName.data(), (cacheSize_t) newSize);
 
   std::string msgText;
   if (newSize <= 0) {
     msgText = "ResizeCacheObject: Invalid params: size must be greater than 0.";
     MojLogError(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCInvalidParams);
     err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
   } else {
     MojLogDebug(s_log, _T("ResizeCacheObject: resizing file '%s' to '%lld'."),
@@ -520,8 +785,12 @@ CategoryHandler::ResizeCacheObject(MojServiceMessage* msg,
 	  MojObject reply;
 	  err = reply.putInt(_T("newSize"), (MojInt64) size);
 	  MojErrCheck(err);
+	  trace.SetResult(FCErrorNone);
 	  err = msg->replySuccess(reply);
 	  MojErrCheck(err);
+	  if (m_streamedObjects.find(objId) != m_streamedObjects.end()) {
+	    ReadBytesAvailable(objId);
+	  }
 	} else {
 	  msgText = "ResizeCacheObject: Unable to resize object.";
 	  errCode = FCResizeError;
@@ -538,6 +807,7 @@ CategoryHandler::ResizeCacheObject(MojServiceMessage* msg,
     }
 
     if (!msgText.empty()) {
+      trace.SetResult(errCode);
       err = msg->replyError((MojErr) errCode, msgText.c_str());
     }
   }
@@ -551,12 +821,14 @@ CategoryHandler::ExpireCacheObject(MojServiceMessage* msg,
 				   MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceExpireCacheObject, msg);
 
   MojString pathName;
   std::string msgText;
 
   MojErr err = payload.getRequired(_T("pathName"), pathName);
   MojErrCheck(err);
+  trace.SetPath(pathName.data());
   MojLogDebug(s_log, _T("ExpireCacheObject: expiring object '%s'."),
 	      pathName.data());
 
@@ -597,8 +869,10 @@ CategoryHandler::ExpireCacheObject(MojServiceMessage* msg,
   }
 
   if (!msgText.empty()) {
+    trace.SetResult(errCode);
     err = msg->replyError((MojErr) errCode, msgText.c_str());
   } else {
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess();
   }
   MojErrCheck(err);
@@ -611,10 +885,12 @@ CategoryHandler::SubscribeCacheObject(MojServiceMessage* msg,
 				      MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceSubscribeCacheObject, msg);
 
   MojString pathName;
   MojErr err = payload.getRequired(_T("pathName"), pathName);
   MojErrCheck(err);
+  trace.SetPath(pathName.data());
   MojLogDebug(s_log, _T("SubscribeCacheObject: subscribing to file '%s'."),
 	      pathName.data());
   std::string msgText;
@@ -622,23 +898,65 @@ CategoryHandler::SubscribeCacheObject(MojServiceMessage* msg,
   const cachedObjectId_t objId = GetObjectIdFromPath(pathName.data());
   if (objId > 0) {
     bool subscribed = false;
+    bool streaming = false;
+    payload.get(_T("streaming"), streaming);
     if (payload.get(_T("subscribe"), subscribed) && subscribed) {
-      if (GetTypeNameFromPath(m_fileCacheSet->GetBaseDirName(),
-			      pathName.data()) ==
-	  m_fileCacheSet->GetTypeForObjectId(objId)) {
-	const std::string fpath(m_fileCacheSet->SubscribeCacheObject(msgText, objId));
+      const std::string typeName(GetTypeNameFromPath(m_fileCacheSet->GetBaseDirName(),
+						     pathName.data()));
+      if (typeName == m_fileCacheSet->GetTypeForObjectId(objId)) {
+	// Only objects still being written need a streaming reader,
+	// otherwise this is an ordinary read subscription
+	const bool streamReader = streaming &&
+	  m_fileCacheSet->isObjectBeingWritten(typeName, objId);
+	const std::string fpath(m_fileCacheSet->SubscribeCacheObject(msgText, objId,
+								     streamReader));
 	if (!fpath.empty()) {
 	  MojObject reply;
+	  // A written object is all there, the readers of one still being
+	  // written start where the others have got to
+	  cacheSize_t bytesAvailable = 0;
+	  if (streamReader) {
+	    bytesAvailable = GetBytesReported(objId);
+	  } else if (streaming) {
+	    bytesAvailable = m_fileCacheSet->CachedObjectSize(objId);
+	  }
 	  MojRefCountedPtr<Subscription> cancelHandler(new Subscription(*this,
 									msg,
-									pathName));
+									pathName,
+									objId,
+									typeName,
+									streamReader,
+									bytesAvailable));
 	  MojAllocCheck(cancelHandler.get());
-	  m_subscribers.push_back(cancelHandler.get());
+	  AddSubscription(cancelHandler);
 	  MojLogDebug(s_log, _T("SubscribeCacheObject: subscribed object '%s'."),
 		      fpath.c_str());
 	  err = reply.putBool(_T("subscribed"), true);
 	  MojErrCheck(err);
-	  err = msg->replySuccess(reply);
+	  if (streaming) {
+	    err = reply.putInt(_T("bytesAvailable"),
+			       (MojInt64) ((bytesAvailable > 0) ? bytesAvailable : 0));
+	    MojErrCheck(err);
+	    err = reply.putBool(_T("complete"), !streamReader);
+	    MojErrCheck(err);
+	    if (streamReader) {
+	      m_streamedObjects.insert(objId);
+	      SetupStreamTimer();
+	    }
+	  }
+	  trace.SetResult(FCErrorNone);
+	  if (!streamReader &&
+	      m_fileCacheSet->isObjectBeingOpened(typeName, objId)) {
+	    // Reply once the I/O workers have made the file writable
+	    cancelHandler->SetPendingReply("SubscribeCacheObject", reply);
+	  } else {
+	    err = msg->replySuccess(reply);
+	  }
+	  if (streamReader) {
+	    // After the reply, as a read run in line tells the reader
+	    // of progress at once
+	    ReadBytesAvailable(objId);
+	  }
 	} else if (!msgText.empty()) {
 	  msgText = "SubscribeCacheObject: " + msgText;
 	  MojLogError(s_log, _T("%s"), msgText.c_str());
@@ -647,6 +965,7 @@ CategoryHandler::SubscribeCacheObject(MojServiceMessage* msg,
 	  MojLogError(s_log, _T("%s"), msgText.c_str());
 	}
       } else {
+	m_fileCacheSet->RecordMiss(typeName);
 	msgText = "SubscribeCacheObject: pathName no longer found in cache.";
 	MojLogError(s_log, _T("%s"), msgText.c_str());
       }
@@ -657,6 +976,7 @@ CategoryHandler::SubscribeCacheObject(MojServiceMessage* msg,
   }
 
   if (!msgText.empty()) {
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
   MojErrCheck(err);
@@ -664,6 +984,252 @@ CategoryHandler::SubscribeCacheObject(MojServiceMessage* msg,
   return MojErrNone;
 }
 
+MojErr
+CategoryHandler::LookupOrInsertCacheObject(MojServiceMessage* msg,
+					   MojObject& payload) {
+
+  MojLogTrace(s_log);
+  TraceScope trace(*this, TraceLookupOrInsertCacheObject, msg);
+
+  MojString typeName, fileName, key;
+  MojInt64 size = 0;
+  MojInt64 cost = 0;
+  MojInt64 lifetime = 0;
+  MojInt64 maxAge = 0;
+  bool subscribed = false;
+  bool streaming = false;
+
+  MojErr err = payload.getRequired(_T("typeName"), typeName);
+  MojErrCheck(err);
+  trace.SetType(typeName.data());
+  err = payload.getRequired(_T("fileName"), fileName);
+  MojErrCheck(err);
+  payload.get(_T("streaming"), streaming);
+
+  std::string msgText(CheckInsertParams(std::string("LookupOrInsertCacheObject"),
+					payload, typeName, fileName, size,
+					cost, lifetime, maxAge, subscribed,
+					key));
+  if (msgText.empty()) {
+    if (key.empty()) {
+      msgText = "LookupOrInsertCacheObject: Invalid params: key must be specified.";
+    } else if (!subscribed) {
+      msgText = "LookupOrInsertCacheObject: Invalid params: subscribe must be true.";
+    }
+  }
+  if (!msgText.empty()) {
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCInvalidParams);
+    err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
+    MojErrCheck(err);
+
+    return MojErrNone;
+  }
+
+  MojLogDebug(s_log,
+	      _T("LookupOrInsertCacheObject: looking up key '%s' in type '%s'."),
+	      key.data(), typeName.data());
+  const std::string type(typeName.data());
+  bool inserted = false;
+  const cachedObjectId_t objId =
+    m_fileCacheSet->LookupOrInsertCacheObject(msgText, type,
+					      std::string(key.data()),
+					      std::string(fileName.data()),
+					      (cacheSize_t) size,
+					      (paramValue_t) cost,
+					      (paramValue_t) lifetime,
+					      inserted, (paramValue_t) maxAge);
+  if (objId != 0) {
+    trace.SetObject(objId, type, inserted ? (cacheSize_t) size : -1);
+    trace.SetResult(inserted ? s_traceInserted : FCErrorNone);
+  }
+  if (objId == 0) {
+    trace.SetResult(FCExistsError);
+    err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
+  } else if (inserted && m_fileCacheSet->isObjectBeingCreated(type, objId)) {
+    // Subscribe once the I/O workers have created the file
+    PendingInsertPtr insert(new PendingInsert(*this, msg, objId, type,
+					      std::string(fileName.data()),
+					      true, true));
+    MojAllocCheck(insert.get());
+    m_pendingInserts[objId] = insert;
+  } else if (!inserted && m_fileCacheSet->isObjectBeingWritten(type, objId) &&
+	     (!streaming || m_fileCacheSet->isObjectBeingCreated(type, objId))) {
+    // Another client is writing this object, so wait for it rather
+    // than writing a duplicate
+    PendingLookupPtr lookup(new PendingLookup(*this, msg, payload, objId));
+    MojAllocCheck(lookup.get());
+    m_pendingLookups.insert(std::make_pair(objId, lookup));
+    SetupWorkerTimer();
+    MojLogInfo(s_log,
+	       _T("LookupOrInsertCacheObject: waiting for object '%llu' to be written."),
+	       objId);
+  } else {
+    err = SubscribeLookup(msg, objId, type, inserted,
+			  !inserted && streaming &&
+			  m_fileCacheSet->isObjectBeingWritten(type, objId));
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+// Subscribe the client to the object found or inserted by a lookup.
+// A new object gets the writer subscription, otherwise the client is
+// a reader.
+MojErr
+CategoryHandler::SubscribeLookup(MojServiceMessage* msg,
+				 const cachedObjectId_t objId,
+				 const std::string& typeName, bool inserted,
+				 bool streamReader) {
+
+  MojLogTrace(s_log);
+
+  MojErr err = MojErrNone;
+  std::string msgText;
+  const std::string fpath(m_fileCacheSet->SubscribeCacheObject(msgText, objId,
+							       streamReader));
+  if (!fpath.empty()) {
+    MojString pathName;
+    err = pathName.assign(fpath.c_str());
+    MojErrCheck(err);
+    const cacheSize_t bytesAvailable = streamReader ?
+      GetBytesReported(objId) : 0;
+    MojRefCountedPtr<Subscription> cancelHandler(new Subscription(*this,
+								  msg,
+								  pathName,
+								  objId,
+								  typeName,
+								  streamReader,
+								  bytesAvailable));
+    MojAllocCheck(cancelHandler.get());
+    AddSubscription(cancelHandler);
+    MojObject reply;
+    err = reply.putString(_T("pathName"), pathName);
+    MojErrCheck(err);
+    err = reply.putBool(_T("subscribed"), true);
+    MojErrCheck(err);
+    err = reply.putBool(_T("inserted"), inserted);
+    MojErrCheck(err);
+    if (streamReader) {
+      err = reply.putInt(_T("bytesAvailable"),
+			 (MojInt64) cancelHandler->GetBytesReported());
+      MojErrCheck(err);
+      err = reply.putBool(_T("complete"), false);
+      MojErrCheck(err);
+      m_streamedObjects.insert(objId);
+      SetupStreamTimer();
+    }
+    MojLogDebug(s_log, _T("SubscribeLookup: subscribed %s object '%s'."),
+		inserted ? "new" : "existing", fpath.c_str());
+    if (!streamReader &&
+	m_fileCacheSet->isObjectBeingOpened(typeName, objId)) {
+      // Reply once the I/O workers have made the file writable
+      cancelHandler->SetPendingReply("LookupOrInsertCacheObject", reply);
+    } else {
+      err = msg->replySuccess(reply);
+    }
+    if (streamReader) {
+      ReadBytesAvailable(objId);
+    }
+  } else {
+    if (msgText.empty()) {
+      msgText = "Could not find object to match key.";
+    }
+    msgText = "LookupOrInsertCacheObject: " + msgText;
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+// Retry the lookups that were waiting on an object that is no longer
+// being written.  If it was written they become readers, otherwise
+// the first one inserts a new object and the rest wait on that.
+MojErr
+CategoryHandler::ResolvePendingLookups(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  std::pair<PendingLookupMap::iterator, PendingLookupMap::iterator> range =
+    m_pendingLookups.equal_range(objId);
+  std::vector<PendingLookupPtr> waiting;
+  for (PendingLookupMap::iterator it = range.first; it != range.second; ++it) {
+    waiting.push_back(it->second);
+  }
+  m_pendingLookups.erase(range.first, range.second);
+
+  MojLogInfo(s_log,
+	     _T("ResolvePendingLookups: Retrying '%zu' lookups for object '%llu'."),
+	     waiting.size(), objId);
+  for (std::vector<PendingLookupPtr>::iterator it = waiting.begin();
+       it != waiting.end(); ++it) {
+    LookupOrInsertCacheObject((*it)->GetMessage(), (*it)->GetPayload());
+  }
+
+  return MojErrNone;
+}
+
+// Fail the lookups waiting on writers that have written nothing for
+// s_writerWaitTimeout, rather than have them wait on a client that
+// may never let go.  How much the writers of the others have written
+// is read again for the next run.
+void
+CategoryHandler::FailStalledLookups() {
+
+  MojLogTrace(s_log);
+
+  const time_t now = ::time(0);
+  std::vector<PendingLookupPtr> stalled;
+  PendingLookupMap::iterator it = m_pendingLookups.begin();
+  while (it != m_pendingLookups.end()) {
+    if (it->second->isStalled(now)) {
+      stalled.push_back(it->second);
+      m_pendingLookups.erase(it++);
+    } else {
+      ReadBytesAvailable((it++)->first);
+    }
+  }
+
+  for (std::vector<PendingLookupPtr>::iterator it = stalled.begin();
+       it != stalled.end(); ++it) {
+    std::stringstream msgText;
+    msgText << "LookupOrInsertCacheObject: Timed out waiting for object '"
+	    << (*it)->GetObjectId() << "' to be written.";
+    MojLogWarning(s_log, _T("%s"), msgText.str().c_str());
+    MojErr err = (*it)->GetMessage()->replyError((MojErr) FCInUseError,
+						 msgText.str().c_str());
+    if (err != MojErrNone) {
+      MojLogError(s_log,
+		  _T("FailStalledLookups: Failed to reply for object '%llu'."),
+		  (*it)->GetObjectId());
+    }
+  }
+}
+
+MojErr
+CategoryHandler::CancelPendingLookup(PendingLookup* lookup) {
+
+  MojLogTrace(s_log);
+
+  std::pair<PendingLookupMap::iterator, PendingLookupMap::iterator> range =
+    m_pendingLookups.equal_range(lookup->GetObjectId());
+  for (PendingLookupMap::iterator it = range.first; it != range.second; ++it) {
+    if (it->second.get() == lookup) {
+      MojLogInfo(s_log,
+		 _T("CancelPendingLookup: Removed lookup waiting on object '%llu'."),
+		 lookup->GetObjectId());
+      // This may release the last reference to lookup
+      m_pendingLookups.erase(it);
+      break;
+    }
+  }
+
+  return MojErrNone;
+}
+
 MojErr
 CategoryHandler::CancelSubscription(Subscription* sub,
 				    MojServiceMessage* msg,
@@ -671,29 +1237,69 @@ CategoryHandler::CancelSubscription(Subscription* sub,
 
   MojLogTrace(s_log);
 
-  const cachedObjectId_t objId = GetObjectIdFromPath(pathName.data());
+  const cachedObjectId_t objId = sub->GetObjectId();
+  if (m_traceRecorder.isRecording()) {
+    m_traceRecorder.Record(TraceUnsubscribe, objId, sub->GetTypeName(), 0,
+			   CTraceRecorder::Hash(CallerID(msg)), FCErrorNone);
+  }
   if (objId > 0) {
-    const std::string typeName(GetTypeNameFromPath(m_fileCacheSet->GetBaseDirName(),
-						   pathName.data()));
-    if (!typeName.empty()) {
-      m_fileCacheSet->UnSubscribeCacheObject(typeName, objId);
+    if (!sub->GetTypeName().empty()) {
+      // Once the writer's release is done, ObjectWritten tells the
+      // streaming readers and the lookups waiting on it
+      m_fileCacheSet->UnSubscribeCacheObject(sub->GetTypeName(), objId,
+					     sub->isStreaming());
     } else {
       MojLogError(s_log,
 		  _T("CancelSubscription: pathName no longer found in cache."));
     }
   }
-  for (SubscriptionVec::iterator it = m_subscribers.begin();
-       it != m_subscribers.end(); ++it) {
-    if (it->get() == sub) {
-      m_subscribers.erase(it);
-      MojLogInfo(s_log,
-		 _T("CancelSubscription: Removed subscription on pathName '%s'."),
-		 pathName.data());
+  MojLogInfo(s_log,
+	     _T("CancelSubscription: Removed subscription on pathName '%s'."),
+	     pathName.data());
+  // This may release the last reference to sub and its pathName
+  RemoveSubscription(sub);
+
+  return MojErrNone;
+}
+
+// Add a subscription to the registry.  Objects that are still being
+// written are remembered so the worker can validate them.
+void
+CategoryHandler::AddSubscription(const SubscriptionPtr& sub) {
+
+  MojLogTrace(s_log);
+
+  m_subscribers[sub.get()] = sub;
+  m_objectSubscribers.insert(std::make_pair(sub->GetObjectId(), sub.get()));
+  if (m_fileCacheSet->isObjectBeingWritten(sub->GetTypeName(),
+					   sub->GetObjectId())) {
+    m_unwrittenObjects.insert(sub->GetObjectId());
+    SetupWorkerTimer();
+  }
+}
+
+// Remove a subscription from the registry.  This may release the
+// last reference to the subscription.
+void
+CategoryHandler::RemoveSubscription(Subscription* sub) {
+
+  MojLogTrace(s_log);
+
+  const cachedObjectId_t objId = sub->GetObjectId();
+  std::pair<ObjectSubscriptionMap::iterator,
+	    ObjectSubscriptionMap::iterator> range =
+    m_objectSubscribers.equal_range(objId);
+  for (ObjectSubscriptionMap::iterator it = range.first;
+       it != range.second; ++it) {
+    if (it->second == sub) {
+      m_objectSubscribers.erase(it);
       break;
     }
   }
-
-  return MojErrNone;
+  if (m_objectSubscribers.find(objId) == m_objectSubscribers.end()) {
+    m_unwrittenObjects.erase(objId);
+  }
+  m_subscribers.erase(sub);
 }
 
 MojErr
@@ -701,10 +1307,12 @@ CategoryHandler::TouchCacheObject(MojServiceMessage* msg,
 				  MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceTouchCacheObject, msg);
 
   MojString pathName;
   MojErr err = payload.getRequired(_T("pathName"), pathName);
   MojErrCheck(err);
+  trace.SetPath(pathName.data());
   MojLogDebug(s_log, _T("TouchCacheObject: touching file '%s'."),
 	      pathName.data());
 
@@ -715,6 +1323,7 @@ CategoryHandler::TouchCacheObject(MojServiceMessage* msg,
 			    pathName.data()) ==
 	m_fileCacheSet->GetTypeForObjectId(objId)) {
       if (m_fileCacheSet->Touch(objId)) {
+	trace.SetResult(FCErrorNone);
 	err = msg->replySuccess();
       } else {
 	msgText = "TouchCacheObject: Could not locate object";
@@ -729,6 +1338,7 @@ CategoryHandler::TouchCacheObject(MojServiceMessage* msg,
   }
 
   if (!msgText.empty()) {
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
   MojErrCheck(err);
@@ -741,12 +1351,14 @@ CategoryHandler::CopyCacheObject(MojServiceMessage* msg,
 				 MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceCopyCacheObject, msg);
 
   MojString pathName, param;
   std::string destination, fileName;
 
   MojErr err = payload.getRequired(_T("pathName"), pathName);
   MojErrCheck(err);
+  trace.SetPath(pathName.data());
 
   MojLogDebug(s_log, _T("CopyCacheObject: attempting to copy file '%s'."),
 	      pathName.data());
@@ -843,9 +1455,14 @@ CategoryHandler::CopyCacheObject(MojServiceMessage* msg,
   }
 
   if (!msgText.empty()) {
+    trace.SetResult(errCode);
     err = msg->replyError(errCode, msgText.c_str());
   } else {
-    err = CopyFile(msg, pathName.data(), destFileName);
+    trace.SetResult(FCErrorNone);
+    err = CopyFile(msg, pathName.data(), destFileName,
+		   GetTypeNameFromPath(m_fileCacheSet->GetBaseDirName(),
+				       pathName.data()),
+		   m_fileCacheSet->CachedObjectSize(objId));
   }
   MojErrCheck(err);
 
@@ -857,6 +1474,7 @@ CategoryHandler::GetCacheStatus(MojServiceMessage* msg,
 				MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetCacheStatus, msg);
 
   cacheSize_t numTypes = 0;
   cacheSize_t size = 0;
@@ -878,6 +1496,7 @@ CategoryHandler::GetCacheStatus(MojServiceMessage* msg,
 	      _T("GetCacheStatus: numTypes = '%d', size = '%d', numObjs = '%d', availSpace = '%d'."),
 	      numTypes, size, numObjs, space);
 
+  trace.SetResult(FCErrorNone);
   err = msg->replySuccess(reply);
   MojErrCheck(err);
 
@@ -889,6 +1508,7 @@ CategoryHandler::GetCacheTypeStatus(MojServiceMessage* msg,
 				    MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetCacheTypeStatus, msg);
 
   cacheSize_t size = 0;
   paramValue_t numObjs = 0;
@@ -897,25 +1517,39 @@ CategoryHandler::GetCacheTypeStatus(MojServiceMessage* msg,
 
   MojErr err = payload.getRequired(_T("typeName"), typeName);
   MojErrCheck(err);
+  trace.SetType(typeName.data());
   MojLogDebug(s_log, _T("GetCacheTypeStatus: getting status for type '%s'."),
 	      typeName.data());
   bool suceeded =
     m_fileCacheSet->GetCacheTypeStatus(std::string(typeName.data()),
 				       &size, &numObjs);
+  bool withStats = false;
+  payload.get(_T("stats"), withStats);
+  CTypeStats stats;
+  if (suceeded && withStats) {
+    suceeded = m_fileCacheSet->GetCacheTypeStats(std::string(typeName.data()),
+						 stats);
+  }
   MojObject reply;
   if (suceeded) {
     err = reply.putInt(_T("size"), (MojInt64) size);
     MojErrCheck(err);
     err = reply.putInt(_T("numObjs"), (MojInt64) numObjs);
     MojErrCheck(err);
+    if (withStats) {
+      err = PutTypeStats(reply, stats);
+      MojErrCheck(err);
+    }
     MojLogDebug(s_log, _T("GetCacheTypeStatus: size = '%d', numObjs = '%d'."),
 		size, numObjs);
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess(reply);
   } else {
     std::string msgText("GetCacheTypeStatus: Type '");
     msgText += typeName.data();
     msgText += "' doesn't exist";
     MojLogInfo(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
 
@@ -924,32 +1558,219 @@ CategoryHandler::GetCacheTypeStatus(MojServiceMessage* msg,
   return MojErrNone;
 }
 
+// Add the stats of a type to a GetCacheTypeStatus reply
 MojErr
-CategoryHandler::GetCacheObjectSize(MojServiceMessage* msg,
-				    MojObject& payload) {
+CategoryHandler::PutTypeStats(MojObject& reply, const CTypeStats& stats) {
 
   MojLogTrace(s_log);
 
-  MojString pathName;
-
-  MojErr err = payload.getRequired(_T("pathName"), pathName);
+  MojObject statsObj;
+  MojErr err = statsObj.putInt(_T("hits"), (MojInt64) stats.m_hits);
+  MojErrCheck(err);
+  err = statsObj.putInt(_T("misses"), (MojInt64) stats.m_misses);
+  MojErrCheck(err);
+  err = statsObj.putInt(_T("inserts"), (MojInt64) stats.m_inserts);
+  MojErrCheck(err);
+  err = statsObj.putInt(_T("insertBytes"), (MojInt64) stats.m_insertBytes);
+  MojErrCheck(err);
+  err = statsObj.putInt(_T("reinserts"), (MojInt64) stats.m_reinserts);
   MojErrCheck(err);
-  MojLogDebug(s_log, _T("GetCacheObjectSize: getting size for '%s'."),
-	      pathName.data());
 
-  MojObject reply;
+  MojObject evictions;
+  for (int i = 0; i < ExpireNumReasons; i++) {
+    MojObject reason;
+    err = reason.putInt(_T("count"), (MojInt64) stats.m_evictions[i]);
+    MojErrCheck(err);
+    err = reason.putInt(_T("bytes"), (MojInt64) stats.m_evictionBytes[i]);
+    MojErrCheck(err);
+    err = evictions.put(s_expireReasonNames[i], reason);
+    MojErrCheck(err);
+  }
+  err = statsObj.put(_T("evictions"), evictions);
+  MojErrCheck(err);
+
+  // The ages, in seconds, of the objects evicted for capacity
+  const CLatencyHistogram& ages = stats.m_evictionAge;
+  MojObject age;
+  err = age.putInt(_T("p10"), (MojInt64) ages.GetPercentile(0.1));
+  MojErrCheck(err);
+  err = age.putInt(_T("p50"), (MojInt64) ages.GetPercentile(0.5));
+  MojErrCheck(err);
+  err = age.putInt(_T("p90"), (MojInt64) ages.GetPercentile(0.9));
+  MojErrCheck(err);
+  err = age.putInt(_T("max"), (MojInt64) ages.GetMax());
+  MojErrCheck(err);
+  err = statsObj.put(_T("evictionAge"), age);
+  MojErrCheck(err);
+
+  err = reply.put(_T("stats"), statsObj);
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+MojErr
+CategoryHandler::ListCacheObjects(MojServiceMessage* msg,
+				  MojObject& payload) {
+
+  MojLogTrace(s_log);
+  TraceScope trace(*this, TraceListCacheObjects, msg);
+
+  MojString typeName;
+  MojString sortBy;
+  MojString cursor;
+  MojInt64 minSize = -1;
+  MojInt64 maxSize = -1;
+  MojInt64 accessedBefore = 0;
+  MojInt64 accessedAfter = 0;
+  MojInt64 limit = CObjectQuery::s_defaultPageSize;
+  bool subscribed = false;
+  bool written = false;
+  bool found = false;
+  CObjectQuery query;
+
+  MojErr err = payload.getRequired(_T("typeName"), typeName);
+  MojErrCheck(err);
+  trace.SetType(typeName.data());
+  MojLogDebug(s_log, _T("ListCacheObjects: listing objects for type '%s'."),
+	      typeName.data());
+
+  payload.get(_T("minSize"), minSize);
+  payload.get(_T("maxSize"), maxSize);
+  payload.get(_T("accessedBefore"), accessedBefore);
+  payload.get(_T("accessedAfter"), accessedAfter);
+  payload.get(_T("limit"), limit);
+  payload.get(_T("descending"), query.m_descending);
+  if (payload.get(_T("subscribed"), subscribed)) {
+    query.m_subscribed = subscribed ? 1 : 0;
+  }
+  if (payload.get(_T("written"), written)) {
+    query.m_written = written ? 1 : 0;
+  }
+  err = payload.get(_T("sortBy"), sortBy, found);
+  MojErrCheck(err);
+  err = payload.get(_T("cursor"), cursor, found);
+  MojErrCheck(err);
+
+  std::string msgText;
+  const std::string sortKey(sortBy.data());
+  if (!sortKey.empty() && (sortKey != "size") &&
+      (sortKey != "recency") && (sortKey != "cost")) {
+    msgText = "ListCacheObjects: Invalid params: sortBy must be one of 'size', 'recency' or 'cost'.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+  } else if ((limit <= 0) || (limit > CObjectQuery::s_maxPageSize)) {
+    msgText = "ListCacheObjects: Invalid params: limit must be in the range of 1 to 500.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+  } else if ((minSize >= 0) && (maxSize >= 0) && (minSize > maxSize)) {
+    msgText = "ListCacheObjects: Invalid params: minSize must not be greater than maxSize.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+  }
+  if (!msgText.empty()) {
+    trace.SetResult(FCInvalidParams);
+    err = msg->replyError((MojErr) FCInvalidParams, msgText.c_str());
+    MojErrCheck(err);
+
+    return MojErrNone;
+  }
+
+  if (sortKey == "size") {
+    query.m_sortBy = SortBySize;
+  } else if (sortKey == "cost") {
+    query.m_sortBy = SortByCost;
+  }
+  query.m_minSize = (cacheSize_t) minSize;
+  query.m_maxSize = (cacheSize_t) maxSize;
+  query.m_accessedBefore = (time_t) accessedBefore;
+  query.m_accessedAfter = (time_t) accessedAfter;
+  query.m_limit = (paramValue_t) limit;
+  query.m_cursor = cursor.data();
+
+  std::vector<CCacheObjectInfo> objects;
+  std::string nextCursor;
+  if (m_fileCacheSet->ListCacheObjects(msgText, std::string(typeName.data()),
+				       query, objects, nextCursor)) {
+    MojObject reply;
+    MojObject objArray;
+    std::vector<CCacheObjectInfo>::const_iterator iter = objects.begin();
+    while (iter != objects.end()) {
+      MojObject obj;
+      err = obj.putString(_T("pathName"), iter->m_pathname.c_str());
+      MojErrCheck(err);
+      err = obj.putString(_T("fileName"), iter->m_filename.c_str());
+      MojErrCheck(err);
+      err = obj.putInt(_T("size"), (MojInt64) iter->m_size);
+      MojErrCheck(err);
+      err = obj.putInt(_T("cost"), (MojInt64) iter->m_cost);
+      MojErrCheck(err);
+      err = obj.putInt(_T("lifetime"), (MojInt64) iter->m_lifetime);
+      MojErrCheck(err);
+      err = obj.putInt(_T("creationTime"), (MojInt64) iter->m_creationTime);
+      MojErrCheck(err);
+      err = obj.putInt(_T("lastAccessTime"),
+		       (MojInt64) iter->m_lastAccessTime);
+      MojErrCheck(err);
+      err = obj.putInt(_T("subscribers"),
+		       (MojInt64) iter->m_subscriptionCount);
+      MojErrCheck(err);
+      err = obj.putBool(_T("written"), iter->m_written);
+      MojErrCheck(err);
+      err = objArray.push(obj);
+      MojErrCheck(err);
+      ++iter;
+    }
+    err = reply.put(_T("objects"), objArray);
+    MojErrCheck(err);
+    if (!nextCursor.empty()) {
+      err = reply.putString(_T("nextCursor"), nextCursor.c_str());
+      MojErrCheck(err);
+    }
+    MojLogDebug(s_log, _T("ListCacheObjects: returning '%zu' objects."),
+		objects.size());
+    trace.SetResult(FCErrorNone);
+    err = msg->replySuccess(reply);
+  } else {
+    FCErr errCode = FCExistsError;
+    if (m_fileCacheSet->TypeExists(std::string(typeName.data()))) {
+      errCode = FCInvalidParams;
+    }
+    trace.SetResult(errCode);
+    err = msg->replyError((MojErr) errCode, msgText.c_str());
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+MojErr
+CategoryHandler::GetCacheObjectSize(MojServiceMessage* msg,
+				    MojObject& payload) {
+
+  MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetCacheObjectSize, msg);
+
+  MojString pathName;
+
+  MojErr err = payload.getRequired(_T("pathName"), pathName);
+  MojErrCheck(err);
+  trace.SetPath(pathName.data());
+  MojLogDebug(s_log, _T("GetCacheObjectSize: getting size for '%s'."),
+	      pathName.data());
+
+  MojObject reply;
   const cachedObjectId_t objId = GetObjectIdFromPath(pathName.data());
   cacheSize_t objSize = 0;
   if ((objId > 0) && ((objSize = m_fileCacheSet->CachedObjectSize(objId)) >= 0)) {
     err = reply.putInt(_T("size"), (MojInt64) objSize);
     MojErrCheck(err);
     MojLogDebug(s_log, _T("GetCacheObjectSize: found size '%d'."), objSize);
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess(reply);
   } else {
     std::string msgText("GetCacheObjectSize: Object '");
     msgText += pathName.data();
     msgText += "' doesn't exist";
     MojLogInfo(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
   MojErrCheck(err);
@@ -962,11 +1783,13 @@ CategoryHandler::GetCacheObjectFilename(MojServiceMessage* msg,
 					MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetCacheObjectFilename, msg);
 
   MojString pathName;
 
   MojErr err = payload.getRequired(_T("pathName"), pathName);
   MojErrCheck(err);
+  trace.SetPath(pathName.data());
   MojLogDebug(s_log, _T("GetCacheObjectFilename: getting filename for '%s'."),
 	      pathName.data());
 
@@ -978,12 +1801,14 @@ CategoryHandler::GetCacheObjectFilename(MojServiceMessage* msg,
     MojErrCheck(err);
     MojLogDebug(s_log, _T("GetCacheObjectFilename: found filename '%s'."),
 		filename.c_str());
+    trace.SetResult(FCErrorNone);
     err = msg->replySuccess(reply);
   } else {
     std::string msgText("GetCacheObjectFilename: Object '");
     msgText += pathName.data();
     msgText += "' doesn't exist";
     MojLogInfo(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCExistsError);
     err = msg->replyError((MojErr) FCExistsError, msgText.c_str());
   }
   MojErrCheck(err);
@@ -996,6 +1821,7 @@ CategoryHandler::GetCacheTypes(MojServiceMessage* msg,
 			       MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetCacheTypes, msg);
 
   MojErr err = MojErrNone;
 
@@ -1015,6 +1841,7 @@ CategoryHandler::GetCacheTypes(MojServiceMessage* msg,
     MojLogDebug(s_log, _T("GetCacheTypes: found '%zd' types."),
 		cacheTypes.size());
   }
+  trace.SetResult(FCErrorNone);
   err = msg->replySuccess(reply);
   MojErrCheck(err);
 
@@ -1026,11 +1853,13 @@ CategoryHandler::GetVersion(MojServiceMessage* msg,
 			    MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetVersion, msg);
 
   MojObject reply;
 
   MojErr err = reply.putString(_T("version"), s_InterfaceVersion.c_str());
   MojErrCheck(err);
+  trace.SetResult(FCErrorNone);
   err = msg->replySuccess(reply);
   MojErrCheck(err);
 
@@ -1039,110 +1868,1534 @@ CategoryHandler::GetVersion(MojServiceMessage* msg,
 }
 
 MojErr
-CategoryHandler::WorkerHandler() {
+CategoryHandler::WatchCacheEvents(MojServiceMessage* msg,
+				  MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceWatchCacheEvents, msg);
 
-  MojLogDebug(s_log, _T("WorkerHandler: Attempting to cleanup any orphans."));
-  m_fileCacheSet->CleanupOrphans();
+  MojString typeName;
+  MojInt64 interval = s_defaultEventInterval;
+  bool subscribed = false;
+  bool found = false;
 
-  // For each subscribed object, if it's still being written, do a
-  // validity check
-  for (SubscriptionVec::const_iterator it = m_subscribers.begin();
-       it != m_subscribers.end(); ++it) {
-    MojLogDebug(s_log, _T("WorkerHandler: Validating subscribed object '%s'."),
-		(*it)->GetPathName().data());
-    const cachedObjectId_t objId =
-      GetObjectIdFromPath((*it)->GetPathName().data());
-    const std::string typeName(GetTypeNameFromPath(m_fileCacheSet->GetBaseDirName(),
-						   (*it)->GetPathName().data()));
-    m_fileCacheSet->CheckSubscribedObject(typeName, objId);
+  MojErr err = payload.get(_T("typeName"), typeName, found);
+  MojErrCheck(err);
+  if (found) {
+    trace.SetType(typeName.data());
+  }
+  payload.get(_T("interval"), interval);
+  payload.get(_T("subscribe"), subscribed);
+
+  std::string msgText;
+  FCErr errCode = FCInvalidParams;
+  if (!subscribed) {
+    msgText = "WatchCacheEvents: Invalid params: subscribe must be true.";
+  } else if ((interval < s_minEventInterval) ||
+	     (interval > s_maxEventInterval)) {
+    msgText = "WatchCacheEvents: Invalid params: interval must be in the range of 100 to 60000.";
+  } else if (!typeName.empty() &&
+	     !m_fileCacheSet->TypeExists(std::string(typeName.data()))) {
+    msgText = "WatchCacheEvents: Type '" + std::string(typeName.data()) +
+      "' doesn't exist";
+    errCode = FCExistsError;
+  }
+
+  if (msgText.empty()) {
+    EventWatcherPtr watcher(new EventWatcher(*this, msg,
+					     std::string(typeName.data()),
+					     (guint) interval));
+    MojAllocCheck(watcher.get());
+    m_watchers[watcher.get()] = watcher;
+    MojLogInfo(s_log,
+	       _T("WatchCacheEvents: %s watching '%s' every '%lld' ms."),
+	       CallerID(msg).c_str(),
+	       typeName.empty() ? "all types" : typeName.data(), interval);
+
+    MojObject reply;
+    err = reply.putBool(_T("subscribed"), true);
+    MojErrCheck(err);
+    trace.SetResult(FCErrorNone);
+    err = msg->replySuccess(reply);
+  } else {
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(errCode);
+    err = msg->replyError((MojErr) errCode, msgText.c_str());
   }
+  MojErrCheck(err);
 
   return MojErrNone;
 }
 
+// Turn the recording of requests and evictions to the trace file on
+// or off
 MojErr
-CategoryHandler::CleanerHandler() {
+CategoryHandler::SetTraceRecording(MojServiceMessage* msg,
+				   MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceSetTraceRecording, msg);
 
-  MojLogDebug(s_log, _T("CleanerHandler: Attempting to cleanup dirTypes."));
-  m_fileCacheSet->CleanupDirTypes();
+  bool enabled = false;
+  MojErr err = payload.getRequired(_T("enabled"), enabled);
+  MojErrCheck(err);
+
+  std::string msgText;
+  const std::string& traceFile = m_fileCacheSet->GetTraceFile();
+  if (!enabled) {
+    m_traceRecorder.Stop();
+  } else if (traceFile.empty()) {
+    msgText = "SetTraceRecording: Tracing is turned off in the configuration.";
+  } else if (!m_traceRecorder.Start(traceFile,
+				    (off_t) m_fileCacheSet->GetTraceFileSize())) {
+    msgText = "SetTraceRecording: Unable to open '" + traceFile + "'.";
+  }
+
+  if (msgText.empty()) {
+    MojLogInfo(s_log, _T("SetTraceRecording: %s turned tracing %s."),
+	       CallerID(msg).c_str(), enabled ? "on" : "off");
+    MojObject reply;
+    err = reply.putBool(_T("enabled"), m_traceRecorder.isRecording());
+    MojErrCheck(err);
+    err = reply.putString(_T("pathName"), traceFile.c_str());
+    MojErrCheck(err);
+    err = reply.putInt(_T("dropped"),
+		       (MojInt64) m_traceRecorder.GetDropped());
+    MojErrCheck(err);
+    trace.SetResult(FCErrorNone);
+    err = msg->replySuccess(reply);
+  } else {
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    trace.SetResult(FCConfigurationError);
+    err = msg->replyError((MojErr) FCConfigurationError, msgText.c_str());
+  }
+  MojErrCheck(err);
 
   return MojErrNone;
 }
 
+// Reply with the wall time, in microseconds, and the number of calls
+// of each phase of starting up, and the time it took the daemon to be
+// ready to serve
 MojErr
-CategoryHandler::SetupWorkerTimer() {
+CategoryHandler::GetStartupProfile(MojServiceMessage* msg,
+				   MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetStartupProfile, msg);
 
-  g_timeout_add_seconds(15, &TimerCallback, this);
-  g_timeout_add_seconds(120, &CleanerCallback, this);
+  const CStartupProfile& profile = m_fileCacheSet->GetStartupProfile();
+  MojObject phases;
+  MojErr err = MojErrNone;
+  for (int i = 0; i < StartupNumPhases; i++) {
+    const StartupPhase phase = (StartupPhase) i;
+    MojObject obj;
+    err = obj.putString(_T("phase"), CStartupProfile::GetPhaseName(phase));
+    MojErrCheck(err);
+    err = obj.putInt(_T("us"), (MojInt64) (profile.GetTime(phase) / 1000));
+    MojErrCheck(err);
+    err = obj.putInt(_T("calls"), (MojInt64) profile.GetCount(phase));
+    MojErrCheck(err);
+    err = phases.push(obj);
+    MojErrCheck(err);
+  }
+
+  MojObject reply;
+  // The state of the last daemon was adopted if the tree wasn't walked
+  err = reply.putBool(_T("adopted"), profile.GetCount(StartupWalk) == 0);
+  MojErrCheck(err);
+  err = reply.putInt(_T("readyUs"), (MojInt64) (profile.GetReadyTime() / 1000));
+  MojErrCheck(err);
+  err = reply.put(_T("phases"), phases);
+  MojErrCheck(err);
+  trace.SetResult(FCErrorNone);
+  err = msg->replySuccess(reply);
+  MojErrCheck(err);
 
   return MojErrNone;
 }
 
-gboolean
-CategoryHandler::TimerCallback(void* data) {
+// Reply with the calls, failures and percentiles of the time taken, in
+// microseconds, of each method, of the work done on timers and of each
+// filesystem call, since the daemon started.  The filesystem calls and
+// the bytes they are estimated to have written are also counted for
+// each type, and the number of requests logged as slow is given.
+MojErr
+CategoryHandler::GetMetrics(MojServiceMessage* msg, MojObject& payload) {
 
   MojLogTrace(s_log);
+  TraceScope trace(*this, TraceGetMetrics, msg);
 
-  CategoryHandler* self = static_cast<CategoryHandler*>(data);
-  self->WorkerHandler();
+  static const char* const percentileNames[] = {
+    "p50Us", "p90Us", "p99Us", "p999Us"
+  };
+  MojObject methods;
+  MojObject tasks;
+  MojErr err = MojErrNone;
+  for (size_t i = 0; i < m_metrics.GetNumPaths(); i++) {
+    const CLatencyHistogram& histogram = m_metrics.GetHistogram(i);
+    const std::string& label = m_metrics.GetLabel(i);
+    MojObject obj;
+    err = obj.putString(label.c_str(), m_metrics.GetName(i).c_str());
+    MojErrCheck(err);
+    err = obj.putInt(_T("calls"), (MojInt64) histogram.GetCount());
+    MojErrCheck(err);
+    err = obj.putInt(_T("failures"), (MojInt64) m_metrics.GetFailures(i));
+    MojErrCheck(err);
+    err = obj.putInt(_T("totalUs"), (MojInt64) histogram.GetSum());
+    MojErrCheck(err);
+    for (size_t j = 0; j < CMetrics::s_numPercentiles; j++) {
+      err = obj.putInt(percentileNames[j],
+		       (MojInt64) histogram.GetPercentile(CMetrics::s_percentiles[j]));
+      MojErrCheck(err);
+    }
+    err = obj.putInt(_T("maxUs"), (MojInt64) histogram.GetMax());
+    MojErrCheck(err);
+    err = (label == "task") ? tasks.push(obj) : methods.push(obj);
+    MojErrCheck(err);
+  }
 
-  return true;
+  const CFsStats& fsStats = m_fileCacheSet->GetFsStats();
+  CFsCounts counts;
+  fsStats.GetCounts(counts);
+  MojObject filesystem;
+  for (int i = 0; i < FsNumOps; i++) {
+    const FsOp op = (FsOp) i;
+    const CLatencyHistogram* histogram = fsStats.GetLatency(op);
+    MojObject obj;
+    err = obj.putString(_T("op"), CFsStats::GetOpName(op));
+    MojErrCheck(err);
+    err = obj.putInt(_T("calls"), (MojInt64) counts.m_calls[i]);
+    MojErrCheck(err);
+    err = obj.putInt(_T("failures"), (MojInt64) counts.m_failures[i]);
+    MojErrCheck(err);
+    err = obj.putInt(_T("bytes"), (MojInt64) counts.m_bytes[i]);
+    MojErrCheck(err);
+    err = obj.putInt(_T("totalUs"), (MojInt64) counts.m_us[i]);
+    MojErrCheck(err);
+    for (size_t j = 0; j < CMetrics::s_numPercentiles; j++) {
+      err = obj.putInt(percentileNames[j],
+		       (MojInt64) histogram->GetPercentile(CMetrics::s_percentiles[j]));
+      MojErrCheck(err);
+    }
+    err = obj.putInt(_T("maxUs"), (MojInt64) histogram->GetMax());
+    MojErrCheck(err);
+    err = filesystem.push(obj);
+    MojErrCheck(err);
+  }
+
+  // Only the calls a type has made are listed
+  std::map<std::string, CFsCounts> typeCounts;
+  m_fileCacheSet->GetTypeFsCounts(typeCounts);
+  MojObject filesystemTypes;
+  for (std::map<std::string, CFsCounts>::const_iterator iter =
+	 typeCounts.begin(); iter != typeCounts.end(); ++iter) {
+    MojObject ops;
+    for (int i = 0; i < FsNumOps; i++) {
+      if (iter->second.m_calls[i] == 0) {
+	continue;
+      }
+      MojObject obj;
+      err = obj.putInt(_T("calls"), (MojInt64) iter->second.m_calls[i]);
+      MojErrCheck(err);
+      err = obj.putInt(_T("failures"), (MojInt64) iter->second.m_failures[i]);
+      MojErrCheck(err);
+      err = obj.putInt(_T("bytes"), (MojInt64) iter->second.m_bytes[i]);
+      MojErrCheck(err);
+      err = obj.putInt(_T("totalUs"), (MojInt64) iter->second.m_us[i]);
+      MojErrCheck(err);
+      err = ops.put(CFsStats::GetOpName((FsOp) i), obj);
+      MojErrCheck(err);
+    }
+    MojObject type;
+    err = type.putString(_T("typeName"), iter->first.c_str());
+    MojErrCheck(err);
+    err = type.put(_T("ops"), ops);
+    MojErrCheck(err);
+    err = filesystemTypes.push(type);
+    MojErrCheck(err);
+  }
+
+  // The lag of each heartbeat and the stalls, with the activities
+  // they were put down to
+  MojObject mainLoop;
+  const CLatencyHistogram* loopHistograms[] = {
+    &m_loopWatchdog.GetLag(), &m_loopWatchdog.GetStalls()
+  };
+  const char* const loopNames[] = { "lag", "stalls" };
+  for (int i = 0; i < 2; i++) {
+    MojObject obj;
+    err = obj.putInt(_T("count"), (MojInt64) loopHistograms[i]->GetCount());
+    MojErrCheck(err);
+    err = obj.putInt(_T("totalUs"), (MojInt64) loopHistograms[i]->GetSum());
+    MojErrCheck(err);
+    for (size_t j = 0; j < CMetrics::s_numPercentiles; j++) {
+      err = obj.putInt(percentileNames[j],
+		       (MojInt64) loopHistograms[i]->GetPercentile(CMetrics::s_percentiles[j]));
+      MojErrCheck(err);
+    }
+    err = obj.putInt(_T("maxUs"), (MojInt64) loopHistograms[i]->GetMax());
+    MojErrCheck(err);
+    err = mainLoop.put(loopNames[i], obj);
+    MojErrCheck(err);
+  }
+  std::map<std::string, uint64_t> stallActivities;
+  m_loopWatchdog.GetStallActivities(stallActivities);
+  MojObject activities;
+  for (std::map<std::string, uint64_t>::const_iterator iter =
+	 stallActivities.begin(); iter != stallActivities.end(); ++iter) {
+    err = activities.putInt(iter->first.c_str(), (MojInt64) iter->second);
+    MojErrCheck(err);
+  }
+  err = mainLoop.put(_T("stallActivities"), activities);
+  MojErrCheck(err);
+  std::string lastStallActivity;
+  uint64_t lastStallUs = 0;
+  m_loopWatchdog.GetLastStall(lastStallActivity, lastStallUs);
+  if (!lastStallActivity.empty()) {
+    MojObject lastStall;
+    err = lastStall.putString(_T("activity"), lastStallActivity.c_str());
+    MojErrCheck(err);
+    err = lastStall.putInt(_T("us"), (MojInt64) lastStallUs);
+    MojErrCheck(err);
+    err = mainLoop.put(_T("lastStall"), lastStall);
+    MojErrCheck(err);
+  }
+
+  MojObject reply;
+  err = reply.put(_T("methods"), methods);
+  MojErrCheck(err);
+  err = reply.put(_T("tasks"), tasks);
+  MojErrCheck(err);
+  err = reply.put(_T("filesystem"), filesystem);
+  MojErrCheck(err);
+  err = reply.put(_T("filesystemTypes"), filesystemTypes);
+  MojErrCheck(err);
+  err = reply.putInt(_T("slowRequests"),
+		     (MojInt64) m_requestTracer.GetSlowRequests());
+  MojErrCheck(err);
+  err = reply.put(_T("mainLoop"), mainLoop);
+  MojErrCheck(err);
+  trace.SetResult(FCErrorNone);
+  err = msg->replySuccess(reply);
+  MojErrCheck(err);
+
+  return MojErrNone;
 }
 
-gboolean
-CategoryHandler::CleanerCallback(void* data) {
+MojErr
+CategoryHandler::CancelWatcher(EventWatcher* watcher) {
 
   MojLogTrace(s_log);
 
-  CategoryHandler* self = static_cast<CategoryHandler*>(data);
-  self->CleanerHandler();
+  watcher->Stop();
+  MojLogInfo(s_log, _T("CancelWatcher: Removed watcher on '%s'."),
+	     watcher->GetTypeName().empty() ?
+	     "all types" : watcher->GetTypeName().c_str());
+  // This may release the last reference to watcher
+  m_watchers.erase(watcher);
 
-  // return false here as this is a one shot
-  return false;
+  return MojErrNone;
 }
 
-CategoryHandler::Subscription::Subscription(CategoryHandler& handler,
-					    MojServiceMessage* msg,
-					    MojString& pathName)
-  : m_handler(handler),
-    m_msg(msg),
-    m_pathName(pathName),
-    m_cancelSlot(this, &Subscription::HandleCancel) {
+// Give an event to every watcher of the type it belongs to, or to all
+// watchers if it isn't for a specific type.
+void
+CategoryHandler::QueueEvent(const std::string& typeName,
+			    const MojObject& event,
+			    const std::string& coalesceKey) {
 
   MojLogTrace(s_log);
 
-  msg->notifyCancel(m_cancelSlot);
+  for (EventWatcherMap::iterator it = m_watchers.begin();
+       it != m_watchers.end(); ++it) {
+    if (typeName.empty() || it->second->GetTypeName().empty() ||
+	(it->second->GetTypeName() == typeName)) {
+      it->second->AddEvent(event, coalesceKey);
+    }
+  }
 }
 
-CategoryHandler::Subscription::~Subscription() {
+// The listener calls may be on any thread that changes the cache set
+// and with its locks held, so they only record what they are told.
+// It is handled on the main loop by ListenerHandler.
+void
+CategoryHandler::ObjectExpired(const std::string& typeName,
+			       const cachedObjectId_t objId,
+			       const std::string& filename,
+			       ExpireReason reason) {
 
   MojLogTrace(s_log);
+
+  m_traceRecorder.Record(TraceObjectExpired, objId, typeName, 0, 0,
+			 (int) reason);
+  ListenerEvent event(ListenerEvent::Expired, typeName);
+  event.m_objId = objId;
+  event.m_filename = filename;
+  event.m_change = (int) reason;
+  RecordListenerEvent(event);
 }
 
-MojErr
-CategoryHandler::Subscription::HandleCancel(MojServiceMessage* msg) {
+void
+CategoryHandler::TypeModified(const std::string& typeName,
+			      TypeChange change) {
 
   MojLogTrace(s_log);
 
-  return m_handler.CancelSubscription(this, msg, m_pathName);
+  ListenerEvent event(ListenerEvent::Modified, typeName);
+  event.m_change = (int) change;
+  RecordListenerEvent(event);
+}
+
+// An expired object is left for the worker to remove
+void
+CategoryHandler::ObjectOrphaned(const std::string& typeName,
+				const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  m_orphansReported = true;
+  SetupListenerCallback();
+}
+
+// An object has a maximum age deadline earlier than the age timer
+void
+CategoryHandler::AgingScheduled(time_t due) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  if ((m_agingDue == 0) || (due < m_agingDue)) {
+    m_agingDue = due;
+  }
+  SetupListenerCallback();
+}
+
+// The creates, opens and writes completed by the I/O workers
+void
+CategoryHandler::ObjectCreated(const std::string& typeName,
+			       const cachedObjectId_t objId, bool created) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  m_createdObjects.push_back(std::make_pair(objId, created));
+  SetupListenerCallback();
+}
+
+void
+CategoryHandler::ObjectOpened(const std::string& typeName,
+			      const cachedObjectId_t objId, bool opened) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  m_openedObjects.push_back(std::make_pair(objId, opened));
+  SetupListenerCallback();
+}
+
+void
+CategoryHandler::ObjectWritten(const std::string& typeName,
+			       const cachedObjectId_t objId, bool written) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  m_writtenObjects.push_back(objId);
+  SetupListenerCallback();
+}
+
+void
+CategoryHandler::ThresholdCrossed(const std::string& typeName,
+				  CacheThreshold threshold, bool above,
+				  cacheSize_t size) {
+
+  MojLogTrace(s_log);
+
+  ListenerEvent event(ListenerEvent::Threshold, typeName);
+  event.m_change = (int) threshold;
+  event.m_above = above;
+  event.m_size = size;
+  RecordListenerEvent(event);
+}
+
+void
+CategoryHandler::RecordListenerEvent(const ListenerEvent& event) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+  m_listenerEvents.push_back(event);
+  SetupListenerCallback();
+}
+
+// Build the event a listener call reported and give it to the
+// watchers.  Called on the main loop.
+void
+CategoryHandler::HandleListenerEvent(const ListenerEvent& event) {
+
+  MojLogTrace(s_log);
+
+  if (m_watchers.empty()) {
+    return;
+  }
+
+  static const char* const changes[] = { "typeDefined", "typeChanged",
+					 "typeDeleted" };
+  static const char* const thresholds[] = { "loWatermark", "hiWatermark",
+					    "totalCacheSpace" };
+  const std::string& typeName = event.m_typeName;
+  MojObject watcherEvent;
+  MojErr err = MojErrNone;
+  std::string coalesceKey;
+  if (event.m_kind == ListenerEvent::Expired) {
+    err = watcherEvent.putString(_T("event"), _T("expired"));
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("typeName"), typeName.c_str());
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("pathName"),
+				   BuildPathname(event.m_objId,
+						 m_fileCacheSet->GetBaseDirName(),
+						 typeName,
+						 event.m_filename).c_str());
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("fileName"), event.m_filename.c_str());
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("reason"),
+				   s_expireReasonNames[event.m_change]);
+    }
+  } else if (event.m_kind == ListenerEvent::Modified) {
+    err = watcherEvent.putString(_T("event"), changes[event.m_change]);
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("typeName"), typeName.c_str());
+    }
+  } else {
+    err = watcherEvent.putString(_T("event"), _T("threshold"));
+    if ((err == MojErrNone) && !typeName.empty()) {
+      err = watcherEvent.putString(_T("typeName"), typeName.c_str());
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putString(_T("threshold"),
+				   thresholds[event.m_change]);
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putBool(_T("above"), event.m_above);
+    }
+    if (err == MojErrNone) {
+      err = watcherEvent.putInt(_T("size"), (MojInt64) event.m_size);
+    }
+    // Only the latest crossing of a threshold within an interval is
+    // interesting
+    coalesceKey = typeName + "/" + thresholds[event.m_change];
+  }
+  if (err == MojErrNone) {
+    QueueEvent(typeName, watcherEvent, coalesceKey);
+  } else {
+    MojLogError(s_log,
+		_T("HandleListenerEvent: Failed to build event for '%s'."),
+		typeName.c_str());
+  }
+}
+
+// Remove the orphans, resolve lookups left waiting and validate the
+// objects still being written.  Returns how many of these are left.
+size_t
+CategoryHandler::WorkerHandler() {
+
+  MojLogTrace(s_log);
+
+  MojLogDebug(s_log, _T("WorkerHandler: Attempting to cleanup any orphans."));
+  const int numOrphans = m_fileCacheSet->CleanupOrphans();
+
+  // Objects that lookups are waiting on may have been cleaned up
+  // without the writer ever letting go
+  std::set<cachedObjectId_t> resolved;
+  for (PendingLookupMap::iterator it = m_pendingLookups.begin();
+       it != m_pendingLookups.end(); ++it) {
+    if (!m_fileCacheSet->isObjectBeingWritten(m_fileCacheSet->GetTypeForObjectId(it->first),
+					      it->first)) {
+      resolved.insert(it->first);
+    }
+  }
+  for (std::set<cachedObjectId_t>::const_iterator it = resolved.begin();
+       it != resolved.end(); ++it) {
+    ResolvePendingLookups(*it);
+  }
+  FailStalledLookups();
+
+  // For each subscribed object that is still being written, do a
+  // validity check.  Objects that have since been written no longer
+  // need checking.
+  std::set<cachedObjectId_t>::iterator it = m_unwrittenObjects.begin();
+  while (it != m_unwrittenObjects.end()) {
+    const cachedObjectId_t objId = *it;
+    ObjectSubscriptionMap::const_iterator sub =
+      m_objectSubscribers.find(objId);
+    if (sub == m_objectSubscribers.end()) {
+      m_unwrittenObjects.erase(it++);
+      continue;
+    }
+    const std::string& typeName = sub->second->GetTypeName();
+    MojLogDebug(s_log, _T("WorkerHandler: Validating subscribed object '%s'."),
+		sub->second->GetPathName().data());
+    m_fileCacheSet->CheckSubscribedObject(typeName, objId);
+    if (!m_fileCacheSet->isObjectBeingWritten(typeName, objId)) {
+      m_unwrittenObjects.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  return (size_t) numOrphans + m_pendingLookups.size() +
+    m_unwrittenObjects.size();
+}
+
+MojErr
+CategoryHandler::CleanerHandler() {
+
+  MojLogTrace(s_log);
+
+  MojLogDebug(s_log, _T("CleanerHandler: Attempting to cleanup dirTypes."));
+  m_fileCacheSet->CleanupDirTypes();
+
+  return MojErrNone;
+}
+
+// Run the worker soon now that there is new work for it, unless it
+// is already about to run
+void
+CategoryHandler::SetupWorkerTimer() {
+
+  MojLogTrace(s_log);
+
+  if ((m_workerTimer != 0) && (m_workerInterval == s_minWorkerInterval)) {
+    return;
+  }
+  if (m_workerTimer != 0) {
+    g_source_remove(m_workerTimer);
+  }
+  m_workerInterval = s_minWorkerInterval;
+  m_workerBacklog = 0;
+  m_workerTimer = g_timeout_add_seconds(m_workerInterval, &TimerCallback,
+					this);
+}
+
+// The worker runs again only if work is left, at the shortest interval
+// while the work left is shrinking and backing off while it isn't
+gboolean
+CategoryHandler::TimerCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("worker");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  self->m_workerTimer = 0;
+  const uint64_t start = CMetrics::Now();
+  const size_t backlog = self->WorkerHandler();
+  self->m_metrics.Record(self->m_workerMetrics, CMetrics::Now() - start,
+			 false);
+  if (backlog == 0) {
+    MojLogDebug(s_log, _T("TimerCallback: No work left, worker stopped."));
+  } else {
+    if ((self->m_workerBacklog > 0) && (backlog < self->m_workerBacklog)) {
+      self->m_workerInterval = s_minWorkerInterval;
+    } else {
+      self->m_workerInterval = std::min(self->m_workerInterval * 2,
+					s_maxWorkerInterval);
+    }
+    self->m_workerBacklog = backlog;
+    self->m_workerTimer = g_timeout_add_seconds(self->m_workerInterval,
+						&TimerCallback, self);
+  }
+
+  return false;
+}
+
+// Run the age timer at due, unless it is already due to run by then
+void
+CategoryHandler::SetupAgeTimer(time_t due) {
+
+  MojLogTrace(s_log);
+
+  if ((m_ageTimer != 0) && (m_ageTimerDue <= due)) {
+    return;
+  }
+  if (m_ageTimer != 0) {
+    g_source_remove(m_ageTimer);
+  }
+  const time_t now = ::time(0);
+  const guint interval = (due > now) ? (guint) (due - now) : 0;
+  m_ageTimerDue = due;
+  m_ageTimer = g_timeout_add_seconds(interval, &AgeTimerCallback, this);
+}
+
+// Expire the objects past their maximum age and run again when the
+// next one is due
+gboolean
+CategoryHandler::AgeTimerCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("expireAged");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  self->m_ageTimer = 0;
+  const uint64_t start = CMetrics::Now();
+  self->m_fileCacheSet->ExpireAgedObjects(::time(0));
+  self->m_metrics.Record(self->m_ageMetrics, CMetrics::Now() - start, false);
+  const time_t due = self->m_fileCacheSet->NextAgingDue();
+  if (due != 0) {
+    self->SetupAgeTimer(due);
+  }
+
+  return false;
+}
+
+gboolean
+CategoryHandler::CleanerCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("cleaner");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  const uint64_t start = CMetrics::Now();
+  const MojErr err = self->CleanerHandler();
+  self->m_metrics.Record(self->m_cleanerMetrics, CMetrics::Now() - start,
+			 err != MojErrNone);
+
+  // return false here as this is a one shot
+  return false;
+}
+
+// Write the metrics out for whatever collects them
+gboolean
+CategoryHandler::MetricsCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("metrics");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  const std::string& metricsFile = self->m_fileCacheSet->GetMetricsFile();
+  std::map<std::string, CFsCounts> typeCounts;
+  self->m_fileCacheSet->GetTypeFsCounts(typeCounts);
+  std::string extraText;
+  FormatFsPrometheus(self->m_fileCacheSet->GetFsStats(), typeCounts,
+		     extraText);
+  if (self->m_loopWatchdog.isStarted()) {
+    self->m_loopWatchdog.FormatPrometheus(extraText);
+  }
+  if (!self->m_metrics.WritePrometheus(metricsFile, extraText)) {
+    MojLogWarning(s_log, _T("MetricsCallback: Unable to write '%s'."),
+		  metricsFile.c_str());
+  }
+
+  return true;
+}
+
+// Tell the watchdog the main loop is running
+gboolean
+CategoryHandler::HeartbeatCallback(void* data) {
+
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  self->m_loopWatchdog.Beat();
+
+  return true;
+}
+
+// The file for a new object has been created, or has failed to be, so
+// the insert waiting on it can reply.  Lookups for the same key that
+// arrived meanwhile are retried.
+MojErr
+CategoryHandler::HandleObjectCreated(const cachedObjectId_t objId,
+				     bool created) {
+
+  MojLogTrace(s_log);
+
+  PendingInsertMap::iterator it = m_pendingInserts.find(objId);
+  if (it != m_pendingInserts.end()) {
+    PendingInsertPtr insert(it->second);
+    m_pendingInserts.erase(it);
+    CRequestScope scope(insert->GetRequest());
+    MojErr err = MojErrNone;
+    if (!created) {
+      std::string msgText((insert->isLookup() ? "LookupOrInsertCacheObject" :
+			   "InsertCacheObject"));
+      msgText += ": Failed to initialize new object for '" +
+	insert->GetFileName() + "'.";
+      MojLogError(s_log, _T("%s"), msgText.c_str());
+      err = insert->GetMessage()->replyError((MojErr) FCExistsError,
+					     msgText.c_str());
+    } else if (insert->isLookup()) {
+      err = SubscribeLookup(insert->GetMessage(), objId,
+			    insert->GetTypeName(), true, false);
+    } else {
+      err = ReplyInsert(insert->GetMessage(), objId, insert->GetTypeName(),
+			insert->GetFileName(), insert->isSubscribed());
+    }
+    if (err != MojErrNone) {
+      MojLogError(s_log,
+		  _T("HandleObjectCreated: Failed to reply for object '%llu'."),
+		  objId);
+    }
+  }
+  if (m_pendingLookups.find(objId) != m_pendingLookups.end()) {
+    ResolvePendingLookups(objId);
+  }
+
+  return MojErrNone;
+}
+
+// The file of an object has been made writable for its writer, or has
+// failed to be, so the reply to the writer can be sent
+MojErr
+CategoryHandler::HandleObjectOpened(const cachedObjectId_t objId,
+				    bool opened) {
+
+  MojLogTrace(s_log);
+
+  std::pair<ObjectSubscriptionMap::iterator,
+	    ObjectSubscriptionMap::iterator> range =
+    m_objectSubscribers.equal_range(objId);
+  for (ObjectSubscriptionMap::iterator it = range.first;
+       it != range.second; ++it) {
+    if (it->second->isOpening()) {
+      MojErr err = it->second->NotifyOpened(opened);
+      if (err != MojErrNone) {
+	MojLogError(s_log,
+		    _T("HandleObjectOpened: Failed to reply for object '%llu'."),
+		    objId);
+      }
+    }
+  }
+
+  return MojErrNone;
+}
+
+// The writer of an object has let go and the file has been synced,
+// or the object has failed.  Streaming readers are told the object is
+// complete and lookups waiting on the writer can now proceed.
+MojErr
+CategoryHandler::HandleObjectWritten(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  if (m_streamedObjects.find(objId) != m_streamedObjects.end()) {
+    NotifyStreamReaders(objId);
+  }
+  if (m_pendingLookups.find(objId) != m_pendingLookups.end()) {
+    ResolvePendingLookups(objId);
+  }
+
+  return MojErrNone;
+}
+
+// Called with the listener lock held.  Adding an idle source is safe
+// from any thread.
+void
+CategoryHandler::SetupListenerCallback() {
+
+  MojLogTrace(s_log);
+
+  if (m_listenerIdle == 0) {
+    m_listenerIdle = g_idle_add(&ListenerCallback, this);
+  }
+}
+
+// Handle what the listener calls recorded since the last callback
+MojErr
+CategoryHandler::ListenerHandler() {
+
+  MojLogTrace(s_log);
+
+  // Handling these may complete more I/O in line, which is recorded
+  // for the next callback
+  std::vector<std::pair<cachedObjectId_t, bool> > created;
+  std::vector<std::pair<cachedObjectId_t, bool> > opened;
+  std::vector<cachedObjectId_t> written;
+  std::vector<ListenerEvent> events;
+  bool orphans = false;
+  time_t agingDue = 0;
+  {
+    CCacheMutexGuard guard(m_listenerLock);
+    m_listenerIdle = 0;
+    created.swap(m_createdObjects);
+    opened.swap(m_openedObjects);
+    written.swap(m_writtenObjects);
+    events.swap(m_listenerEvents);
+    orphans = m_orphansReported;
+    m_orphansReported = false;
+    agingDue = m_agingDue;
+    m_agingDue = 0;
+  }
+
+  if (orphans) {
+    SetupWorkerTimer();
+  }
+  if (agingDue != 0) {
+    SetupAgeTimer(agingDue);
+  }
+  for (std::vector<ListenerEvent>::const_iterator it = events.begin();
+       it != events.end(); ++it) {
+    HandleListenerEvent(*it);
+  }
+  for (std::vector<std::pair<cachedObjectId_t, bool> >::const_iterator it =
+	 created.begin(); it != created.end(); ++it) {
+    HandleObjectCreated(it->first, it->second);
+  }
+  for (std::vector<std::pair<cachedObjectId_t, bool> >::const_iterator it =
+	 opened.begin(); it != opened.end(); ++it) {
+    HandleObjectOpened(it->first, it->second);
+  }
+  for (std::vector<cachedObjectId_t>::const_iterator it = written.begin();
+       it != written.end(); ++it) {
+    HandleObjectWritten(*it);
+  }
+
+  return MojErrNone;
+}
+
+gboolean
+CategoryHandler::ListenerCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("listener");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  self->ListenerHandler();
+
+  return false;
+}
+
+// Start polling objects with streaming readers if not already doing
+// so.  The timer stops itself once there are no more streamed objects.
+void
+CategoryHandler::SetupStreamTimer() {
+
+  MojLogTrace(s_log);
+
+  if (m_streamTimer == 0) {
+    m_streamTimer = g_timeout_add(s_streamPollInterval, &StreamCallback, this);
+  }
+}
+
+// How much of each streamed object has been written is read on the
+// I/O workers, and the readers are told once it has been
+MojErr
+CategoryHandler::StreamHandler() {
+
+  MojLogTrace(s_log);
+
+  // Notifying may remove the object from the set so walk a copy
+  const std::set<cachedObjectId_t> streamedObjects(m_streamedObjects);
+  for (std::set<cachedObjectId_t>::const_iterator it = streamedObjects.begin();
+       it != streamedObjects.end(); ++it) {
+    NotifyStreamReaders(*it);
+  }
+
+  return MojErrNone;
+}
+
+gboolean
+CategoryHandler::StreamCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("stream");
+  CategoryHandler* self = static_cast<CategoryHandler*>(data);
+  self->StreamHandler();
+  if (self->m_streamedObjects.empty()) {
+    self->m_streamTimer = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// Once an object is no longer being written, its streaming readers
+// get a final notification with the size it was written at and the
+// object is no longer tracked, as it also isn't once all of its
+// streaming readers have gone.  Otherwise how much is now available
+// is read on an I/O worker and BytesAvailableRead tells the readers.
+MojErr
+CategoryHandler::NotifyStreamReaders(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  std::pair<ObjectSubscriptionMap::iterator,
+	    ObjectSubscriptionMap::iterator> range =
+    m_objectSubscribers.equal_range(objId);
+  if (range.first == range.second) {
+    m_streamedObjects.erase(objId);
+
+    return MojErrNone;
+  }
+
+  const std::string& typeName = range.first->second->GetTypeName();
+  if (m_fileCacheSet->isObjectBeingWritten(typeName, objId)) {
+    ReadBytesAvailable(objId);
+
+    return MojErrNone;
+  }
+
+  const cacheSize_t size = m_fileCacheSet->CachedObjectSize(objId);
+  for (ObjectSubscriptionMap::iterator it = range.first;
+       it != range.second; ++it) {
+    Subscription* sub = it->second;
+    if (sub->isStreaming() && !sub->isComplete()) {
+      sub->NotifyComplete(size >= 0, size);
+    }
+  }
+  m_streamedObjects.erase(objId);
+
+  return MojErrNone;
+}
+
+// The most any streaming reader of an object has been told is
+// available, which is where a new reader starts
+cacheSize_t
+CategoryHandler::GetBytesReported(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  cacheSize_t bytesReported = 0;
+  std::pair<ObjectSubscriptionMap::iterator,
+	    ObjectSubscriptionMap::iterator> range =
+    m_objectSubscribers.equal_range(objId);
+  for (ObjectSubscriptionMap::iterator it = range.first;
+       it != range.second; ++it) {
+    if (it->second->isStreaming()) {
+      bytesReported = std::max(bytesReported, it->second->GetBytesReported());
+    }
+  }
+
+  return bytesReported;
+}
+
+// The jobs are completed on the main loop, and those still pending
+// when the workers are stopped are completed then, before the handler
+// goes away
+class CategoryHandler::BytesAvailableJob : public CIOJob {
+ public:
+  BytesAvailableJob(CategoryHandler& handler, const cachedObjectId_t objId,
+		    const std::string& pathname)
+    : CIOJob(pathname), m_handler(handler), m_objId(objId),
+      m_bytesAvailable(-1) {}
+
+  void Run() {
+    m_bytesAvailable = CCacheObject::GetBytesAvailable(m_pathname);
+  }
+  void Complete() { m_handler.BytesAvailableRead(m_objId, m_bytesAvailable); }
+
+ private:
+  CategoryHandler& m_handler;
+  const cachedObjectId_t m_objId;
+  cacheSize_t m_bytesAvailable;
+};
+
+// Start reading how much of an object has been written, unless that
+// is already under way
+void
+CategoryHandler::ReadBytesAvailable(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  if (m_bytesPending.find(objId) != m_bytesPending.end()) {
+    return;
+  }
+  const std::string typeName(m_fileCacheSet->GetTypeForObjectId(objId));
+  const std::string fileName(m_fileCacheSet->CachedObjectFilename(objId));
+  if (typeName.empty() || fileName.empty()) {
+    // Expired, the readers and lookups are told once the writer lets go
+    return;
+  }
+  m_bytesPending.insert(objId);
+  m_fileCacheSet->SubmitIO(new BytesAvailableJob(*this, objId,
+						 BuildPathname(objId,
+							       m_fileCacheSet->GetBaseDirName(),
+							       typeName,
+							       fileName)));
+}
+
+// Tell the lookups waiting on the writer of an object, and its
+// streaming readers, how much of it has been written.  The readers of
+// an object the writer has finished with meanwhile get their final
+// notification instead.
+MojErr
+CategoryHandler::BytesAvailableRead(const cachedObjectId_t objId,
+				    cacheSize_t bytesAvailable) {
+
+  MojLogTrace(s_log);
+
+  m_bytesPending.erase(objId);
+  MojLogDebug(s_log,
+	      _T("BytesAvailableRead: Object '%llu' has '%d' bytes available."),
+	      objId, bytesAvailable);
+
+  std::pair<PendingLookupMap::iterator, PendingLookupMap::iterator> lookups =
+    m_pendingLookups.equal_range(objId);
+  for (PendingLookupMap::iterator it = lookups.first;
+       it != lookups.second; ++it) {
+    it->second->NotifyProgress(bytesAvailable);
+  }
+
+  if (m_streamedObjects.find(objId) == m_streamedObjects.end()) {
+    return MojErrNone;
+  }
+  std::pair<ObjectSubscriptionMap::iterator,
+	    ObjectSubscriptionMap::iterator> range =
+    m_objectSubscribers.equal_range(objId);
+  if ((range.first == range.second) ||
+      !m_fileCacheSet->isObjectBeingWritten(range.first->second->GetTypeName(),
+					    objId)) {
+    return NotifyStreamReaders(objId);
+  }
+
+  const time_t now = ::time(0);
+  bool waiting = false;
+  for (ObjectSubscriptionMap::iterator it = range.first;
+       it != range.second; ++it) {
+    Subscription* sub = it->second;
+    if (sub->isStreaming() && !sub->isComplete()) {
+      sub->NotifyProgress(bytesAvailable);
+      if (sub->isStalled(now)) {
+	sub->NotifyStalled();
+      } else {
+	waiting = true;
+      }
+    }
+  }
+  if (!waiting) {
+    m_streamedObjects.erase(objId);
+  }
+
+  return MojErrNone;
+}
+
+CategoryHandler::Subscription::Subscription(CategoryHandler& handler,
+					    MojServiceMessage* msg,
+					    MojString& pathName,
+					    const cachedObjectId_t objId,
+					    const std::string& typeName,
+					    bool streaming,
+					    cacheSize_t bytesAvailable)
+  : m_handler(handler),
+    m_msg(msg),
+    m_pathName(pathName),
+    m_objId(objId),
+    m_typeName(typeName),
+    m_streaming(streaming),
+    m_complete(false),
+    m_bytesReported((streaming && (bytesAvailable > 0)) ? bytesAvailable : 0),
+    m_progressTime(::time(0)),
+    m_opening(false),
+    m_cancelSlot(this, &Subscription::HandleCancel) {
+
+  MojLogTrace(s_log);
+
+  msg->notifyCancel(m_cancelSlot);
+}
+
+CategoryHandler::Subscription::~Subscription() {
+
+  MojLogTrace(s_log);
+}
+
+MojErr
+CategoryHandler::Subscription::HandleCancel(MojServiceMessage* msg) {
+
+  MojLogTrace(s_log);
+
+  return m_handler.CancelSubscription(this, msg, m_pathName);
+}
+
+CategoryHandler::EventWatcher::EventWatcher(CategoryHandler& handler,
+					    MojServiceMessage* msg,
+					    const std::string& typeName,
+					    guint interval)
+  : m_handler(handler),
+    m_msg(msg),
+    m_typeName(typeName),
+    m_interval(interval),
+    m_timer(0),
+    m_dropped(0),
+    m_cancelSlot(this, &EventWatcher::HandleCancel) {
+
+  MojLogTrace(s_log);
+
+  msg->notifyCancel(m_cancelSlot);
+}
+
+CategoryHandler::EventWatcher::~EventWatcher() {
+
+  MojLogTrace(s_log);
+
+  Stop();
+}
+
+// Queue an event and start the interval timer if this is the first
+// event since the last flush.
+void
+CategoryHandler::EventWatcher::AddEvent(const MojObject& event,
+					const std::string& coalesceKey) {
+
+  MojLogTrace(s_log);
+
+  if (!coalesceKey.empty()) {
+    m_coalesced[coalesceKey] = event;
+  } else if (m_events.size() < s_maxQueuedEvents) {
+    m_events.push_back(event);
+  } else {
+    m_dropped++;
+  }
+  if (m_timer == 0) {
+    m_timer = g_timeout_add(m_interval, &FlushCallback, this);
+  }
+}
+
+// Send everything queued since the last flush in a single reply
+MojErr
+CategoryHandler::EventWatcher::Flush() {
+
+  MojLogTrace(s_log);
+
+  MojObject events(MojObject::TypeArray);
+  MojErr err = MojErrNone;
+  for (std::vector<MojObject>::const_iterator it = m_events.begin();
+       it != m_events.end(); ++it) {
+    err = events.push(*it);
+    MojErrCheck(err);
+  }
+  for (std::map<std::string, MojObject>::const_iterator it = m_coalesced.begin();
+       it != m_coalesced.end(); ++it) {
+    err = events.push(it->second);
+    MojErrCheck(err);
+  }
+
+  MojObject reply;
+  err = reply.put(_T("events"), events);
+  MojErrCheck(err);
+  if (m_dropped > 0) {
+    err = reply.putInt(_T("dropped"), (MojInt64) m_dropped);
+    MojErrCheck(err);
+    MojLogWarning(s_log, _T("Flush: Dropped '%zu' events for '%s'."),
+		  m_dropped, m_typeName.c_str());
+  }
+  m_events.clear();
+  m_coalesced.clear();
+  m_dropped = 0;
+  err = m_msg->replySuccess(reply);
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+void
+CategoryHandler::EventWatcher::Stop() {
+
+  MojLogTrace(s_log);
+
+  if (m_timer != 0) {
+    g_source_remove(m_timer);
+    m_timer = 0;
+  }
+}
+
+gboolean
+CategoryHandler::EventWatcher::FlushCallback(void* data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("flushEvents");
+  EventWatcher* self = static_cast<EventWatcher*>(data);
+  self->m_timer = 0;
+  self->Flush();
+
+  return false;
+}
+
+MojErr
+CategoryHandler::EventWatcher::HandleCancel(MojServiceMessage* msg) {
+
+  MojLogTrace(s_log);
+
+  return m_handler.CancelWatcher(this);
+}
+
+CategoryHandler::PendingInsert::PendingInsert(CategoryHandler& handler,
+					      MojServiceMessage* msg,
+					      const cachedObjectId_t objId,
+					      const std::string& typeName,
+					      const std::string& fileName,
+					      bool subscribed, bool lookup)
+  : m_handler(handler),
+    m_msg(msg),
+    m_objId(objId),
+    m_typeName(typeName),
+    m_fileName(fileName),
+    m_subscribed(subscribed),
+    m_lookup(lookup),
+    m_request(CRequestTrace::GetCurrent()),
+    m_cancelSlot(this, &PendingInsert::HandleCancel) {
+
+  MojLogTrace(s_log);
+
+  if (m_request != NULL) {
+    m_request->AddRef();
+  }
+  msg->notifyCancel(m_cancelSlot);
+}
+
+CategoryHandler::PendingInsert::~PendingInsert() {
+
+  MojLogTrace(s_log);
+
+  if (m_request != NULL) {
+    m_request->Release();
+  }
+}
+
+MojErr
+CategoryHandler::PendingInsert::HandleCancel(MojServiceMessage* msg) {
+
+  MojLogTrace(s_log);
+
+  return m_handler.CancelPendingInsert(this);
+}
+
+CategoryHandler::PendingLookup::PendingLookup(CategoryHandler& handler,
+					      MojServiceMessage* msg,
+					      MojObject& payload,
+					      const cachedObjectId_t objId)
+  : m_handler(handler),
+    m_msg(msg),
+    m_payload(payload),
+    m_objId(objId),
+    m_bytesSeen(0),
+    m_progressTime(::time(0)),
+    m_cancelSlot(this, &PendingLookup::HandleCancel) {
+
+  MojLogTrace(s_log);
+
+  msg->notifyCancel(m_cancelSlot);
+}
+
+CategoryHandler::PendingLookup::~PendingLookup() {
+
+  MojLogTrace(s_log);
+}
+
+MojErr
+CategoryHandler::PendingLookup::HandleCancel(MojServiceMessage* msg) {
+
+  MojLogTrace(s_log);
+
+  return m_handler.CancelPendingLookup(this);
+}
+
+// Note the bytes the writer has written, and when it last wrote more
+void
+CategoryHandler::PendingLookup::NotifyProgress(cacheSize_t bytesAvailable) {
+
+  if (bytesAvailable > m_bytesSeen) {
+    m_bytesSeen = bytesAvailable;
+    m_progressTime = ::time(0);
+  }
+}
+
+// Send the reader the number of bytes now available if the object has
+// grown since the last notification.
+MojErr
+CategoryHandler::Subscription::NotifyProgress(cacheSize_t bytesAvailable) {
+
+  MojLogTrace(s_log);
+
+  if (bytesAvailable > m_bytesReported) {
+    m_bytesReported = bytesAvailable;
+    m_progressTime = ::time(0);
+    MojObject reply;
+    MojErr err = reply.putInt(_T("bytesAvailable"), (MojInt64) bytesAvailable);
+    MojErrCheck(err);
+    err = reply.putBool(_T("complete"), false);
+    MojErrCheck(err);
+    err = m_msg->replySuccess(reply);
+    MojErrCheck(err);
+  }
+
+  return MojErrNone;
+}
+
+// Send the reader the final notification once the writer is done.  If
+// the object could not be written the reader gets an error instead.
+MojErr
+CategoryHandler::Subscription::NotifyComplete(bool written,
+					      cacheSize_t bytesAvailable) {
+
+  MojLogTrace(s_log);
+
+  MojErr err = MojErrNone;
+  m_complete = true;
+  if (written) {
+    MojObject reply;
+    err = reply.putInt(_T("bytesAvailable"),
+		       (MojInt64) ((bytesAvailable > 0) ? bytesAvailable : 0));
+    MojErrCheck(err);
+    err = reply.putBool(_T("complete"), true);
+    MojErrCheck(err);
+    err = m_msg->replySuccess(reply);
+  } else {
+    std::string msgText("SubscribeCacheObject: Object '");
+    msgText += m_pathName.data();
+    msgText += "' was not completely written";
+    MojLogWarning(s_log, _T("%s"), msgText.c_str());
+    err = m_msg->replyError((MojErr) FCExistsError, msgText.c_str());
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+void
+CategoryHandler::Subscription::SetPendingReply(const std::string& method,
+					       const MojObject& reply) {
+
+  MojLogTrace(s_log);
+
+  m_opening = true;
+  m_method = method;
+  m_pendingReply = reply;
+}
+
+// Send the writer the reply held back until its file was made
+// writable.  If that failed, the object has expired and the writer
+// gets an error instead, but holds its subscription until it lets go.
+MojErr
+CategoryHandler::Subscription::NotifyOpened(bool opened) {
+
+  MojLogTrace(s_log);
+
+  m_opening = false;
+  MojErr err = MojErrNone;
+  if (opened) {
+    err = m_msg->replySuccess(m_pendingReply);
+  } else {
+    std::string msgText(m_method);
+    msgText += ": Failed to make object '";
+    msgText += m_pathName.data();
+    msgText += "' writable";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+    err = m_msg->replyError((MojErr) FCExistsError, msgText.c_str());
+  }
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+// Fail the reader of an object whose writer has stopped writing.  The
+// reader still holds its subscription until it lets go.
+MojErr
+CategoryHandler::Subscription::NotifyStalled() {
+
+  MojLogTrace(s_log);
+
+  m_complete = true;
+  std::string msgText("SubscribeCacheObject: Timed out waiting for object '");
+  msgText += m_pathName.data();
+  msgText += "' to be written";
+  MojLogWarning(s_log, _T("%s"), msgText.c_str());
+  MojErr err = m_msg->replyError((MojErr) FCInUseError, msgText.c_str());
+  MojErrCheck(err);
+
+  return MojErrNone;
+}
+
+CategoryHandler::TraceScope::TraceScope(CategoryHandler& handler,
+				       TraceOp op, MojServiceMessage* msg)
+  : m_handler(handler),
+    m_op(op),
+    m_active(handler.m_traceRecorder.isRecording()),
+    m_caller(0),
+    m_objId(0),
+    m_size(0),
+    m_result(s_traceNoReply),
+    m_start(CMetrics::Now()),
+    m_request(handler.m_requestTracer.Begin(
+		handler.m_metrics.GetName(handler.m_opMetrics[op]).c_str())),
+    m_requestScope(m_request),
+    m_activity(handler.m_metrics.GetName(handler.m_opMetrics[op]).c_str()) {
+
+  // Nothing is looked up unless the request will be recorded
+  if (m_active) {
+    m_caller = CTraceRecorder::Hash(handler.CallerID(msg));
+  }
+}
+
+CategoryHandler::TraceScope::~TraceScope() {
+
+  const bool failed = (m_result != FCErrorNone) &&
+    (m_result != s_traceInserted);
+  m_handler.m_metrics.Record(m_handler.m_opMetrics[m_op],
+			     CMetrics::Now() - m_start, failed);
+  if (m_active) {
+    m_handler.m_traceRecorder.Record(m_op, m_objId, m_typeName, m_size,
+				     m_caller, m_result);
+  }
+  if (m_request != NULL) {
+    m_request->Release();
+  }
+}
+
+void
+CategoryHandler::TraceScope::SetType(const char* typeName) {
+
+  if (m_active) {
+    m_typeName = typeName;
+  }
+}
+
+// A negative size is looked up in the cache set
+void
+CategoryHandler::TraceScope::SetObject(const cachedObjectId_t objId,
+				       const std::string& typeName,
+				       cacheSize_t size) {
+
+  if (m_active) {
+    m_objId = objId;
+    m_typeName = typeName;
+    m_size = (size >= 0) ? size :
+      m_handler.m_fileCacheSet->CachedObjectSize(objId);
+  }
+}
+
+// Take the object id and type from the pathname of an object
+void
+CategoryHandler::TraceScope::SetPath(const char* pathName, cacheSize_t size) {
+
+  if (m_active) {
+    const cachedObjectId_t objId = GetObjectIdFromPath(pathName);
+    SetObject(objId,
+	      GetTypeNameFromPath(m_handler.m_fileCacheSet->GetBaseDirName(),
+				  pathName),
+	      (objId > 0) ? size : 0);
+  }
 }
 
 MojErr
 CategoryHandler::CopyFile(MojServiceMessage* msg,
 			  const std::string& source,
-			  const std::string& destination) {
+			  const std::string& destination,
+			  const std::string& typeName, cacheSize_t size) {
 
   MojLogTrace(s_log);
 
   MojErr err = MojErrNone;
 
-  CAsyncCopier* c = new CAsyncCopier(source, destination, msg);
+  CAsyncCopier* c =
+    new CAsyncCopier(source, destination, msg,
+		     m_fileCacheSet->GetTypeFsStats(typeName),
+		     (size > 0) ? (uint64_t) size : 0);
   c->StartCopy();
 
   return err;
@@ -21,26 +21,104 @@ LICENSE@@@ */
 
 #include "CacheBase.h"
 #include "FileCacheSet.h"
+#include "LoopWatchdog.h"
+#include "Metrics.h"
+#include "TraceRecorder.h"
 #include "core/MojService.h"
 #include "luna/MojLunaMessage.h"
 #include "glib.h"
+#include "boost/unordered_map.hpp"
+#include <map>
+#include <set>
 #include <vector>
 
 static const std::string s_InterfaceVersion("1.0");
 
-class CategoryHandler : public MojService::CategoryHandler {
+// How often, in milliseconds, objects with streaming readers are
+// checked for newly written data
+static const guint s_streamPollInterval = 250;
+
+// How long, in seconds, lookups and streaming readers wait on the
+// writer of an object that writes nothing more before they are failed
+static const time_t s_writerWaitTimeout = 120;
+
+// The shortest and longest time, in seconds, between runs of the
+// worker that removes orphans and checks objects being written.  It
+// only runs while there is such work, and backs off while it makes
+// no progress.
+static const guint s_minWorkerInterval = 1;
+static const guint s_maxWorkerInterval = 15;
+
+// The range and default, in milliseconds, for how long cache events
+// are collected before being sent to a watcher, and the most events
+// sent at once.  Events beyond that are only counted.
+static const MojInt64 s_minEventInterval = 100;
+static const MojInt64 s_maxEventInterval = 60000;
+static const MojInt64 s_defaultEventInterval = 1000;
+static const size_t s_maxQueuedEvents = 100;
+
+class CategoryHandler : public MojService::CategoryHandler,
+			public CFileCacheListener {
  public:
   CategoryHandler(CFileCacheSet* cacheSet);
   virtual ~CategoryHandler();
   MojErr RegisterMethods();
 
+  // CFileCacheListener
+  virtual void ObjectExpired(const std::string& typeName,
+			     const cachedObjectId_t objId,
+			     const std::string& filename,
+			     ExpireReason reason);
+  virtual void TypeModified(const std::string& typeName, TypeChange change);
+  virtual void ObjectCreated(const std::string& typeName,
+			     const cachedObjectId_t objId, bool created);
+  virtual void ObjectOpened(const std::string& typeName,
+			    const cachedObjectId_t objId, bool opened);
+  virtual void ObjectWritten(const std::string& typeName,
+			     const cachedObjectId_t objId, bool written);
+  virtual void ObjectOrphaned(const std::string& typeName,
+			      const cachedObjectId_t objId);
+  virtual void AgingScheduled(time_t due);
+  virtual void ThresholdCrossed(const std::string& typeName,
+				CacheThreshold threshold, bool above,
+				cacheSize_t size);
+
  private:
   class Subscription : public MojSignalHandler {
    public:
+    // A streaming reader is first told of the bytesAvailable the
+    // caller knows to be written, only what is written after that is
+    // progress
     Subscription(CategoryHandler& handler, MojServiceMessage* msg,
-		 MojString& pathName);
+		 MojString& pathName, const cachedObjectId_t objId,
+		 const std::string& typeName, bool streaming = false,
+		 cacheSize_t bytesAvailable = 0);
     ~Subscription();
     MojString GetPathName() { return m_pathName; }
+    cachedObjectId_t GetObjectId() { return m_objId; }
+    const std::string& GetTypeName() { return m_typeName; }
+
+    // Streaming readers are told as the object grows and when the
+    // writer is done with it
+    bool isStreaming() { return m_streaming; }
+    bool isComplete() { return m_complete; }
+    // The bytes the reader has been told are available, starting with
+    // those written when it subscribed
+    cacheSize_t GetBytesReported() { return m_bytesReported; }
+    MojErr NotifyProgress(cacheSize_t bytesAvailable);
+    MojErr NotifyComplete(bool written, cacheSize_t bytesAvailable);
+    // Whether the writer has written nothing for s_writerWaitTimeout,
+    // the reader is then failed with NotifyStalled
+    bool isStalled(time_t now) {
+      return (now - m_progressTime) >= s_writerWaitTimeout;
+    }
+    MojErr NotifyStalled();
+
+    // The reply to a writer waits until its file has been made
+    // writable, and is then sent by NotifyOpened
+    void SetPendingReply(const std::string& method, const MojObject& reply);
+    bool isOpening() { return m_opening; }
+    MojErr NotifyOpened(bool opened);
 
    private:
     MojErr HandleCancel(MojServiceMessage* msg);
@@ -48,9 +126,177 @@ class CategoryHandler : public MojService::CategoryHandler {
     CategoryHandler& m_handler;
     MojRefCountedPtr<MojServiceMessage> m_msg;
     MojString m_pathName;
+    // The object id and type parsed from the pathName when the
+    // subscription was made
+    cachedObjectId_t m_objId;
+    std::string m_typeName;
+    bool m_streaming;
+    bool m_complete;
+    cacheSize_t m_bytesReported;
+    // When the object last grew, or the reader subscribed
+    time_t m_progressTime;
+    // The method and reply held back by SetPendingReply
+    bool m_opening;
+    std::string m_method;
+    MojObject m_pendingReply;
     MojServiceMessage::CancelSignal::Slot<Subscription> m_cancelSlot;
   };
 
+  // A LookupOrInsertCacheObject request waiting for another client to
+  // finish writing the object for its key
+  class PendingLookup : public MojSignalHandler {
+   public:
+    PendingLookup(CategoryHandler& handler, MojServiceMessage* msg,
+		  MojObject& payload, const cachedObjectId_t objId);
+    ~PendingLookup();
+    MojServiceMessage* GetMessage() { return m_msg.get(); }
+    MojObject& GetPayload() { return m_payload; }
+    cachedObjectId_t GetObjectId() { return m_objId; }
+    // Called with the bytes the writer has written each time they are
+    // read
+    void NotifyProgress(cacheSize_t bytesAvailable);
+    // Whether the writer has written nothing more for
+    // s_writerWaitTimeout
+    bool isStalled(time_t now) {
+      return (now - m_progressTime) >= s_writerWaitTimeout;
+    }
+
+   private:
+    MojErr HandleCancel(MojServiceMessage* msg);
+
+    CategoryHandler& m_handler;
+    MojRefCountedPtr<MojServiceMessage> m_msg;
+    MojObject m_payload;
+    cachedObjectId_t m_objId;
+    // The bytes the writer had written when last checked and when it
+    // was last seen to write more
+    cacheSize_t m_bytesSeen;
+    time_t m_progressTime;
+    MojServiceMessage::CancelSignal::Slot<PendingLookup> m_cancelSlot;
+  };
+
+  // An insert whose reply is waiting for the I/O workers to create
+  // the file for the new object
+  class PendingInsert : public MojSignalHandler {
+   public:
+    PendingInsert(CategoryHandler& handler, MojServiceMessage* msg,
+		  const cachedObjectId_t objId, const std::string& typeName,
+		  const std::string& fileName, bool subscribed, bool lookup);
+    ~PendingInsert();
+    MojServiceMessage* GetMessage() { return m_msg.get(); }
+    cachedObjectId_t GetObjectId() { return m_objId; }
+    const std::string& GetTypeName() { return m_typeName; }
+    const std::string& GetFileName() { return m_fileName; }
+    bool isSubscribed() { return m_subscribed; }
+    // Whether this came from LookupOrInsertCacheObject
+    bool isLookup() { return m_lookup; }
+    // The trace of the request, which goes on until it is replied to
+    CRequestTrace* GetRequest() { return m_request; }
+
+   private:
+    MojErr HandleCancel(MojServiceMessage* msg);
+
+    CategoryHandler& m_handler;
+    MojRefCountedPtr<MojServiceMessage> m_msg;
+    cachedObjectId_t m_objId;
+    std::string m_typeName;
+    std::string m_fileName;
+    bool m_subscribed;
+    bool m_lookup;
+    CRequestTrace* m_request;
+    MojServiceMessage::CancelSignal::Slot<PendingInsert> m_cancelSlot;
+  };
+
+  // Reads how much of an object has been written on an I/O worker
+  class BytesAvailableJob;
+
+  // A WatchCacheEvents subscription.  Events are collected and sent
+  // together once the watcher's interval has passed.
+  class EventWatcher : public MojSignalHandler {
+   public:
+    EventWatcher(CategoryHandler& handler, MojServiceMessage* msg,
+		 const std::string& typeName, guint interval);
+    ~EventWatcher();
+    const std::string& GetTypeName() { return m_typeName; }
+
+    // Queue an event.  Events with a coalesceKey replace any queued
+    // event with the same key.
+    void AddEvent(const MojObject& event,
+		  const std::string& coalesceKey = std::string());
+    MojErr Flush();
+    void Stop();
+
+   private:
+    static gboolean FlushCallback(void* data);
+    MojErr HandleCancel(MojServiceMessage* msg);
+
+    CategoryHandler& m_handler;
+    MojRefCountedPtr<MojServiceMessage> m_msg;
+    std::string m_typeName;
+    guint m_interval;
+    guint m_timer;
+    std::vector<MojObject> m_events;
+    std::map<std::string, MojObject> m_coalesced;
+    size_t m_dropped;
+    MojServiceMessage::CancelSignal::Slot<EventWatcher> m_cancelSlot;
+  };
+
+  // A watcher event reported by a listener call, kept until the main
+  // loop handles it
+  class ListenerEvent {
+   public:
+    enum Kind { Expired, Modified, Threshold };
+
+    ListenerEvent(Kind kind, const std::string& typeName)
+      : m_kind(kind), m_typeName(typeName), m_objId(0), m_change(0)
+      , m_above(false), m_size(0) {}
+
+    Kind m_kind;
+    std::string m_typeName;
+    cachedObjectId_t m_objId;
+    std::string m_filename;
+    // The ExpireReason, TypeChange or CacheThreshold
+    int m_change;
+    bool m_above;
+    cacheSize_t m_size;
+  };
+
+  // Records a request to the trace, if one is being recorded, and its
+  // time and whether it failed to the metrics, when the method
+  // handling it returns.  The result is s_traceNoReply unless the
+  // method sets it.
+  class TraceScope {
+   public:
+    TraceScope(CategoryHandler& handler, TraceOp op, MojServiceMessage* msg);
+    ~TraceScope();
+    void SetType(const char* typeName);
+    // A negative size is looked up in the cache set
+    void SetObject(const cachedObjectId_t objId, const std::string& typeName,
+		   cacheSize_t size = -1);
+    // Take the object id and type from the pathname of an object
+    void SetPath(const char* pathName, cacheSize_t size = -1);
+    void SetResult(int result) { m_result = result; }
+
+   private:
+    TraceScope& operator=(const TraceScope&);
+    TraceScope(const TraceScope&);
+
+    CategoryHandler& m_handler;
+    TraceOp m_op;
+    bool m_active;
+    uint32_t m_caller;
+    cachedObjectId_t m_objId;
+    std::string m_typeName;
+    cacheSize_t m_size;
+    int m_result;
+    uint64_t m_start;
+    // The stages of the request, NULL unless requests are traced
+    CRequestTrace* m_request;
+    CRequestScope m_requestScope;
+    // Names the method while it runs, should it stall the main loop
+    CLoopActivity m_activity;
+  };
+
   MojErr DefineType(MojServiceMessage* msg, MojObject& payload);
   MojErr ChangeType(MojServiceMessage* msg, MojObject& payload);
   MojErr DeleteType(MojServiceMessage* msg, MojObject& payload);
@@ -59,33 +305,149 @@ class CategoryHandler : public MojService::CategoryHandler {
   MojErr ResizeCacheObject(MojServiceMessage* msg, MojObject& payload);
   MojErr ExpireCacheObject(MojServiceMessage* msg, MojObject& payload);
   MojErr SubscribeCacheObject(MojServiceMessage* msg, MojObject& payload);
+  MojErr LookupOrInsertCacheObject(MojServiceMessage* msg, MojObject& payload);
   MojErr TouchCacheObject(MojServiceMessage* msg, MojObject& payload);
   MojErr CopyCacheObject(MojServiceMessage* msg, MojObject& payload);
   MojErr GetCacheStatus(MojServiceMessage* msg, MojObject& payload);
   MojErr GetCacheTypeStatus(MojServiceMessage* msg, MojObject& payload);
+  MojErr ListCacheObjects(MojServiceMessage* msg, MojObject& payload);
   MojErr GetCacheObjectSize(MojServiceMessage* msg, MojObject& payload);
   MojErr GetCacheObjectFilename(MojServiceMessage* msg, MojObject& payload);
   MojErr GetCacheTypes(MojServiceMessage* msg, MojObject& payload);
   MojErr GetVersion(MojServiceMessage* msg, MojObject& payload);
+  MojErr WatchCacheEvents(MojServiceMessage* msg, MojObject& payload);
+  MojErr SetTraceRecording(MojServiceMessage* msg, MojObject& payload);
+  MojErr GetStartupProfile(MojServiceMessage* msg, MojObject& payload);
+  MojErr GetMetrics(MojServiceMessage* msg, MojObject& payload);
 
+  std::string CheckInsertParams(const std::string& method,
+				MojObject& payload, const MojString& typeName,
+				const MojString& fileName, MojInt64& size,
+				MojInt64& cost, MojInt64& lifetime,
+				MojInt64& maxAge, bool& subscribed,
+				MojString& key);
+  MojErr PutTypeStats(MojObject& reply, const CTypeStats& stats);
+  MojErr ReplyInsert(MojServiceMessage* msg, const cachedObjectId_t objId,
+		     const std::string& typeName, const std::string& fileName,
+		     bool subscribed);
+  MojErr CancelPendingInsert(PendingInsert* insert);
   MojErr CancelSubscription(Subscription* sub, MojServiceMessage* msg,
 			    MojString& pathName);
+  MojErr SubscribeLookup(MojServiceMessage* msg, const cachedObjectId_t objId,
+			 const std::string& typeName, bool inserted,
+			 bool streamReader);
+  MojErr ResolvePendingLookups(const cachedObjectId_t objId);
+  MojErr CancelPendingLookup(PendingLookup* lookup);
+  void FailStalledLookups();
+  MojErr CancelWatcher(EventWatcher* watcher);
+  void QueueEvent(const std::string& typeName, const MojObject& event,
+		  const std::string& coalesceKey = std::string());
 
   typedef MojRefCountedPtr<Subscription> SubscriptionPtr;
-  typedef std::vector<SubscriptionPtr> SubscriptionVec;
+  typedef boost::unordered_map<Subscription*, SubscriptionPtr> SubscriptionMap;
+  typedef boost::unordered_multimap<cachedObjectId_t,
+				    Subscription*> ObjectSubscriptionMap;
+  typedef MojRefCountedPtr<PendingLookup> PendingLookupPtr;
+  typedef std::multimap<cachedObjectId_t, PendingLookupPtr> PendingLookupMap;
+  typedef MojRefCountedPtr<PendingInsert> PendingInsertPtr;
+  typedef boost::unordered_map<cachedObjectId_t,
+			       PendingInsertPtr> PendingInsertMap;
+  typedef MojRefCountedPtr<EventWatcher> EventWatcherPtr;
+  typedef boost::unordered_map<EventWatcher*, EventWatcherPtr> EventWatcherMap;
 
-  MojErr SetupWorkerTimer();
-  MojErr WorkerHandler();
+  void SetupWorkerTimer();
+  size_t WorkerHandler();
   static gboolean TimerCallback(void* data);
   MojErr CleanerHandler();
   static gboolean CleanerCallback(void* data);
+  static gboolean MetricsCallback(void* data);
+  static gboolean HeartbeatCallback(void* data);
+  void SetupAgeTimer(time_t due);
+  static gboolean AgeTimerCallback(void* data);
+  void SetupStreamTimer();
+  MojErr StreamHandler();
+  static gboolean StreamCallback(void* data);
+  MojErr NotifyStreamReaders(const cachedObjectId_t objId);
+  cacheSize_t GetBytesReported(const cachedObjectId_t objId);
+  void ReadBytesAvailable(const cachedObjectId_t objId);
+  MojErr BytesAvailableRead(const cachedObjectId_t objId,
+			    cacheSize_t bytesAvailable);
+  MojErr HandleObjectCreated(const cachedObjectId_t objId, bool created);
+  MojErr HandleObjectOpened(const cachedObjectId_t objId, bool opened);
+  MojErr HandleObjectWritten(const cachedObjectId_t objId);
+  void HandleListenerEvent(const ListenerEvent& event);
+  void RecordListenerEvent(const ListenerEvent& event);
+  void SetupListenerCallback();
+  MojErr ListenerHandler();
+  static gboolean ListenerCallback(void* data);
   MojErr CopyFile(MojServiceMessage* msg, const std::string& source,
-		  const std::string& destination);
+		  const std::string& destination, const std::string& typeName,
+		  cacheSize_t size);
   std::string CallerID(MojServiceMessage* msg);
 
   CFileCacheSet* m_fileCacheSet;
 
-  SubscriptionVec m_subscribers;
+  void AddSubscription(const SubscriptionPtr& sub);
+  void RemoveSubscription(Subscription* sub);
+
+  // All active subscriptions, indexed both by subscription and by
+  // the object subscribed to
+  SubscriptionMap m_subscribers;
+  ObjectSubscriptionMap m_objectSubscribers;
+  // Subscribed objects that were not completely written when last
+  // checked.  These are the only objects the worker validates.
+  std::set<cachedObjectId_t> m_unwrittenObjects;
+  // The worker timer, its current interval and how much work was
+  // left after its last run
+  guint m_workerTimer;
+  guint m_workerInterval;
+  size_t m_workerBacklog;
+  // The timer for expiring objects past their maximum age and the
+  // time it is due
+  guint m_ageTimer;
+  time_t m_ageTimerDue;
+  // Objects that have streaming readers waiting for the writer to
+  // finish and the timer used to poll them for growth
+  std::set<cachedObjectId_t> m_streamedObjects;
+  guint m_streamTimer;
+  // The objects with a BytesAvailableJob still pending
+  std::set<cachedObjectId_t> m_bytesPending;
+  // Lookups parked on an object another client is still writing,
+  // keyed by that object
+  PendingLookupMap m_pendingLookups;
+  // Inserts waiting for the file of the new object to be created
+  PendingInsertMap m_pendingInserts;
+  // The listener calls come on whichever thread changed the cache set,
+  // which may be the local server's, so they only record what they
+  // were told here and leave it to an idle callback on the main loop.
+  // The lock guards everything up to the callback's source, and is
+  // only held to copy them in or out.
+  CCacheMutex m_listenerLock;
+  std::vector<std::pair<cachedObjectId_t, bool> > m_createdObjects;
+  std::vector<std::pair<cachedObjectId_t, bool> > m_openedObjects;
+  std::vector<cachedObjectId_t> m_writtenObjects;
+  std::vector<ListenerEvent> m_listenerEvents;
+  bool m_orphansReported;
+  // The earliest aging deadline reported, 0 if none
+  time_t m_agingDue;
+  guint m_listenerIdle;
+  EventWatcherMap m_watchers;
+  // Records requests and evictions while turned on by
+  // SetTraceRecording
+  CTraceRecorder m_traceRecorder;
+  // The time and failures of each method, by the op its requests are
+  // traced as, and of the work done on timers
+  CMetrics m_metrics;
+  std::vector<size_t> m_opMetrics;
+  size_t m_workerMetrics;
+  size_t m_cleanerMetrics;
+  size_t m_ageMetrics;
+  guint m_metricsTimer;
+  // Logs the slow requests with the time taken by each of their stages
+  CRequestTracer m_requestTracer;
+  // Counts the stalls of the main loop and what held it up
+  CLoopWatchdog m_loopWatchdog;
+  guint m_heartbeatTimer;
   static const Method s_privMethods[];
   static const Method s_pubMethods[];
   static MojLogger s_log;
@@ -19,8 +19,51 @@
 #include "FileCache.h"
 #include "FileCacheSet.h"
 
+#include <limits.h>
+
 MojLogger CFileCache::s_log(_T("filecache.filecache"));
 
+// Removes the directory of a deleted type once the removals of its
+// objects, which may be queued on any worker, have run.  The type is
+// gone by the time this runs so it only keeps what it needs.
+class CRemoveTypeJob : public CIOJob {
+ public:
+  CRemoveTypeJob(CFileCacheSet* cacheSet, const std::string& typeName,
+		 const std::string& pathname, bool cleanable,
+		 CFsStats* fsStats)
+    : CIOJob(pathname), m_cacheSet(cacheSet), m_typeName(typeName),
+      m_cleanable(cleanable), m_fsStats(fsStats) {}
+
+  bool isAfterAll() { return true; }
+  void Run() {
+    CFileCache::RemoveFromDisk(m_pathname, m_cleanable, m_fsStats);
+  }
+  void Complete() { m_cacheSet->TypeRemovalDone(m_typeName); }
+
+ private:
+  CFileCacheSet* m_cacheSet;
+  const std::string m_typeName;
+  const bool m_cleanable;
+  CFsStats* m_fsStats;
+};
+
+// Returns true if the index position a comes before b, where end()
+// comes after every entry.
+template <class Index>
+static bool
+IndexBefore(const Index& index, typename Index::iterator a,
+	    typename Index::iterator b) {
+
+  if (a == index.end()) {
+    return false;
+  }
+  if (b == index.end()) {
+    return true;
+  }
+
+  return *a < *b;
+}
+
 // This constructor is used to create a new type or deserialize an
 // already constructed type
 CFileCache::CFileCache(CFileCacheSet* cacheSet, 
@@ -33,7 +76,13 @@ CFileCache::CFileCache(CFileCacheSet* cacheSet,
 						    , m_defaultSize(0)
 						    , m_defaultLifetime(1)
 						    , m_defaultCost(0)
-						    , m_dirType(false) {
+						    , m_defaultMaxAge(0)
+						    , m_dirType(false)
+						    , m_aboveLoWatermark(false)
+						    , m_aboveHiWatermark(false)
+						    , m_snapshotChanged(true)
+						    , m_snapshotRebuild(true)
+						    , m_fsStats(cacheSet->GetTypeFsStats(cacheType)) {
   MojLogTrace(s_log);
 }
 
@@ -42,28 +91,47 @@ CFileCache::~CFileCache() {
   MojLogTrace(s_log);
 
   bool cleanable = isCleanable();
+  if (!cleanable) {
+    MojLogWarning(s_log, _T("~CFileCache: '%s' has orphans."),
+		  m_cacheType.c_str());
+  }
 
-  // Get the full path name from the file cache base directory, the
-  // typename, the id and the filename
+  // Get the full path name from the file cache base directory and the
+  // typename.  The objects just expired are still being removed, so
+  // the directory is only removed after them.
   std::string pathname(GetFileCacheSet()->GetBaseDirName());
   pathname += "/" + m_cacheType;
+  GetFileCacheSet()->TypeRemovalQueued(m_cacheType);
+  GetFileCacheSet()->SubmitIO(new CRemoveTypeJob(GetFileCacheSet(),
+						 m_cacheType, pathname,
+						 cleanable, m_fsStats));
+}
+
+// Remove the configuration file of a deleted type and its directory.
+// The directory is left if it still holds objects that couldn't be
+// expired.  This runs on an I/O worker.
+void
+CFileCache::RemoveFromDisk(const std::string& pathname, bool cleanable,
+			   CFsStats* fsStats) {
+
+  MojLogTrace(s_log);
+
   std::string configFile(pathname + "/Type.defaults");
-  if (::unlink(configFile.c_str()) != 0) {
-    MojLogError(s_log, _T("~CFileCache: Failed to unlink config file '%s'."),
+  if (FsUnlinkCall(fsStats, configFile) != 0) {
+    MojLogError(s_log,
+		_T("RemoveFromDisk: Failed to unlink config file '%s'."),
 		configFile.c_str());
   }
 
   // Don't bother trying to remove the directory as it contains a file
   // for the cached object that couldn't be expired.
   if (cleanable) {
-    if (::rmdir(pathname.c_str()) != 0) {
+    if (FsRmdirCall(fsStats, pathname) != 0) {
+      int savedErrno = errno;
       MojLogError(s_log,
-		  _T("~CFileCache: Failed to unlink cache directory '%s'."),
-		  pathname.c_str());
+		  _T("RemoveFromDisk: Failed to remove cache directory '%s' (%s)."),
+		  pathname.c_str(), ::strerror(savedErrno));
     }
-  } else {
-    MojLogWarning(s_log, _T("~CFileCache: '%s' has orphans."),
-		  m_cacheType.c_str());
   }
 }
 
@@ -75,14 +143,22 @@ CFileCache::Configure(CCacheParamValues* params, bool dirType) {
 
   MojLogTrace(s_log);
 
+  // Summing the watermarks takes the lock of every type, including
+  // this one, so it is done before this lock is held
+  cacheSize_t availSpace = 0;
+  if (params != NULL) {
+    availSpace = GetFileCacheSet()->TotalCacheSpace() - 
+      GetFileCacheSet()->SumOfLoWatermarks();
+  }
+
+  CCacheMutexGuard guard(m_lock);
+
   bool retVal = false;
   if (params == NULL) {
     MojLogDebug(s_log, _T("Configure: configuring '%s' from file."),
 		m_cacheType.c_str());
     retVal = ReadConfig();
   } else {
-    cacheSize_t availSpace = GetFileCacheSet()->TotalCacheSpace() - 
-      GetFileCacheSet()->SumOfLoWatermarks();
     if (GetFilesystemFileSize(params->GetLoWatermark()) < availSpace) {
       if (params->GetLoWatermark() > 0) {
 	m_loWatermark = GetFilesystemFileSize(params->GetLoWatermark());
@@ -126,14 +202,24 @@ CFileCache::Configure(CCacheParamValues* params, bool dirType) {
 		    _T("Configure: Configured '%s' cost to %d."),
 		    m_cacheType.c_str(), m_defaultCost);
       }
+      if (params->GetMaxAge() > 0) {
+        m_defaultMaxAge = params->GetMaxAge();
+        MojLogDebug(s_log,
+		    _T("Configure: Configured '%s' maximum age to %d."),
+		    m_cacheType.c_str(), m_defaultMaxAge);
+      }
       m_dirType = dirType;
       retVal = WriteConfig();
+      CheckThresholds();
     } else {
       MojLogWarning(s_log, 
 		    _T("Configure: Not enough cache space to configure '%s'."),
 		    m_cacheType.c_str());
     }
   }
+  if (retVal) {
+    SnapshotChanged();
+  }
 
   return retVal;
 }
@@ -145,29 +231,53 @@ CFileCache::Describe(CCacheParamValues& params) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   params.SetLoWatermark(m_loWatermark);
   params.SetHiWatermark(m_hiWatermark);
   params.SetSize(m_defaultSize);
   params.SetLifetime(m_defaultLifetime);
   params.SetCost(m_defaultCost);
+  params.SetMaxAge(m_defaultMaxAge);
 
   return m_cacheSize;
 }
 
 // Insert a new object in the cache.  The cachedObjectId_t is provided
 // by the CFileCacheSet to maintain unique cache IDs across all cache
-// types.  The number of objects in the cache will be returned.
+// types.  Only isNew objects are counted in the stats.  The number of
+// objects in the cache will be returned.
 paramValue_t
-CFileCache::Insert(CCacheObject* newObj) {
+CFileCache::Insert(CCacheObject* newObj, bool isNew) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   cachedObjectId_t objId = newObj->GetId();
   m_cachedObjects.insert(std::map<cachedObjectId_t, 
 			 CCacheObject*>::value_type(objId, newObj));
   m_cacheList.push_front(objId);
+  m_cacheListPos[objId] = m_cacheList.begin();
+  IndexObject(newObj);
+  if (!newObj->GetKey().empty()) {
+    // The newest object for a key replaces any older one
+    m_keyIndex[newObj->GetKey()] = objId;
+  }
   m_numObjects++;
-  m_cacheSize += GetFilesystemFileSize(newObj->GetSize());
+  AdjustCacheSize(GetFilesystemFileSize(newObj->GetSize()));
+  if (isNew) {
+    m_stats.m_inserts++;
+    m_stats.m_insertBytes += (uint64_t) newObj->GetSize();
+    const std::string& name = newObj->GetKey().empty() ?
+      newObj->GetFileName() : newObj->GetKey();
+    // Each eviction is only matched once
+    if (m_evictedCounts.erase(name) > 0) {
+      m_stats.m_reinserts++;
+    }
+  }
+  SnapshotChanged(objId);
+  CheckThresholds();
   MojLogInfo(s_log,
 	     _T("Insert: Id '%llu'. Cache size '%d', object count '%d'."),
 	     objId, m_cacheSize, m_numObjects);
@@ -191,25 +301,43 @@ CFileCache::Resize(const cachedObjectId_t objId, cacheSize_t newSize) {
   
   MojLogTrace(s_log);
 
+  // Making space may take the locks of the other types so it is done
+  // without this one held.  The object is looked up again after.
+  bool found = false;
+  cacheSize_t neededSpace = 0;
+  {
+    CCacheMutexGuard guard(m_lock);
+    CCacheObject* cachedObject = GetCacheObjectForId(objId);
+    if (cachedObject != NULL) {
+      found = true;
+      neededSpace = GetFilesystemFileSize(newSize) -
+	GetFilesystemFileSize(cachedObject->GetSize());
+    }
+  }
+  if (found && !CheckForSize(neededSpace)) {
+    MojLogInfo(s_log,
+	       _T("Resize: Attempting to cleanup cache for '%d' bytes."),
+	       neededSpace);
+    Cleanup(neededSpace);
+  }
+
+  CCacheMutexGuard guard(m_lock);
+
   cacheSize_t finalSize = 0;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   MojLogDebug(s_log, _T("Resize: Found object for id '%llu'."), objId);
   if (cachedObject != NULL) {
     cacheSize_t origSize = cachedObject->GetSize();
-    cacheSize_t neededSpace = GetFilesystemFileSize(newSize) -
+    neededSpace = GetFilesystemFileSize(newSize) -
       GetFilesystemFileSize(origSize);
-    if (!CheckForSize(neededSpace)) {
-      MojLogInfo(s_log,
-		 _T("Resize: Attempting to cleanup cache for '%d' bytes."),
-		 neededSpace);
-      Cleanup(neededSpace);
-    }
     if (CheckForSize(neededSpace)) {
       finalSize = cachedObject->Resize(newSize);
       if (finalSize != origSize) {
-	m_cacheSize += (GetFilesystemFileSize(finalSize) -
+	SnapshotChanged(objId);
+	AdjustCacheSize(GetFilesystemFileSize(finalSize) -
 			GetFilesystemFileSize(origSize));
 	UpdateObject(objId);
+	CheckThresholds();
 	MojLogInfo(s_log, _T("Resize: Object '%llu' resized to '%d'."),
 		   objId, finalSize);
       } else {
@@ -234,35 +362,60 @@ CFileCache::Resize(const cachedObjectId_t objId, cacheSize_t newSize) {
 // currently pinned in the cache by a subscription and the object
 // will be deleted once the subscription expires.
 bool
-CFileCache::Expire(const cachedObjectId_t objId) {
+CFileCache::Expire(const cachedObjectId_t objId, ExpireReason reason) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   bool retVal = true;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
 
     cacheSize_t objSize = cachedObject->GetSize();
+    SnapshotChanged(objId);
 
     // Remove it from the cache list if it is still there
     if (!cachedObject->isExpired()) {
-      std::list<cachedObjectId_t>::iterator iter;
-      iter = m_cacheList.begin();
-      while (iter != m_cacheList.end()) {
-	if (*iter == objId) {
-	  m_cacheList.erase(iter);
-	  MojLogDebug(s_log,
-		      _T("Expire: Object '%llu' removed from active cache list."),
-		      objId);
-	  break;
-	}
-	++iter;
+      boost::unordered_map<cachedObjectId_t,
+	std::list<cachedObjectId_t>::iterator>::iterator pos =
+	m_cacheListPos.find(objId);
+      if (pos != m_cacheListPos.end()) {
+	m_cacheList.erase(pos->second);
+	m_cacheListPos.erase(pos);
+	MojLogDebug(s_log,
+		    _T("Expire: Object '%llu' removed from active cache list."),
+		    objId);
       }
     }
+    // An expired object can no longer be found by its key, even if
+    // it is still subscribed
+    UnindexKey(cachedObject);
+    if (!cachedObject->isExpired()) {
+      if (cachedObject->GetMaxAge() > 0) {
+	GetFileCacheSet()->CancelAging(objId);
+      }
+      GetFileCacheSet()->NotifyObjectExpired(m_cacheType, objId,
+					     cachedObject->GetFileName(),
+					     reason);
+      m_stats.m_evictions[reason]++;
+      m_stats.m_evictionBytes[reason] += (uint64_t) objSize;
+      if (reason == ExpireCapacity) {
+	const time_t age = GetFileCacheSet()->Now() -
+	  cachedObject->GetCreationTime();
+	m_stats.m_evictionAge.Record((age > 0) ? (uint64_t) age : 0);
+      }
+      if ((reason == ExpireCapacity) || (reason == ExpireAged)) {
+	RememberEviction(cachedObject);
+      }
+    }
+
     // Now try to actually remove the object, this will return false
-    // if the object is still subscribed or if the unlink fails.  If
-    // still subscribed, the unsubscribe will remove the object, if
-    // the unlink fails, it will be retried by the timer worker call.
+    // if the object is still subscribed, in which case the unsubscribe
+    // will remove it.  The file is removed by an I/O worker.  If that
+    // fails the file is left, and the cache set doesn't save its
+    // state, so the next start walks the tree and takes it back into
+    // account.
     retVal = cachedObject->Expire();
     if (retVal) {
       // Remove it from the map so no further work is done on it.
@@ -271,14 +424,18 @@ CFileCache::Expire(const cachedObjectId_t objId) {
       // This way we only remove the lookup reference once the expire
       // call is successful.
       m_cachedObjects.erase(objId);
+      m_orphans.erase(objId);
+      UnindexObject(objId);
       m_numObjects--;
-      m_cacheSize -= GetFilesystemFileSize(objSize);
+      AdjustCacheSize(-GetFilesystemFileSize(objSize));
       delete cachedObject;
+      CheckThresholds();
       MojLogWarning(s_log, _T("Expire: Object '%llu' removed from the cache."),
 		 objId);
     } else {
       MojLogInfo(s_log, _T("Expire: Object '%llu' expired but still in use."),
 		 objId);
+      AddOrphan(objId);
     }
   } else {
     MojLogWarning(s_log, _T("Expire: Object '%llu' does not exist."), objId);
@@ -292,19 +449,29 @@ CFileCache::Expire(const cachedObjectId_t objId) {
 // object is guaranteed not to be deleted from the cache.  This is also
 // how you obtain the pathname to the cached object.
 const std::string
-CFileCache::Subscribe(std::string& msgText, const cachedObjectId_t objId) {
+CFileCache::Subscribe(std::string& msgText, const cachedObjectId_t objId,
+		      bool streamReader) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   std::string retVal("");
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
-    retVal = cachedObject->Subscribe(msgText);
+    const bool written = cachedObject->isWritten();
+    retVal = cachedObject->Subscribe(msgText, streamReader);
     if (!retVal.empty() && msgText.empty()) {
+      if (written) {
+	m_stats.m_hits++;
+      }
       UpdateObject(objId);
       MojLogInfo(s_log,
 		 _T("Subscribe: Subscribed to object '%llu' at path '%s'."),
 		 objId, retVal.c_str());
+    } else {
+      // The access time is updated even when the subscribe fails
+      IndexObject(cachedObject);
     }
   } else {
     MojLogWarning(s_log,
@@ -318,27 +485,125 @@ CFileCache::Subscribe(std::string& msgText, const cachedObjectId_t objId) {
 // cache.  This means that there is no longer any guarantee of available
 // of the object in the cache.
 void
-CFileCache::UnSubscribe(const cachedObjectId_t objId) {
+CFileCache::UnSubscribe(const cachedObjectId_t objId, bool streamReader) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
-    cacheSize_t origSize = cachedObject->GetSize();
-    cachedObject->UnSubscribe();
+    // The object calls ObjectUnSubscribed when it is done, which for
+    // the writer may be after this returns
+    cachedObject->UnSubscribe(streamReader);
     MojLogInfo(s_log,
 	       _T("UnSubscribe: UnSubscribed from object '%llu'."), objId);
+  } else {
+    MojLogWarning(s_log, _T("UnSubscribe: Object '%llu' does not exists."),
+		  objId);
+  }
+}
+
+// Called by an object once the I/O workers have created its file.
+// An object that couldn't be created is expired.
+void
+CFileCache::ObjectCreated(const cachedObjectId_t objId, bool created) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject != NULL) {
+    if (!created) {
+      MojLogError(s_log, _T("ObjectCreated: Failed to create object '%llu'."),
+		  objId);
+      // This runs from the I/O completion without the type lock so
+      // the object is expired here rather than through the cache set
+      GetFileCacheSet()->RemoveObjectFromIdMap(objId);
+      Expire(objId, ExpireOrphan);
+    }
+    GetFileCacheSet()->NotifyObjectCreated(m_cacheType, objId, created);
+  } else {
+    MojLogWarning(s_log, _T("ObjectCreated: Object '%llu' does not exists."),
+		  objId);
+  }
+}
+
+// Called by an object once the I/O workers have made its file
+// writable for the writer.  An object that couldn't be is expired.
+void
+CFileCache::ObjectOpened(const cachedObjectId_t objId, bool opened) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject != NULL) {
+    if (!opened) {
+      MojLogError(s_log, _T("ObjectOpened: Failed to open object '%llu'."),
+		  objId);
+      GetFileCacheSet()->RemoveObjectFromIdMap(objId);
+      Expire(objId, ExpireOrphan);
+    }
+    GetFileCacheSet()->NotifyObjectOpened(m_cacheType, objId, opened);
+  } else {
+    MojLogWarning(s_log, _T("ObjectOpened: Object '%llu' does not exists."),
+		  objId);
+  }
+}
+
+// Called by an object once a subscription has been released, which
+// for the writer is after the file has been synced.  failed is set
+// if the release caused the object to be expired.
+void
+CFileCache::ObjectUnSubscribed(const cachedObjectId_t objId,
+			       cacheSize_t origSize, bool failed,
+			       bool writer) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject != NULL) {
+    SnapshotChanged(objId);
+    if (failed) {
+      // The object failed to be written
+      UnindexKey(cachedObject);
+      GetFileCacheSet()->NotifyObjectExpired(m_cacheType, objId,
+					     cachedObject->GetFileName(),
+					     ExpireOrphan);
+    }
     cacheSize_t finalSize = cachedObject->GetSize();
     if (finalSize != origSize) {
-      m_cacheSize += (GetFilesystemFileSize(finalSize) - 
+      AdjustCacheSize(GetFilesystemFileSize(finalSize) -
 		      GetFilesystemFileSize(origSize));
+      CheckThresholds();
       MojLogInfo(s_log, 
-		 _T("UnSubscribe: Adjusting cache for new file size of '%d' bytes."),
+		 _T("ObjectUnSubscribed: Adjusting cache for new file size of '%d' bytes."),
 		 finalSize);
     }
     UpdateObject(objId);
+    if (cachedObject->isExpired()) {
+      if (failed && (cachedObject->GetMaxAge() > 0)) {
+	GetFileCacheSet()->CancelAging(objId);
+      }
+      // The listeners are told again once the last subscription has
+      // gone so the orphan is removed without waiting for long
+      if (m_orphans.insert(objId).second ||
+	  (cachedObject->GetSubscriptionCount() == 0)) {
+	GetFileCacheSet()->NotifyObjectOrphaned(m_cacheType, objId);
+      }
+    }
+    if (writer) {
+      GetFileCacheSet()->NotifyObjectWritten(m_cacheType, objId,
+					     cachedObject->isWritten());
+    }
   } else {
-    MojLogWarning(s_log, _T("UnSubscribe: Object '%llu' does not exists."),
+    MojLogWarning(s_log,
+		  _T("ObjectUnSubscribed: Object '%llu' does not exists."),
 		  objId);
   }
 }
@@ -350,6 +615,8 @@ CFileCache::Touch(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   bool retVal = false;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
@@ -365,6 +632,50 @@ CFileCache::Touch(const cachedObjectId_t objId) {
   return retVal;
 }
 
+// Touch a batch of objects, in the order given, under one lock and
+// with one pass over the recency list.  Ids that aren't in this cache
+// are ignored.  Returns the number of objects touched.
+int
+CFileCache::TouchObjects(const std::vector<cachedObjectId_t>& objIds) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  // Only the last touch of an object matters for its place in the
+  // list, so go backwards and keep the first seen of each
+  std::set<cachedObjectId_t> touched;
+  std::vector<cachedObjectId_t> latestFirst;
+  std::vector<cachedObjectId_t>::const_reverse_iterator riter;
+  for (riter = objIds.rbegin(); riter != objIds.rend(); ++riter) {
+    CCacheObject* cachedObject = GetCacheObjectForId(*riter);
+    if ((cachedObject != NULL) && touched.insert(*riter).second) {
+      cachedObject->Touch();
+      latestFirst.push_back(*riter);
+    }
+  }
+  if (latestFirst.empty()) {
+    return 0;
+  }
+
+  // Moving the least recent first leaves the latest at the front
+  for (riter = latestFirst.rbegin(); riter != latestFirst.rend(); ++riter) {
+    boost::unordered_map<cachedObjectId_t,
+      std::list<cachedObjectId_t>::iterator>::const_iterator pos =
+      m_cacheListPos.find(*riter);
+    if (pos != m_cacheListPos.end()) {
+      m_cacheList.splice(m_cacheList.begin(), m_cacheList, pos->second);
+    }
+  }
+  for (size_t i = 0; i < latestFirst.size(); ++i) {
+    IndexObject(GetCacheObjectForId(latestFirst[i]));
+  }
+  MojLogInfo(s_log, _T("TouchObjects: Updated access time for '%zu' objects."),
+	     latestFirst.size());
+
+  return (int) latestFirst.size();
+}
+
 // Get a vector containing pairs of all the objects in the cache and
 // their object IDs.
 std::vector<std::pair<cachedObjectId_t, CCacheObject*> >
@@ -372,6 +683,8 @@ CFileCache::GetCachedObjects() {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   std::vector<std::pair<cachedObjectId_t,
     CCacheObject*> > objs(m_cachedObjects.size());
   std::map<cachedObjectId_t, CCacheObject*>::iterator iter;
@@ -389,12 +702,203 @@ CFileCache::GetCachedObjects() {
   return objs;
 }
 
+// Get the objects from the least to the most recently used, which is
+// the order they are inserted in to rebuild the cache.  Returns false
+// if any object is expired or has I/O in progress.
+bool
+CFileCache::GetObjectsByRecency(std::vector<CCacheObject*>& objects) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  objects.clear();
+  objects.reserve(m_cacheList.size());
+  if (m_cacheList.size() != m_cachedObjects.size()) {
+    // An expired object that is still subscribed is only in the map
+    return false;
+  }
+  std::list<cachedObjectId_t>::reverse_iterator iter;
+  for (iter = m_cacheList.rbegin(); iter != m_cacheList.rend(); ++iter) {
+    CCacheObject* cachedObject = GetCacheObjectForId(*iter);
+    if ((cachedObject == NULL) || cachedObject->isExpired() ||
+	cachedObject->isIOPending()) {
+      return false;
+    }
+    objects.push_back(cachedObject);
+  }
+
+  return true;
+}
+
+// Set the times of an object adopted from a saved cache set
+bool
+CFileCache::RestoreTimes(const cachedObjectId_t objId, time_t creationTime,
+			 time_t lastAccessTime) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject == NULL) {
+    return false;
+  }
+  cachedObject->RestoreTimes(creationTime, lastAccessTime);
+  IndexObject(cachedObject);
+
+  return true;
+}
+
+// Return one page of the objects matching the query in the requested
+// order.  The ordered indexes are used to position the page so the
+// cost is proportional to the page size when the range filters match
+// the sort key.  nextCursor is set when more objects may follow.
+// Returns false if the cursor is not valid.
+bool
+CFileCache::ListObjects(const CObjectQuery& query,
+			std::vector<CCacheObjectInfo>& objects,
+			std::string& nextCursor) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  objects.clear();
+  nextCursor.clear();
+
+  ObjectIndex& index = GetIndex(query.m_sortBy);
+
+  // Narrow the range of index entries to walk using the filter that
+  // matches the sort key, if one was given.
+  long long loKey = LLONG_MIN;
+  long long hiKey = LLONG_MAX;
+  if (query.m_sortBy == SortBySize) {
+    if (query.m_minSize >= 0) {
+      loKey = query.m_minSize;
+    }
+    if (query.m_maxSize >= 0) {
+      hiKey = query.m_maxSize;
+    }
+  } else if (query.m_sortBy == SortByRecency) {
+    if (query.m_accessedAfter > 0) {
+      loKey = (long long) query.m_accessedAfter + 1;
+    }
+    if (query.m_accessedBefore > 0) {
+      hiKey = (long long) query.m_accessedBefore - 1;
+    }
+  }
+  ObjectIndex::iterator first = index.lower_bound(std::make_pair(loKey,
+								 (cachedObjectId_t) 0));
+  ObjectIndex::iterator last = index.upper_bound(std::make_pair(hiKey,
+								ULLONG_MAX));
+
+  // The cursor is the index entry of the last object returned, so
+  // resume just past it in the direction being walked.
+  if (!query.m_cursor.empty()) {
+    long long cursorKey;
+    cachedObjectId_t cursorId;
+    char extra;
+    if (sscanf(query.m_cursor.c_str(), "%lld.%llu%c", &cursorKey,
+	       &cursorId, &extra) != 2) {
+      MojLogWarning(s_log, _T("ListObjects: Invalid cursor '%s'."),
+		    query.m_cursor.c_str());
+      return false;
+    }
+    std::pair<long long, cachedObjectId_t> cursor(cursorKey, cursorId);
+    if (query.m_descending) {
+      ObjectIndex::iterator pos = index.lower_bound(cursor);
+      if (IndexBefore(index, pos, last)) {
+	last = pos;
+      }
+    } else {
+      ObjectIndex::iterator pos = index.upper_bound(cursor);
+      if (IndexBefore(index, first, pos)) {
+	first = pos;
+      }
+    }
+  }
+  // Keep the range well formed when the bounds or the cursor cross
+  if (IndexBefore(index, last, first)) {
+    first = last;
+  }
+
+  paramValue_t limit = query.m_limit;
+  if ((limit <= 0) || (limit > CObjectQuery::s_maxPageSize)) {
+    limit = CObjectQuery::s_maxPageSize;
+  }
+
+  ObjectIndex::iterator iter = query.m_descending ? last : first;
+  const ObjectIndex::iterator stop = query.m_descending ? first : last;
+  // The cursor is left at the last entry looked at, whether or not
+  // it matched, so a walk cut short by the visit limit resumes there
+  std::pair<long long, cachedObjectId_t> lastEntry;
+  paramValue_t visited = 0;
+  while ((iter != stop) && (objects.size() < (size_t) limit) &&
+	 (visited < CObjectQuery::s_maxEntriesVisited)) {
+    if (query.m_descending) {
+      --iter;
+    }
+    const std::pair<long long, cachedObjectId_t> entry(*iter);
+    if (!query.m_descending) {
+      ++iter;
+    }
+    visited++;
+    lastEntry = entry;
+
+    CCacheObject* cachedObject = GetCacheObjectForId(entry.second);
+    if ((cachedObject == NULL) || cachedObject->isExpired()) {
+      continue;
+    }
+    if (((query.m_minSize >= 0) &&
+	 (cachedObject->GetSize() < query.m_minSize)) ||
+	((query.m_maxSize >= 0) &&
+	 (cachedObject->GetSize() > query.m_maxSize)) ||
+	((query.m_accessedAfter > 0) &&
+	 (cachedObject->GetLastAccessTime() <= query.m_accessedAfter)) ||
+	((query.m_accessedBefore > 0) &&
+	 (cachedObject->GetLastAccessTime() >= query.m_accessedBefore)) ||
+	((query.m_subscribed >= 0) &&
+	 ((cachedObject->GetSubscriptionCount() > 0) !=
+	  (query.m_subscribed != 0))) ||
+	((query.m_written >= 0) &&
+	 (cachedObject->isWritten() != (query.m_written != 0)))) {
+      continue;
+    }
+
+    CCacheObjectInfo info;
+    info.m_id = entry.second;
+    info.m_pathname = cachedObject->GetPathname();
+    info.m_filename = cachedObject->GetFileName();
+    info.m_size = cachedObject->GetSize();
+    info.m_cost = cachedObject->GetCost();
+    info.m_lifetime = cachedObject->GetLifetime();
+    info.m_subscriptionCount = cachedObject->GetSubscriptionCount();
+    info.m_written = cachedObject->isWritten();
+    info.m_creationTime = cachedObject->GetCreationTime();
+    info.m_lastAccessTime = cachedObject->GetLastAccessTime();
+    objects.push_back(info);
+  }
+
+  if ((iter != stop) && (visited > 0)) {
+    std::stringstream cursor;
+    cursor << lastEntry.first << "." << lastEntry.second;
+    nextCursor = cursor.str();
+  }
+  MojLogDebug(s_log, _T("ListObjects: Returned '%zu' objects from '%s'."),
+	      objects.size(), m_cacheType.c_str());
+
+  return true;
+}
+
 // Check if there is space in the cache for a new object of size
 bool
 CFileCache::CheckForSize(cacheSize_t size) {
   
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   bool retVal = false;
   cacheSize_t availSpace = GetFileCacheSet()->TotalCacheSpace() - 
     GetFileCacheSet()->SumOfCacheSizes();
@@ -421,14 +925,17 @@ CFileCache::CleanupCache(cachedObjectId_t* cleanedId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   bool expired = false;
   cachedObjectId_t objId = 0;
   cacheSize_t size = -1;
   while(!m_cacheList.empty() && !expired) {
     objId = m_cacheList.back();
     m_cacheList.pop_back();
+    m_cacheListPos.erase(objId);
     size = GetObjectSize(objId); // size will always be >= 0
-    expired = GetFileCacheSet()->ExpireCacheObject(objId);
+    expired = GetFileCacheSet()->ExpireCacheObject(objId, ExpireCapacity);
   }
   if(expired) {
     if (cleanedId != NULL) {
@@ -450,10 +957,19 @@ CFileCache::Cleanup(cacheSize_t size) {
 
   MojLogTrace(s_log);
 
-  if (size < m_hiWatermark) {
-    while (((m_cacheSize + size) >= m_hiWatermark) && 
+  // The cleanup across types takes the locks of the other types so
+  // this one is released first
+  bool belowHiWatermark;
+  {
+    CTraceSpan span("evict");
+    CCacheMutexGuard guard(m_lock);
+    belowHiWatermark = (size < m_hiWatermark);
+    while (belowHiWatermark && ((m_cacheSize + size) >= m_hiWatermark) &&
 	   (CleanupCache(NULL) >= 0)) {
     }
+  }
+
+  if (belowHiWatermark) {
     cacheSize_t availSpace = GetFileCacheSet()->TotalCacheSpace() - 
       GetFileCacheSet()->SumOfCacheSizes();
 
@@ -474,6 +990,8 @@ CFileCache::GetCacheCost(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   paramValue_t cost = -1;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
@@ -489,12 +1007,36 @@ CFileCache::GetCacheCost(const cachedObjectId_t objId) {
   return cost;
 }
 
+// Count a lookup or subscription that found no object
+void
+CFileCache::RecordMiss() {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  m_stats.m_misses++;
+}
+
+// Copy the stats of the type
+void
+CFileCache::GetStats(CTypeStats& stats) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  stats = m_stats;
+}
+
 // Get the best object from this cache for cleanup
 cachedObjectId_t
 CFileCache::GetCleanupCandidate() {
   
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   cachedObjectId_t objId = 0;
   if ((m_cacheSize > m_loWatermark) && !m_cacheList.empty()) {
     objId = m_cacheList.back();
@@ -503,26 +1045,29 @@ CFileCache::GetCleanupCandidate() {
   return objId;
 }
 
-// Cleanup orphaned objects
-void
+// Cleanup orphaned objects, which are the expired objects that
+// couldn't be removed when they expired.  Returns how many are still
+// left.
+int
 CFileCache::CleanupOrphanedObjects() {
   
   MojLogTrace(s_log);
 
-  std::map<cachedObjectId_t, CCacheObject*>::const_iterator iter;
-  std::vector<cachedObjectId_t> cleanups;
-  iter = m_cachedObjects.begin();
-  while (iter != m_cachedObjects.end()) {
-    if ((*iter).second->isExpired()) {
-      cleanups.push_back((*iter).first);
-    }
-    ++iter;
-  }
+  CCacheMutexGuard guard(m_lock);
+
+  // Only the orphans are visited, not every object in the cache
+  std::vector<cachedObjectId_t> cleanups(m_orphans.begin(), m_orphans.end());
   while(!cleanups.empty()) {
     cachedObjectId_t objId = cleanups.back();
-    Expire(objId);
+    if (GetCacheObjectForId(objId) == NULL) {
+      m_orphans.erase(objId);
+    } else {
+      Expire(objId);
+    }
     cleanups.pop_back();
   }
+
+  return (int) m_orphans.size();
 }
 
 // Return information about the current state of the cache.  The
@@ -535,6 +1080,8 @@ CFileCache::GetCacheStatus(cacheSize_t* cacheSize,
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   if (cacheSize != NULL) {
     *cacheSize = m_cacheSize;
   }
@@ -551,6 +1098,8 @@ CFileCache::GetObjectSize(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   cacheSize_t retVal = -1;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
@@ -563,12 +1112,118 @@ CFileCache::GetObjectSize(const cachedObjectId_t objId) {
   return retVal;  
 }
 
+// This returns the number of bytes written so far to a cached object
+// or -1 if it can't be determined.
+cacheSize_t
+CFileCache::GetObjectBytesAvailable(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  cacheSize_t retVal = -1;
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject != NULL) {
+    retVal = cachedObject->GetBytesAvailable();
+  } else {
+    MojLogWarning(s_log,
+		  _T("GetObjectBytesAvailable: Object '%llu' does not exists."),
+		  objId);
+  }
+
+  return retVal;
+}
+
+// This returns the id of the active object inserted with the client
+// key or 0 if there is none.
+cachedObjectId_t
+CFileCache::FindObjectByKey(const std::string& key) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  cachedObjectId_t retVal = 0;
+  boost::unordered_map<std::string, cachedObjectId_t>::iterator iter =
+    m_keyIndex.find(key);
+  if (iter != m_keyIndex.end()) {
+    CCacheObject* cachedObject = GetCacheObjectForId(iter->second);
+    if ((cachedObject != NULL) && !cachedObject->isExpired()) {
+      retVal = iter->second;
+    } else {
+      // The object failed to be written or was removed some other
+      // way, so forget the key
+      m_keyIndex.erase(iter);
+    }
+  }
+  MojLogDebug(s_log, _T("FindObjectByKey: Key '%s' found object '%llu'."),
+	      key.c_str(), retVal);
+
+  return retVal;
+}
+
+// This returns true if the object is still in the cache and has not
+// yet been completely written.
+bool
+CFileCache::isObjectBeingWritten(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  bool retVal = false;
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if ((cachedObject != NULL) && !cachedObject->isExpired()) {
+    retVal = !cachedObject->isWritten();
+  }
+
+  return retVal;
+}
+
+// This returns true while the file for a new object is still being
+// created
+bool
+CFileCache::isObjectBeingCreated(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  bool retVal = false;
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if ((cachedObject != NULL) && !cachedObject->isExpired()) {
+    retVal = cachedObject->isCreating();
+  }
+
+  return retVal;
+}
+
+// This returns true while the file of an object is still being made
+// writable for its writer
+bool
+CFileCache::isObjectBeingOpened(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  bool retVal = false;
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if ((cachedObject != NULL) && !cachedObject->isExpired()) {
+    retVal = cachedObject->isOpening();
+  }
+
+  return retVal;
+}
+
 // This returns the filename of a cached object
 const std::string
 CFileCache::GetObjectFilename(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   std::string retVal;
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
@@ -586,12 +1241,15 @@ CFileCache::isCleanable() {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   bool retVal = true;
   if (!m_cachedObjects.empty()) {
     std::map<cachedObjectId_t, CCacheObject*>::const_iterator iter;
     iter = m_cachedObjects.begin();
     while(iter != m_cachedObjects.end()) {
-      if ((*iter).second->GetSubscriptionCount() > 0) {
+      if (((*iter).second->GetSubscriptionCount() > 0) ||
+	  (*iter).second->isIOPending()) {
 	retVal = false;
 	break;
       }
@@ -643,24 +1301,271 @@ CFileCache::UpdateObject(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
-  std::list<cachedObjectId_t>::iterator iter;
-  iter = m_cacheList.begin();
-  while (iter != m_cacheList.end()) {
-    if (*iter == objId) {
-      m_cacheList.erase(iter);
-      m_cacheList.push_front(objId);
-      break;
+  boost::unordered_map<cachedObjectId_t,
+    std::list<cachedObjectId_t>::iterator>::const_iterator pos =
+    m_cacheListPos.find(objId);
+  if (pos != m_cacheListPos.end()) {
+    m_cacheList.splice(m_cacheList.begin(), m_cacheList, pos->second);
+  }
+
+  CCacheObject* cachedObject = GetCacheObjectForId(objId);
+  if (cachedObject != NULL) {
+    IndexObject(cachedObject);
+  }
+}
+
+void
+CFileCache::UnindexKey(CCacheObject* cachedObject) {
+
+  MojLogTrace(s_log);
+
+  if (!cachedObject->GetKey().empty()) {
+    boost::unordered_map<std::string, cachedObjectId_t>::iterator iter =
+      m_keyIndex.find(cachedObject->GetKey());
+    if ((iter != m_keyIndex.end()) &&
+	(iter->second == cachedObject->GetId())) {
+      m_keyIndex.erase(iter);
     }
-    ++iter;
   }
 }
 
+// Remember an expired object that is still in the cache so it is
+// removed by the next cleanup of the orphans, and let the listeners
+// know there is one to clean up
+void
+CFileCache::AddOrphan(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  if (m_orphans.insert(objId).second) {
+    GetFileCacheSet()->NotifyObjectOrphaned(m_cacheType, objId);
+  }
+}
+
+// Remember the name of an evicted object, its key or without one its
+// filename, so inserting it again can be counted
+void
+CFileCache::RememberEviction(CCacheObject* cachedObject) {
+
+  MojLogTrace(s_log);
+
+  const std::string& name = cachedObject->GetKey().empty() ?
+    cachedObject->GetFileName() : cachedObject->GetKey();
+  m_evictedNames.push_back(name);
+  m_evictedCounts[name]++;
+  if (m_evictedNames.size() > s_evictionHistory) {
+    // The name may already have been matched by an insert
+    boost::unordered_map<std::string, int>::iterator iter =
+      m_evictedCounts.find(m_evictedNames.front());
+    if ((iter != m_evictedCounts.end()) && (--iter->second == 0)) {
+      m_evictedCounts.erase(iter);
+    }
+    m_evictedNames.pop_front();
+  }
+}
+
+// Change the size of the cache and of the cache set total with it
+void
+CFileCache::AdjustCacheSize(cacheSize_t delta) {
+
+  MojLogTrace(s_log);
+
+  m_cacheSize += delta;
+  GetFileCacheSet()->AddToCacheSize(delta);
+  SnapshotChanged();
+}
+
+// Mark this type and the cache set snapshot as out of date
+void
+CFileCache::SnapshotChanged() {
+
+  MojLogTrace(s_log);
+
+  m_snapshotChanged = true;
+  GetFileCacheSet()->SnapshotChanged();
+}
+
+// Mark an object as out of date along with the type.  Called with
+// the type's lock held whenever the attributes kept in the snapshot
+// change, or the object is added or expired.
+void
+CFileCache::SnapshotChanged(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  m_changedObjects.insert(objId);
+  SnapshotChanged();
+}
+
+// Returns a snapshot of the type, which is the last one if nothing
+// has changed since it was taken.  Only the chunks holding objects
+// that changed are copied, the rest are shared with the last one.
+typeSnapshotPtr_t
+CFileCache::GetSnapshot(const typeSnapshotPtr_t& last) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_lock);
+
+  if (!m_snapshotChanged && last) {
+    return last;
+  }
+
+  CTypeSnapshot* snapshot = new CTypeSnapshot();
+  snapshot->m_size = m_cacheSize;
+  snapshot->m_numObjects = m_numObjects;
+  std::map<cachedObjectId_t, objectSnapshotMap_t> chunks;
+  if (!m_snapshotRebuild && last) {
+    snapshot->m_chunks = last->m_chunks;
+    std::set<cachedObjectId_t>::const_iterator iter;
+    for (iter = m_changedObjects.begin(); iter != m_changedObjects.end();
+	 ++iter) {
+      const cachedObjectId_t chunk = GetSnapshotChunk(*iter);
+      if (chunks.find(chunk) == chunks.end()) {
+	std::map<cachedObjectId_t, objectChunkPtr_t>::const_iterator lastChunk;
+	lastChunk = snapshot->m_chunks.find(chunk);
+	if (lastChunk != snapshot->m_chunks.end()) {
+	  chunks[chunk] = *(*lastChunk).second;
+	}
+      }
+      SnapshotObject(chunks[chunk], *iter);
+    }
+  } else {
+    std::map<cachedObjectId_t, CCacheObject*>::const_iterator iter;
+    for (iter = m_cachedObjects.begin(); iter != m_cachedObjects.end();
+	 ++iter) {
+      SnapshotObject(chunks[GetSnapshotChunk((*iter).first)], (*iter).first);
+    }
+  }
+  std::map<cachedObjectId_t, objectSnapshotMap_t>::iterator chunkIter;
+  for (chunkIter = chunks.begin(); chunkIter != chunks.end(); ++chunkIter) {
+    if ((*chunkIter).second.empty()) {
+      snapshot->m_chunks.erase((*chunkIter).first);
+    } else {
+      objectSnapshotMap_t* objects = new objectSnapshotMap_t();
+      objects->swap((*chunkIter).second);
+      snapshot->m_chunks[(*chunkIter).first] = objectChunkPtr_t(objects);
+    }
+  }
+  m_changedObjects.clear();
+  m_snapshotChanged = false;
+  m_snapshotRebuild = false;
+
+  return typeSnapshotPtr_t(snapshot);
+}
+
+// Copy an object into its chunk of the snapshot if it can still be
+// found by id, or drop it from the chunk if it can't
+void
+CFileCache::SnapshotObject(objectSnapshotMap_t& objects,
+			   const cachedObjectId_t objId) {
+
+  std::map<cachedObjectId_t, CCacheObject*>::const_iterator iter;
+  iter = m_cachedObjects.find(objId);
+  if ((iter == m_cachedObjects.end()) || (*iter).second->isExpired()) {
+    objects.erase(objId);
+    return;
+  }
+  CCacheObject* cachedObject = (*iter).second;
+  CObjectSnapshot& objSnapshot = objects[objId];
+  objSnapshot.m_size = cachedObject->GetSize();
+  objSnapshot.m_written = cachedObject->isWritten();
+  objSnapshot.m_filename = cachedObject->GetFileName();
+}
+
+// Tell the cache set listeners if the cache size has moved across
+// either watermark since the last check.
+void
+CFileCache::CheckThresholds() {
+
+  MojLogTrace(s_log);
+
+  const bool aboveLo = (m_cacheSize > m_loWatermark);
+  const bool aboveHi = (m_cacheSize >= m_hiWatermark);
+  if (aboveLo != m_aboveLoWatermark) {
+    m_aboveLoWatermark = aboveLo;
+    GetFileCacheSet()->NotifyThresholdCrossed(m_cacheType,
+					      ThresholdLoWatermark,
+					      aboveLo, m_cacheSize);
+  }
+  if (aboveHi != m_aboveHiWatermark) {
+    m_aboveHiWatermark = aboveHi;
+    GetFileCacheSet()->NotifyThresholdCrossed(m_cacheType,
+					      ThresholdHiWatermark,
+					      aboveHi, m_cacheSize);
+  }
+  GetFileCacheSet()->CheckTotalSpace();
+}
+
+// Enter the object in the ordered indexes used by ListObjects,
+// replacing any entries made with its previous attribute values.
+void
+CFileCache::IndexObject(CCacheObject* cachedObject) {
+
+  MojLogTrace(s_log);
+
+  const cachedObjectId_t objId = cachedObject->GetId();
+  UnindexObject(objId);
+
+  cacheSize_t sizeInPages = (cachedObject->GetSize() + s_blockSize - 1) /
+    s_blockSize;
+  CIndexKeys keys;
+  keys.m_size = cachedObject->GetSize();
+  keys.m_recency = (long long) cachedObject->GetLastAccessTime();
+  keys.m_cost = (long long) cachedObject->GetCost() * sizeInPages;
+
+  m_sizeIndex.insert(std::make_pair(keys.m_size, objId));
+  m_recencyIndex.insert(std::make_pair(keys.m_recency, objId));
+  m_costIndex.insert(std::make_pair(keys.m_cost, objId));
+  m_indexKeys[objId] = keys;
+
+  // Every change to the access time comes through here, so this is
+  // where an object with a maximum age has its expiry moved on
+  if ((cachedObject->GetMaxAge() > 0) && !cachedObject->isExpired()) {
+    GetFileCacheSet()->ScheduleAging(objId, cachedObject->GetLastAccessTime() +
+				     cachedObject->GetMaxAge());
+  }
+}
+
+// Remove the object from the ordered indexes
+void
+CFileCache::UnindexObject(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  std::map<cachedObjectId_t, CIndexKeys>::iterator iter;
+  iter = m_indexKeys.find(objId);
+  if (iter != m_indexKeys.end()) {
+    m_sizeIndex.erase(std::make_pair((*iter).second.m_size, objId));
+    m_recencyIndex.erase(std::make_pair((*iter).second.m_recency, objId));
+    m_costIndex.erase(std::make_pair((*iter).second.m_cost, objId));
+    m_indexKeys.erase(iter);
+  }
+}
+
+// Return the ordered index for a sort key
+CFileCache::ObjectIndex&
+CFileCache::GetIndex(ObjectSortKey sortBy) {
+
+  MojLogTrace(s_log);
+
+  if (sortBy == SortBySize) {
+    return m_sizeIndex;
+  } else if (sortBy == SortByCost) {
+    return m_costIndex;
+  }
+
+  return m_recencyIndex;
+}
+
 // Validate a subscribed object.
 void
 CFileCache::CheckSubscribedObject(const cachedObjectId_t objId) {
   
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   CCacheObject* cachedObject = GetCacheObjectForId(objId);
   if (cachedObject != NULL) {
     MojLogDebug(s_log, 
@@ -681,11 +1586,14 @@ CFileCache::CleanupDirType() {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_lock);
+
   std::map<cachedObjectId_t, CCacheObject*>::const_iterator iter;
   std::vector<cachedObjectId_t> cleanups;
   iter = m_cachedObjects.begin();
   while (iter != m_cachedObjects.end()) {
-    if ((*iter).second->GetSubscriptionCount() == 0) {
+    if (((*iter).second->GetSubscriptionCount() == 0) &&
+	!(*iter).second->isIOPending()) {
       cleanups.push_back((*iter).first);
     }
     ++iter;
@@ -701,7 +1609,7 @@ CFileCache::CleanupDirType() {
     if (m_cachedObjects[objId]->isExpired()) {
       expired = Expire(objId);
     } else {
-      expired = m_fileCacheSet->ExpireCacheObject(objId);
+      expired = m_fileCacheSet->ExpireCacheObject(objId, ExpireOrphan);
     }
     if (expired) {
       MojLogWarning(s_log, _T("CleanupDirType: Expired object '%llu'."), objId);
@@ -723,7 +1631,7 @@ CFileCache::WriteConfig() {
   std::string pathname(GetFileCacheSet()->GetBaseDirName());
   pathname += "/" + m_cacheType;
 
-  int errVal = ::mkdir(pathname.c_str(), s_dirPerms);
+  int errVal = FsMkdirCall(m_fsStats, pathname, s_dirPerms);
   if (errVal != 0 && errno != EEXIST) {	
     int savedErrno = errno;
     MojLogError(s_log,
@@ -746,11 +1654,13 @@ CFileCache::WriteConfig() {
       outfile << s_defaultCost << " " << m_defaultCost << std::endl;
       outfile << s_defaultLifetime << " " << m_defaultLifetime << std::endl;
       outfile << s_dirType << " " << (m_dirType ? 1 : 0) << std::endl;
+      outfile << s_defaultMaxAge << " " << m_defaultMaxAge << std::endl;
+      const uint64_t written = (uint64_t) outfile.tellp();
       outfile.close();
       bool writeOK = outfile.good();
       if (writeOK) {
 	std::string msgText;
-	writeOK = SyncFile(tmpFile, msgText);
+	writeOK = FsSyncCall(m_fsStats, tmpFile, written, msgText);
 	MojLogDebug(s_log, _T("WriteConfig: SyncFile was %s."),
 		    writeOK ? "successful" : "unsuccessful");
 	if (!writeOK && !msgText.empty()) {
@@ -763,13 +1673,13 @@ CFileCache::WriteConfig() {
       }
 
       if (writeOK) {
-	errVal = ::rename(tmpFile.c_str(), pathname.c_str());
+	errVal = FsRenameCall(m_fsStats, tmpFile, pathname);
 	if (errVal != 0) {
 	  int savedErrno = errno;
 	  MojLogError(s_log,
 		      _T("WriteConfig: Failed to rename temp file '%s' to '%s' (%s)."),
 		      tmpFile.c_str(), pathname.c_str(), ::strerror(savedErrno));
-	  ::unlink(tmpFile.c_str());
+	  FsUnlinkCall(m_fsStats, tmpFile);
 	} else {
 	  retVal = true;
 	}
@@ -830,6 +1740,8 @@ CFileCache::ReadConfig() {
 	  m_dirType = false;
 	}
 	labels.insert(s_dirType);
+      } else if (label == s_defaultMaxAge) {
+	m_defaultMaxAge = value;
       }
     }
     infile.close();
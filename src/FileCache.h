@@ -20,7 +20,14 @@ LICENSE@@@ */
 #define __FILE_CACHE_H__
 
 #include "CacheBase.h"
+#include "CacheLock.h"
 #include "CacheObject.h"
+#include "CacheSnapshot.h"
+#include "FileCacheEvents.h"
+#include "FsStats.h"
+#include "Metrics.h"
+#include "boost/unordered_map.hpp"
+#include <deque>
 
 class CFileCacheSet;
 
@@ -31,6 +38,119 @@ static const std::string s_defaultLifetime("defaultLifetime");
 static const std::string s_defaultCost("defaultCost");
 static const std::string s_dirType("dirType");
 static const uint32_t s_numLabels = 6;
+// Types written before there was a maximum age don't have this one
+static const std::string s_defaultMaxAge("defaultMaxAge");
+
+// The orderings supported when listing the objects in a cache.  Cost
+// orders by the object cost weighted by its size in pages, which is
+// the part of GetCacheCost that doesn't depend on the current time.
+enum ObjectSortKey {
+  SortBySize = 0,
+  SortByRecency,
+  SortByCost
+};
+
+// Describes which objects a ListObjects call should return.  Filters
+// left at their default values don't restrict the result.  The
+// cursor is the opaque value returned with the previous page and is
+// empty to start at the beginning of the ordering.
+class CObjectQuery {
+ public:
+
+  CObjectQuery()
+    : m_minSize(-1)
+    , m_maxSize(-1)
+    , m_accessedBefore(0)
+    , m_accessedAfter(0)
+    , m_subscribed(-1)
+    , m_written(-1)
+    , m_sortBy(SortByRecency)
+    , m_descending(false)
+    , m_limit(s_defaultPageSize) {
+  }
+
+  static const paramValue_t s_defaultPageSize = 50;
+  static const paramValue_t s_maxPageSize = 500;
+  // The most index entries one call looks at.  Filters that don't
+  // match the sort key are checked entry by entry, so a page can
+  // stop short of its limit with a cursor to continue from.
+  static const paramValue_t s_maxEntriesVisited = 4 * s_maxPageSize;
+
+  cacheSize_t m_minSize;
+  cacheSize_t m_maxSize;
+  time_t m_accessedBefore;
+  time_t m_accessedAfter;
+  // -1 matches either state, otherwise 0 or 1
+  int m_subscribed;
+  int m_written;
+  ObjectSortKey m_sortBy;
+  bool m_descending;
+  paramValue_t m_limit;
+  std::string m_cursor;
+};
+
+// The attributes of a cached object as returned by ListObjects
+class CCacheObjectInfo {
+ public:
+
+  CCacheObjectInfo()
+    : m_id(0)
+    , m_size(0)
+    , m_cost(0)
+    , m_lifetime(0)
+    , m_subscriptionCount(0)
+    , m_written(false)
+    , m_creationTime(0)
+    , m_lastAccessTime(0) {
+  }
+
+  cachedObjectId_t m_id;
+  std::string m_pathname;
+  std::string m_filename;
+  cacheSize_t m_size;
+  paramValue_t m_cost;
+  paramValue_t m_lifetime;
+  paramValue_t m_subscriptionCount;
+  bool m_written;
+  time_t m_creationTime;
+  time_t m_lastAccessTime;
+};
+
+// How well a type keeps the objects its clients ask for, counted
+// since the daemon started.  Objects found by the walk at startup
+// aren't counted as inserted.
+class CTypeStats {
+ public:
+
+  CTypeStats()
+    : m_hits(0)
+    , m_misses(0)
+    , m_inserts(0)
+    , m_insertBytes(0)
+    , m_reinserts(0) {
+    for (int i = 0; i < ExpireNumReasons; i++) {
+      m_evictions[i] = 0;
+      m_evictionBytes[i] = 0;
+    }
+  }
+
+  // Subscriptions to written objects
+  uint64_t m_hits;
+  // Lookups by key, and subscriptions by pathname, that found no
+  // object
+  uint64_t m_misses;
+  uint64_t m_inserts;
+  uint64_t m_insertBytes;
+  // Inserts with the key, or without one the filename, of an object
+  // evicted for capacity or age among the last s_evictionHistory
+  uint64_t m_reinserts;
+  // By ExpireReason
+  uint64_t m_evictions[ExpireNumReasons];
+  uint64_t m_evictionBytes[ExpireNumReasons];
+  // Seconds from insert to eviction of the objects evicted for
+  // capacity
+  CLatencyHistogram m_evictionAge;
+};
 
 class CFileCache {
  public:
@@ -40,6 +160,12 @@ class CFileCache {
 
   ~CFileCache();
 
+  // Remove the configuration file of a deleted type and its
+  // directory.  The directory is left if it still holds objects that
+  // couldn't be expired.  This runs on an I/O worker.
+  static void RemoveFromDisk(const std::string& pathname, bool cleanable,
+			     CFsStats* fsStats);
+
   // Configure the cache configuration items.  Returns false if it
   // can't configure the cache based on the specified configuration
   // and continues to use the last configuration if one is available.
@@ -54,8 +180,9 @@ class CFileCache {
   // types.  You must specify the size of the object unless it matches
   // a specified non-zero default size.  If you don't specify non-zero values
   // for the lifetime and cost, the defaults for the cache type or zero will
-  // be used.  The number of objects in the cache will be returned.
-  paramValue_t Insert(CCacheObject* newObj);
+  // be used.  Only isNew objects are counted in the stats.  The number
+  // of objects in the cache will be returned.
+  paramValue_t Insert(CCacheObject* newObj, bool isNew = false);
 
   // Resize the object in the cache.  This is needed when inserting an
   // object where you don't know the final object size.  This is
@@ -71,36 +198,88 @@ class CFileCache {
   // deleted.  CFileCacheSet should remove the cachedObjectId_t from it's
   // m_idMap.  This will return false if the requested item is
   // currently pinned in the cache by a subscription and the object
-  // will be deleted once the subscription expires.
-  bool Expire(const cachedObjectId_t objId);
+  // will be deleted once the subscription expires.  The reason is
+  // passed on to any listeners on the cache set.
+  bool Expire(const cachedObjectId_t objId,
+	      ExpireReason reason = ExpireExplicit);
 
   // Subscribing to an object is the means to pin an object in the
   // cache.  This means that for the duration of the subscription, the
   // object is guaranteed not to be deleted from the cache.  This is also
-  // how you obtain the pathname to the cached object.
-  const std::string Subscribe(std::string& msgText, const cachedObjectId_t objId);
+  // how you obtain the pathname to the cached object.  A streamReader
+  // may subscribe to an object that is still being written.
+  const std::string Subscribe(std::string& msgText, const cachedObjectId_t objId,
+			      bool streamReader = false);
 
   // Unsubscribing an object removes the pin of the object in the
   // cache.  This means that there is no longer any guarantee of available
   // of the object in the cache.
-  void UnSubscribe(const cachedObjectId_t objId);
+  void UnSubscribe(const cachedObjectId_t objId, bool streamReader = false);
+
+  // Called by an object once the I/O workers have created its file.
+  // An object that couldn't be created is expired.
+  void ObjectCreated(const cachedObjectId_t objId, bool created);
+
+  // Called by an object once the I/O workers have made its file
+  // writable for the writer.  An object that couldn't be is expired.
+  void ObjectOpened(const cachedObjectId_t objId, bool opened);
+
+  // Called by an object once a subscription has been released, which
+  // for the writer is after the file has been synced.  failed is set
+  // if the release caused the object to be expired.
+  void ObjectUnSubscribed(const cachedObjectId_t objId, cacheSize_t origSize,
+			  bool failed, bool writer);
 
   // This updates the access time without needing to subscribe, it's
   // like using touch on an existing file
   bool Touch(const cachedObjectId_t objId);
 
+  // Touch a batch of objects, in the order given, under one lock and
+  // with one pass over the recency list.  Ids that aren't in this
+  // cache are ignored.  Returns the number of objects touched.
+  int TouchObjects(const std::vector<cachedObjectId_t>& objIds);
+
   // Get a vector containing pairs of all the objects in the cache and
   // their object IDs.
   std::vector<std::pair<cachedObjectId_t, CCacheObject*> > GetCachedObjects();
 
+  // Get the objects from the least to the most recently used, which
+  // is the order they are inserted in to rebuild the cache.  Returns
+  // false if any object is expired or has I/O in progress, as those
+  // can't be rebuilt from what the object holds.
+  bool GetObjectsByRecency(std::vector<CCacheObject*>& objects);
+
+  // Set the times of an object adopted from a saved cache set
+  bool RestoreTimes(const cachedObjectId_t objId, time_t creationTime,
+		    time_t lastAccessTime);
+
+  // Return one page of the objects matching the query in the
+  // requested order.  The ordered indexes are used to position the
+  // page so the cost is proportional to the page size when the range
+  // filters match the sort key.  No more than s_maxEntriesVisited
+  // entries are looked at, so the page may hold fewer objects than
+  // the limit, or none, while more may follow.  nextCursor is set
+  // when they may.  Returns false if the cursor is not valid.
+  bool ListObjects(const CObjectQuery& query,
+		   std::vector<CCacheObjectInfo>& objects,
+		   std::string& nextCursor);
+
+  // Count a lookup or subscription that found no object
+  void RecordMiss();
+
+  // Copy the stats of the type
+  void GetStats(CTypeStats& stats);
+
   // Check if there is space in the cache for a new object of size
   bool CheckForSize(cacheSize_t size);
 
   // Cleanup this cache
   void Cleanup(cacheSize_t size);
 
-  // Cleanup orphaned objects
-  void CleanupOrphanedObjects();
+  // Cleanup orphaned objects, which are the expired objects that
+  // couldn't be removed when they expired.  Returns how many are
+  // still left.
+  int CleanupOrphanedObjects();
 
   // Get the best object from this cache for cleanup
   cachedObjectId_t GetCleanupCandidate();
@@ -118,6 +297,26 @@ class CFileCache {
   // This returns the filename of a cached object
   const std::string GetObjectFilename(const cachedObjectId_t objId);
 
+  // This returns the number of bytes written so far to a cached
+  // object or -1 if it can't be determined.
+  cacheSize_t GetObjectBytesAvailable(const cachedObjectId_t objId);
+
+  // This returns the id of the active object inserted with the client
+  // key or 0 if there is none.
+  cachedObjectId_t FindObjectByKey(const std::string& key);
+
+  // This returns true if the object is still in the cache and has
+  // not yet been completely written.
+  bool isObjectBeingWritten(const cachedObjectId_t objId);
+
+  // This returns true while the file for a new object is still being
+  // created
+  bool isObjectBeingCreated(const cachedObjectId_t objId);
+
+  // This returns true while the file of an object is still being
+  // made writable for its writer
+  bool isObjectBeingOpened(const cachedObjectId_t objId);
+
   // This returns the file cache type string
   const std::string GetType() { return m_cacheType; }
 
@@ -127,6 +326,9 @@ class CFileCache {
   // Returen the pointer to the CFileCacheSet object that created us.
   CFileCacheSet* GetFileCacheSet() { return m_fileCacheSet; }
 
+  // The filesystem calls made for this type
+  CFsStats* GetFsStats() { return m_fsStats; }
+
   // Return the cumulative size of the cachedObjects
   cacheSize_t GetCacheSize() { return m_cacheSize; }
 
@@ -137,7 +339,7 @@ class CFileCache {
   cacheSize_t CleanupCache(cachedObjectId_t* cleanedId);
 
   // Returns whether true if none of the cached objects are
-  // subscribed, the cache can be cleanly delete
+  // subscribed or have I/O pending, the cache can be cleanly delete
   bool isCleanable();
 
   // Validate a subscribed object.
@@ -146,20 +348,52 @@ class CFileCache {
   // Return if this type is a dirType
   bool isDirType() { return m_dirType; }
 
+  // The lock held by every call that reads or changes the type or
+  // its objects.  The I/O completions for an object take it directly.
+  CCacheMutex& GetLock() { return m_lock; }
+
   // Cleanup any unsubscribed directory types
   void CleanupDirType();
 
+  // Returns a snapshot of the type, which is the last one if nothing
+  // has changed since it was taken.
+  typeSnapshotPtr_t GetSnapshot(const typeSnapshotPtr_t& last);
+
  private:
 
   CFileCache& operator=(const CFileCache&);
 
+  // An ordered index of (key, object id) pairs
+  typedef std::set<std::pair<long long, cachedObjectId_t> > ObjectIndex;
+
+  // The keys an object was last entered in the indexes with
+  class CIndexKeys {
+   public:
+    long long m_size;
+    long long m_recency;
+    long long m_cost;
+  };
+
   CCacheObject* GetCacheObjectForId(const cachedObjectId_t id);
   void UpdateObject(const cachedObjectId_t objId);
+  void IndexObject(CCacheObject* cachedObject);
+  void UnindexObject(const cachedObjectId_t objId);
+  void UnindexKey(CCacheObject* cachedObject);
+  void AddOrphan(const cachedObjectId_t objId);
+  void RememberEviction(CCacheObject* cachedObject);
+  void AdjustCacheSize(cacheSize_t delta);
+  void SnapshotChanged();
+  void SnapshotChanged(const cachedObjectId_t objId);
+  void SnapshotObject(objectSnapshotMap_t& objects,
+		      const cachedObjectId_t objId);
+  void CheckThresholds();
+  ObjectIndex& GetIndex(ObjectSortKey sortBy);
   bool WriteConfig();
   bool ReadConfig();
 
   CFileCacheSet* m_fileCacheSet;
   std::string m_cacheType;
+  CCacheMutex m_lock;
 
   paramValue_t m_numObjects;
   cacheSize_t m_cacheSize;
@@ -168,10 +402,38 @@ class CFileCache {
   cacheSize_t m_defaultSize;
   paramValue_t m_defaultLifetime;
   paramValue_t m_defaultCost;
+  paramValue_t m_defaultMaxAge;
   bool m_dirType;
+  // Which side of the watermarks the cache size was last seen on
+  bool m_aboveLoWatermark;
+  bool m_aboveHiWatermark;
+  // Set when the type has changed since its last snapshot
+  bool m_snapshotChanged;
+  // Set until the first snapshot, which is built from scratch
+  bool m_snapshotRebuild;
+  // The objects changed since the last snapshot
+  std::set<cachedObjectId_t> m_changedObjects;
 
   std::map<cachedObjectId_t, CCacheObject*> m_cachedObjects;
   std::list<cachedObjectId_t> m_cacheList;
+  // Where each object is in m_cacheList, so it can be moved or
+  // removed without searching the list
+  boost::unordered_map<cachedObjectId_t,
+		       std::list<cachedObjectId_t>::iterator> m_cacheListPos;
+  std::map<cachedObjectId_t, CIndexKeys> m_indexKeys;
+  ObjectIndex m_sizeIndex;
+  ObjectIndex m_recencyIndex;
+  ObjectIndex m_costIndex;
+  // Maps client keys to the object inserted with that key
+  boost::unordered_map<std::string, cachedObjectId_t> m_keyIndex;
+  // Expired objects still waiting to be removed
+  std::set<cachedObjectId_t> m_orphans;
+  CTypeStats m_stats;
+  CFsStats* m_fsStats;
+  // The names of the objects last evicted for capacity or age, oldest
+  // first, and how many times each is in the list
+  std::deque<std::string> m_evictedNames;
+  boost::unordered_map<std::string, int> m_evictedCounts;
   static MojLogger s_log;
 };
 
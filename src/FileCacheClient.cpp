@@ -0,0 +1,527 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "FileCacheClient.h"
+#include "LocalProtocol.h"
+#include "SharedIndex.h"
+#include "TouchRing.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// This is linked into other services so it doesn't use the daemon's
+// logging, failures are only reported through the return values.
+
+CFileCacheBatch::CResult::CResult() : m_status(LocalStatusFailed) {
+
+  ::memset(m_values, 0, sizeof(m_values));
+}
+
+CFileCacheBatch::CFileCacheBatch() : m_tag(0) {
+}
+
+int
+CFileCacheBatch::AddSize(unsigned long long objId) {
+
+  return Add(LocalOpSize, 0, objId, std::string(), std::string());
+}
+
+int
+CFileCacheBatch::AddFilename(unsigned long long objId) {
+
+  return Add(LocalOpFilename, 0, objId, std::string(), std::string());
+}
+
+int
+CFileCacheBatch::AddTouch(unsigned long long objId) {
+
+  return Add(LocalOpTouch, 0, objId, std::string(), std::string());
+}
+
+int
+CFileCacheBatch::AddTypeStatus(const std::string& typeName) {
+
+  return Add(LocalOpTypeStatus, 0, 0, typeName, std::string());
+}
+
+int
+CFileCacheBatch::AddCacheStatus() {
+
+  return Add(LocalOpCacheStatus, 0, 0, std::string(), std::string());
+}
+
+int
+CFileCacheBatch::AddLookup(const std::string& typeName,
+			   const std::string& key) {
+
+  return Add(LocalOpLookup, 0, 0, typeName, key);
+}
+
+int
+CFileCacheBatch::AddSubscribe(unsigned long long objId, bool streamReader) {
+
+  return Add(LocalOpSubscribe, streamReader ? s_localFlagStreamReader : 0,
+	     objId, std::string(), std::string());
+}
+
+int
+CFileCacheBatch::AddUnSubscribe(unsigned long long objId, bool streamReader) {
+
+  return Add(LocalOpUnSubscribe, streamReader ? s_localFlagStreamReader : 0,
+	     objId, std::string(), std::string());
+}
+
+void
+CFileCacheBatch::Clear() {
+
+  m_requests.clear();
+  m_results.clear();
+}
+
+int
+CFileCacheBatch::GetStatus(size_t index) const {
+
+  return (index < m_results.size()) ? m_results[index].m_status :
+    (int) LocalStatusBadRequest;
+}
+
+long long
+CFileCacheBatch::GetValue(size_t index, size_t which) const {
+
+  if ((index >= m_results.size()) || (which >= 4)) {
+    return 0;
+  }
+
+  return m_results[index].m_values[which];
+}
+
+const std::string&
+CFileCacheBatch::GetText(size_t index) const {
+
+  static const std::string empty;
+
+  return (index < m_results.size()) ? m_results[index].m_text : empty;
+}
+
+// Append a request to the batch.  The type name and key follow the
+// request itself.
+int
+CFileCacheBatch::Add(unsigned char op, unsigned char flags,
+		     unsigned long long objId, const std::string& typeName,
+		     const std::string& key) {
+
+  const size_t len = sizeof(CLocalHeader) + m_requests.size() +
+    sizeof(CLocalRequest) + typeName.size() + key.size();
+  if ((m_results.size() >= s_localMaxBatch) || (len > s_localMaxMessage)) {
+    return -1;
+  }
+
+  CLocalRequest request;
+  ::memset(&request, 0, sizeof(request));
+  request.m_op = op;
+  request.m_flags = flags;
+  request.m_typeLen = (uint16_t) typeName.size();
+  request.m_keyLen = (uint16_t) key.size();
+  request.m_objId = objId;
+  m_requests.append((const char*) &request, sizeof(request));
+  m_requests.append(typeName);
+  m_requests.append(key);
+  m_results.push_back(CResult());
+
+  return (int) (m_results.size() - 1);
+}
+
+CFileCacheClient::CFileCacheClient() : m_fd(-1), m_nextTag(0)
+  , m_touchRing(new CTouchRing), m_index(new CSharedIndex) {
+}
+
+CFileCacheClient::~CFileCacheClient() {
+
+  Disconnect();
+  delete m_touchRing;
+  delete m_index;
+}
+
+// Connect to the daemon's local socket
+bool
+CFileCacheClient::Connect(const std::string& socketPath) {
+
+  Disconnect();
+
+  struct sockaddr_un addr;
+  if (socketPath.empty() || (socketPath.size() >= sizeof(addr.sun_path))) {
+    return false;
+  }
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  ::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  m_fd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (m_fd < 0) {
+    return false;
+  }
+  if (::connect(m_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    Disconnect();
+    return false;
+  }
+  m_input.resize(s_localMaxMessage);
+
+  return true;
+}
+
+void
+CFileCacheClient::Disconnect() {
+
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_touchRing->Close();
+  m_index->Close();
+}
+
+// Returns the size of an object or -1 if it is not in the cache
+long long
+CFileCacheClient::ObjectSize(unsigned long long objId) {
+
+  CFileCacheBatch batch;
+  batch.AddSize(objId);
+
+  return (Call(batch) && batch.isOk(0)) ? batch.GetValue(0, 0) : -1;
+}
+
+// Returns the filename of an object or an empty string if it is not
+// in the cache
+std::string
+CFileCacheClient::ObjectFilename(unsigned long long objId) {
+
+  CFileCacheBatch batch;
+  batch.AddFilename(objId);
+
+  return (Call(batch) && batch.isOk(0)) ? batch.GetText(0) : std::string();
+}
+
+// Updates the access time of an object, returns false if it is not in
+// the cache
+bool
+CFileCacheClient::Touch(unsigned long long objId) {
+
+  CFileCacheBatch batch;
+  batch.AddTouch(objId);
+
+  return Call(batch) && batch.isOk(0);
+}
+
+// Gets the space and number of objects used by a type.  Returns false
+// if the type doesn't exist.
+bool
+CFileCacheClient::TypeStatus(const std::string& typeName, long long* size,
+			     long long* numObjects) {
+
+  CFileCacheBatch batch;
+  if ((batch.AddTypeStatus(typeName) < 0) || !Call(batch) ||
+      !batch.isOk(0)) {
+    return false;
+  }
+  if (size != NULL) {
+    *size = batch.GetValue(0, 0);
+  }
+  if (numObjects != NULL) {
+    *numObjects = batch.GetValue(0, 1);
+  }
+
+  return true;
+}
+
+// Gets the status of the whole cache as GetCacheStatus does.  Returns
+// the number of types or -1 on failure.
+long long
+CFileCacheClient::CacheStatus(long long* size, long long* numObjects,
+			      long long* availSpace) {
+
+  CFileCacheBatch batch;
+  batch.AddCacheStatus();
+  if (!Call(batch) || !batch.isOk(0)) {
+    return -1;
+  }
+  if (size != NULL) {
+    *size = batch.GetValue(0, 1);
+  }
+  if (numObjects != NULL) {
+    *numObjects = batch.GetValue(0, 2);
+  }
+  if (availSpace != NULL) {
+    *availSpace = batch.GetValue(0, 3);
+  }
+
+  return batch.GetValue(0, 0);
+}
+
+// Returns the id of the object inserted in a type with a key and
+// optionally its size, or 0 if there isn't one
+unsigned long long
+CFileCacheClient::Lookup(const std::string& typeName,
+			 const std::string& key, long long* size) {
+
+  CFileCacheBatch batch;
+  if ((batch.AddLookup(typeName, key) < 0) || !Call(batch) ||
+      !batch.isOk(0)) {
+    return 0;
+  }
+  if (size != NULL) {
+    *size = batch.GetValue(0, 1);
+  }
+
+  return (unsigned long long) batch.GetValue(0, 0);
+}
+
+// Subscribe to an object to keep it in the cache while it's read.
+// Returns its pathname or an empty string on failure.
+std::string
+CFileCacheClient::Subscribe(unsigned long long objId, bool streamReader) {
+
+  CFileCacheBatch batch;
+  batch.AddSubscribe(objId, streamReader);
+
+  return (Call(batch) && batch.isOk(0)) ? batch.GetText(0) : std::string();
+}
+
+bool
+CFileCacheClient::UnSubscribe(unsigned long long objId, bool streamReader) {
+
+  CFileCacheBatch batch;
+  batch.AddUnSubscribe(objId, streamReader);
+
+  return Call(batch) && batch.isOk(0);
+}
+
+// Map the daemon's touch ring so accesses can be recorded with
+// RecordTouch instead of Touch requests.  The ring is attached by
+// Receive when its descriptor arrives with the reply.
+bool
+CFileCacheClient::OpenTouchRing() {
+
+  if (m_touchRing->isOpen()) {
+    return true;
+  }
+  CFileCacheBatch batch;
+  batch.Add(LocalOpTouchRing, 0, 0, std::string(), std::string());
+
+  return Call(batch) && batch.isOk(0) && m_touchRing->isOpen();
+}
+
+// Record an access to an object in the touch ring.  Returns false if
+// the ring isn't open or was full.
+bool
+CFileCacheClient::RecordTouch(unsigned long long objId) {
+
+  return m_touchRing->Push(objId);
+}
+
+// Map the daemon's shared index.  Like the touch ring, it is attached
+// by Receive when its descriptor arrives with the reply.
+bool
+CFileCacheClient::OpenIndex() {
+
+  if (m_index->isOpen()) {
+    return true;
+  }
+  CFileCacheBatch batch;
+  batch.Add(LocalOpIndex, 0, 0, std::string(), std::string());
+
+  return Call(batch) && batch.isOk(0) && m_index->isOpen();
+}
+
+// Look an object up in the shared index.  Returns 1 if it is cached,
+// 0 if it isn't and -1 if the index can't tell.
+int
+CFileCacheClient::IndexLookup(unsigned long long objId, long long* size,
+			      std::string* filename) {
+
+  CSharedIndex::CObject obj;
+  const CSharedIndex::Result result =
+    m_index->Lookup(objId, ((size != NULL) || (filename != NULL)) ? &obj :
+		    NULL);
+  if (result == CSharedIndex::Found) {
+    if (size != NULL) {
+      *size = obj.m_size;
+    }
+    if (filename != NULL) {
+      *filename = obj.m_filename;
+    }
+  }
+
+  return (int) result;
+}
+
+// Get the space and number of objects used by a type from the shared
+// index.  Returns the same as IndexLookup.
+int
+CFileCacheClient::IndexTypeStatus(const std::string& typeName,
+				  long long* size, long long* numObjects) {
+
+  int64_t typeSize = 0;
+  int64_t typeObjects = 0;
+  const CSharedIndex::Result result =
+    m_index->TypeStatus(typeName, &typeSize, &typeObjects);
+  if (result == CSharedIndex::Found) {
+    if (size != NULL) {
+      *size = typeSize;
+    }
+    if (numObjects != NULL) {
+      *numObjects = typeObjects;
+    }
+  }
+
+  return (int) result;
+}
+
+// Send a batch without waiting for its replies
+bool
+CFileCacheClient::Send(CFileCacheBatch& batch) {
+
+  if (m_fd < 0) {
+    return false;
+  }
+
+  CLocalHeader header;
+  ::memset(&header, 0, sizeof(header));
+  header.m_tag = m_nextTag++;
+  header.m_count = (uint16_t) batch.m_results.size();
+  header.m_version = s_localVersion;
+  std::string message((const char*) &header, sizeof(header));
+  message.append(batch.m_requests);
+
+  ssize_t sent;
+  do {
+    sent = ::send(m_fd, message.data(), message.size(), MSG_NOSIGNAL);
+  } while ((sent < 0) && (errno == EINTR));
+  if (sent != (ssize_t) message.size()) {
+    Disconnect();
+    return false;
+  }
+  batch.m_tag = header.m_tag;
+
+  return true;
+}
+
+// Wait for the replies to the oldest batch sent and not yet received,
+// which has to be this one
+bool
+CFileCacheClient::Receive(CFileCacheBatch& batch) {
+
+  if (m_fd < 0) {
+    return false;
+  }
+
+  struct iovec iov;
+  iov.iov_base = &m_input[0];
+  iov.iov_len = m_input.size();
+  char control[CMSG_SPACE(sizeof(int) * s_localMaxBatch)];
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t len;
+  do {
+    len = ::recvmsg(m_fd, &msg, MSG_TRUNC);
+  } while ((len < 0) && (errno == EINTR));
+
+  // The descriptors passed with the reply, in the order of the
+  // replies they belong to
+  std::vector<int> fds;
+  struct cmsghdr* cmsg = (len >= 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+  if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+      (cmsg->cmsg_type == SCM_RIGHTS) &&
+      (cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))) {
+    fds.resize((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    ::memcpy(&fds[0], CMSG_DATA(cmsg), fds.size() * sizeof(int));
+  }
+
+  const bool ok = ReadReplies(batch, len, fds);
+  for (size_t i = 0; i < fds.size(); ++i) {
+    ::close(fds[i]);
+  }
+  if (!ok) {
+    Disconnect();
+  }
+
+  return ok;
+}
+
+// Copy the results out of a reply message and attach any descriptors
+// that came with it
+bool
+CFileCacheClient::ReadReplies(CFileCacheBatch& batch, ssize_t len,
+			      const std::vector<int>& fds) {
+
+  CLocalHeader header;
+  if ((len < (ssize_t) sizeof(header)) ||
+      ((size_t) len > m_input.size())) {
+    return false;
+  }
+  ::memcpy(&header, &m_input[0], sizeof(header));
+  if ((header.m_tag != batch.m_tag) ||
+      (header.m_count != batch.m_results.size())) {
+    return false;
+  }
+
+  const char* reply = &m_input[0];
+  size_t offset = sizeof(header);
+  size_t nextFd = 0;
+  for (size_t i = 0; i < batch.m_results.size(); ++i) {
+    CLocalReply result;
+    if (((size_t) len - offset) < sizeof(result)) {
+      return false;
+    }
+    ::memcpy(&result, reply + offset, sizeof(result));
+    offset += sizeof(result);
+    if (((size_t) len - offset) < result.m_textLen) {
+      return false;
+    }
+    CFileCacheBatch::CResult& out = batch.m_results[i];
+    out.m_status = result.m_status;
+    for (size_t j = 0; j < 4; ++j) {
+      out.m_values[j] = result.m_values[j];
+    }
+    out.m_text.assign(reply + offset, result.m_textLen);
+    offset += result.m_textLen;
+
+    if ((result.m_status == LocalStatusOk) && (nextFd < fds.size())) {
+      if (result.m_op == LocalOpTouchRing) {
+	if (!m_touchRing->isOpen()) {
+	  m_touchRing->Attach(fds[nextFd]);
+	}
+	nextFd++;
+      } else if (result.m_op == LocalOpIndex) {
+	if (!m_index->isOpen()) {
+	  m_index->Attach(fds[nextFd]);
+	}
+	nextFd++;
+      }
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,187 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __FILECACHE_CLIENT_H__
+#define __FILECACHE_CLIENT_H__
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+class CSharedIndex;
+class CTouchRing;
+
+// A batch of requests sent to the daemon in a single message, and
+// once it has been received, their results.  A batch can be reused
+// after Clear.
+class CFileCacheBatch {
+ public:
+  CFileCacheBatch();
+
+  // Each of these returns the index of the request's result, or -1
+  // if the batch is full or the names are too long.
+  int AddSize(unsigned long long objId);
+  int AddFilename(unsigned long long objId);
+  int AddTouch(unsigned long long objId);
+  int AddTypeStatus(const std::string& typeName);
+  int AddCacheStatus();
+  int AddLookup(const std::string& typeName, const std::string& key);
+  int AddSubscribe(unsigned long long objId, bool streamReader = false);
+  int AddUnSubscribe(unsigned long long objId, bool streamReader = false);
+
+  void Clear();
+  size_t GetCount() const { return m_results.size(); }
+
+  // The results, see LocalProtocol.h for the values and text each
+  // request returns.  The status is a LocalStatus.
+  bool isOk(size_t index) const { return GetStatus(index) == 0; }
+  int GetStatus(size_t index) const;
+  long long GetValue(size_t index, size_t which) const;
+  const std::string& GetText(size_t index) const;
+
+ private:
+  friend class CFileCacheClient;
+
+  class CResult {
+   public:
+    CResult();
+
+    int m_status;
+    long long m_values[4];
+    std::string m_text;
+  };
+
+  int Add(unsigned char op, unsigned char flags, unsigned long long objId,
+	  const std::string& typeName, const std::string& key);
+
+  // The requests as they are sent, without the header
+  std::string m_requests;
+  std::vector<CResult> m_results;
+  // The tag the batch was last sent with
+  unsigned int m_tag;
+};
+
+
+// The client side of the local socket protocol, for services on the
+// same device that want to look objects up without a bus call.  The
+// daemon still owns the cache, this only asks it.  A client is not
+// safe to share between threads; use one per thread instead.
+//
+// Requests can be made one at a time or in batches.  Several batches
+// may be sent before their replies are received, which must then be
+// received in the order they were sent.  Every call returns a failure
+// if the request couldn't be made, in which case the client is
+// disconnected and Connect has to be called again.
+class CFileCacheClient {
+ public:
+  CFileCacheClient();
+  ~CFileCacheClient();
+
+  // Connect to the daemon's local socket.  The path is the one set
+  // by localSocket in FileCache.conf.
+  bool Connect(const std::string& socketPath);
+  void Disconnect();
+  bool isConnected() const { return m_fd >= 0; }
+
+  // Returns the size of an object or -1 if it is not in the cache
+  long long ObjectSize(unsigned long long objId);
+
+  // Returns the filename of an object or an empty string if it is
+  // not in the cache
+  std::string ObjectFilename(unsigned long long objId);
+
+  // Updates the access time of an object, returns false if it is not
+  // in the cache
+  bool Touch(unsigned long long objId);
+
+  // Gets the space and number of objects used by a type.  Returns
+  // false if the type doesn't exist.
+  bool TypeStatus(const std::string& typeName, long long* size,
+		  long long* numObjects);
+
+  // Gets the status of the whole cache as GetCacheStatus does.
+  // Returns the number of types or -1 on failure.
+  long long CacheStatus(long long* size, long long* numObjects,
+			long long* availSpace);
+
+  // Returns the id of the object inserted in a type with a key and
+  // optionally its size, or 0 if there isn't one
+  unsigned long long Lookup(const std::string& typeName,
+			    const std::string& key, long long* size = NULL);
+
+  // Subscribe to an object to keep it in the cache while it's read.
+  // Returns its pathname or an empty string on failure.  The
+  // subscription is released by UnSubscribe or when the client
+  // disconnects.
+  std::string Subscribe(unsigned long long objId, bool streamReader = false);
+  bool UnSubscribe(unsigned long long objId, bool streamReader = false);
+
+  // Send a batch without waiting for its replies
+  bool Send(CFileCacheBatch& batch);
+
+  // Wait for the replies to the oldest batch sent and not yet
+  // received, which has to be this one
+  bool Receive(CFileCacheBatch& batch);
+
+  // Send a batch and wait for its replies
+  bool Call(CFileCacheBatch& batch) { return Send(batch) && Receive(batch); }
+
+  // Map the daemon's touch ring so accesses can be recorded with
+  // RecordTouch instead of Touch requests
+  bool OpenTouchRing();
+
+  // Record an access to an object in the touch ring.  The daemon
+  // applies it shortly afterwards, like a Touch.  Returns false if
+  // the ring isn't open or was full, in which case the access is
+  // lost.  This makes no request so it can be called from any thread.
+  bool RecordTouch(unsigned long long objId);
+
+  // Map the daemon's shared index so objects can be looked up with
+  // IndexLookup and IndexTypeStatus without making a request
+  bool OpenIndex();
+
+  // Look an object up in the shared index.  Returns 1 if it is
+  // cached, 0 if it isn't and -1 if the index can't tell, because it
+  // isn't open, was being rewritten or is incomplete, in which case
+  // ObjectSize has to be asked instead.  The index may be up to
+  // s_localTouchInterval milliseconds old (see SharedIndex.h).  This
+  // makes no request so it can be called from any thread.
+  int IndexLookup(unsigned long long objId, long long* size = NULL,
+		  std::string* filename = NULL);
+
+  // Get the space and number of objects used by a type from the
+  // shared index.  Returns the same as IndexLookup.
+  int IndexTypeStatus(const std::string& typeName, long long* size,
+		      long long* numObjects);
+
+ private:
+  CFileCacheClient& operator=(const CFileCacheClient&);
+  CFileCacheClient(const CFileCacheClient&);
+
+  bool ReadReplies(CFileCacheBatch& batch, ssize_t len,
+		   const std::vector<int>& fds);
+
+  int m_fd;
+  unsigned int m_nextTag;
+  CTouchRing* m_touchRing;
+  CSharedIndex* m_index;
+  // Replies are read into this
+  std::vector<char> m_input;
+};
+
+#endif /* __FILECACHE_CLIENT_H__ */
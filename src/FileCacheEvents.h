@@ -0,0 +1,104 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __FILECACHE_EVENTS_H__
+#define __FILECACHE_EVENTS_H__
+
+#include "CacheBase.h"
+
+// Why an object was removed from the cache
+enum ExpireReason {
+  ExpireExplicit = 0,	// a client or type delete asked for it
+  ExpireCapacity,	// evicted to make space
+  ExpireOrphan,		// never completely written or no longer used
+  ExpireAged,		// unused for longer than its maximum age
+  ExpireNumReasons
+};
+
+// The ways a type definition can change
+enum TypeChange {
+  TypeDefined = 0,
+  TypeChanged,
+  TypeDeleted
+};
+
+// The size thresholds that are watched.  The watermarks apply to a
+// single type and the total space to the whole cache set.
+enum CacheThreshold {
+  ThresholdLoWatermark = 0,
+  ThresholdHiWatermark,
+  ThresholdTotalSpace
+};
+
+// Implemented by anything that wants to be told about changes in the
+// cache set.  Listeners are called synchronously from the cache
+// operation that caused the event, on whichever thread made it and
+// with the cache locks held, so they should only record it and must
+// not call back into the cache set.
+class CFileCacheListener {
+ public:
+  virtual ~CFileCacheListener() {}
+
+  // An object is no longer available from the cache.  If it is still
+  // subscribed, the file is removed once the last subscription goes.
+  virtual void ObjectExpired(const std::string& typeName,
+			     const cachedObjectId_t objId,
+			     const std::string& filename,
+			     ExpireReason reason) = 0;
+
+  virtual void TypeModified(const std::string& typeName,
+			    TypeChange change) = 0;
+
+  // The file for a new object has been created, or couldn't be in
+  // which case the object has also expired.
+  virtual void ObjectCreated(const std::string& typeName,
+			     const cachedObjectId_t objId,
+			     bool created) = 0;
+
+  // The file of an object has been made writable for the writer that
+  // subscribed to it, or couldn't be in which case the object has
+  // also expired.
+  virtual void ObjectOpened(const std::string& typeName,
+			    const cachedObjectId_t objId,
+			    bool opened) = 0;
+
+  // The writer of an object has let go and the object is either
+  // written or, if that failed, expired.
+  virtual void ObjectWritten(const std::string& typeName,
+			     const cachedObjectId_t objId,
+			     bool written) = 0;
+
+  // An expired object couldn't be removed yet, because it is still
+  // subscribed or its I/O is pending, and is left for the next
+  // CleanupOrphans.
+  virtual void ObjectOrphaned(const std::string& typeName,
+			      const cachedObjectId_t objId) = 0;
+
+  // An object was given a maximum age deadline earlier than any the
+  // listeners have been told about since ExpireAgedObjects last ran,
+  // which should next be called at due.
+  virtual void AgingScheduled(time_t due) = 0;
+
+  // The size of a type (or for ThresholdTotalSpace, the sum of all
+  // types where typeName is empty) moved above or below a threshold.
+  virtual void ThresholdCrossed(const std::string& typeName,
+				CacheThreshold threshold, bool above,
+				cacheSize_t size) = 0;
+};
+
+#endif /* __FILECACHE_EVENTS_H__ */
@@ -37,14 +37,17 @@ int main(int argc, char** argv) {
   return mainResult;
 }
 
-ServiceApp::ServiceApp() : m_service(true) {
+ServiceApp::ServiceApp() : m_localServer(NULL), m_service(true) {
 
   //  MojLogEngine::instance()->reset(MojLogger::LevelTrace);
 
-  // When creating the service app, walk the directory tree and build
-  // the cache data structures for objects already cached.
+  // When creating the service app, adopt the cache set handed over
+  // by the last daemon or else walk the directory tree and build the
+  // cache data structures for objects already cached.
   m_fileCacheSet = new CFileCacheSet;
-  m_fileCacheSet->WalkDirTree();
+  if (!m_fileCacheSet->LoadState(m_fileCacheSet->GetStateFile())) {
+    m_fileCacheSet->WalkDirTree();
+  }
 
   // This is part of the fix for NOV-128944.
   m_fileCacheSet->CleanupAtStartup();
@@ -63,6 +66,23 @@ MojErr ServiceApp::open() {
   err = m_service.attach(m_reactor.impl());
   MojErrCheck(err);
 
+  // The blocking filesystem work is done off the main loop from here
+  // on, the completions are delivered through it
+  if (!m_fileCacheSet->StartIOWorkers()) {
+    MojLogWarning(s_globalLogger,
+		  _T("ServiceApp: No I/O workers, filesystem work is done in line"));
+  }
+
+  // Trusted clients on the device can also ask the cache directly
+  // unless the local socket has been turned off
+  if (!m_fileCacheSet->GetLocalSocketPath().empty()) {
+    m_localServer = new CLocalServer(m_fileCacheSet);
+    if (!m_localServer->Start(m_fileCacheSet->GetLocalSocketPath())) {
+      MojLogWarning(s_globalLogger,
+		    _T("ServiceApp: Local socket not available, only the bus is served"));
+    }
+  }
+
   m_handler.reset(new CategoryHandler(m_fileCacheSet));
   MojAllocCheck(m_handler.get());
 
@@ -93,5 +113,31 @@ MojErr ServiceApp::open() {
   }
 #endif // #if !defined(TARGET_DESKTOP)
 
+  m_fileCacheSet->GetStartupProfile().SetReady();
+  MojLogInfo(s_globalLogger, _T("ServiceApp: Ready to serve after %llu ms"),
+	     (unsigned long long)
+	     (m_fileCacheSet->GetStartupProfile().GetReadyTime() / 1000000));
+
   return MojErrNone;
 }
+
+// Stop serving and hand the cache set over to the next daemon.  This
+// runs once the main loop has stopped, so nothing else is using the
+// cache set.
+MojErr ServiceApp::close() {
+
+  if (m_localServer != NULL) {
+    m_localServer->Stop();
+  }
+  // The main loop won't deliver the completions of the jobs still
+  // queued, so these are completed as the workers stop.  Otherwise
+  // their objects would stay busy and the state couldn't be saved.
+  m_fileCacheSet->StopIOWorkers();
+  if (!m_fileCacheSet->GetStateFile().empty() &&
+      !m_fileCacheSet->SaveState(m_fileCacheSet->GetStateFile())) {
+    MojLogWarning(s_globalLogger,
+		  _T("ServiceApp: Cache set not saved, the next start walks the cache"));
+  }
+
+  return Base::close();
+}
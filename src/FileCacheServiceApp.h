@@ -24,17 +24,20 @@ LICENSE@@@ */
 #include "luna/MojLunaService.h"
 #include "CategoryHandler.h"
 #include "FileCacheSet.h"
+#include "LocalServer.h"
 
 class ServiceApp : public MojReactorApp<MojGmainReactor> {
  public:
   ServiceApp();
   virtual MojErr open();
+  virtual MojErr close();
 
  private:
   typedef MojReactorApp<MojGmainReactor> Base;
 
   static const char* const ServiceName;
   CFileCacheSet* m_fileCacheSet;
+  CLocalServer* m_localServer;
 
   MojRefCountedPtr<CategoryHandler> m_handler;
   MojLunaService m_service;
@@ -18,7 +18,9 @@
 
 #include "FileCacheSet.h"
 
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <time.h>
 #include <sys/time.h>
 
@@ -27,7 +29,18 @@ namespace fs = boost::filesystem;
 
 MojLogger CFileCacheSet::s_log(_T("filecache.filecacheset"));
 
-CFileCacheSet::CFileCacheSet(bool init) : m_totalCacheSpace(0) {
+CFileCacheSet::CFileCacheSet(bool init) : m_totalCacheSpace(0),
+					  m_cacheSizeTotal(0),
+					  m_aboveTotalSpace(false),
+					  m_snapshotDirty(0),
+					  m_ioWorkerCount(0),
+					  m_removalFailed(false),
+					  m_traceFileSize(0),
+					  m_metricsInterval(0),
+					  m_slowRequestTime(0),
+					  m_stallTime(0),
+					  m_ageWheel(::time(0)),
+					  m_ageNotifiedDue(0) {
 
   MojLogTrace(s_log);
 
@@ -37,7 +50,7 @@ CFileCacheSet::CFileCacheSet(bool init) : m_totalCacheSpace(0) {
 
     // Make sure the cache directory exists and set the correct
     // directory permissions
-    int retVal = ::mkdir(m_baseDirName.c_str(), s_dirPerms);
+    int retVal = FsMkdirCall(&m_fsStats, m_baseDirName, s_dirPerms);
     if (retVal != 0 && errno != EEXIST) {	
       int savedErrno = errno;
       MojLogError(s_log,
@@ -54,6 +67,16 @@ CFileCacheSet::CFileCacheSet(bool init) : m_totalCacheSpace(0) {
   ReadSequenceNumber();
 }
 
+CFileCacheSet::~CFileCacheSet() {
+
+  MojLogTrace(s_log);
+
+  for (std::map<std::string, CFsStats*>::iterator iter =
+	 m_typeFsStats.begin(); iter != m_typeFsStats.end(); ++iter) {
+    delete iter->second;
+  }
+}
+
 // This defines a new cache type and will cause a new CFileCache
 // object to be instantiated.  The typeName must be unique.  The sum
 // of the cache loWatermarks must be less than the total cache space
@@ -64,10 +87,21 @@ CFileCacheSet::DefineType(std::string& msgText, const std::string& typeName,
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheWriteGuard typeGuard(m_typeLock);
+
   msgText = "DefineType: ";
   bool retVal = false;
   CFileCache* fileCache = GetFileCacheForType(typeName);
-  if (fileCache == NULL) {
+  bool removing;
+  {
+    CCacheMutexGuard removalGuard(m_removalLock);
+    removing = (m_removingTypes.find(typeName) != m_removingTypes.end());
+  }
+  if (removing) {
+    msgText += "Type '" + typeName + "' is still being removed.";
+    MojLogWarning(s_log, _T("%s"), msgText.c_str());
+  } else if (fileCache == NULL) {
     CFileCache* newType = new CFileCache(this, typeName);
     if (newType != NULL) {
       if (newType->Configure(params, dirType)) {
@@ -76,6 +110,7 @@ CFileCacheSet::DefineType(std::string& msgText, const std::string& typeName,
         retVal = true;
         msgText += "Created type '" + typeName + "'.";
         MojLogInfo(s_log, _T("%s"), msgText.c_str());
+        NotifyTypeModified(typeName, TypeDefined);
       } else {
         delete newType;
         msgText += "Failed to configure '" + typeName + "'.";
@@ -103,6 +138,9 @@ CFileCacheSet::ChangeType(std::string& msgText, const std::string& typeName,
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheWriteGuard typeGuard(m_typeLock);
+
   msgText = "ChangeType: ";
   bool retVal = false;
   CFileCache* fileCache = GetFileCacheForType(typeName);
@@ -110,6 +148,9 @@ CFileCacheSet::ChangeType(std::string& msgText, const std::string& typeName,
     retVal = fileCache->Configure(params);
     msgText += "Configured type '" + typeName + "'.";
     MojLogInfo(s_log, _T("%s"), msgText.c_str());
+    if (retVal) {
+      NotifyTypeModified(typeName, TypeChanged);
+    }
   } else {
     msgText += "Type '" + typeName + "'does not exist.";
     MojLogWarning(s_log, _T("%s"), msgText.c_str());
@@ -127,6 +168,9 @@ CFileCacheSet::DeleteType(std::string& msgText,
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheWriteGuard typeGuard(m_typeLock);
+
   msgText = "DeleteType: ";
   cacheSize_t retVal = -1;
   CFileCache* fileCache = GetFileCacheForType(typeName);
@@ -150,10 +194,15 @@ CFileCacheSet::DeleteType(std::string& msgText,
 	}
       }
 
+      // Anything that couldn't be expired goes with the type
+      AddToCacheSize(-fileCache->GetCacheSize());
       m_cacheSet.erase(typeName);
       delete fileCache;
+      SnapshotChanged();
       msgText += "Deleted type '" + typeName + "'.";
       MojLogInfo(s_log, _T("%s"), msgText.c_str());
+      NotifyTypeModified(typeName, TypeDeleted);
+      CheckTotalSpace();
     } else {
       msgText += "Type '" + typeName + "' has subscribed objects.";
       MojLogWarning(s_log, _T("%s"), msgText.c_str());
@@ -172,6 +221,8 @@ CFileCacheSet::GetTypes() {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   std::vector<std::string> cacheTypes(m_cacheSet.size());
   std::map<const std::string, CFileCache*>::const_iterator iter;
   iter = m_cacheSet.begin();
@@ -190,6 +241,8 @@ CFileCacheSet::DescribeType(const std::string& typeName) {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   CCacheParamValues params;
   CFileCache* fileCache = GetFileCacheForType(typeName);
   if (fileCache != NULL) {
@@ -231,6 +284,11 @@ CFileCacheSet::CleanupAllTypes(cacheSize_t neededSize) {
   
   MojLogTrace(s_log);
 
+  CTraceSpan span("evictAllTypes");
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+  CCacheMutexGuard spaceGuard(m_spaceLock);
+
   std::map<CFileCache*, const cachedObjectId_t> m_cleanupMap;
   std::map<const std::string, CFileCache*>::const_iterator iter;
   iter = m_cacheSet.begin();
@@ -262,10 +320,12 @@ CFileCacheSet::CleanupAllTypes(cacheSize_t neededSize) {
       break;
     }
     cachedObjectId_t objId = m_cleanupMap[fileCache];
-    // This is part of the fix for bug NOV-128944.
-    cacheSize_t size = GetFilesystemFileSize(CachedObjectSize(objId));
+    // This is part of the fix for bug NOV-128944.  The size is read
+    // from the type, as the snapshot isn't published until the
+    // cleanup is done.
+    cacheSize_t size = GetFilesystemFileSize(fileCache->GetObjectSize(objId));
     m_cleanupMap.erase(fileCache);
-    if (ExpireCacheObject(objId)) {
+    if (ExpireCacheObject(objId, ExpireCapacity)) {
       cleanedSize += size;
     }
     if (cleanedSize < neededSize) {
@@ -284,8 +344,8 @@ CFileCacheSet::CleanupAllTypes(cacheSize_t neededSize) {
 // Insert an object into the cache and returns the object id of that
 // cache object.  The size value must be provided unless the size is
 // the default non-zero size configured for the cache.  Any values
-// provided for cost and lifetime will override the default
-// configuration.
+// provided for cost, lifetime and maximum age will override the
+// default configuration.
 
 // This is the general one for making new cached objects
 cachedObjectId_t
@@ -293,17 +353,23 @@ CFileCacheSet::InsertCacheObject(std::string& msgText,
 				 const std::string& typeName,
 				 const std::string& filename,
 				 cacheSize_t size, paramValue_t cost,
-				 paramValue_t lifetime) {
+				 paramValue_t lifetime,
+				 const std::string& key,
+				 paramValue_t maxAge) {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+  CCacheMutexGuard spaceGuard(m_spaceLock);
+
   msgText = "InsertCacheObject: ";
   cachedObjectId_t retVal = 0;
   CFileCache* fileCache = GetFileCacheForType(typeName);
   if (fileCache != NULL) {
     // If needed, overwrite values with the defaults for that cache
     // type.
-    if ((size == 0) || (cost == 0) || (lifetime == 0)) {
+    if ((size == 0) || (cost == 0) || (lifetime == 0) || (maxAge == 0)) {
       CCacheParamValues params;
       fileCache->Describe(params);
       if (size == 0) {
@@ -315,20 +381,29 @@ CFileCacheSet::InsertCacheObject(std::string& msgText,
       if (lifetime == 0) {
         lifetime = params.GetLifetime();
       }
+      if (maxAge == 0) {
+        maxAge = params.GetMaxAge();
+      }
     }
     // Check to ensure there is space in the cache We do this here so
     // we don't create the CCacheObject if the space doesn't exist
     cacheSize_t fsSize = GetFilesystemFileSize(size);
-    if (!fileCache->CheckForSize(fsSize)) {
-      MojLogInfo(s_log,
-		 _T("InsertCacheObject: Calling Cleanup to make space."));
-      fileCache->Cleanup(fsSize);
+    bool haveSpace;
+    {
+      CTraceSpan span("space");
+      if (!fileCache->CheckForSize(fsSize)) {
+	MojLogInfo(s_log,
+		   _T("InsertCacheObject: Calling Cleanup to make space."));
+	fileCache->Cleanup(fsSize);
+      }
+      haveSpace = fileCache->CheckForSize(fsSize);
     }
-    if (fileCache->CheckForSize(fsSize)) {
+    if (haveSpace) {
+      CTraceSpan span("insert");
       cachedObjectId_t id = GetNextCachedObjectId();
       std::string subText;
       retVal = InsertCacheObject(subText, typeName, filename, id, size,
-				 cost, lifetime, false, true);
+				 cost, lifetime, false, true, key, maxAge);
       if (retVal > 0) {
         msgText += "Inserted new object for filename '" + filename + "'.";
         MojLogInfo(s_log, _T("%s"), msgText.c_str());
@@ -362,24 +437,37 @@ CFileCacheSet::InsertCacheObject(std::string& msgText,
 				 const cachedObjectId_t objectId,
 				 cacheSize_t size, paramValue_t cost,
 				 paramValue_t lifetime, bool written,
-				 bool isNew) {
+				 bool isNew, const std::string& key,
+				 paramValue_t maxAge) {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   cachedObjectId_t retVal = 0;
   CFileCache* fileCache = GetFileCacheForType(typeName);
   if (fileCache != NULL) {
     CCacheObject* newObj = new CCacheObject(fileCache, objectId, filename,
 					    size, cost, lifetime, written,
-					    fileCache->isDirType());
+					    fileCache->isDirType(), key, maxAge);
     if (newObj != NULL) {
-      if (newObj->Initialize(isNew)) {
-        fileCache->Insert(newObj);
-        m_idMap.insert(std::map<const cachedObjectId_t,
+      // The object is entered first so its space is accounted for
+      // while the I/O workers create the file.  If that fails, the
+      // object is expired again.
+      fileCache->Insert(newObj, isNew);
+      {
+	CCacheMutexGuard guard(m_idMapLock);
+	m_idMap.insert(std::map<const cachedObjectId_t,
 		       const std::string>::value_type(objectId, typeName));
+      }
+      if (!newObj->Initialize(isNew)) {
+        ExpireCacheObject(objectId, ExpireOrphan);
+      }
+      // The create may already have been done in line and failed
+      if (!GetTypeForObjectId(objectId).empty()) {
         retVal = objectId;
       } else {
-        delete newObj;
         msgText += "Failed to initialize new object for '" + filename + "'.";
         MojLogError(s_log, _T("%s"), msgText.c_str());
       }
@@ -394,6 +482,77 @@ CFileCacheSet::InsertCacheObject(std::string& msgText,
 
   return retVal;
 }
+
+// Returns the id of the object in a type that was inserted with a
+// client key, or 0 if there isn't one.
+cachedObjectId_t
+CFileCacheSet::FindCacheObjectByKey(const std::string& typeName,
+				    const std::string& key) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  cachedObjectId_t retVal = 0;
+  CFileCache* fileCache = GetFileCacheForType(typeName);
+  if (fileCache != NULL) {
+    retVal = fileCache->FindObjectByKey(key);
+  } else {
+    MojLogWarning(s_log,
+		  _T("FindCacheObjectByKey: Type '%s' does not exists."),
+		  typeName.c_str());
+  }
+
+  return retVal;
+}
+
+// Returns the id of the object in a type that was inserted with a
+// client key.  If there isn't one, a new object is inserted with that
+// key and inserted is set to true.  Returns 0 if the lookup missed
+// and the insert failed.
+cachedObjectId_t
+CFileCacheSet::LookupOrInsertCacheObject(std::string& msgText,
+					 const std::string& typeName,
+					 const std::string& key,
+					 const std::string& filename,
+					 cacheSize_t size,
+					 paramValue_t cost,
+					 paramValue_t lifetime,
+					 bool& inserted,
+					 paramValue_t maxAge) {
+
+  MojLogTrace(s_log);
+
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  inserted = false;
+  cachedObjectId_t retVal = FindCacheObjectByKey(typeName, key);
+  if ((retVal == 0) && TypeExists(typeName)) {
+    RecordMiss(typeName);
+    // Another thread may have inserted an object for the key since
+    // the lookup.  Inserts hold the space lock so look again once it
+    // is held.
+    CCacheMutexGuard spaceGuard(m_spaceLock);
+    retVal = FindCacheObjectByKey(typeName, key);
+    if (retVal == 0) {
+      retVal = InsertCacheObject(msgText, typeName, filename, size, cost,
+				 lifetime, key, maxAge);
+      inserted = (retVal > 0);
+    }
+  }
+  if ((retVal > 0) && !inserted) {
+    MojLogInfo(s_log,
+	       _T("LookupOrInsertCacheObject: Key '%s' found object '%llu'."),
+	       key.c_str(), retVal);
+  } else if (!TypeExists(typeName)) {
+    msgText = "LookupOrInsertCacheObject: Type '" + typeName +
+      "' does not exist.";
+    MojLogError(s_log, _T("%s"), msgText.c_str());
+  }
+
+  return retVal;
+}
  
 // Request to change the size of an object.  This is only valid
 // while the initial writable subscription is in effect.  If there
@@ -405,7 +564,11 @@ CFileCacheSet::Resize(const cachedObjectId_t objId, cacheSize_t newSize) {
 
   MojLogTrace(s_log);
 
-  cacheSize_t retVal = CachedObjectSize(objId);
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+  CCacheMutexGuard spaceGuard(m_spaceLock);
+
+  cacheSize_t retVal = -1;
   const std::string typeName(GetTypeForObjectId(objId));
   if (!typeName.empty()) {
     CFileCache* fileCache = GetFileCacheForType(typeName);
@@ -429,17 +592,21 @@ CFileCacheSet::Resize(const cachedObjectId_t objId, cacheSize_t newSize) {
 // requested item is currently pinned in the cache by a subscription
 // and the object will be deleted once the subscription expires.
 bool
-CFileCacheSet::ExpireCacheObject(const cachedObjectId_t objId) {
+CFileCacheSet::ExpireCacheObject(const cachedObjectId_t objId,
+				 ExpireReason reason) {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   bool retVal = true;
   const std::string typeName(GetTypeForObjectId(objId));
   if (!typeName.empty()) {
     CFileCache* fileCache = GetFileCacheForType(typeName);
     if (fileCache != NULL) {
       RemoveObjectFromIdMap(objId);
-      retVal = fileCache->Expire(objId);
+      retVal = fileCache->Expire(objId, reason);
       if (!retVal) {
 	MojLogInfo(s_log,
 		   _T("ExpireCacheObject: expire deferred, object '%llu' in use"),
@@ -464,16 +631,20 @@ CFileCacheSet::ExpireCacheObject(const cachedObjectId_t objId) {
 // from the cache while the subscription is active.  Returns the
 // file path associated with the objectId.
 const std::string
-CFileCacheSet::SubscribeCacheObject(std::string& msgText, const cachedObjectId_t objId) {
+CFileCacheSet::SubscribeCacheObject(std::string& msgText, const cachedObjectId_t objId,
+				    bool streamReader) {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   std::string retVal("");
   const std::string typeName(GetTypeForObjectId(objId));
   if (!typeName.empty()) {
     CFileCache* fileCache = GetFileCacheForType(typeName);
     if (fileCache != NULL) {
-      retVal = fileCache->Subscribe(msgText, objId);
+      retVal = fileCache->Subscribe(msgText, objId, streamReader);
       if (msgText.empty()) {
 	MojLogInfo(s_log,
 		   _T("SubscribeCacheObject: Object '%llu' subscribed."), objId);
@@ -496,14 +667,18 @@ CFileCacheSet::SubscribeCacheObject(std::string& msgText, const cachedObjectId_t
 // the guarantee that the object will be kept in the cache.
 void 
 CFileCacheSet::UnSubscribeCacheObject(const std::string& typeName,
-				      const cachedObjectId_t objId) {
+				      const cachedObjectId_t objId,
+				      bool streamReader) {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   if (!typeName.empty()) {
     CFileCache* fileCache = GetFileCacheForType(typeName);
     if (fileCache != NULL) {
-      fileCache->UnSubscribe(objId);
+      fileCache->UnSubscribe(objId, streamReader);
       MojLogInfo(s_log,
 		 _T("UnSubscribeCacheObject: Object '%llu' unsubscribed."),
 		 objId);
@@ -526,6 +701,8 @@ CFileCacheSet::Touch(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   bool retVal = false;
   const std::string typeName(GetTypeForObjectId(objId));
   if (!typeName.empty()) {
@@ -546,13 +723,124 @@ CFileCacheSet::Touch(const cachedObjectId_t objId) {
   return retVal;
 }
 
+// Apply a batch of accesses recorded outside of requests, such as
+// through the local touch ring.  The objects are grouped by type so
+// each type is only locked once.  Ids that are no longer in the
+// cache are ignored.  Returns the number of objects touched.
+int
+CFileCacheSet::TouchObjects(const std::vector<cachedObjectId_t>& objIds) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  std::map<std::string, std::vector<cachedObjectId_t> > byType;
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = objIds.begin(); iter != objIds.end(); ++iter) {
+    const std::string typeName(GetTypeForObjectId(*iter));
+    if (!typeName.empty()) {
+      byType[typeName].push_back(*iter);
+    }
+  }
+
+  int touched = 0;
+  std::map<std::string, std::vector<cachedObjectId_t> >::const_iterator
+    typeIter;
+  for (typeIter = byType.begin(); typeIter != byType.end(); ++typeIter) {
+    CFileCache* fileCache = GetFileCacheForType(typeIter->first);
+    if (fileCache != NULL) {
+      touched += fileCache->TouchObjects(typeIter->second);
+    }
+  }
+  MojLogInfo(s_log, _T("TouchObjects: '%d' of '%zu' objects touched."),
+	     touched, objIds.size());
+
+  return touched;
+}
+
+// Expire the objects that haven't been used for longer than their
+// maximum age as of now.  Touching an object moves its deadline on,
+// and an object that is still being written expires the same way as
+// its writer doesn't touch it.  Returns the number expired.
+int
+CFileCacheSet::ExpireAgedObjects(time_t now) {
+
+  MojLogTrace(s_log);
+
+  std::vector<cachedObjectId_t> fired;
+  {
+    CCacheMutexGuard guard(m_ageLock);
+    m_ageWheel.Advance(now, fired);
+    m_ageNotifiedDue = m_ageWheel.NextDue();
+  }
+
+  int expired = 0;
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = fired.begin(); iter != fired.end(); ++iter) {
+    if (!GetTypeForObjectId(*iter).empty()) {
+      ExpireCacheObject(*iter, ExpireAged);
+      expired++;
+    }
+  }
+  if (expired > 0) {
+    MojLogInfo(s_log, _T("ExpireAgedObjects: '%d' objects expired."),
+	       expired);
+  }
+
+  return expired;
+}
+
+// Returns a time no later than the earliest maximum age deadline, or
+// 0 if no object has one
+time_t
+CFileCacheSet::NextAgingDue() {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_ageLock);
+
+  return m_ageWheel.NextDue();
+}
+
+// Set the time an object expires for being unused.  The listeners are
+// only told when this is earlier than anything they already know of,
+// so touching an object doesn't reach them.
+void
+CFileCacheSet::ScheduleAging(const cachedObjectId_t objId, time_t due) {
+
+  MojLogTrace(s_log);
+
+  bool notify = false;
+  {
+    CCacheMutexGuard guard(m_ageLock);
+    m_ageWheel.Schedule(objId, due);
+    if ((m_ageNotifiedDue == 0) || (due < m_ageNotifiedDue)) {
+      m_ageNotifiedDue = due;
+      notify = true;
+    }
+  }
+  if (notify) {
+    NotifyAgingScheduled(due);
+  }
+}
+
+void
+CFileCacheSet::CancelAging(const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_ageLock);
+  m_ageWheel.Cancel(objId);
+}
+
 // Get the current status of the cache as a whole.  The current
 // amount of space used in all the caches will be returned in size.
 // The current number of active cached objects will be returned in
 // numCacheObjects.  The availableSpace is the sum of the cache
 // loWatermark values minus the current amount of space in use.
 // This is the guaranteed amount of space available.  Returns the
-// number of cache types.
+// number of cache types.  This is answered from the snapshot and
+// takes no locks.
 cacheSize_t
 CFileCacheSet::GetCacheStatus(cacheSize_t* size,
 			      paramValue_t* numCacheObjects,
@@ -560,35 +848,23 @@ CFileCacheSet::GetCacheStatus(cacheSize_t* size,
 
   MojLogTrace(s_log);
 
-  cacheSize_t cacheSize = 0;
-  paramValue_t numObjects = 0;
-  std::map<const std::string, CFileCache*>::const_iterator iter;
-  iter = m_cacheSet.begin();
-  while(iter != m_cacheSet.end()) {
-    CFileCache* fileCache = (*iter).second;
-
-    // First accumulate the size and number of objects;
-    cacheSize_t sz;
-    paramValue_t nco;
-    fileCache->GetCacheStatus(&sz, &nco);
-    cacheSize += sz;
-    numObjects += nco;
-    ++iter;
-  }
+  CSnapshotReader reader(m_snapshot);
+  const CCacheSnapshot* snapshot = reader.Get();
 
   MojLogInfo(s_log, 
 	     _T("GetCacheStatus: numtypes = '%zd', size = '%d', numobjs = '%d', space = '%d'"),
-	     m_cacheSet.size(), cacheSize, numObjects,
-	     (SumOfLoWatermarks() - cacheSize));
+	     snapshot->m_types.size(), snapshot->m_size,
+	     snapshot->m_numObjects,
+	     (snapshot->m_sumOfLoWatermarks - snapshot->m_size));
 
   if (size != NULL) {
-    *size = cacheSize;
+    *size = snapshot->m_size;
   }
   if (numCacheObjects != NULL) {
-    *numCacheObjects = numObjects;
+    *numCacheObjects = snapshot->m_numObjects;
   }
   if (availSpace != NULL) {
-    *availSpace = SumOfLoWatermarks() - cacheSize;
+    *availSpace = snapshot->m_sumOfLoWatermarks - snapshot->m_size;
     
     // Part of the fix for NOV-128944.
     if (*availSpace < 0)
@@ -597,12 +873,13 @@ CFileCacheSet::GetCacheStatus(cacheSize_t* size,
     }
   }
 
-  return (cacheSize_t) m_cacheSet.size();
+  return (cacheSize_t) snapshot->m_types.size();
 }
 
 // Gets the current status of a specied cache type.  Returns the
 // amount of space and the number of cached objects used by the
-// items in that cache type.
+// items in that cache type.  This is answered from the snapshot and
+// takes no locks.
 bool
 CFileCacheSet::GetCacheTypeStatus(const std::string& typeName,
 				  cacheSize_t* size,
@@ -610,22 +887,20 @@ CFileCacheSet::GetCacheTypeStatus(const std::string& typeName,
 
   MojLogTrace(s_log);
 
-  bool retVal = false;
-  cacheSize_t cacheSize = 0;
-  paramValue_t numObjects = 0;
+  CSnapshotReader reader(m_snapshot);
 
-  CFileCache* fileCache = GetFileCacheForType(typeName);
-  if (fileCache != NULL) {
-    fileCache->GetCacheStatus(&cacheSize, &numObjects);
+  bool retVal = false;
+  const CTypeSnapshot* typeSnapshot = reader.Get()->GetType(typeName);
+  if (typeSnapshot != NULL) {
     if (size != NULL) {
-      *size = cacheSize;
+      *size = typeSnapshot->m_size;
     }
     if (numCacheObjects != NULL) {
-      *numCacheObjects = numObjects;
+      *numCacheObjects = typeSnapshot->m_numObjects;
     }
     
     MojLogInfo(s_log, _T("GetCacheTypeStatus: size = '%d', numobjs = '%d'"),
-	       cacheSize, numObjects);
+	       typeSnapshot->m_size, typeSnapshot->m_numObjects);
     retVal = true;
   } else {
     MojLogWarning(s_log,
@@ -636,59 +911,126 @@ CFileCacheSet::GetCacheTypeStatus(const std::string& typeName,
   return retVal;
 }
 
+// Copies the hit, miss, insert and eviction counts of a type.  Returns
+// false if there is no such type.
+bool
+CFileCacheSet::GetCacheTypeStats(const std::string& typeName,
+				 CTypeStats& stats) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  CFileCache* fileCache = GetFileCacheForType(typeName);
+  if (fileCache == NULL) {
+    MojLogWarning(s_log,
+		  _T("GetCacheTypeStats: No cache of type '%s' found."),
+		  typeName.c_str());
+    return false;
+  }
+  fileCache->GetStats(stats);
+
+  return true;
+}
+
+// Count a lookup or subscription in a type that found no object.
+// Types that don't exist are ignored.
+void
+CFileCacheSet::RecordMiss(const std::string& typeName) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  CFileCache* fileCache = GetFileCacheForType(typeName);
+  if (fileCache != NULL) {
+    fileCache->RecordMiss();
+  }
+}
+
+// The filesystem stats of a type, created the first time they are
+// asked for.  The calls that belong to no type, such as those on the
+// base directory, are counted by the cache set's own stats.
+CFsStats*
+CFileCacheSet::GetTypeFsStats(const std::string& typeName) {
+
+  MojLogTrace(s_log);
+
+  if (typeName.empty()) {
+    return &m_fsStats;
+  }
+
+  CCacheMutexGuard guard(m_fsStatsLock);
+
+  CFsStats*& fsStats = m_typeFsStats[typeName];
+  if (fsStats == NULL) {
+    fsStats = new CFsStats(&m_fsStats);
+  }
+
+  return fsStats;
+}
+
+// Copies the filesystem counts of every type that has made a call
+void
+CFileCacheSet::GetTypeFsCounts(std::map<std::string, CFsCounts>& typeCounts) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_fsStatsLock);
+
+  typeCounts.clear();
+  for (std::map<std::string, CFsStats*>::const_iterator iter =
+	 m_typeFsStats.begin(); iter != m_typeFsStats.end(); ++iter) {
+    iter->second->GetCounts(typeCounts[iter->first]);
+  }
+}
+
 // Returns the size of a cached object or -1 if the object is no
-// longer in the cache.
+// longer in the cache.  This is answered from the snapshot and takes
+// no locks, so inside a CSnapshotBatch it may not see the changes
+// the batch has made and the type has to be asked instead.
 cacheSize_t
 CFileCacheSet::CachedObjectSize(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CSnapshotReader reader(m_snapshot);
+
   cacheSize_t retVal = -1;
-  const std::string typeName(GetTypeForObjectId(objId));
-  if (!typeName.empty()) {
-    CFileCache* fileCache = GetFileCacheForType(typeName);
-    if (fileCache != NULL) {
-      retVal = fileCache->GetObjectSize(objId);
-      MojLogInfo(s_log,
-		 _T("CachedObjectSize: Object '%llu' is size '%d'."),
-		 objId, retVal);
-    } else {
-      MojLogWarning(s_log,
-		    _T("CachedObjectSize: No cache of type '%s' found for id '%llu'."),
-		    typeName.c_str(), objId);
-    }
+  const CObjectSnapshot* objSnapshot = reader.Get()->GetObject(objId);
+  if (objSnapshot != NULL) {
+    retVal = objSnapshot->m_size;
+    MojLogInfo(s_log,
+	       _T("CachedObjectSize: Object '%llu' is size '%d'."),
+	       objId, retVal);
   } else {
     MojLogWarning(s_log,
-		  _T("CachedObjectSize: Cache type not found for id '%llu'."),
+		  _T("CachedObjectSize: Object not found for id '%llu'."),
 		  objId);
   }
 
   return retVal;
 }
 
-// Returns the filename of a cachedObject
+// Returns the filename of a cachedObject.  This is answered from the
+// snapshot and takes no locks.
 const std::string
 CFileCacheSet::CachedObjectFilename(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CSnapshotReader reader(m_snapshot);
+
   std::string retVal;
-  const std::string typeName(GetTypeForObjectId(objId));
-  if (!typeName.empty()) {
-    CFileCache* fileCache = GetFileCacheForType(typeName);
-    if (fileCache != NULL) {
-      retVal = fileCache->GetObjectFilename(objId);
-      MojLogInfo(s_log,
-		 _T("CachedObjectFilename: Object '%llu' has name '%s'."),
-		 objId, retVal.c_str());
-    } else {
-      MojLogWarning(s_log,
-		    _T("CachedObjectFilename: No cache of type '%s' found for id '%llu'."),
-		    typeName.c_str(), objId);
-    }
+  const CObjectSnapshot* objSnapshot = reader.Get()->GetObject(objId);
+  if (objSnapshot != NULL) {
+    retVal = objSnapshot->m_filename;
+    MojLogInfo(s_log,
+	       _T("CachedObjectFilename: Object '%llu' has name '%s'."),
+	       objId, retVal.c_str());
   } else {
     MojLogWarning(s_log,
-		  _T("CachedObjectFilename: Cache type not found for id '%llu'."),
+		  _T("CachedObjectFilename: Object not found for id '%llu'."),
 		  objId);
   }
 
@@ -696,6 +1038,96 @@ CFileCacheSet::CachedObjectFilename(const cachedObjectId_t objId) {
 
 }
 
+// Copies the types in the current snapshot and returns its
+// generation.  The copies share the snapshot's data so they can be
+// read for as long as needed without holding up the writers.
+uint64_t
+CFileCacheSet::GetSnapshotTypes(std::map<std::string,
+				typeSnapshotPtr_t>& types) {
+
+  MojLogTrace(s_log);
+
+  CSnapshotReader reader(m_snapshot);
+  const CCacheSnapshot* snapshot = reader.Get();
+  types = snapshot->m_types;
+
+  return snapshot->m_generation;
+}
+
+// Rebuild the snapshot from the types that changed since the last
+// one and publish it.  A call that finds nothing changed still waits
+// for any rebuild in progress, as that may be publishing its change.
+void
+CFileCacheSet::PublishSnapshot() {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+  CCacheMutexGuard snapshotGuard(m_snapshotLock);
+
+  if (!__sync_bool_compare_and_swap(&m_snapshotDirty, 1, 0)) {
+    return;
+  }
+
+  const CCacheSnapshot* last = m_snapshot.Current();
+  CCacheSnapshot* snapshot = new CCacheSnapshot();
+  snapshot->m_generation = last->m_generation + 1;
+  std::map<const std::string, CFileCache*>::const_iterator iter;
+  iter = m_cacheSet.begin();
+  while (iter != m_cacheSet.end()) {
+    typeSnapshotPtr_t lastType;
+    std::map<std::string, typeSnapshotPtr_t>::const_iterator lastIter;
+    lastIter = last->m_types.find((*iter).first);
+    if (lastIter != last->m_types.end()) {
+      lastType = (*lastIter).second;
+    }
+    typeSnapshotPtr_t typeSnapshot = (*iter).second->GetSnapshot(lastType);
+    snapshot->m_types[(*iter).first] = typeSnapshot;
+    snapshot->m_size += typeSnapshot->m_size;
+    snapshot->m_numObjects += typeSnapshot->m_numObjects;
+    ++iter;
+  }
+  snapshot->m_sumOfLoWatermarks = SumOfLoWatermarks();
+
+  m_snapshot.Publish(snapshot);
+}
+
+// Returns one page of the objects in a cache type that match the
+// query.  nextCursor is set when more objects may follow and should
+// be passed back in the query to get the next page.  Returns false if
+// the type doesn't exist or the query is invalid.
+bool
+CFileCacheSet::ListCacheObjects(std::string& msgText,
+				const std::string& typeName,
+				const CObjectQuery& query,
+				std::vector<CCacheObjectInfo>& objects,
+				std::string& nextCursor) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  msgText = "ListCacheObjects: ";
+  bool retVal = false;
+  CFileCache* fileCache = GetFileCacheForType(typeName);
+  if (fileCache != NULL) {
+    retVal = fileCache->ListObjects(query, objects, nextCursor);
+    if (retVal) {
+      MojLogInfo(s_log,
+		 _T("ListCacheObjects: Found '%zu' objects in type '%s'."),
+		 objects.size(), typeName.c_str());
+    } else {
+      msgText += "Invalid cursor '" + query.m_cursor + "'.";
+      MojLogWarning(s_log, _T("%s"), msgText.c_str());
+    }
+  } else {
+    msgText += "Type '" + typeName + "' does not exist.";
+    MojLogWarning(s_log, _T("%s"), msgText.c_str());
+  }
+
+  return retVal;
+}
+
 // Read the FileCache configuration file to get the system wide
 // default values
 void
@@ -705,6 +1137,16 @@ CFileCacheSet::ReadConfig(const std::string& configFile) {
 
   m_totalCacheSpace = s_defaultCacheSpace;
   m_baseDirName = s_defaultBaseDirName;
+  m_ioWorkerCount = s_defaultIOWorkers;
+  m_localSocketPath = s_defaultLocalSocket;
+  m_stateFile = s_defaultStateFile;
+  m_traceFile = s_defaultTraceFile;
+  m_traceFileSize = s_defaultTraceFileSize;
+  m_metricsFile.clear();
+  m_metricsInterval = s_defaultMetricsInterval;
+  m_slowRequestTime = s_defaultSlowRequestTime;
+  m_requestTraceFile.clear();
+  m_stallTime = s_defaultStallTime;
 
   std::ifstream infile(configFile.c_str());
   if (infile) {
@@ -719,6 +1161,61 @@ CFileCacheSet::ReadConfig(const std::string& configFile) {
 	infile >> m_baseDirName;
 	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
 		   s_baseDirName.c_str(), m_baseDirName.c_str());
+      } else if (label == s_ioWorkers) {
+	infile >> m_ioWorkerCount;
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%d'."),
+		   s_ioWorkers.c_str(), m_ioWorkerCount);
+      } else if (label == s_localSocket) {
+	infile >> m_localSocketPath;
+	if (m_localSocketPath == s_localSocketNone) {
+	  m_localSocketPath.clear();
+	}
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
+		   s_localSocket.c_str(), m_localSocketPath.c_str());
+      } else if (label == s_stateFile) {
+	infile >> m_stateFile;
+	if (m_stateFile == s_stateFileNone) {
+	  m_stateFile.clear();
+	}
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
+		   s_stateFile.c_str(), m_stateFile.c_str());
+      } else if (label == s_traceFile) {
+	infile >> m_traceFile;
+	if (m_traceFile == s_traceFileNone) {
+	  m_traceFile.clear();
+	}
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
+		   s_traceFile.c_str(), m_traceFile.c_str());
+      } else if (label == s_traceFileSize) {
+	infile >> m_traceFileSize;
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%d'."),
+		   s_traceFileSize.c_str(), m_traceFileSize);
+      } else if (label == s_metricsFile) {
+	infile >> m_metricsFile;
+	if (m_metricsFile == s_metricsFileNone) {
+	  m_metricsFile.clear();
+	}
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
+		   s_metricsFile.c_str(), m_metricsFile.c_str());
+      } else if (label == s_metricsInterval) {
+	infile >> m_metricsInterval;
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%d'."),
+		   s_metricsInterval.c_str(), m_metricsInterval);
+      } else if (label == s_slowRequestTime) {
+	infile >> m_slowRequestTime;
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%d'."),
+		   s_slowRequestTime.c_str(), m_slowRequestTime);
+      } else if (label == s_requestTraceFile) {
+	infile >> m_requestTraceFile;
+	if (m_requestTraceFile == s_requestTraceFileNone) {
+	  m_requestTraceFile.clear();
+	}
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%s'."),
+		   s_requestTraceFile.c_str(), m_requestTraceFile.c_str());
+      } else if (label == s_stallTime) {
+	infile >> m_stallTime;
+	MojLogInfo(s_log, _T("ReadConfig: '%s' = '%d'."),
+		   s_stallTime.c_str(), m_stallTime);
       }
     }
     infile.close();
@@ -774,11 +1271,12 @@ CFileCacheSet::WriteSequenceNumber() {
 		 _T("WriteSequenceNumber: Writing sequence number %d to file '%s'."),
 		 m_sequenceNumber, tmpFile.c_str());
       outfile << m_sequenceNumber << std::endl;
+      const uint64_t written = (uint64_t) outfile.tellp();
       outfile.close();
       bool writeOK = outfile.good();
       if (writeOK) {
 	std::string msgText;
-	writeOK = SyncFile(tmpFile, msgText);
+	writeOK = FsSyncCall(&m_fsStats, tmpFile, written, msgText);
 	MojLogDebug(s_log, _T("WriteSequenceNumber: SyncFile was %s."),
 		    writeOK ? "successful" : "unsuccessful");
 	if (!writeOK && !msgText.empty()) {
@@ -791,13 +1289,13 @@ CFileCacheSet::WriteSequenceNumber() {
       }
 
       if (writeOK) {
-	int retVal = ::rename(tmpFile.c_str(), seqNumFile.c_str());
+	int retVal = FsRenameCall(&m_fsStats, tmpFile, seqNumFile);
 	if (retVal != 0) {
 	  int savedErrno = errno;
 	  MojLogError(s_log,
 		      _T("WriteSequenceNumber: Failed to rename file '%s' to '%s' (%s)."),
 		      tmpFile.c_str(), seqNumFile.c_str(), ::strerror(savedErrno));
-	  ::unlink(tmpFile.c_str());
+	  FsUnlinkCall(&m_fsStats, tmpFile);
 	}
       }
     } else {
@@ -814,6 +1312,8 @@ CFileCacheSet::SumOfLoWatermarks() {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   cacheSize_t lwm = 0;
   std::map<const std::string, CFileCache*>::const_iterator iter;
   iter = m_cacheSet.begin();
@@ -835,17 +1335,9 @@ CFileCacheSet::SumOfCacheSizes() {
 
   MojLogTrace(s_log);
 
-  cacheSize_t sumOfSizes = 0;
-  std::map<const std::string, CFileCache*>::const_iterator iter;
-  iter = m_cacheSet.begin();
-  while(iter != m_cacheSet.end()) {
-    CFileCache* fileCache = (*iter).second;
-    CCacheParamValues params;
-    sumOfSizes += fileCache->Describe(params);
-    ++iter;
-  }
-
-  return sumOfSizes;
+  // The caches keep the sum up to date as their sizes change, so this
+  // doesn't need any of their locks
+  return __sync_add_and_fetch(&m_cacheSizeTotal, 0);
 }
 
 
@@ -855,6 +1347,8 @@ CFileCacheSet::GetTypeForObjectId(const cachedObjectId_t objId) {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_idMapLock);
+
   std::string retVal("");
   std::map<const cachedObjectId_t, const std::string>::iterator iter;
   iter = m_idMap.find(objId);
@@ -871,6 +1365,8 @@ CFileCacheSet::TypeExists(const std::string& typeName) {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   return (m_cacheSet.find(typeName) != m_cacheSet.end());
 }
 
@@ -880,6 +1376,8 @@ CFileCacheSet::isTypeDirType(const std::string& typeName) {
 
   MojLogTrace(s_log);
 
+  CCacheReadGuard typeGuard(m_typeLock);
+
   bool isDirType = false;
   CFileCache* fileCache = GetFileCacheForType(typeName);
   if (fileCache != NULL) {
@@ -905,18 +1403,25 @@ CFileCacheSet::GetFileCacheForType(const std::string& typeName) {
   return retVal;
 }
 
-// Locate and try to cleanup any orphans
-void
+// Locate and try to cleanup any orphans.  Returns how many are still
+// left.
+int
 CFileCacheSet::CleanupOrphans() {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  int numOrphans = 0;
   std::map<const std::string, CFileCache*>::const_iterator iter;
   iter = m_cacheSet.begin();
   while(iter != m_cacheSet.end()) {
-    (*iter).second->CleanupOrphanedObjects();
+    numOrphans += (*iter).second->CleanupOrphanedObjects();
     ++iter;
   }
+
+  return numOrphans;
 }
 
 // Generate a unique object id that isn't duplicated in the set of
@@ -926,6 +1431,8 @@ CFileCacheSet::GetNextCachedObjectId() {
 
   MojLogTrace(s_log);
 
+  CCacheMutexGuard guard(m_sequenceLock);
+
   cachedObjectId_t objId;
   bool validId = false;
 
@@ -966,6 +1473,9 @@ CFileCacheSet::CheckSubscribedObject(const std::string& typeName,
   
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   if (!typeName.empty()) {
     CFileCache* fileCache = GetFileCacheForType(typeName);
     if (fileCache != NULL) {
@@ -983,12 +1493,100 @@ CFileCacheSet::CheckSubscribedObject(const std::string& typeName,
 
 }
 
+// Returns the number of bytes written so far to an object or -1 if
+// the object is no longer in the cache.
+cacheSize_t
+CFileCacheSet::CachedObjectBytesAvailable(const std::string& typeName,
+					  const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  cacheSize_t retVal = -1;
+  if (!typeName.empty()) {
+    CFileCache* fileCache = GetFileCacheForType(typeName);
+    if (fileCache != NULL) {
+      retVal = fileCache->GetObjectBytesAvailable(objId);
+    }
+  }
+
+  return retVal;
+}
+
+// Check if an object is still in the cache and has not yet been
+// completely written.
+bool
+CFileCacheSet::isObjectBeingWritten(const std::string& typeName,
+				    const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  bool retVal = false;
+  if (!typeName.empty()) {
+    CFileCache* fileCache = GetFileCacheForType(typeName);
+    if (fileCache != NULL) {
+      retVal = fileCache->isObjectBeingWritten(objId);
+    }
+  }
+
+  return retVal;
+}
+
+// Check if the file for a new object is still being created.  The
+// object can't be subscribed until it has been.
+bool
+CFileCacheSet::isObjectBeingCreated(const std::string& typeName,
+				    const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  bool retVal = false;
+  if (!typeName.empty()) {
+    CFileCache* fileCache = GetFileCacheForType(typeName);
+    if (fileCache != NULL) {
+      retVal = fileCache->isObjectBeingCreated(objId);
+    }
+  }
+
+  return retVal;
+}
+
+// Check if the file of an object is still being made writable for
+// the writer that has subscribed to it.  The writer shouldn't write
+// it until it has been.
+bool
+CFileCacheSet::isObjectBeingOpened(const std::string& typeName,
+				   const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheReadGuard typeGuard(m_typeLock);
+
+  bool retVal = false;
+  if (!typeName.empty()) {
+    CFileCache* fileCache = GetFileCacheForType(typeName);
+    if (fileCache != NULL) {
+      retVal = fileCache->isObjectBeingOpened(objId);
+    }
+  }
+
+  return retVal;
+}
+
 // Cleanup any unsubscribed directory types
 void
 CFileCacheSet::CleanupDirTypes() {
 
   MojLogTrace(s_log);
 
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+
   std::map<const std::string, CFileCache*>::const_iterator iter;
   iter = m_cacheSet.begin();
   while(iter != m_cacheSet.end()) {
@@ -1048,7 +1646,7 @@ CFileCacheSet::CreateTypeIfNeeded(const std::string& pathname,
 		  typeName.c_str(), msgText.c_str());
       // Since we failed to create a type for this file, we can't
       // really do anything but delete the file.
-      int retVal = ::unlink(pathname.c_str());
+      int retVal = FsUnlinkCall(GetTypeFsStats(typeName), pathname);
       if (retVal != 0) {
 	int savedErrno = errno;
 	MojLogError(s_log,
@@ -1110,8 +1708,8 @@ CFileCacheSet::GetWritten(const std::string& pathname, int* written,
   ProcessStatus stat = CONTINUE;
   // Let's start by checking if this file was completely written as
   // we will remove it if not.
-  ssize_t attrSize = FC_getxattr(pathname.c_str(), "user.w", written,
-				 sizeof(*written));
+  ssize_t attrSize = WalkGetxattr(pathname, "user.w", written,
+				  sizeof(*written), StartupXattrWritten);
   if ((attrSize == -1) || (!(*written))) {
     if (attrSize == -1) {
       int savedErrno = errno;
@@ -1130,7 +1728,7 @@ CFileCacheSet::GetWritten(const std::string& pathname, int* written,
       // returning COMPLETE here will cause this file not to be added
       // to the cache but let the file tree walk continue
       stat = COMPLETE;    
-      int retVal = ::unlink(pathname.c_str());
+      int retVal = WalkRemove(pathname, false);
       if (retVal != 0) {
 	int savedErrno = errno;
 	MojLogError(s_log,
@@ -1139,7 +1737,7 @@ CFileCacheSet::GetWritten(const std::string& pathname, int* written,
 	stat = ERROR;
       }
       const std::string dirpath(GetDirectoryFromPath(pathname.c_str()));
-      retVal = ::rmdir(dirpath.c_str());
+      retVal = WalkRemove(dirpath, true);
       if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
 	// This should also never happen.  If it does we will just print
 	// out the error as there isn't anything we can do about it.
@@ -1150,7 +1748,7 @@ CFileCacheSet::GetWritten(const std::string& pathname, int* written,
       }
     } else if (attrSize == -1) {
       std::string msgText;
-      CleanupDir(pathname, msgText);
+      FsRemoveTreeCall(GetWalkFsStats(pathname), pathname, msgText);
       if (!msgText.empty()) {
 	MojLogDebug(s_log, _T("ProcessFiles: %s."), msgText.c_str());
       }
@@ -1159,7 +1757,12 @@ CFileCacheSet::GetWritten(const std::string& pathname, int* written,
     // If the file was written, make sure the perms are correct as
     // we could have crashed after writing the attribute but before
     // we reset the permissions.
-    int retVal = ::chmod(pathname.c_str(), s_fileROPerms);
+    int retVal;
+    {
+      CStartupTimer timer(m_startupProfile, StartupChmod);
+      retVal = FsChmodCall(GetWalkFsStats(pathname), pathname,
+			   s_fileROPerms);
+    }
     if (retVal != 0) {
       int savedErrno = errno;
       MojLogError(s_log,
@@ -1183,7 +1786,8 @@ CFileCacheSet::GetSize(const std::string& pathname, const struct stat* sb,
   // Now get the size and validate it is correct or else remove the
   // file as it was tampered with after the attributes were written
   // and the cache statistics won't add up.
-  ssize_t attrSize = FC_getxattr(pathname.c_str(), "user.s", size, sizeof(*size));
+  ssize_t attrSize = WalkGetxattr(pathname, "user.s", size, sizeof(*size),
+				  StartupXattrSize);
   if (attrSize == -1) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -1193,7 +1797,7 @@ CFileCacheSet::GetSize(const std::string& pathname, const struct stat* sb,
   }
   // Now check that the size on disk is equal to the specified size
   if (!dirType && ((cacheSize_t) sb->st_size != *size)) {
-    int retVal = ::unlink(pathname.c_str());
+    int retVal = WalkRemove(pathname, false);
     if (retVal != 0) {
       int savedErrno = errno;
       MojLogError(s_log,
@@ -1201,7 +1805,7 @@ CFileCacheSet::GetSize(const std::string& pathname, const struct stat* sb,
 		  pathname.c_str(), ::strerror(savedErrno));
     } else {
       const std::string dirpath(GetDirectoryFromPath(pathname.c_str()));
-      retVal = ::rmdir(dirpath.c_str());
+      retVal = WalkRemove(dirpath, true);
       if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
 	// This should also never happen.  If it does we will just print
 	// out the error as there isn't anything we can do about it.
@@ -1226,8 +1830,8 @@ CFileCacheSet::GetFilename(const std::string& pathname, char* fileName) {
   ProcessStatus stat = CONTINUE;
 
   // Get the real filename from the extended attribute
-  ssize_t attrSize = FC_getxattr(pathname.c_str(), "user.f", fileName,
-				 s_maxFilenameLength);
+  ssize_t attrSize = WalkGetxattr(pathname, "user.f", fileName,
+				  s_maxFilenameLength, StartupXattrFilename);
   if (attrSize == -1) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -1247,7 +1851,8 @@ CFileCacheSet::GetCost(const std::string& pathname, paramValue_t* cost) {
   ProcessStatus stat = CONTINUE;
 
   // Get the code from the extended attribute
-  ssize_t attrSize = FC_getxattr(pathname.c_str(), "user.c", cost, sizeof(*cost));
+  ssize_t attrSize = WalkGetxattr(pathname, "user.c", cost, sizeof(*cost),
+				  StartupXattrCost);
   if (attrSize == -1) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -1267,8 +1872,8 @@ CFileCacheSet::GetLifetime(const std::string& pathname, paramValue_t* lifetime)
   ProcessStatus stat = CONTINUE;
 
   // Get the lifetime from the extended attribute
-  ssize_t attrSize = FC_getxattr(pathname.c_str(), "user.l", lifetime,
-				 sizeof(*lifetime));
+  ssize_t attrSize = WalkGetxattr(pathname, "user.l", lifetime,
+				  sizeof(*lifetime), StartupXattrLifetime);
   if (attrSize == -1) {
     int savedErrno = errno;
     MojLogError(s_log,
@@ -1280,13 +1885,72 @@ CFileCacheSet::GetLifetime(const std::string& pathname, paramValue_t* lifetime)
   return stat;
 }
 
+CFileCacheSet::ProcessStatus
+CFileCacheSet::GetMaxAge(const std::string& pathname, paramValue_t* maxAge) {
+
+  MojLogTrace(s_log);
+
+  ProcessStatus stat = CONTINUE;
+
+  // Get the maximum age from the extended attribute.  It is only set
+  // on objects that have one so a missing attribute is not an error.
+  ssize_t attrSize = WalkGetxattr(pathname, "user.a", maxAge,
+				  sizeof(*maxAge), StartupXattrMaxAge);
+  if (attrSize == -1) {
+    int savedErrno = errno;
+#ifdef MOJ_MAC
+    if (savedErrno != ENOATTR) {
+#else
+    if (savedErrno != ENODATA) {
+#endif // #ifdef MOJ_MAC
+      MojLogError(s_log,
+		  _T("ProcessFiles: Failed to read attribute maxAge on '%s' (%s)."),
+		  pathname.c_str(), ::strerror(savedErrno));
+      stat = ERROR;
+    }
+    *maxAge = 0;
+  }
+
+  return stat;
+}
+
+CFileCacheSet::ProcessStatus
+CFileCacheSet::GetKey(const std::string& pathname, std::string& key) {
+
+  MojLogTrace(s_log);
+
+  ProcessStatus stat = CONTINUE;
+
+  // Get the client key from the extended attribute.  Keys are
+  // optional so a missing attribute is not an error.
+  char keyValue[s_maxKeyLength + 1];
+  ssize_t attrSize = WalkGetxattr(pathname, "user.k", keyValue,
+				  sizeof(keyValue), StartupXattrKey);
+  if (attrSize > 0) {
+    keyValue[attrSize - 1] = '\0';
+    key = keyValue;
+  } else if (attrSize == -1) {
+    int savedErrno = errno;
+#ifdef MOJ_MAC
+    if (savedErrno != ENOATTR) {
+#else
+    if (savedErrno != ENODATA) {
+#endif // #ifdef MOJ_MAC
+      MojLogError(s_log,
+		  _T("ProcessFiles: Failed to read attribute key on '%s' (%s)."),
+		  pathname.c_str(), ::strerror(savedErrno));
+      stat = ERROR;
+    }
+  }
+
+  return stat;
+}
+
 int
 CFileCacheSet::ProcessFiles(const std::string& filepath) {
 
   MojLogTrace(s_log);
 
-  static std::set<std::string> types;
-  static std::string s_dirTypeDir;
   ProcessStatus flowStat = CONTINUE;
 
   char fileName[s_maxFilenameLength];
@@ -1297,7 +1961,12 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
   bool dirType = false;
 
   struct stat buf;
-  if (::stat(filepath.c_str(), &buf) == -1) {
+  int statRet;
+  {
+    CStartupTimer timer(m_startupProfile, StartupStat);
+    statRet = ::stat(filepath.c_str(), &buf);
+  }
+  if (statRet == -1) {
     int savedErrno = errno;
     MojLogError(s_log, _T("ProcessFiles: Failed to stat file '%s' (%s)."),
 		filepath.c_str(), ::strerror(savedErrno));
@@ -1307,11 +1976,11 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
   if ((flowStat == CONTINUE) && S_ISDIR(buf.st_mode) &&
       isTopLevelDirectory(filepath)) {
     flowStat = COMPLETE;
-  } else if (!s_dirTypeDir.empty()) {
-    if (s_dirTypeDir == filepath.substr(0, s_dirTypeDir.length())) {
+  } else if (!m_walkDirTypeDir.empty()) {
+    if (m_walkDirTypeDir == filepath.substr(0, m_walkDirTypeDir.length())) {
       flowStat = COMPLETE;
     } else {
-      s_dirTypeDir.clear();
+      m_walkDirTypeDir.clear();
     }
   }
 
@@ -1319,22 +1988,23 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
     if (S_ISREG(buf.st_mode)) {
       MojLogDebug(s_log, _T("ProcessFiles: processing file '%s'."),
 		  filepath.c_str());
-      flowStat = CheckForSpecialFile(filepath, types);
+      CStartupTimer timer(m_startupProfile, StartupTypeConfig);
+      flowStat = CheckForSpecialFile(filepath, m_walkTypes);
       
       //  Make sure the type has already been defined and define it if
       //  not.  This should never happen since the pre-order traversal
       //  should have processed the type defaults file first but is done
       //  just for safety.
       if (flowStat == CONTINUE) {
-	flowStat = CreateTypeIfNeeded(filepath, typeName, types);
+	flowStat = CreateTypeIfNeeded(filepath, typeName, m_walkTypes);
       }
     } else if (S_ISDIR(buf.st_mode)) {
-      if ((types.find(typeName) != types.end()) && isTypeDirType(typeName) &&
-	  (objectId != 0)) {
+      if ((m_walkTypes.find(typeName) != m_walkTypes.end()) &&
+	  isTypeDirType(typeName) && (objectId != 0)) {
 	dirType = true;
-	s_dirTypeDir = filepath;
+	m_walkDirTypeDir = filepath;
       } else {
-	int retVal = ::rmdir(filepath.c_str());
+	int retVal = WalkRemove(filepath, true);
 	if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
 	  // This should also never happen.  If it does we will just print
 	  // out the error as there isn't anything we can do about it.
@@ -1354,7 +2024,7 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
 
   if ((flowStat == CONTINUE) && (objectId <= 0)) {
     flowStat = COMPLETE;    
-    int retVal = ::unlink(filepath.c_str());
+    int retVal = WalkRemove(filepath, false);
     if (retVal != 0) {
       int savedErrno = errno;
       MojLogError(s_log,
@@ -1365,7 +2035,7 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
       MojLogError(s_log,
 		  _T("ProcessFiles: Unlinked non-cache file '%s'."),
 		  filepath.c_str());
-      retVal = ::rmdir(GetDirectoryFromPath(filepath).c_str());
+      retVal = WalkRemove(GetDirectoryFromPath(filepath), true);
       if ((retVal != 0) && (errno != ENOTEMPTY) && (errno != ENOENT)) {
 	int savedErrno = errno;
 	MojLogError(s_log,
@@ -1405,13 +2075,24 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
     flowStat = GetLifetime(filepath, &lifetime);
   }
 
+  std::string key;
+  if (flowStat == CONTINUE) {
+    flowStat = GetKey(filepath, key);
+  }
+
+  paramValue_t maxAge = 0;
+  if (flowStat == CONTINUE) {
+    flowStat = GetMaxAge(filepath, &maxAge);
+  }
+
   if (flowStat == CONTINUE) {
     MojLogDebug(s_log,
 		_T("ProcessFiles: Path %s yielded objectId %llu and filename %s."),
 		filepath.c_str(), objectId, fileName);
+    CStartupTimer timer(m_startupProfile, StartupInsert);
     InsertCacheObject(msgText, typeName, std::string(fileName),
 		      objectId, size, cost, lifetime,
-		      written ? true : false, false);
+		      written ? true : false, false, key, maxAge);
   }
 
   int retVal = 0;
@@ -1424,6 +2105,36 @@ CFileCacheSet::ProcessFiles(const std::string& filepath) {
   return retVal;
 }
 
+// Read an attribute of a file found by the walk, timed as phase
+ssize_t
+CFileCacheSet::WalkGetxattr(const std::string& pathname, const char* name,
+			    void* value, size_t size, StartupPhase phase) {
+
+  CStartupTimer timer(m_startupProfile, phase);
+
+  return FsGetxattrCall(GetWalkFsStats(pathname), pathname, name, value,
+			size);
+}
+
+// Remove a file or directory found by the walk, timed as StartupRemove
+int
+CFileCacheSet::WalkRemove(const std::string& pathname, bool dir) {
+
+  CStartupTimer timer(m_startupProfile, StartupRemove);
+
+  CFsStats* fsStats = GetWalkFsStats(pathname);
+
+  return dir ? FsRmdirCall(fsStats, pathname) :
+    FsUnlinkCall(fsStats, pathname);
+}
+
+// The filesystem stats of the type a file found by the walk is in
+CFsStats*
+CFileCacheSet::GetWalkFsStats(const std::string& pathname) {
+
+  return GetTypeFsStats(GetTypeNameFromPath(GetBaseDirName(), pathname));
+}
+
 bool
 CFileCacheSet::FileTreeWalk(const std::string& dirName) {
 
@@ -1432,7 +2143,11 @@ CFileCacheSet::FileTreeWalk(const std::string& dirName) {
   bool retVal = true;
   fs::path pathname(dirName);
   fs::directory_iterator endIter;
-  fs::directory_iterator dirIter1(pathname);
+  fs::directory_iterator dirIter1;
+  {
+    CStartupTimer timer(m_startupProfile, StartupReadDir);
+    dirIter1 = fs::directory_iterator(pathname);
+  }
   while ((dirIter1 != endIter) && (retVal == true)) {
     try {
       if (ProcessFiles(dirIter1->path().string()) != 0) {
@@ -1446,13 +2161,27 @@ CFileCacheSet::FileTreeWalk(const std::string& dirName) {
       }
       retVal = false;
     }
+    CStartupTimer timer(m_startupProfile, StartupReadDir);
     ++dirIter1;
   }
-  if (fs::exists(pathname)) {
-    fs::directory_iterator dirIter2(pathname);
+  bool exists;
+  {
+    CStartupTimer timer(m_startupProfile, StartupStat);
+    exists = fs::exists(pathname);
+  }
+  if (exists) {
+    fs::directory_iterator dirIter2;
+    {
+      CStartupTimer timer(m_startupProfile, StartupReadDir);
+      dirIter2 = fs::directory_iterator(pathname);
+    }
     while ((dirIter2 != endIter) && (retVal == true)) {
       try {
-	fs::file_status iterStatus = fs::status(dirIter2->path());
+	fs::file_status iterStatus;
+	{
+	  CStartupTimer timer(m_startupProfile, StartupStat);
+	  iterStatus = fs::status(dirIter2->path());
+	}
 	if (fs::status_known(iterStatus) &&
 	    fs::exists(iterStatus) &&
 	    fs::is_directory(iterStatus)) {
@@ -1463,6 +2192,7 @@ CFileCacheSet::FileTreeWalk(const std::string& dirName) {
 	MojLogError(s_log, _T("FileTreeWalk: %s (%s)"),
 		    ex.what(), ex.code().message().c_str());
       }
+      CStartupTimer timer(m_startupProfile, StartupReadDir);
       ++dirIter2;
     }
   }
@@ -1477,21 +2207,14 @@ CFileCacheSet::WalkDirTree() {
 
   MojLogTrace(s_log);
 
-  int retVal = true;
-#ifdef DEBUG
-  long long startTime;
-  long long stopTime;
-
-#ifdef MOJ_MAC
-  startTime = ::clock() * 1000 / CLOCKS_PER_SEC;
-#else
-  struct timespec tm;
-  ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tm);
-  startTime = tm.tv_sec * 1000LL + tm.tv_nsec / 1000000;
-#endif // #ifdef MOJ_MAC
-#endif // #ifdef DEBUG
+  CSnapshotBatch batch(this);
+  CCacheWriteGuard typeGuard(m_typeLock);
 
-  std::string dirName(GetCacheDirectory());
+  int retVal = true;
+  const uint64_t startTime = CStartupProfile::Now();
+  m_walkTypes.clear();
+  m_walkDirTypeDir.clear();
+  std::string dirName(GetBaseDirName());
   // walk the directory dirName and call ProcessFiles on each
   // entry.
   try {
@@ -1507,17 +2230,12 @@ CFileCacheSet::WalkDirTree() {
     retVal = false;
   }
 
-#ifdef DEBUG
-#ifdef MOJ_MAC
-  stopTime = ::clock() * 1000 / CLOCKS_PER_SEC;
-#else
-  ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tm);
-  stopTime = tm.tv_sec * 1000LL + tm.tv_nsec / 1000000;
-#endif // #ifdef MOJ_MAC
-
-  MojLogDebug(s_log, _T("Walking object directory/files took %lld ms."),
-	      stopTime - startTime);
-#endif // #ifdef DEBUG
+  const uint64_t elapsed = CStartupProfile::Now() - startTime;
+  m_startupProfile.Add(StartupWalk, elapsed);
+  MojLogInfo(s_log,
+	     _T("WalkDirTree: Walking object directory/files took %llu ms for '%llu' objects."),
+	     (unsigned long long) (elapsed / 1000000),
+	     (unsigned long long) m_startupProfile.GetCount(StartupInsert));
 
   return retVal;
 }
@@ -1528,6 +2246,10 @@ CFileCacheSet::WalkDirTree() {
 void
 CFileCacheSet::CleanupAtStartup()
 {
+  CStartupTimer timer(m_startupProfile, StartupCleanup);
+  CSnapshotBatch batch(this);
+  CCacheReadGuard typeGuard(m_typeLock);
+  CCacheMutexGuard spaceGuard(m_spaceLock);
   if (SumOfCacheSizes() > TotalCacheSpace())
   {
   	cacheSize_t overRun = SumOfCacheSizes() - TotalCacheSpace();
@@ -1536,3 +2258,570 @@ CFileCacheSet::CleanupAtStartup()
 	CleanupAllTypes(overRun);
   }
 }
+
+// The saved state starts with this and the version, and ends with
+// the magic again so a truncated file is caught
+static const uint32_t s_stateMagic = 0x46435354;
+static const uint32_t s_stateVersion = 2;
+
+static void
+PutState(std::string& out, uint64_t value) {
+
+  out.append((const char*) &value, sizeof(value));
+}
+
+static void
+PutState(std::string& out, const std::string& value) {
+
+  PutState(out, (uint64_t) value.size());
+  out.append(value);
+}
+
+// Reads back what PutState wrote.  Every get fails once the data has
+// run out.
+class CStateReader {
+ public:
+  CStateReader(const std::string& data) : m_data(data), m_offset(0) {}
+
+  bool Get(uint64_t* value) {
+    if ((m_data.size() - m_offset) < sizeof(*value)) {
+      return false;
+    }
+    ::memcpy(value, m_data.data() + m_offset, sizeof(*value));
+    m_offset += sizeof(*value);
+    return true;
+  }
+
+  bool Get(std::string* value) {
+    uint64_t len;
+    if (!Get(&len) || ((m_data.size() - m_offset) < len)) {
+      return false;
+    }
+    value->assign(m_data, m_offset, (size_t) len);
+    m_offset += (size_t) len;
+    return true;
+  }
+
+  bool AtEnd() { return m_offset == m_data.size(); }
+
+ private:
+  CStateReader& operator=(const CStateReader&);
+  CStateReader(const CStateReader&);
+
+  const std::string& m_data;
+  size_t m_offset;
+};
+
+// An object as saved in the state file
+class CSavedObject {
+ public:
+  uint64_t m_id;
+  uint64_t m_size;
+  uint64_t m_cost;
+  uint64_t m_lifetime;
+  uint64_t m_written;
+  uint64_t m_creationTime;
+  uint64_t m_lastAccessTime;
+  uint64_t m_changeSec;
+  uint64_t m_changeNsec;
+  std::string m_filename;
+  std::string m_key;
+  uint64_t m_maxAge;
+};
+
+// Save the cache set so the next daemon can adopt it with LoadState
+// instead of walking the cache tree.  This is meant to be called at
+// shutdown once nothing else is using the cache set.  The state is
+// tied to the cache tree by a generation counter kept on the base
+// directory, which LoadState moves on, so a state can only be adopted
+// once and only by the next daemon to start.  Returns false if the
+// cache set can't be handed over.
+bool
+CFileCacheSet::SaveState(const std::string& stateFile) {
+
+  MojLogTrace(s_log);
+
+  CCacheWriteGuard typeGuard(m_typeLock);
+
+  if (stateFile.empty()) {
+    return false;
+  }
+  bool removalFailed;
+  {
+    CCacheMutexGuard removalGuard(m_removalLock);
+    removalFailed = m_removalFailed;
+  }
+  if (removalFailed) {
+    MojLogWarning(s_log,
+		  _T("SaveState: Files of expired objects are left, not saving."));
+    return false;
+  }
+
+  const uint64_t generation = ReadGeneration() + 1;
+
+  std::string state;
+  PutState(state, (uint64_t) s_stateMagic);
+  PutState(state, (uint64_t) s_stateVersion);
+  PutState(state, generation);
+  PutState(state, (uint64_t) m_cacheSet.size());
+  std::map<const std::string, CFileCache*>::const_iterator iter;
+  for (iter = m_cacheSet.begin(); iter != m_cacheSet.end(); ++iter) {
+    std::vector<CCacheObject*> objects;
+    if (!(*iter).second->GetObjectsByRecency(objects)) {
+      MojLogWarning(s_log,
+		    _T("SaveState: Type '%s' has objects in use, not saving."),
+		    (*iter).first.c_str());
+      return false;
+    }
+    PutState(state, (*iter).first);
+    PutState(state, (uint64_t) objects.size());
+    std::vector<CCacheObject*>::const_iterator objIter;
+    for (objIter = objects.begin(); objIter != objects.end(); ++objIter) {
+      // The change time of the file shows whether it was touched
+      // after this
+      CCacheObject* cachedObject = *objIter;
+      const std::string pathname(cachedObject->GetPathname());
+      struct stat buf;
+      if (::lstat(pathname.c_str(), &buf) != 0) {
+	int savedErrno = errno;
+	MojLogWarning(s_log, _T("SaveState: Failed to stat '%s' (%s)."),
+		      pathname.c_str(), ::strerror(savedErrno));
+	return false;
+      }
+      PutState(state, (uint64_t) cachedObject->GetId());
+      PutState(state, (uint64_t) cachedObject->GetSize());
+      PutState(state, (uint64_t) cachedObject->GetCost());
+      PutState(state, (uint64_t) cachedObject->GetLifetime());
+      PutState(state, (uint64_t) cachedObject->isWritten());
+      PutState(state, (uint64_t) cachedObject->GetCreationTime());
+      PutState(state, (uint64_t) cachedObject->GetLastAccessTime());
+      PutState(state, (uint64_t) buf.st_ctim.tv_sec);
+      PutState(state, (uint64_t) buf.st_ctim.tv_nsec);
+      PutState(state, cachedObject->GetFileName());
+      PutState(state, cachedObject->GetKey());
+      PutState(state, (uint64_t) cachedObject->GetMaxAge());
+    }
+  }
+  PutState(state, (uint64_t) s_stateMagic);
+
+  // The state is written before the generation so a failure leaves
+  // nothing that could be adopted
+  const std::string tmpFile(stateFile + ".tmp");
+  std::ofstream outfile(tmpFile.c_str(), std::ios::binary | std::ios::trunc);
+  outfile.write(state.data(), state.size());
+  outfile.close();
+  if (!outfile.good() ||
+      (FsRenameCall(&m_fsStats, tmpFile, stateFile) != 0)) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("SaveState: Failed to write '%s' (%s)."),
+		stateFile.c_str(), ::strerror(savedErrno));
+    FsUnlinkCall(&m_fsStats, tmpFile);
+    return false;
+  }
+  if (!WriteGeneration(generation)) {
+    FsUnlinkCall(&m_fsStats, stateFile);
+    return false;
+  }
+  MojLogInfo(s_log, _T("SaveState: Saved '%zu' types at generation '%llu'."),
+	     m_cacheSet.size(), (unsigned long long) generation);
+
+  return true;
+}
+
+// Adopt the cache set saved by the last daemon instead of walking the
+// cache tree.  The state is only used if its generation is the one on
+// the base directory and every object's file is still there, the
+// right size and has the change time it had when the state was saved.  Either way the
+// file is removed and the generation moved on, so a state is never
+// adopted twice.  Returns false if the tree has to be walked.
+bool
+CFileCacheSet::LoadState(const std::string& stateFile) {
+
+  MojLogTrace(s_log);
+
+  CStartupTimer timer(m_startupProfile, StartupLoadState);
+  CSnapshotBatch batch(this);
+  CCacheWriteGuard typeGuard(m_typeLock);
+
+  // The generation is moved on even if there is no state to adopt, in
+  // case one was left by a daemon configured differently
+  const uint64_t expected = ReadGeneration();
+  WriteGeneration(expected + 1);
+  if (stateFile.empty()) {
+    return false;
+  }
+
+  std::string state;
+  std::ifstream infile(stateFile.c_str(), std::ios::binary);
+  if (!infile) {
+    MojLogInfo(s_log, _T("LoadState: No saved state in '%s'."),
+	       stateFile.c_str());
+    return false;
+  }
+  std::ostringstream contents;
+  contents << infile.rdbuf();
+  state = contents.str();
+  infile.close();
+  FsUnlinkCall(&m_fsStats, stateFile);
+
+  // Read and check everything before anything is changed
+  CStateReader reader(state);
+  uint64_t magic = 0;
+  uint64_t version = 0;
+  uint64_t generation = 0;
+  uint64_t numTypes = 0;
+  if (!reader.Get(&magic) || (magic != s_stateMagic) ||
+      !reader.Get(&version) || (version != s_stateVersion) ||
+      !reader.Get(&generation) || !reader.Get(&numTypes)) {
+    MojLogWarning(s_log, _T("LoadState: '%s' is not a saved state."),
+		  stateFile.c_str());
+    return false;
+  }
+  if ((generation != expected) || (generation == 0)) {
+    MojLogWarning(s_log,
+		  _T("LoadState: Saved generation '%llu' is not the current '%llu'."),
+		  (unsigned long long) generation,
+		  (unsigned long long) expected);
+    return false;
+  }
+
+  std::vector<std::pair<std::string, std::vector<CSavedObject> > > types;
+  bool valid = true;
+  for (uint64_t i = 0; valid && (i < numTypes); ++i) {
+    std::string typeName;
+    uint64_t numObjects = 0;
+    valid = reader.Get(&typeName) && reader.Get(&numObjects);
+    if (valid) {
+      types.push_back(std::make_pair(typeName, std::vector<CSavedObject>()));
+    }
+    for (uint64_t j = 0; valid && (j < numObjects); ++j) {
+      CSavedObject obj;
+      valid = reader.Get(&obj.m_id) && reader.Get(&obj.m_size) &&
+	reader.Get(&obj.m_cost) && reader.Get(&obj.m_lifetime) &&
+	reader.Get(&obj.m_written) && reader.Get(&obj.m_creationTime) &&
+	reader.Get(&obj.m_lastAccessTime) && reader.Get(&obj.m_changeSec) &&
+	reader.Get(&obj.m_changeNsec) && reader.Get(&obj.m_filename) &&
+	reader.Get(&obj.m_key) && reader.Get(&obj.m_maxAge);
+      if (!valid) {
+	break;
+      }
+
+      // A file that was changed after the state was saved, even if
+      // only its attributes, has to be checked the slow way
+      const std::string pathname(BuildPathname((cachedObjectId_t) obj.m_id,
+					       GetBaseDirName(), typeName,
+					       obj.m_filename));
+      struct stat buf;
+      if ((::lstat(pathname.c_str(), &buf) != 0) ||
+	  (!S_ISREG(buf.st_mode) && !S_ISDIR(buf.st_mode)) ||
+	  (S_ISREG(buf.st_mode) && obj.m_written &&
+	   ((uint64_t) buf.st_size != obj.m_size)) ||
+	  ((uint64_t) buf.st_ctim.tv_sec != obj.m_changeSec) ||
+	  ((uint64_t) buf.st_ctim.tv_nsec != obj.m_changeNsec)) {
+	MojLogWarning(s_log, _T("LoadState: '%s' changed since it was saved."),
+		      pathname.c_str());
+	valid = false;
+	break;
+      }
+      types.back().second.push_back(obj);
+    }
+  }
+  uint64_t endMagic = 0;
+  if (!valid || !reader.Get(&endMagic) || (endMagic != s_stateMagic) ||
+      !reader.AtEnd()) {
+    MojLogWarning(s_log, _T("LoadState: Saved state is not valid."));
+    return false;
+  }
+
+  // The types read their configuration from the tree, the same as
+  // when it is walked, and the objects are inserted from the least
+  // recently used so the recency order comes out the same.  An object
+  // that wasn't completely written is removed, again as the walk
+  // would.
+  size_t numObjects = 0;
+  std::vector<std::pair<std::string, std::vector<CSavedObject> > >::const_iterator typeIter;
+  for (typeIter = types.begin(); typeIter != types.end(); ++typeIter) {
+    const std::string& typeName = (*typeIter).first;
+    std::string msgText;
+    if (!TypeExists(typeName) && !DefineType(msgText, typeName)) {
+      MojLogError(s_log, _T("LoadState: Failed to define type '%s' (%s)."),
+		  typeName.c_str(), msgText.c_str());
+      continue;
+    }
+    CFileCache* fileCache = GetFileCacheForType(typeName);
+    const bool dirType = fileCache->isDirType();
+    std::vector<CSavedObject>::const_iterator objIter;
+    for (objIter = (*typeIter).second.begin();
+	 objIter != (*typeIter).second.end(); ++objIter) {
+      const CSavedObject& obj = *objIter;
+      const cachedObjectId_t objId =
+	InsertCacheObject(msgText, typeName, obj.m_filename,
+			  (cachedObjectId_t) obj.m_id,
+			  (cacheSize_t) obj.m_size,
+			  (paramValue_t) obj.m_cost,
+			  (paramValue_t) obj.m_lifetime, obj.m_written != 0,
+			  false, obj.m_key, (paramValue_t) obj.m_maxAge);
+      if (objId == 0) {
+	continue;
+      }
+      if (!obj.m_written && !dirType) {
+	ExpireCacheObject(objId, ExpireOrphan);
+	continue;
+      }
+      fileCache->RestoreTimes(objId, (time_t) obj.m_creationTime,
+			      (time_t) obj.m_lastAccessTime);
+      numObjects++;
+    }
+  }
+  MojLogInfo(s_log,
+	     _T("LoadState: Adopted '%zu' types and '%zu' objects from '%s'."),
+	     types.size(), numObjects, stateFile.c_str());
+
+  return true;
+}
+
+// The generation of the saved state that matches the cache tree, kept
+// as an attribute of the base directory.  Returns 0 if there isn't
+// one.
+uint64_t
+CFileCacheSet::ReadGeneration() {
+
+  MojLogTrace(s_log);
+
+  uint64_t generation = 0;
+  if (FsGetxattrCall(&m_fsStats, GetBaseDirName(), "user.g", &generation,
+		     sizeof(generation)) != (ssize_t) sizeof(generation)) {
+    generation = 0;
+  }
+
+  return generation;
+}
+
+bool
+CFileCacheSet::WriteGeneration(uint64_t generation) {
+
+  MojLogTrace(s_log);
+
+  if (FsSetxattrCall(&m_fsStats, GetBaseDirName(), "user.g", &generation,
+		     sizeof(generation), 0) != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log,
+		_T("WriteGeneration: Failed to set generation on '%s' (%s)."),
+		GetBaseDirName().c_str(), ::strerror(savedErrno));
+    return false;
+  }
+
+  return true;
+}
+
+// Register a listener for cache events.  The cache set does not own
+// its listeners.
+void
+CFileCacheSet::AddListener(CFileCacheListener* listener) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  if (std::find(m_listeners.begin(), m_listeners.end(), listener) ==
+      m_listeners.end()) {
+    m_listeners.push_back(listener);
+  }
+}
+
+// Remove a previously registered listener
+void
+CFileCacheSet::RemoveListener(CFileCacheListener* listener) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  m_listeners.erase(std::remove(m_listeners.begin(), m_listeners.end(),
+				listener), m_listeners.end());
+}
+
+void
+CFileCacheSet::NotifyObjectExpired(const std::string& typeName,
+				   const cachedObjectId_t objId,
+				   const std::string& filename,
+				   ExpireReason reason) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ObjectExpired(typeName, objId, filename, reason);
+  }
+}
+
+void
+CFileCacheSet::NotifyObjectCreated(const std::string& typeName,
+				   const cachedObjectId_t objId,
+				   bool created) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ObjectCreated(typeName, objId, created);
+  }
+}
+
+void
+CFileCacheSet::NotifyObjectOpened(const std::string& typeName,
+				  const cachedObjectId_t objId,
+				  bool opened) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ObjectOpened(typeName, objId, opened);
+  }
+}
+
+void
+CFileCacheSet::NotifyObjectWritten(const std::string& typeName,
+				   const cachedObjectId_t objId,
+				   bool written) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ObjectWritten(typeName, objId, written);
+  }
+}
+
+void
+CFileCacheSet::NotifyObjectOrphaned(const std::string& typeName,
+				    const cachedObjectId_t objId) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ObjectOrphaned(typeName, objId);
+  }
+}
+
+void
+CFileCacheSet::NotifyAgingScheduled(time_t due) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->AgingScheduled(due);
+  }
+}
+
+void
+CFileCacheSet::NotifyThresholdCrossed(const std::string& typeName,
+				      CacheThreshold threshold, bool above,
+				      cacheSize_t size) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  MojLogDebug(s_log,
+	      _T("NotifyThresholdCrossed: Type '%s' now %s threshold '%d' at size '%d'."),
+	      typeName.c_str(), above ? "above" : "below", threshold, size);
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->ThresholdCrossed(typeName, threshold, above, size);
+  }
+}
+
+void
+CFileCacheSet::NotifyTypeModified(const std::string& typeName,
+				  TypeChange change) {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  std::vector<CFileCacheListener*>::const_iterator iter;
+  for (iter = m_listeners.begin(); iter != m_listeners.end(); ++iter) {
+    (*iter)->TypeModified(typeName, change);
+  }
+}
+
+// Check whether the sum of the cache sizes has moved across the total
+// cache space and tell the listeners if it has
+void
+CFileCacheSet::CheckTotalSpace() {
+
+  MojLogTrace(s_log);
+
+  CCacheMutexGuard guard(m_listenerLock);
+
+  // Nobody needs to know if nobody is listening
+  if (!m_listeners.empty()) {
+    const cacheSize_t size = SumOfCacheSizes();
+    const bool above = (size >= TotalCacheSpace());
+    if (above != m_aboveTotalSpace) {
+      m_aboveTotalSpace = above;
+      NotifyThresholdCrossed(std::string(), ThresholdTotalSpace, above, size);
+    }
+  }
+}
+
+// Start the configured number of I/O worker threads.  Until this is
+// called, or if no workers are configured, the blocking filesystem
+// work is done in line.
+bool
+CFileCacheSet::StartIOWorkers() {
+
+  MojLogTrace(s_log);
+
+  return m_ioWorkers.Start(m_ioWorkerCount);
+}
+
+void
+CFileCacheSet::StopIOWorkers() {
+
+  MojLogTrace(s_log);
+
+  m_ioWorkers.Stop();
+}
+
+// Called by the jobs that remove a deleted type, which can't be
+// defined again until its directory is gone, and by those that remove
+// an expired object when the file can't be removed
+void
+CFileCacheSet::TypeRemovalQueued(const std::string& typeName) {
+
+  CCacheMutexGuard guard(m_removalLock);
+  m_removingTypes.insert(typeName);
+}
+
+void
+CFileCacheSet::TypeRemovalDone(const std::string& typeName) {
+
+  CCacheMutexGuard guard(m_removalLock);
+  m_removingTypes.erase(typeName);
+}
+
+// The file is left behind, so the state isn't saved and the next
+// start walks the tree, which takes it back into account
+void
+CFileCacheSet::ObjectRemovalFailed() {
+
+  CCacheMutexGuard guard(m_removalLock);
+  m_removalFailed = true;
+}
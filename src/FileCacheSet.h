@@ -20,22 +20,39 @@ LICENSE@@@ */
 #define __FILE_CACHE_SET_H__
 
 #include "CacheBase.h"
+#include "CacheLock.h"
 #include "CacheObject.h"
+#include "CacheSnapshot.h"
 #include "FileCache.h"
+#include "FsStats.h"
+#include "IOWorkerPool.h"
+#include "RequestTrace.h"
+#include "StartupProfile.h"
+#include "TimingWheel.h"
 
 static const std::string s_totalCacheSpace("totalCacheSpace");
 static const std::string s_baseDirName("baseDirName");
+static const std::string s_ioWorkers("ioWorkers");
+static const std::string s_localSocket("localSocket");
+static const std::string s_localSocketNone("none");
+static const std::string s_stateFile("stateFile");
+static const std::string s_stateFileNone("none");
+static const std::string s_traceFile("traceFile");
+static const std::string s_traceFileNone("none");
+static const std::string s_traceFileSize("traceFileSize");
+static const std::string s_metricsFile("metricsFile");
+static const std::string s_metricsFileNone("none");
+static const std::string s_metricsInterval("metricsInterval");
+static const std::string s_slowRequestTime("slowRequestTime");
+static const std::string s_requestTraceFile("requestTraceFile");
+static const std::string s_requestTraceFileNone("none");
+static const std::string s_stallTime("stallTime");
 static const std::string s_seqNumFilename(".sequenceNumber");
 
-inline ssize_t FC_getxattr(const char* path, const char* name,  void* value,
-		       size_t size) {
-#ifdef MOJ_MAC
-  return ::getxattr(path, name, value, size, 0, 0);
-#else
-  return ::getxattr(path, name, value, size);
-#endif // #ifdef MOJ_MAC
-}
-
+// The cache set may be called from any number of threads.  See
+// CacheLock.h for the locks used and the order they are taken in.
+// The status and size queries don't take any locks, see
+// CacheSnapshot.h.
 class CFileCacheSet {
  public:
 
@@ -85,12 +102,15 @@ class CFileCacheSet {
   // provided for cost and lifetime will override the default
   // configuration.
 
-  // This is the general one for making new cached objects
+  // This is the general one for making new cached objects.  If a key
+  // is given the object can later be found by that key.
   cachedObjectId_t InsertCacheObject(std::string& msgText,
 				     const std::string& typeName,
 				     const std::string& filename,
 				     cacheSize_t size, paramValue_t cost = 0,
-				     paramValue_t lifetime = 0);
+				     paramValue_t lifetime = 0,
+				     const std::string& key = std::string(),
+				     paramValue_t maxAge = 0);
 
   // This one is used on start-up when rebuilding from the filesystem
   cachedObjectId_t InsertCacheObject(std::string& msgText,
@@ -99,7 +119,28 @@ class CFileCacheSet {
 				     const cachedObjectId_t objectId,
 				     cacheSize_t size, paramValue_t cost,
 				     paramValue_t lifetime, bool written,
-				     bool isNew);
+				     bool isNew,
+				     const std::string& key = std::string(),
+				     paramValue_t maxAge = 0);
+
+  // Returns the id of the object in a type that was inserted with a
+  // client key, or 0 if there isn't one.
+  cachedObjectId_t FindCacheObjectByKey(const std::string& typeName,
+					const std::string& key);
+
+  // Returns the id of the object in a type that was inserted with a
+  // client key.  If there isn't one, a new object is inserted with
+  // that key and inserted is set to true.  Returns 0 if the lookup
+  // missed and the insert failed.
+  cachedObjectId_t LookupOrInsertCacheObject(std::string& msgText,
+					     const std::string& typeName,
+					     const std::string& key,
+					     const std::string& filename,
+					     cacheSize_t size,
+					     paramValue_t cost,
+					     paramValue_t lifetime,
+					     bool& inserted,
+					     paramValue_t maxAge = 0);
 
   // Request to change the size of an object.  This is only valid
   // while the initial writable subscription is in effect.  If there
@@ -112,26 +153,51 @@ class CFileCacheSet {
   // be deleted from the cache.  This will return false if the
   // requested item is currently pinned in the cache by a subscription
   // and the object will be deleted once the subscription expires.
-  bool ExpireCacheObject(const cachedObjectId_t objId);
+  bool ExpireCacheObject(const cachedObjectId_t objId,
+			 ExpireReason reason = ExpireExplicit);
 
   // Pin an object in the cache by allowing a client to subscribe to
   // the object.  This will guarantee the object will not be removed
   // from the cache while the subscription is active.  Returns the
-  // file path associated with the objectId.
-  const std::string SubscribeCacheObject(std::string& msgText, const cachedObjectId_t objId);
+  // file path associated with the objectId.  A streamReader may
+  // subscribe to an object that is still being written and read it
+  // as it grows.
+  const std::string SubscribeCacheObject(std::string& msgText, const cachedObjectId_t objId,
+					 bool streamReader = false);
 
   // Remove the client subscription of an object.  This will remove
   // the guarantee that the object will be kept in the cache.
   void UnSubscribeCacheObject(const std::string& typeName,
-			      const cachedObjectId_t objId);
+			      const cachedObjectId_t objId,
+			      bool streamReader = false);
 
   // This updates the access time without needing to subscribe, it's
   // like using touch on an existing file
   bool Touch(const cachedObjectId_t objId);
 
+  // Apply a batch of accesses recorded outside of requests, such as
+  // through the local touch ring.  Ids that are no longer in the
+  // cache are ignored.  Returns the number of objects touched.
+  int TouchObjects(const std::vector<cachedObjectId_t>& objIds);
+
+  // Expire the objects that haven't been used for longer than their
+  // maximum age as of now.  Returns the number expired.
+  int ExpireAgedObjects(time_t now);
+
+  // Returns a time no later than the earliest maximum age deadline,
+  // when ExpireAgedObjects should next be called, or 0 if no object
+  // has one.
+  time_t NextAgingDue();
+
+  // Set or clear the time an object with a maximum age expires.
+  // These are called by the caches as objects are indexed.
+  void ScheduleAging(const cachedObjectId_t objId, time_t due);
+  void CancelAging(const cachedObjectId_t objId);
+
   // This will remove an object id from the id map and make it an
   // orphan to be cleaned up on expiration
   void RemoveObjectFromIdMap(const cachedObjectId_t objId) {
+    CCacheMutexGuard guard(m_idMapLock);
     m_idMap.erase(objId);
   }
 
@@ -152,13 +218,55 @@ class CFileCacheSet {
   bool GetCacheTypeStatus(const std::string& typeName, cacheSize_t* size,
 			  paramValue_t* numCacheObjects);
 
+  // Copies the hit, miss, insert and eviction counts of a type.
+  // Returns false if there is no such type.
+  bool GetCacheTypeStats(const std::string& typeName, CTypeStats& stats);
+
+  // Count a lookup or subscription in a type that found no object.
+  // Types that don't exist are ignored.
+  void RecordMiss(const std::string& typeName);
+
+  // The filesystem calls made by the whole cache set, and those made
+  // for a type.  The stats of a type are kept after it is deleted, so
+  // I/O jobs still pending for it and a type defined again with the
+  // same name count against the same stats.
+  CFsStats& GetFsStats() { return m_fsStats; }
+  CFsStats* GetTypeFsStats(const std::string& typeName);
+  // Copies the filesystem counts of every type that has made a call
+  void GetTypeFsCounts(std::map<std::string, CFsCounts>& typeCounts);
+
   // Returns the size of a cached object or -1 if the object is no
-  // longer in the cache.
+  // longer in the cache.  This is read from the snapshot, so isn't
+  // to be used inside a CSnapshotBatch.
   cacheSize_t CachedObjectSize(const cachedObjectId_t objId);
 
   // Returns the filename of a cachedObject
   const std::string CachedObjectFilename(const cachedObjectId_t objId);
 
+  // Copies the types in the current snapshot and returns its
+  // generation.  The copies share the snapshot's data so they can be
+  // read for as long as needed without holding up the writers.
+  uint64_t GetSnapshotTypes(std::map<std::string, typeSnapshotPtr_t>& types);
+
+  // Used by the caches to mark the snapshot as out of date
+  void SnapshotChanged() {
+    __sync_bool_compare_and_swap(&m_snapshotDirty, 0, 1);
+  }
+
+  // Rebuild and publish the snapshot if anything has changed.  This
+  // is called when the outermost CSnapshotBatch ends and must not be
+  // called with any cache lock held.
+  virtual void PublishSnapshot();
+
+  // Returns one page of the objects in a cache type that match the
+  // query.  nextCursor is set when more objects may follow and
+  // should be passed back in the query to get the next page.
+  // Returns false if the type doesn't exist or the query is invalid.
+  bool ListCacheObjects(std::string& msgText, const std::string& typeName,
+			const CObjectQuery& query,
+			std::vector<CCacheObjectInfo>& objects,
+			std::string& nextCursor);
+
   // Return the base directory name for the file cache directory tree
   virtual std::string& GetBaseDirName() { return m_baseDirName; }
 
@@ -173,25 +281,81 @@ class CFileCacheSet {
   // caches
   virtual cacheSize_t SumOfCacheSizes();
 
+  // Used by the caches to keep the sum of their sizes up to date
+  void AddToCacheSize(cacheSize_t delta) {
+    __sync_add_and_fetch(&m_cacheSizeTotal, delta);
+  }
+
   // Get the type that cooresponds to an objectId
   const std::string GetTypeForObjectId(const cachedObjectId_t objId);
 
   // Return the cache directory name
   const std::string GetCacheDirectory() { return m_baseDirName; }
 
+  // Return the path of the socket the local clients connect to, or
+  // an empty string if the local socket is turned off
+  const std::string& GetLocalSocketPath() { return m_localSocketPath; }
+
+  // Return the file the cache set is handed to the next daemon in, or
+  // an empty string if it isn't
+  const std::string& GetStateFile() { return m_stateFile; }
+
+  // Return the file requests are traced to when tracing is turned on,
+  // or an empty string if it can't be, and the size it is rotated at
+  const std::string& GetTraceFile() { return m_traceFile; }
+  cacheSize_t GetTraceFileSize() { return m_traceFileSize; }
+
+  // Return the file the metrics are written to, or an empty string if
+  // they aren't, and how often in seconds they are
+  const std::string& GetMetricsFile() { return m_metricsFile; }
+  int GetMetricsInterval() { return m_metricsInterval; }
+
+  // Return the time in milliseconds a request has to take to be
+  // logged as slow, 0 if none are, and the file every request is
+  // traced to in the Chrome trace event format, or an empty string if
+  // they aren't
+  int GetSlowRequestTime() { return m_slowRequestTime; }
+  const std::string& GetRequestTraceFile() { return m_requestTraceFile; }
+
+  // Return the time in milliseconds the main loop has to be held up
+  // for to count as a stall, 0 if it isn't watched
+  int GetStallTime() { return m_stallTime; }
+
   // Check if a type exists
   bool TypeExists(const std::string& typeName);
 
   // Check if a type is a directory type
   bool isTypeDirType(const std::string& typeName);
 
-  // locate and try to cleanup any orphans
-  void CleanupOrphans();
+  // locate and try to cleanup any orphans.  Returns how many are
+  // still left.
+  int CleanupOrphans();
 
   // Validate a subscribed object.
   void CheckSubscribedObject(const std::string& typeName,
 			     const cachedObjectId_t objId);
 
+  // Returns the number of bytes written so far to an object or -1 if
+  // the object is no longer in the cache.
+  cacheSize_t CachedObjectBytesAvailable(const std::string& typeName,
+					 const cachedObjectId_t objId);
+
+  // Check if an object is still in the cache and has not yet been
+  // completely written.
+  bool isObjectBeingWritten(const std::string& typeName,
+			    const cachedObjectId_t objId);
+
+  // Check if the file for a new object is still being created.  The
+  // object can't be subscribed until it has been.
+  bool isObjectBeingCreated(const std::string& typeName,
+			    const cachedObjectId_t objId);
+
+  // Check if the file of an object is still being made writable for
+  // the writer that has subscribed to it.  The writer shouldn't write
+  // it until it has been.
+  bool isObjectBeingOpened(const std::string& typeName,
+			   const cachedObjectId_t objId);
+
   // Cleanup any unsubscribed directory types
   void CleanupDirTypes();
 
@@ -202,9 +366,73 @@ class CFileCacheSet {
   // Cleanup cache space at startup.  
   void CleanupAtStartup();
 
+  // Save the cache set at shutdown so the next daemon can adopt it
+  // with LoadState instead of walking the cache tree.  Returns false
+  // if it can't be handed over, for example while objects are being
+  // written.
+  bool SaveState(const std::string& stateFile);
+
+  // Adopt the cache set saved by the last daemon if the cache tree
+  // hasn't changed since.  The saved state is removed either way.
+  // Returns false if the tree has to be walked instead.
+  bool LoadState(const std::string& stateFile);
+
+  // The time spent and calls made in each phase of starting up, by
+  // LoadState, WalkDirTree and CleanupAtStartup
+  CStartupProfile& GetStartupProfile() { return m_startupProfile; }
+
+  // Register or remove a listener for cache events.  The cache set
+  // does not own its listeners.
+  void AddListener(CFileCacheListener* listener);
+  void RemoveListener(CFileCacheListener* listener);
+
+  // Used by the caches to report events to the listeners
+  void NotifyObjectExpired(const std::string& typeName,
+			   const cachedObjectId_t objId,
+			   const std::string& filename, ExpireReason reason);
+  void NotifyThresholdCrossed(const std::string& typeName,
+			      CacheThreshold threshold, bool above,
+			      cacheSize_t size);
+
+  void NotifyObjectCreated(const std::string& typeName,
+			   const cachedObjectId_t objId, bool created);
+  void NotifyObjectOpened(const std::string& typeName,
+			  const cachedObjectId_t objId, bool opened);
+  void NotifyObjectWritten(const std::string& typeName,
+			   const cachedObjectId_t objId, bool written);
+  void NotifyObjectOrphaned(const std::string& typeName,
+			    const cachedObjectId_t objId);
+  void NotifyAgingScheduled(time_t due);
+
+  // Check whether the sum of the cache sizes has moved across the
+  // total cache space and tell the listeners if it has
+  void CheckTotalSpace();
+
+  // Start the configured number of I/O worker threads.  Until this
+  // is called, or if no workers are configured, the blocking
+  // filesystem work is done in line.
+  bool StartIOWorkers();
+  void StopIOWorkers();
+
+  // Hand blocking filesystem work to the I/O workers.  The job is
+  // deleted once it has completed.
+  virtual void SubmitIO(CIOJob* job) { m_ioWorkers.Submit(job); }
+
+  // Called by the jobs that remove a deleted type, which can't be
+  // defined again until its directory is gone, and by those that
+  // remove an expired object when the file can't be removed
+  void TypeRemovalQueued(const std::string& typeName);
+  void TypeRemovalDone(const std::string& typeName);
+  void ObjectRemovalFailed();
+
+  // The clock the creation and access times of objects are read
+  // from
+  virtual time_t Now() { return ::time(0); }
+
  protected:
-  ~CFileCacheSet() {};
+  ~CFileCacheSet();
   virtual cachedObjectId_t GetNextCachedObjectId();
+  void SetIOWorkerCount(int count) { m_ioWorkerCount = count; }
 
  private:
 
@@ -215,6 +443,9 @@ class CFileCacheSet {
   void ReadConfig(const std::string& configFile);
   void ReadSequenceNumber();
   void WriteSequenceNumber();
+  uint64_t ReadGeneration();
+  bool WriteGeneration(uint64_t generation);
+  void NotifyTypeModified(const std::string& typeName, TypeChange change);
 	
   enum ProcessStatus {
     ERROR = 0,
@@ -235,15 +466,70 @@ class CFileCacheSet {
   ProcessStatus GetFilename(const std::string& pathname, char* fileName);
   ProcessStatus GetCost(const std::string& pathname, paramValue_t* cost);
   ProcessStatus GetLifetime(const std::string& pathname, paramValue_t* lifetime);
+  ProcessStatus GetKey(const std::string& pathname, std::string& key);
+  ProcessStatus GetMaxAge(const std::string& pathname, paramValue_t* maxAge);
+  ssize_t WalkGetxattr(const std::string& pathname, const char* name,
+		       void* value, size_t size, StartupPhase phase);
+  int WalkRemove(const std::string& pathname, bool dir);
+  CFsStats* GetWalkFsStats(const std::string& pathname);
   int ProcessFiles(const std::string& filepath);
   bool FileTreeWalk(const std::string& dirName);
 
   std::map<const std::string, CFileCache*> m_cacheSet;
   std::map<const cachedObjectId_t, const std::string> m_idMap;
 
+  // Guards m_cacheSet and the lifetime of the caches in it
+  CCacheRWLock m_typeLock;
+  CCacheMutex m_spaceLock;
+  CCacheMutex m_snapshotLock;
+  CCacheMutex m_idMapLock;
+  CCacheMutex m_listenerLock;
+  CCacheMutex m_sequenceLock;
+  CCacheMutex m_ageLock;
+  CCacheMutex m_fsStatsLock;
+  CCacheMutex m_removalLock;
+
   cacheSize_t m_totalCacheSpace;
+  // The sum of the cache sizes, changed atomically by the caches
+  cacheSize_t m_cacheSizeTotal;
+  // Whether the sum was last seen at or above m_totalCacheSpace,
+  // guarded by m_listenerLock
+  bool m_aboveTotalSpace;
+  CSnapshotHolder m_snapshot;
+  // Set when a change hasn't been published yet, changed atomically
+  int m_snapshotDirty;
+  std::vector<CFileCacheListener*> m_listeners;
+  CIOWorkerPool m_ioWorkers;
+  int m_ioWorkerCount;
+  // The deleted types whose directories are still queued for removal
+  // and whether any expired object's file couldn't be removed,
+  // guarded by m_removalLock
+  std::set<std::string> m_removingTypes;
+  bool m_removalFailed;
   std::string m_baseDirName;
+  std::string m_localSocketPath;
+  std::string m_stateFile;
+  std::string m_traceFile;
+  cacheSize_t m_traceFileSize;
+  std::string m_metricsFile;
+  int m_metricsInterval;
+  int m_slowRequestTime;
+  std::string m_requestTraceFile;
+  int m_stallTime;
   sequenceNumber_t m_sequenceNumber;
+  // The types seen and the directory type object being skipped by
+  // the current walk of the cache tree
+  std::set<std::string> m_walkTypes;
+  std::string m_walkDirTypeDir;
+  // The maximum age deadlines and the earliest the listeners have
+  // been told about, guarded by m_ageLock
+  CTimingWheel m_ageWheel;
+  time_t m_ageNotifiedDue;
+  CStartupProfile m_startupProfile;
+  CFsStats m_fsStats;
+  // The filesystem stats of each type, guarded by m_fsStatsLock.
+  // Entries are never removed so the pointers handed out stay valid.
+  std::map<std::string, CFsStats*> m_typeFsStats;
   static MojLogger s_log;
 };
 
@@ -0,0 +1,296 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "FsStats.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+
+static const char* const s_fsOpNames[FsNumOps] = {
+  "mkdir",
+  "create",
+  "chmod",
+  "setxattr",
+  "getxattr",
+  "fsync",
+  "unlink",
+  "rmdir",
+  "rename",
+  "copy"
+};
+
+CFsStats::CFsStats(CFsStats* parent)
+  : m_parent(parent)
+  , m_latency(NULL)
+{
+
+  if (m_parent == NULL) {
+    m_latency = new CLatencyHistogram[FsNumOps];
+  }
+}
+
+CFsStats::~CFsStats() {
+
+  delete [] m_latency;
+}
+
+void
+CFsStats::Record(FsOp op, uint64_t us, bool failed, uint64_t bytes) {
+
+  __sync_fetch_and_add(&m_counts.m_calls[op], 1);
+  __sync_fetch_and_add(&m_counts.m_us[op], us);
+  if (failed) {
+    __sync_fetch_and_add(&m_counts.m_failures[op], 1);
+  } else if (bytes > 0) {
+    __sync_fetch_and_add(&m_counts.m_bytes[op], bytes);
+  }
+  if (m_latency != NULL) {
+    m_latency[op].Record(us);
+  }
+  if (m_parent != NULL) {
+    m_parent->Record(op, us, failed, bytes);
+  }
+}
+
+void
+CFsStats::GetCounts(CFsCounts& counts) const {
+
+  for (int i = 0; i < FsNumOps; i++) {
+    counts.m_calls[i] = m_counts.m_calls[i];
+    counts.m_failures[i] = m_counts.m_failures[i];
+    counts.m_us[i] = m_counts.m_us[i];
+    counts.m_bytes[i] = m_counts.m_bytes[i];
+  }
+}
+
+const char*
+CFsStats::GetOpName(FsOp op) {
+
+  return s_fsOpNames[op];
+}
+
+// Time a call from construction to Done and record it unless stats
+// is NULL.  errno is left as the call set it.
+class CFsTimer {
+ public:
+  CFsTimer(CFsStats* stats, FsOp op)
+    : m_stats(stats)
+    , m_op(op)
+    , m_start((stats != NULL) ? CMetrics::Now() : 0)
+  {
+  }
+
+  void Done(bool failed, uint64_t bytes) {
+    if (m_stats != NULL) {
+      const int savedErrno = errno;
+      m_stats->Record(m_op, CMetrics::Now() - m_start, failed, bytes);
+      errno = savedErrno;
+    }
+  }
+
+ private:
+  CFsStats* m_stats;
+  FsOp m_op;
+  uint64_t m_start;
+};
+
+int
+FsMkdirCall(CFsStats* stats, const std::string& pathname, mode_t mode) {
+
+  CFsTimer timer(stats, FsMkdir);
+  const int retVal = ::mkdir(pathname.c_str(), mode);
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+// Create an empty file, or truncate an existing one
+int
+FsCreateCall(CFsStats* stats, const std::string& pathname) {
+
+  CFsTimer timer(stats, FsCreate);
+  int retVal = ::open(pathname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (retVal >= 0) {
+    retVal = ::close(retVal);
+  }
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+int
+FsChmodCall(CFsStats* stats, const std::string& pathname, mode_t mode) {
+
+  CFsTimer timer(stats, FsChmod);
+  const int retVal = ::chmod(pathname.c_str(), mode);
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+int
+FsSetxattrCall(CFsStats* stats, const std::string& pathname,
+	       const char* name, const void* value, size_t size, int flags) {
+
+  CFsTimer timer(stats, FsSetxattr);
+  const int retVal = FC_setxattr(pathname.c_str(), name, value, size, flags);
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+ssize_t
+FsGetxattrCall(CFsStats* stats, const std::string& pathname,
+	       const char* name, void* value, size_t size) {
+
+  CFsTimer timer(stats, FsGetxattr);
+  const ssize_t retVal = FC_getxattr(pathname.c_str(), name, value, size);
+  timer.Done(retVal < 0, 0);
+
+  return retVal;
+}
+
+// SyncFile of a file of size bytes
+bool
+FsSyncCall(CFsStats* stats, const std::string& pathname, uint64_t size,
+	   std::string& msgText) {
+
+  CFsTimer timer(stats, FsSync);
+  const bool retVal = SyncFile(pathname, msgText);
+  timer.Done(!retVal, s_fsMetadataBytes +
+	     (size + s_blockSize - 1) / s_blockSize * s_blockSize);
+
+  return retVal;
+}
+
+int
+FsUnlinkCall(CFsStats* stats, const std::string& pathname) {
+
+  CFsTimer timer(stats, FsUnlink);
+  const int retVal = ::unlink(pathname.c_str());
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+int
+FsRmdirCall(CFsStats* stats, const std::string& pathname) {
+
+  CFsTimer timer(stats, FsRmdir);
+  const int retVal = ::rmdir(pathname.c_str());
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+// CleanupDir, counted as a rmdir
+bool
+FsRemoveTreeCall(CFsStats* stats, const std::string& pathname,
+		 std::string& msgText) {
+
+  CFsTimer timer(stats, FsRmdir);
+  const bool retVal = CleanupDir(pathname, msgText);
+  timer.Done(!retVal, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+int
+FsRenameCall(CFsStats* stats, const std::string& from,
+	     const std::string& to) {
+
+  CFsTimer timer(stats, FsRename);
+  const int retVal = ::rename(from.c_str(), to.c_str());
+  timer.Done(retVal != 0, s_fsMetadataBytes);
+
+  return retVal;
+}
+
+// Append the calls in the Prometheus text format, the time taken by
+// each from total and the calls and bytes written of each from
+// typeCounts
+void
+FormatFsPrometheus(const CFsStats& total,
+		   const std::map<std::string, CFsCounts>& typeCounts,
+		   std::string& text) {
+
+  // A type name is a directory name so it is no longer than NAME_MAX
+  char line[NAME_MAX + 128];
+  text += "# HELP filecache_fs_duration_seconds Time taken by each filesystem call.\n"
+    "# TYPE filecache_fs_duration_seconds summary\n";
+  for (int i = 0; i < FsNumOps; i++) {
+    const FsOp op = (FsOp) i;
+    const CLatencyHistogram* histogram = total.GetLatency(op);
+    for (size_t j = 0; j < CMetrics::s_numPercentiles; j++) {
+      ::snprintf(line, sizeof(line),
+		 "filecache_fs_duration_seconds{op=\"%s\",quantile=\"%g\"} %.6f\n",
+		 CFsStats::GetOpName(op), CMetrics::s_percentiles[j],
+		 (double) histogram->GetPercentile(CMetrics::s_percentiles[j]) / 1e6);
+      text += line;
+    }
+    ::snprintf(line, sizeof(line),
+	       "filecache_fs_duration_seconds_sum{op=\"%s\"} %.6f\n"
+	       "filecache_fs_duration_seconds_count{op=\"%s\"} %llu\n",
+	       CFsStats::GetOpName(op), (double) histogram->GetSum() / 1e6,
+	       CFsStats::GetOpName(op),
+	       (unsigned long long) histogram->GetCount());
+    text += line;
+  }
+
+  CFsCounts counts;
+  total.GetCounts(counts);
+  text += "# HELP filecache_fs_failures_total Filesystem calls that failed.\n"
+    "# TYPE filecache_fs_failures_total counter\n";
+  for (int i = 0; i < FsNumOps; i++) {
+    ::snprintf(line, sizeof(line), "filecache_fs_failures_total{op=\"%s\"} %llu\n",
+	       CFsStats::GetOpName((FsOp) i),
+	       (unsigned long long) counts.m_failures[i]);
+    text += line;
+  }
+
+  // Only the calls a type has made are listed, most types only ever
+  // make a few of them
+  text += "# HELP filecache_fs_calls_total Filesystem calls made for each type.\n"
+    "# TYPE filecache_fs_calls_total counter\n";
+  std::map<std::string, CFsCounts>::const_iterator iter;
+  for (iter = typeCounts.begin(); iter != typeCounts.end(); ++iter) {
+    for (int i = 0; i < FsNumOps; i++) {
+      if (iter->second.m_calls[i] > 0) {
+	::snprintf(line, sizeof(line),
+		   "filecache_fs_calls_total{type=\"%s\",op=\"%s\"} %llu\n",
+		   iter->first.c_str(), CFsStats::GetOpName((FsOp) i),
+		   (unsigned long long) iter->second.m_calls[i]);
+	text += line;
+      }
+    }
+  }
+  text += "# HELP filecache_fs_bytes_written_total Estimated bytes written to the filesystem for each type, including metadata.\n"
+    "# TYPE filecache_fs_bytes_written_total counter\n";
+  for (iter = typeCounts.begin(); iter != typeCounts.end(); ++iter) {
+    for (int i = 0; i < FsNumOps; i++) {
+      if (iter->second.m_bytes[i] > 0) {
+	::snprintf(line, sizeof(line),
+		   "filecache_fs_bytes_written_total{type=\"%s\",op=\"%s\"} %llu\n",
+		   iter->first.c_str(), CFsStats::GetOpName((FsOp) i),
+		   (unsigned long long) iter->second.m_bytes[i]);
+	text += line;
+      }
+    }
+  }
+}
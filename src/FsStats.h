@@ -0,0 +1,143 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __FS_STATS_H__
+#define __FS_STATS_H__
+
+#include "CacheBase.h"
+#include "Metrics.h"
+
+inline int FC_setxattr(const char* path, const char* name, const void* value,
+		       size_t size, int options) {
+#ifdef MOJ_MAC
+  return ::setxattr(path, name, value, size, 0, options);
+#else
+  return ::setxattr(path, name, value, size, options);
+#endif // #ifdef MOJ_MAC
+}
+
+inline ssize_t FC_getxattr(const char* path, const char* name,  void* value,
+		       size_t size) {
+#ifdef MOJ_MAC
+  return ::getxattr(path, name, value, size, 0, 0);
+#else
+  return ::getxattr(path, name, value, size);
+#endif // #ifdef MOJ_MAC
+}
+
+// The filesystem calls the cache makes
+enum FsOp {
+  FsMkdir = 0,
+  FsCreate,
+  FsChmod,
+  FsSetxattr,
+  FsGetxattr,
+  FsSync,
+  FsUnlink,
+  FsRmdir,		// including removing a directory type object's tree
+  FsRename,
+  FsCopy,
+  FsNumOps
+};
+
+// Every call that changes metadata is counted as writing one block,
+// which is the least a journalled filesystem writes for it.  A sync
+// is also counted as writing the data of the file, rounded up to
+// blocks, and a copy as writing the copy.
+static const uint64_t s_fsMetadataBytes = s_blockSize;
+
+// The calls, failures, time in microseconds and estimated bytes
+// written of each FsOp
+class CFsCounts {
+ public:
+
+  CFsCounts() {
+    for (int i = 0; i < FsNumOps; i++) {
+      m_calls[i] = 0;
+      m_failures[i] = 0;
+      m_us[i] = 0;
+      m_bytes[i] = 0;
+    }
+  }
+
+  uint64_t m_calls[FsNumOps];
+  uint64_t m_failures[FsNumOps];
+  uint64_t m_us[FsNumOps];
+  uint64_t m_bytes[FsNumOps];
+};
+
+// Counts the filesystem calls of a type, or of the whole cache set.
+// The stats of a type add each call to those of the cache set as
+// well, and only the cache set's keep a latency histogram of each
+// call.  Any thread may record, the counts are changed atomically.
+class CFsStats {
+ public:
+  explicit CFsStats(CFsStats* parent = NULL);
+  ~CFsStats();
+
+  void Record(FsOp op, uint64_t us, bool failed, uint64_t bytes);
+
+  void GetCounts(CFsCounts& counts) const;
+
+  // NULL for the stats of a type
+  const CLatencyHistogram* GetLatency(FsOp op) const {
+    return (m_latency != NULL) ? &m_latency[op] : NULL;
+  }
+
+  static const char* GetOpName(FsOp op);
+
+ private:
+  CFsStats& operator=(const CFsStats&);
+  CFsStats(const CFsStats&);
+
+  CFsCounts m_counts;
+  CFsStats* m_parent;
+  CLatencyHistogram* m_latency;
+};
+
+// The filesystem calls the cache makes, timed and counted in stats
+// unless that is NULL.  Each returns what the call it wraps does and
+// leaves errno as that set it.
+int FsMkdirCall(CFsStats* stats, const std::string& pathname, mode_t mode);
+// Create an empty file, or truncate an existing one
+int FsCreateCall(CFsStats* stats, const std::string& pathname);
+int FsChmodCall(CFsStats* stats, const std::string& pathname, mode_t mode);
+int FsSetxattrCall(CFsStats* stats, const std::string& pathname,
+		   const char* name, const void* value, size_t size,
+		   int flags);
+ssize_t FsGetxattrCall(CFsStats* stats, const std::string& pathname,
+		       const char* name, void* value, size_t size);
+// SyncFile of a file of size bytes
+bool FsSyncCall(CFsStats* stats, const std::string& pathname,
+		uint64_t size, std::string& msgText);
+int FsUnlinkCall(CFsStats* stats, const std::string& pathname);
+int FsRmdirCall(CFsStats* stats, const std::string& pathname);
+// CleanupDir, counted as a rmdir
+bool FsRemoveTreeCall(CFsStats* stats, const std::string& pathname,
+		      std::string& msgText);
+int FsRenameCall(CFsStats* stats, const std::string& from,
+		 const std::string& to);
+
+// Append the calls in the Prometheus text format, the time taken by
+// each from total and the calls and bytes written of each from
+// typeCounts
+void FormatFsPrometheus(const CFsStats& total,
+			const std::map<std::string, CFsCounts>& typeCounts,
+			std::string& text);
+
+#endif /* __FS_STATS_H__ */
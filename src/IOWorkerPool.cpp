@@ -0,0 +1,222 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "IOWorkerPool.h"
+#include "LoopWatchdog.h"
+#include "boost/functional/hash.hpp"
+
+MojLogger CIOWorkerPool::s_log(_T("filecache.ioworkerpool"));
+
+// Holds back a job that is after all others, one of these is queued
+// on each worker.  The last of them to run runs the job, so it follows
+// whatever every worker had queued before it, and completes it.
+class CAfterAllJob : public CIOJob {
+ public:
+  CAfterAllJob(CIOJob* job, int* remaining)
+    : CIOJob(job->GetPathname()), m_job(job), m_remaining(remaining),
+      m_last(false) {}
+
+  void Run() {
+    if (__sync_sub_and_fetch(m_remaining, 1) == 0) {
+      delete m_remaining;
+      m_last = true;
+      m_job->Run();
+    }
+  }
+
+  void Complete() {
+    if (m_last) {
+      m_job->Complete();
+      delete m_job;
+    }
+  }
+
+ private:
+  CIOJob* m_job;
+  int* m_remaining;
+  bool m_last;
+};
+
+CIOWorkerPool::CIOWorkerPool() : m_completeIdle(0) {
+
+  MojLogTrace(s_log);
+}
+
+CIOWorkerPool::~CIOWorkerPool() {
+
+  MojLogTrace(s_log);
+
+  Stop();
+}
+
+// Start numWorkers worker threads.  Returns false if the threads
+// can't be created, in which case jobs continue to run in line.
+bool
+CIOWorkerPool::Start(int numWorkers) {
+
+  MojLogTrace(s_log);
+
+  if (isRunning() || (numWorkers <= 0)) {
+    return isRunning();
+  }
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (!g_thread_supported()) {
+    g_thread_init(NULL);
+  }
+#endif
+
+  for (int i = 0; i < numWorkers; i++) {
+    GError* error = NULL;
+    GThreadPool* shard = g_thread_pool_new(&RunJob, this, 1, TRUE, &error);
+    if (shard == NULL) {
+      MojLogError(s_log, _T("Start: Failed to start worker '%d' (%s)."), i,
+		  (error != NULL) ? error->message : "unknown error");
+      if (error != NULL) {
+	g_error_free(error);
+      }
+      Stop();
+      break;
+    }
+    m_shards.push_back(shard);
+  }
+  if (isRunning()) {
+    MojLogInfo(s_log, _T("Start: Started '%zu' I/O workers."),
+	       m_shards.size());
+  }
+
+  return isRunning();
+}
+
+// Waits for the queued jobs to run, stops the worker threads and
+// completes in line the jobs still waiting for the main loop.  This is
+// called on the main loop, or once it has stopped and would never
+// deliver them.
+void
+CIOWorkerPool::Stop() {
+
+  MojLogTrace(s_log);
+
+  while (!m_shards.empty()) {
+    g_thread_pool_free(m_shards.back(), FALSE, TRUE);
+    m_shards.pop_back();
+  }
+  {
+    CCacheMutexGuard guard(m_completedLock);
+    if (m_completeIdle != 0) {
+      g_source_remove(m_completeIdle);
+      m_completeIdle = 0;
+    }
+  }
+  CompleteJobs();
+}
+
+// The pool takes ownership of the job and deletes it once it has
+// completed.
+void
+CIOWorkerPool::Submit(CIOJob* job) {
+
+  MojLogTrace(s_log);
+
+  if (!isRunning()) {
+    job->Run();
+    job->Complete();
+    delete job;
+  } else if (job->isAfterAll() && (m_shards.size() > 1)) {
+    int* remaining = new int((int) m_shards.size());
+    for (size_t shard = 0; shard < m_shards.size(); shard++) {
+      Push(shard, new CAfterAllJob(job, remaining));
+    }
+  } else {
+    // Jobs in the same directory always go to the same worker so
+    // the creates, removes and rmdirs in it can't be reordered
+    boost::hash<std::string> hasher;
+    Push(hasher(GetDirectoryFromPath(job->GetPathname())) % m_shards.size(),
+	 job);
+  }
+}
+
+// Queue a job on a worker, or run it in line if it can't be queued
+void
+CIOWorkerPool::Push(size_t shard, CIOJob* job) {
+
+  MojLogDebug(s_log, _T("Push: Queued job for '%s' on worker '%zu'."),
+	      job->GetPathname().c_str(), shard);
+  GError* error = NULL;
+  g_thread_pool_push(m_shards[shard], job, &error);
+  if (error == NULL) {
+    return;
+  }
+  MojLogError(s_log, _T("Push: Failed to queue job for '%s' (%s)."),
+	      job->GetPathname().c_str(), error->message);
+  g_error_free(error);
+
+  job->Run();
+  job->Complete();
+  delete job;
+}
+
+// Run on a worker, then hand the job to the main loop to complete.
+// One idle callback completes all the jobs that have run by then.
+void
+CIOWorkerPool::RunJob(gpointer data, gpointer userData) {
+
+  CIOJob* job = static_cast<CIOJob*>(data);
+  CIOWorkerPool* pool = static_cast<CIOWorkerPool*>(userData);
+  job->Run();
+  CCacheMutexGuard guard(pool->m_completedLock);
+  pool->m_completed.push_back(job);
+  if (pool->m_completeIdle == 0) {
+    pool->m_completeIdle = g_idle_add(&CompleteCallback, pool);
+  }
+}
+
+// Complete the jobs that have run.  Completing a job may submit more,
+// which are completed by a later call once they have run.
+void
+CIOWorkerPool::CompleteJobs() {
+
+  MojLogTrace(s_log);
+
+  std::vector<CIOJob*> completed;
+  {
+    CCacheMutexGuard guard(m_completedLock);
+    completed.swap(m_completed);
+  }
+  for (std::vector<CIOJob*>::const_iterator iter = completed.begin();
+       iter != completed.end(); ++iter) {
+    (*iter)->Complete();
+    delete *iter;
+  }
+}
+
+gboolean
+CIOWorkerPool::CompleteCallback(gpointer data) {
+
+  MojLogTrace(s_log);
+
+  CLoopActivity activity("completeJob");
+  CIOWorkerPool* pool = static_cast<CIOWorkerPool*>(data);
+  {
+    CCacheMutexGuard guard(pool->m_completedLock);
+    pool->m_completeIdle = 0;
+  }
+  pool->CompleteJobs();
+
+  return false;
+}
@@ -0,0 +1,100 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __IO_WORKER_POOL_H__
+#define __IO_WORKER_POOL_H__
+
+#include "CacheBase.h"
+#include "CacheLock.h"
+#include "glib.h"
+
+// A unit of blocking filesystem work.  Run is called on a worker
+// thread and must only touch the filesystem and the job's own data.
+// Complete is then called back on the main loop where the cache
+// bookkeeping can be updated with the result.
+class CIOJob {
+ public:
+  CIOJob(const std::string& pathname) : m_pathname(pathname) {}
+  virtual ~CIOJob() {}
+
+  virtual void Run() = 0;
+  virtual void Complete() {}
+
+  // Take the result Run would have on a filesystem where everything
+  // succeeds, without doing the work.  This is for running the cache
+  // without a filesystem, as the simulator does.
+  virtual void Simulate() {}
+
+  // Whether the job has to wait for every job submitted before it, on
+  // any worker, such as removing a directory the others remove the
+  // files of
+  virtual bool isAfterAll() { return false; }
+
+  const std::string& GetPathname() { return m_pathname; }
+
+ protected:
+  const std::string m_pathname;
+};
+
+// Runs CIOJobs off the main loop.  Jobs are sharded by the directory
+// of their pathname and each shard has a single thread, so the work
+// for any one object (and for the objects sharing its directory) is
+// done in the order it was submitted.  A job that is after all others
+// runs once every worker has run what it had queued before it.  Until
+// Start is called, jobs are run in line when they are submitted.
+class CIOWorkerPool {
+ public:
+  CIOWorkerPool();
+  ~CIOWorkerPool();
+
+  // Start numWorkers worker threads.  Returns false if the threads
+  // can't be created, in which case jobs continue to run in line.
+  bool Start(int numWorkers);
+
+  // Waits for the queued jobs to run, stops the worker threads and
+  // completes in line the jobs still waiting for the main loop, so
+  // nothing is left pending once this returns.
+  void Stop();
+
+  bool isRunning() { return !m_shards.empty(); }
+
+  // The pool takes ownership of the job and deletes it once it has
+  // completed.
+  void Submit(CIOJob* job);
+
+ private:
+
+  CIOWorkerPool& operator=(const CIOWorkerPool&);
+  CIOWorkerPool(const CIOWorkerPool&);
+
+  void Push(size_t shard, CIOJob* job);
+  void CompleteJobs();
+  static void RunJob(gpointer data, gpointer userData);
+  static gboolean CompleteCallback(gpointer data);
+
+  std::vector<GThreadPool*> m_shards;
+  // The jobs that have run and are waiting to be completed on the main
+  // loop, in the order they ran, and the idle source that will
+  // complete them.  The lock guards both.
+  CCacheMutex m_completedLock;
+  std::vector<CIOJob*> m_completed;
+  guint m_completeIdle;
+  static MojLogger s_log;
+};
+
+#endif /* __IO_WORKER_POOL_H__ */
@@ -0,0 +1,125 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __LOCAL_PROTOCOL_H__
+#define __LOCAL_PROTOCOL_H__
+
+#include <stdint.h>
+
+// The protocol spoken on the local socket by CLocalServer and
+// CFileCacheClient.  This is shared by the daemon and the client
+// library so it must not depend on anything else in the daemon.
+//
+// The socket is a SOCK_SEQPACKET socket so each send is received as
+// one message.  A request message is a batch: a CLocalHeader followed
+// by m_count requests, each a CLocalRequest followed by m_typeLen
+// bytes of type name and m_keyLen bytes of key.  The reply message
+// holds a CLocalHeader with the same tag and count followed by a
+// CLocalReply and m_textLen bytes of text for each request, in the
+// same order.  A client may send more batches before reading the
+// replies; they are answered in the order they were sent.
+//
+// The structures are copied to and from the messages as they are, in
+// the host's byte order, since both ends are on the same device.
+//
+//   op                  request            reply
+//   LocalOpSize         objId              values[0] size
+//   LocalOpFilename     objId              text filename
+//   LocalOpTouch        objId
+//   LocalOpTypeStatus   type               values[0] size, [1] numObjects
+//   LocalOpCacheStatus                     values[0] numTypes, [1] size,
+//                                          [2] numObjects, [3] availSpace
+//   LocalOpLookup       type, key          values[0] objId, [1] size
+//   LocalOpSubscribe    objId, flags       text pathname
+//   LocalOpUnSubscribe  objId, flags
+//   LocalOpTouchRing                       values[0] capacity
+//   LocalOpIndex                           values[0] maxObjects
+//
+// Subscriptions are read subscriptions, so the object has to have
+// been written unless s_localFlagStreamReader in the flags asks for a
+// stream reader's.  They belong to the connection, only it can
+// release them and any it still holds are released when it closes.
+// A failed request has the reason in the text.
+//
+// The reply to LocalOpTouchRing carries the descriptor of the
+// daemon's touch ring (see TouchRing.h) as SCM_RIGHTS ancillary data.
+// Accesses recorded in the ring are applied in batches every
+// s_localTouchInterval milliseconds.  The reply to LocalOpIndex
+// likewise carries the descriptor of the shared index (see
+// SharedIndex.h), which is republished as often.  When a batch has
+// several of these, the descriptors come in the order of the replies.
+
+static const uint8_t s_localVersion = 1;
+
+enum LocalOp {
+  LocalOpSize = 1,
+  LocalOpFilename,
+  LocalOpTouch,
+  LocalOpTypeStatus,
+  LocalOpCacheStatus,
+  LocalOpLookup,
+  LocalOpSubscribe,
+  LocalOpUnSubscribe,
+  LocalOpTouchRing,
+  LocalOpIndex
+};
+
+enum LocalStatus {
+  LocalStatusOk = 0,
+  LocalStatusNotFound,
+  LocalStatusFailed,
+  LocalStatusBadRequest
+};
+
+static const uint8_t s_localFlagStreamReader = 0x01;
+
+static const int s_localTouchInterval = 100;
+
+struct CLocalHeader {
+  uint32_t m_tag;
+  uint16_t m_count;
+  uint8_t m_version;
+  uint8_t m_pad;
+};
+
+struct CLocalRequest {
+  uint8_t m_op;
+  uint8_t m_flags;
+  uint16_t m_typeLen;
+  uint16_t m_keyLen;
+  uint16_t m_pad;
+  uint64_t m_objId;
+};
+
+struct CLocalReply {
+  uint8_t m_op;
+  uint8_t m_status;
+  uint16_t m_textLen;
+  uint32_t m_pad;
+  int64_t m_values[4];
+};
+
+// The most requests in a batch and the longest text in a reply.
+// These bound the size of a reply message, which is also the most a
+// request message may hold.
+static const unsigned int s_localMaxBatch = 32;
+static const unsigned int s_localMaxText = 4096;
+static const unsigned int s_localMaxMessage = sizeof(CLocalHeader) +
+  s_localMaxBatch * (sizeof(CLocalReply) + s_localMaxText);
+
+#endif /* __LOCAL_PROTOCOL_H__ */
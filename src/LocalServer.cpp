@@ -0,0 +1,807 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "LocalServer.h"
+#include "FileCacheSet.h"
+
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+MojLogger CLocalServer::s_log(_T("filecache.localserver"));
+
+// The number of accesses the touch ring can hold between drains
+static const unsigned int s_touchRingSize = 16384;
+
+// The most objects and types the shared index can hold, which bound
+// its size to about 3 MiB
+static const uint32_t s_indexMaxObjects = 32768;
+static const uint32_t s_indexMaxTypes = 512;
+
+static long long
+NowMs() {
+
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+CLocalServer::CLocalServer(CFileCacheSet* cacheSet) : m_fileCacheSet(cacheSet)
+  , m_listenFd(-1), m_lastDrain(0), m_touchesDropped(0)
+  , m_indexGeneration(0) {
+
+  MojLogTrace(s_log);
+
+  m_wakeFds[0] = -1;
+  m_wakeFds[1] = -1;
+}
+
+CLocalServer::~CLocalServer() {
+
+  MojLogTrace(s_log);
+
+  Stop();
+}
+
+// Listen on the socket at socketPath, replacing any socket left
+// there, and start the server thread.  Returns false if the socket
+// can't be set up.
+bool
+CLocalServer::Start(const std::string& socketPath) {
+
+  MojLogTrace(s_log);
+
+  if (isRunning()) {
+    return true;
+  }
+
+  struct sockaddr_un addr;
+  if (socketPath.empty() || (socketPath.size() >= sizeof(addr.sun_path))) {
+    MojLogError(s_log, _T("Start: Invalid socket path '%s'."),
+		socketPath.c_str());
+    return false;
+  }
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  ::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  // A socket left behind by an earlier run would make the bind fail
+  ::unlink(socketPath.c_str());
+
+  int fd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("Start: Failed to create socket (%s)."),
+		::strerror(savedErrno));
+    return false;
+  }
+  if ((::bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+      (::chmod(socketPath.c_str(), S_IRUSR | S_IWUSR | S_IRGRP |
+	       S_IWGRP) != 0) ||
+      (::listen(fd, SOMAXCONN) != 0) || (::pipe(m_wakeFds) != 0)) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("Start: Failed to listen on '%s' (%s)."),
+		socketPath.c_str(), ::strerror(savedErrno));
+    ::close(fd);
+    ::unlink(socketPath.c_str());
+    return false;
+  }
+
+  m_socketPath = socketPath;
+  m_listenFd = fd;
+  m_input.resize(s_localMaxMessage);
+  if (m_touchRing.Create(s_touchRingSize)) {
+    m_lastDrain = NowMs();
+    m_touchesDropped = 0;
+  } else {
+    MojLogWarning(s_log, _T("Start: No touch ring, clients have to use Touch."));
+  }
+  if (m_index.Create(s_indexMaxObjects, s_indexMaxTypes)) {
+    // No generation matches this, so the first one is always built
+    m_indexGeneration = ~(uint64_t) 0;
+    PublishIndex();
+  } else {
+    MojLogWarning(s_log, _T("Start: No shared index, clients have to ask."));
+  }
+  if (::pthread_create(&m_thread, NULL, &Run, this) != 0) {
+    MojLogError(s_log, _T("Start: Failed to start the server thread."));
+    ::close(m_wakeFds[0]);
+    ::close(m_wakeFds[1]);
+    m_wakeFds[0] = -1;
+    m_wakeFds[1] = -1;
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    ::unlink(m_socketPath.c_str());
+    m_touchRing.Close();
+    m_index.Close();
+    return false;
+  }
+  MojLogInfo(s_log, _T("Start: Listening on '%s'."), m_socketPath.c_str());
+
+  return true;
+}
+
+// Stops the server thread, releases the clients' subscriptions,
+// closes the connections and removes the socket.
+void
+CLocalServer::Stop() {
+
+  MojLogTrace(s_log);
+
+  if (!isRunning()) {
+    return;
+  }
+
+  const char wake = 0;
+  if (::write(m_wakeFds[1], &wake, 1) != 1) {
+    MojLogError(s_log, _T("Stop: Failed to wake the server thread."));
+  }
+  ::pthread_join(m_thread, NULL);
+
+  DrainTouches();
+  m_touchRing.Close();
+  CloseConnections();
+  PublishIndex();
+  m_index.Close();
+  m_indexTypes.clear();
+  ::close(m_wakeFds[0]);
+  ::close(m_wakeFds[1]);
+  m_wakeFds[0] = -1;
+  m_wakeFds[1] = -1;
+  ::close(m_listenFd);
+  m_listenFd = -1;
+  ::unlink(m_socketPath.c_str());
+}
+
+void*
+CLocalServer::Run(void* data) {
+
+  static_cast<CLocalServer*>(data)->Serve();
+
+  return NULL;
+}
+
+// Wait for new connections and requests until Stop wakes us
+void
+CLocalServer::Serve() {
+
+  MojLogTrace(s_log);
+
+  for (;;) {
+    std::vector<struct pollfd> fds(2 + m_connections.size());
+    fds[0].fd = m_wakeFds[0];
+    fds[1].fd = m_listenFd;
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+      fds[2 + i].fd = m_connections[i].m_fd;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+
+    // Wake up in time to drain the touch ring and publish the index
+    int timeout = -1;
+    if (m_touchRing.isOpen() || m_index.isOpen()) {
+      const long long due = m_lastDrain + s_localTouchInterval - NowMs();
+      timeout = (due > 0) ? (int) due : 0;
+    }
+    if (::poll(&fds[0], (nfds_t) fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      int savedErrno = errno;
+      MojLogError(s_log, _T("Serve: Failed to poll (%s)."),
+		  ::strerror(savedErrno));
+      break;
+    }
+    if (fds[0].revents != 0) {
+      break;
+    }
+    if ((NowMs() - m_lastDrain) >= s_localTouchInterval) {
+      DrainTouches();
+      PublishIndex();
+    }
+
+    // Go backwards so a closed connection can be removed in place
+    for (size_t i = m_connections.size(); i > 0; --i) {
+      if ((fds[1 + i].revents != 0) && !ReadRequests(m_connections[i - 1])) {
+	CloseConnection(m_connections[i - 1]);
+	m_connections.erase(m_connections.begin() + (i - 1));
+      }
+    }
+    if (fds[1].revents != 0) {
+      Accept();
+    }
+  }
+}
+
+void
+CLocalServer::Accept() {
+
+  MojLogTrace(s_log);
+
+  int fd = ::accept(m_listenFd, NULL, NULL);
+  if (fd < 0) {
+    int savedErrno = errno;
+    MojLogWarning(s_log, _T("Accept: Failed to accept a client (%s)."),
+		  ::strerror(savedErrno));
+    return;
+  }
+  if (!isAllowed(fd)) {
+    ::close(fd);
+    return;
+  }
+
+  // A client that stops reading its replies is dropped rather than
+  // left to hold up everyone else
+  struct timeval timeout;
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  if (::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+		   sizeof(timeout)) != 0) {
+    int savedErrno = errno;
+    MojLogWarning(s_log, _T("Accept: Failed to set send timeout (%s)."),
+		  ::strerror(savedErrno));
+  }
+  MojLogDebug(s_log, _T("Accept: New client on fd '%d'."), fd);
+  m_connections.push_back(CConnection(fd));
+}
+
+// Clients are only served if they run as root, as the same user as
+// the daemon or in its group.  The socket's permissions say the same
+// but they depend on where it is created.
+bool
+CLocalServer::isAllowed(int fd) {
+
+  MojLogTrace(s_log);
+
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("isAllowed: Failed to get client credentials (%s)."),
+		::strerror(savedErrno));
+    return false;
+  }
+  if ((cred.uid == 0) || (cred.uid == ::geteuid()) ||
+      (cred.gid == ::getegid())) {
+    return true;
+  }
+  MojLogWarning(s_log,
+		_T("isAllowed: Refused client pid '%d' uid '%d' gid '%d'."),
+		(int) cred.pid, (int) cred.uid, (int) cred.gid);
+
+  return false;
+}
+
+// Answer the batches the client has sent, a few at a time so a busy
+// client doesn't keep the others waiting.  Returns false if the
+// connection should be closed.
+bool
+CLocalServer::ReadRequests(CConnection& conn) {
+
+  MojLogTrace(s_log);
+
+  for (int i = 0; i < 16; ++i) {
+    ssize_t len = ::recv(conn.m_fd, &m_input[0], m_input.size(),
+			 MSG_DONTWAIT | MSG_TRUNC);
+    if (len < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+    }
+    if (len == 0) {
+      return false;
+    }
+    if ((size_t) len > m_input.size()) {
+      MojLogWarning(s_log, _T("ReadRequests: Request too long on fd '%d'."),
+		    conn.m_fd);
+      return false;
+    }
+    if (!HandleBatch(conn, &m_input[0], (size_t) len)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Answer a batch of requests with a single reply message.  The whole
+// batch is checked before any of it is run so a malformed one has no
+// effect.  Returns false if the connection should be closed.
+bool
+CLocalServer::HandleBatch(CConnection& conn, const char* request,
+			  size_t len) {
+
+  MojLogTrace(s_log);
+
+  CLocalHeader header;
+  if (len < sizeof(header)) {
+    MojLogWarning(s_log, _T("HandleBatch: Short request on fd '%d'."),
+		  conn.m_fd);
+    return false;
+  }
+  ::memcpy(&header, request, sizeof(header));
+  if ((header.m_version != s_localVersion) ||
+      (header.m_count > s_localMaxBatch)) {
+    MojLogWarning(s_log,
+		  _T("HandleBatch: Bad version '%d' or count '%d' on fd '%d'."),
+		  (int) header.m_version, (int) header.m_count, conn.m_fd);
+    return false;
+  }
+
+  std::vector<CLocalRequest> requests(header.m_count);
+  std::vector<size_t> offsets(header.m_count);
+  size_t offset = sizeof(header);
+  for (size_t i = 0; i < requests.size(); ++i) {
+    if ((len - offset) < sizeof(CLocalRequest)) {
+      offset = len + 1;
+      break;
+    }
+    ::memcpy(&requests[i], request + offset, sizeof(CLocalRequest));
+    offset += sizeof(CLocalRequest);
+    offsets[i] = offset;
+    const size_t argsLen = (size_t) requests[i].m_typeLen +
+      requests[i].m_keyLen;
+    if ((len - offset) < argsLen) {
+      offset = len + 1;
+      break;
+    }
+    offset += argsLen;
+  }
+  if (offset != len) {
+    MojLogWarning(s_log, _T("HandleBatch: Malformed request on fd '%d'."),
+		  conn.m_fd);
+    return false;
+  }
+
+  std::string replies;
+  replies.reserve(sizeof(header) + requests.size() * sizeof(CLocalReply));
+  std::vector<int> passFds;
+  replies.append((const char*) &header, sizeof(header));
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const char* args = request + offsets[i];
+    const std::string typeName(args, requests[i].m_typeLen);
+    const std::string key(args + requests[i].m_typeLen,
+			  requests[i].m_keyLen);
+    CLocalReply reply;
+    ::memset(&reply, 0, sizeof(reply));
+    reply.m_op = requests[i].m_op;
+    std::string text;
+    HandleRequest(conn, requests[i], typeName, key, reply, text);
+    if (reply.m_status == LocalStatusOk) {
+      if (reply.m_op == LocalOpTouchRing) {
+	passFds.push_back(m_touchRing.GetFd());
+      } else if (reply.m_op == LocalOpIndex) {
+	passFds.push_back(m_index.GetFd());
+      }
+    }
+    if (text.size() > s_localMaxText) {
+      text.resize(s_localMaxText);
+    }
+    reply.m_textLen = (uint16_t) text.size();
+    replies.append((const char*) &reply, sizeof(reply));
+    replies.append(text);
+  }
+
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(replies.data());
+  iov.iov_len = replies.size();
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  // The descriptors go in the order of the replies they belong to
+  char control[CMSG_SPACE(sizeof(int) * s_localMaxBatch)];
+  if (!passFds.empty()) {
+    const size_t fdsLen = passFds.size() * sizeof(int);
+    ::memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fdsLen);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdsLen);
+    ::memcpy(CMSG_DATA(cmsg), &passFds[0], fdsLen);
+  }
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(conn.m_fd, &msg, MSG_NOSIGNAL);
+  } while ((sent < 0) && (errno == EINTR));
+  if (sent != (ssize_t) replies.size()) {
+    int savedErrno = errno;
+    MojLogWarning(s_log, _T("HandleBatch: Failed to reply on fd '%d' (%s)."),
+		  conn.m_fd, ::strerror(savedErrno));
+    return false;
+  }
+
+  return true;
+}
+
+// Answer a single request
+void
+CLocalServer::HandleRequest(CConnection& conn, const CLocalRequest& request,
+			    const std::string& typeName,
+			    const std::string& key, CLocalReply& reply,
+			    std::string& text) {
+
+  MojLogTrace(s_log);
+
+  const cachedObjectId_t objId = request.m_objId;
+  const bool streamReader = (request.m_flags & s_localFlagStreamReader) != 0;
+  cacheSize_t size = 0;
+  paramValue_t numObjects = 0;
+  reply.m_status = LocalStatusOk;
+  switch (request.m_op) {
+  case LocalOpSize:
+    size = m_fileCacheSet->CachedObjectSize(objId);
+    if (size >= 0) {
+      reply.m_values[0] = size;
+    } else {
+      reply.m_status = LocalStatusNotFound;
+    }
+    break;
+  case LocalOpFilename:
+    text = m_fileCacheSet->CachedObjectFilename(objId);
+    if (text.empty()) {
+      reply.m_status = LocalStatusNotFound;
+    }
+    break;
+  case LocalOpTouch:
+    if (!m_fileCacheSet->Touch(objId)) {
+      reply.m_status = LocalStatusNotFound;
+    }
+    break;
+  case LocalOpTypeStatus:
+    if (m_fileCacheSet->GetCacheTypeStatus(typeName, &size, &numObjects)) {
+      reply.m_values[0] = size;
+      reply.m_values[1] = numObjects;
+    } else {
+      reply.m_status = LocalStatusNotFound;
+    }
+    break;
+  case LocalOpCacheStatus: {
+    cacheSize_t availSpace = 0;
+    reply.m_values[0] = m_fileCacheSet->GetCacheStatus(&size, &numObjects,
+						       &availSpace);
+    reply.m_values[1] = size;
+    reply.m_values[2] = numObjects;
+    reply.m_values[3] = availSpace;
+    break;
+  }
+  case LocalOpLookup: {
+    const cachedObjectId_t foundId =
+      m_fileCacheSet->FindCacheObjectByKey(typeName, key);
+    size = (foundId != 0) ? m_fileCacheSet->CachedObjectSize(foundId) : -1;
+    if (size >= 0) {
+      reply.m_values[0] = (int64_t) foundId;
+      reply.m_values[1] = size;
+    } else {
+      m_fileCacheSet->RecordMiss(typeName);
+      reply.m_status = LocalStatusNotFound;
+    }
+    break;
+  }
+  case LocalOpSubscribe: {
+    // The type is kept so the release can find the object even if it
+    // has been expired in the mean time
+    const std::string objType(m_fileCacheSet->GetTypeForObjectId(objId));
+    if (objType.empty()) {
+      reply.m_status = LocalStatusNotFound;
+      break;
+    }
+    // The first subscription to an object that isn't written yet
+    // would be the writer's, which is only given out on the bus
+    if (!streamReader && m_fileCacheSet->isObjectBeingWritten(objType, objId)) {
+      reply.m_status = LocalStatusFailed;
+      text = "object is not written yet";
+      break;
+    }
+    std::string msgText;
+    text = m_fileCacheSet->SubscribeCacheObject(msgText, objId, streamReader);
+    if (!text.empty()) {
+      conn.m_subscriptions.push_back(CSubscription(objId, objType,
+						   streamReader));
+    } else {
+      reply.m_status = LocalStatusFailed;
+      text = msgText;
+    }
+    break;
+  }
+  case LocalOpUnSubscribe: {
+    // Only the connection's own subscriptions can be released
+    std::vector<CSubscription>::iterator iter;
+    for (iter = conn.m_subscriptions.begin();
+	 iter != conn.m_subscriptions.end(); ++iter) {
+      if ((iter->m_objId == objId) && (iter->m_streamReader == streamReader)) {
+	break;
+      }
+    }
+    if (iter != conn.m_subscriptions.end()) {
+      m_fileCacheSet->UnSubscribeCacheObject(iter->m_typeName, objId,
+					     streamReader);
+      conn.m_subscriptions.erase(iter);
+    } else {
+      reply.m_status = LocalStatusNotFound;
+      text = "not subscribed";
+    }
+    break;
+  }
+  case LocalOpTouchRing:
+    // The descriptor goes with the reply
+    if (m_touchRing.isOpen()) {
+      reply.m_values[0] = m_touchRing.GetCapacity();
+    } else {
+      reply.m_status = LocalStatusNotFound;
+      text = "no touch ring";
+    }
+    break;
+  case LocalOpIndex:
+    if (m_index.isOpen()) {
+      reply.m_values[0] = m_index.GetMaxObjects();
+    } else {
+      reply.m_status = LocalStatusNotFound;
+      text = "no shared index";
+    }
+    break;
+  default:
+    MojLogWarning(s_log, _T("HandleRequest: Unknown op '%d' on fd '%d'."),
+		  (int) request.m_op, conn.m_fd);
+    reply.m_status = LocalStatusBadRequest;
+    text = "unknown request";
+    break;
+  }
+}
+
+// Apply the accesses the clients have recorded in the touch ring since
+// the last drain
+void
+CLocalServer::DrainTouches() {
+
+  MojLogTrace(s_log);
+
+  m_lastDrain = NowMs();
+  if (!m_touchRing.isOpen()) {
+    return;
+  }
+  std::vector<uint64_t> records;
+  m_touchRing.Drain(records, m_touchRing.GetCapacity());
+  if (!records.empty()) {
+    const std::vector<cachedObjectId_t> objIds(records.begin(),
+					       records.end());
+    m_fileCacheSet->TouchObjects(objIds);
+  }
+
+  const uint32_t dropped = m_touchRing.GetDropped();
+  if (dropped != m_touchesDropped) {
+    MojLogWarning(s_log,
+		  _T("DrainTouches: '%u' touches dropped, '%u' since start."),
+		  dropped - m_touchesDropped, dropped);
+    m_touchesDropped = dropped;
+  }
+}
+
+// Update the shared index if the snapshot has changed since it was
+// last published.  The types are copied out of the snapshot first so
+// the index can be written without holding up the cache set.  Only
+// the chunks of objects that changed are written, unless the types
+// changed or the last publication was incomplete, then it is rebuilt.
+void
+CLocalServer::PublishIndex() {
+
+  MojLogTrace(s_log);
+
+  if (!m_index.isOpen()) {
+    return;
+  }
+  std::map<std::string, typeSnapshotPtr_t> types;
+  const uint64_t generation = m_fileCacheSet->GetSnapshotTypes(types);
+  if (generation == m_indexGeneration) {
+    return;
+  }
+
+  m_index.BeginUpdate();
+  bool complete = m_index.isComplete() && PatchIndex(types);
+  if (!complete) {
+    m_index.Clear();
+    complete = BuildIndex(types);
+  }
+  m_index.EndUpdate(generation);
+  m_indexGeneration = generation;
+  m_indexTypes.swap(types);
+
+  if (!complete) {
+    MojLogWarning(s_log,
+		  _T("PublishIndex: The cache set doesn't fit, the index is incomplete."));
+  }
+}
+
+// Add all the types and objects to an empty index.  Returns false if
+// they didn't all fit.
+bool
+CLocalServer::BuildIndex(const std::map<std::string,
+			 typeSnapshotPtr_t>& types) {
+
+  MojLogTrace(s_log);
+
+  bool complete = true;
+  std::map<std::string, typeSnapshotPtr_t>::const_iterator iter;
+  for (iter = types.begin(); iter != types.end(); ++iter) {
+    const CTypeSnapshot& type = *(*iter).second;
+    const int typeIndex = m_index.AddType((*iter).first, type.m_size,
+					  type.m_numObjects);
+    std::map<cachedObjectId_t, objectChunkPtr_t>::const_iterator chunkIter;
+    for (chunkIter = type.m_chunks.begin();
+	 complete && (typeIndex >= 0) && (chunkIter != type.m_chunks.end());
+	 ++chunkIter) {
+      objectSnapshotMap_t::const_iterator objIter;
+      for (objIter = (*chunkIter).second->begin();
+	   complete && (objIter != (*chunkIter).second->end()); ++objIter) {
+	const CObjectSnapshot& obj = (*objIter).second;
+	complete = m_index.AddObject((*objIter).first, typeIndex, obj.m_size,
+				     obj.m_written, obj.m_filename);
+      }
+    }
+    complete = complete && (typeIndex >= 0);
+  }
+
+  return complete;
+}
+
+// Write the difference between two versions of a chunk to the index.
+// Either may be NULL when the chunk was added or dropped.
+static bool
+PatchChunk(CSharedIndex& index, int typeIndex,
+	   const objectSnapshotMap_t* oldChunk,
+	   const objectSnapshotMap_t* newChunk) {
+
+  objectSnapshotMap_t::const_iterator iter;
+  if (oldChunk != NULL) {
+    for (iter = oldChunk->begin(); iter != oldChunk->end(); ++iter) {
+      if ((newChunk == NULL) || (newChunk->count((*iter).first) == 0)) {
+	index.RemoveObject((*iter).first);
+      }
+    }
+  }
+  if (newChunk != NULL) {
+    for (iter = newChunk->begin(); iter != newChunk->end(); ++iter) {
+      const CObjectSnapshot& obj = (*iter).second;
+      if (oldChunk != NULL) {
+	objectSnapshotMap_t::const_iterator oldIter =
+	  oldChunk->find((*iter).first);
+	if ((oldIter != oldChunk->end()) &&
+	    ((*oldIter).second.m_size == obj.m_size) &&
+	    ((*oldIter).second.m_written == obj.m_written)) {
+	  continue;
+	}
+      }
+      if (!index.AddObject((*iter).first, typeIndex, obj.m_size,
+			   obj.m_written, obj.m_filename)) {
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Change the index from the types it was last published from to
+// these.  The types and chunks that haven't changed are shared with
+// the last snapshot so they are skipped by comparing pointers.  The
+// index of a type is its place in the map, so this returns false
+// without changing anything if the set of types changed.  It also
+// returns false once the objects no longer fit, and the index then
+// has to be rebuilt.
+bool
+CLocalServer::PatchIndex(const std::map<std::string,
+			 typeSnapshotPtr_t>& types) {
+
+  MojLogTrace(s_log);
+
+  if (types.size() != m_indexTypes.size()) {
+    return false;
+  }
+  std::map<std::string, typeSnapshotPtr_t>::const_iterator iter;
+  std::map<std::string, typeSnapshotPtr_t>::const_iterator oldIter;
+  for (iter = types.begin(), oldIter = m_indexTypes.begin();
+       iter != types.end(); ++iter, ++oldIter) {
+    if ((*iter).first != (*oldIter).first) {
+      return false;
+    }
+  }
+
+  int typeIndex = 0;
+  for (iter = types.begin(), oldIter = m_indexTypes.begin();
+       iter != types.end(); ++iter, ++oldIter, ++typeIndex) {
+    if ((*iter).second == (*oldIter).second) {
+      continue;
+    }
+    const CTypeSnapshot& type = *(*iter).second;
+    const CTypeSnapshot& oldType = *(*oldIter).second;
+    if (!m_index.SetType(typeIndex, type.m_size, type.m_numObjects)) {
+      return false;
+    }
+
+    // The chunks are walked in order of their keys, like a merge
+    std::map<cachedObjectId_t, objectChunkPtr_t>::const_iterator chunkIter =
+      type.m_chunks.begin();
+    std::map<cachedObjectId_t, objectChunkPtr_t>::const_iterator oldChunkIter =
+      oldType.m_chunks.begin();
+    while ((chunkIter != type.m_chunks.end()) ||
+	   (oldChunkIter != oldType.m_chunks.end())) {
+      bool patched = true;
+      if ((oldChunkIter == oldType.m_chunks.end()) ||
+	  ((chunkIter != type.m_chunks.end()) &&
+	   ((*chunkIter).first < (*oldChunkIter).first))) {
+	patched = PatchChunk(m_index, typeIndex, NULL,
+			     (*chunkIter).second.get());
+	++chunkIter;
+      } else if ((chunkIter == type.m_chunks.end()) ||
+		 ((*oldChunkIter).first < (*chunkIter).first)) {
+	patched = PatchChunk(m_index, typeIndex, (*oldChunkIter).second.get(),
+			     NULL);
+	++oldChunkIter;
+      } else {
+	if ((*chunkIter).second != (*oldChunkIter).second) {
+	  patched = PatchChunk(m_index, typeIndex,
+			       (*oldChunkIter).second.get(),
+			       (*chunkIter).second.get());
+	}
+	++chunkIter;
+	++oldChunkIter;
+      }
+      if (!patched) {
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Release what the client still holds and close its connection
+void
+CLocalServer::CloseConnection(CConnection& conn) {
+
+  MojLogTrace(s_log);
+
+  while (!conn.m_subscriptions.empty()) {
+    const CSubscription& sub = conn.m_subscriptions.back();
+    m_fileCacheSet->UnSubscribeCacheObject(sub.m_typeName, sub.m_objId,
+					   sub.m_streamReader);
+    conn.m_subscriptions.pop_back();
+  }
+  ::close(conn.m_fd);
+  conn.m_fd = -1;
+}
+
+void
+CLocalServer::CloseConnections() {
+
+  MojLogTrace(s_log);
+
+  while (!m_connections.empty()) {
+    CloseConnection(m_connections.back());
+    m_connections.pop_back();
+  }
+}
@@ -0,0 +1,118 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __LOCAL_SERVER_H__
+#define __LOCAL_SERVER_H__
+
+#include <pthread.h>
+#include "CacheBase.h"
+#include "CacheSnapshot.h"
+#include "LocalProtocol.h"
+#include "SharedIndex.h"
+#include "TouchRing.h"
+
+class CFileCacheSet;
+
+// Serves the local socket protocol (see LocalProtocol.h) to clients
+// on the same device.  The requests are answered on the server's own
+// thread straight from the cache set, so they don't go through the
+// bus or wait for the main loop.  Only clients running as root, as
+// the daemon's user or in the daemon's group are served.  The same
+// thread drains the touch ring handed out to the clients and
+// publishes the shared index they can read.
+class CLocalServer {
+ public:
+  CLocalServer(CFileCacheSet* cacheSet);
+  ~CLocalServer();
+
+  // Listen on the socket at socketPath, replacing any socket left
+  // there, and start the server thread.  Returns false if the socket
+  // can't be set up.
+  bool Start(const std::string& socketPath);
+
+  // Stops the server thread, releases the clients' subscriptions,
+  // closes the connections and removes the socket.
+  void Stop();
+
+  bool isRunning() { return m_listenFd >= 0; }
+
+ private:
+
+  CLocalServer& operator=(const CLocalServer&);
+  CLocalServer(const CLocalServer&);
+
+  // A subscription made by a client, with the type it was in so it
+  // can be released even if the object has expired since
+  class CSubscription {
+   public:
+    CSubscription(const cachedObjectId_t objId, const std::string& typeName,
+		  bool streamReader)
+      : m_objId(objId), m_typeName(typeName), m_streamReader(streamReader) {}
+
+    cachedObjectId_t m_objId;
+    std::string m_typeName;
+    bool m_streamReader;
+  };
+
+  // A connected client and the subscriptions it holds
+  class CConnection {
+   public:
+    CConnection(int fd) : m_fd(fd) {}
+
+    int m_fd;
+    std::vector<CSubscription> m_subscriptions;
+  };
+
+  static void* Run(void* data);
+  void Serve();
+  void Accept();
+  bool isAllowed(int fd);
+  bool ReadRequests(CConnection& conn);
+  bool HandleBatch(CConnection& conn, const char* request, size_t len);
+  void HandleRequest(CConnection& conn, const CLocalRequest& request,
+		     const std::string& typeName, const std::string& key,
+		     CLocalReply& reply, std::string& text);
+  void DrainTouches();
+  void PublishIndex();
+  bool BuildIndex(const std::map<std::string, typeSnapshotPtr_t>& types);
+  bool PatchIndex(const std::map<std::string, typeSnapshotPtr_t>& types);
+  void CloseConnection(CConnection& conn);
+  void CloseConnections();
+
+  CFileCacheSet* m_fileCacheSet;
+  std::string m_socketPath;
+  int m_listenFd;
+  // Written to by Stop to wake the server thread
+  int m_wakeFds[2];
+  pthread_t m_thread;
+  std::vector<CConnection> m_connections;
+  // Requests are read into this, it's only used by the server thread
+  std::vector<char> m_input;
+  CTouchRing m_touchRing;
+  // When the ring was last drained and the drops it had counted then
+  long long m_lastDrain;
+  uint32_t m_touchesDropped;
+  CSharedIndex m_index;
+  // The snapshot generation the index was last built from, and its
+  // types, so only the chunks that changed since have to be written
+  uint64_t m_indexGeneration;
+  std::map<std::string, typeSnapshotPtr_t> m_indexTypes;
+  static MojLogger s_log;
+};
+
+#endif /* __LOCAL_SERVER_H__ */
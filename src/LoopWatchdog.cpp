@@ -0,0 +1,244 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "LoopWatchdog.h"
+
+#include <stdio.h>
+#include <time.h>
+
+MojLogger CLoopWatchdog::s_log(_T("filecache.loopwatchdog"));
+
+// The activity the main loop is running.  It is only set by the main
+// loop's thread and read by the helper, a pointer is written in one
+// step.
+static const char* volatile s_loopActivity = NULL;
+
+CLoopWatchdog::CLoopWatchdog()
+  : m_intervalUs(0), m_thresholdUs(0), m_running(false), m_lastBeat(0)
+  , m_stallActivity(NULL), m_lastStallUs(0) {
+
+  MojLogTrace(s_log);
+
+  ::pthread_mutex_init(&m_mutex, NULL);
+  ::pthread_cond_init(&m_cond, NULL);
+}
+
+CLoopWatchdog::~CLoopWatchdog() {
+
+  MojLogTrace(s_log);
+
+  Stop();
+  ::pthread_cond_destroy(&m_cond);
+  ::pthread_mutex_destroy(&m_mutex);
+}
+
+// Expect a beat every intervalUs and count those at least thresholdUs
+// late as stalls.  Returns false if the helper thread can't be
+// started, the stalls are still counted but not put down to any
+// activity.
+bool
+CLoopWatchdog::Start(uint64_t intervalUs, uint64_t thresholdUs) {
+
+  MojLogTrace(s_log);
+
+  if (m_running) {
+    return true;
+  }
+
+  m_intervalUs = intervalUs;
+  m_thresholdUs = thresholdUs;
+  m_running = true;
+  if (::pthread_create(&m_thread, NULL, &Run, this) != 0) {
+    MojLogError(s_log, _T("Start: Failed to start the watchdog thread."));
+    m_running = false;
+    return false;
+  }
+  MojLogInfo(s_log, _T("Start: Watching for main loop stalls of %llums."),
+	     (unsigned long long) (thresholdUs / 1000));
+
+  return true;
+}
+
+// Stop the helper thread
+void
+CLoopWatchdog::Stop() {
+
+  MojLogTrace(s_log);
+
+  if (!m_running) {
+    return;
+  }
+
+  ::pthread_mutex_lock(&m_mutex);
+  m_running = false;
+  ::pthread_cond_signal(&m_cond);
+  ::pthread_mutex_unlock(&m_mutex);
+  ::pthread_join(m_thread, NULL);
+}
+
+// Called on the main loop every interval.  The first beat only starts
+// the watch, the time before the loop ran isn't a stall.
+void
+CLoopWatchdog::Beat() {
+
+  const uint64_t now = CMetrics::Now();
+
+  ::pthread_mutex_lock(&m_mutex);
+  const uint64_t lastBeat = m_lastBeat;
+  const char* activity = m_stallActivity;
+  m_lastBeat = now;
+  m_stallActivity = NULL;
+  ::pthread_mutex_unlock(&m_mutex);
+  if (lastBeat == 0) {
+    return;
+  }
+
+  const uint64_t elapsed = now - lastBeat;
+  const uint64_t lag = (elapsed > m_intervalUs) ? elapsed - m_intervalUs : 0;
+  m_lag.Record(lag);
+  if ((m_thresholdUs == 0) || (lag < m_thresholdUs)) {
+    return;
+  }
+
+  m_stalls.Record(lag);
+  if (activity == NULL) {
+    activity = s_loopUnknownActivity;
+  }
+  ::pthread_mutex_lock(&m_mutex);
+  m_activityStalls[activity]++;
+  m_lastStallActivity = activity;
+  m_lastStallUs = lag;
+  ::pthread_mutex_unlock(&m_mutex);
+  MojLogWarning(s_log, _T("Beat: Main loop stalled for %.1fms in '%s'."),
+		(double) lag / 1000.0, activity);
+}
+
+// The stalls counted against each activity
+void
+CLoopWatchdog::GetStallActivities(std::map<std::string, uint64_t>& activities) {
+
+  ::pthread_mutex_lock(&m_mutex);
+  activities = m_activityStalls;
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+// The activity and time of the last stall, an empty activity if there
+// hasn't been one
+void
+CLoopWatchdog::GetLastStall(std::string& activity, uint64_t& us) {
+
+  ::pthread_mutex_lock(&m_mutex);
+  activity = m_lastStallActivity;
+  us = m_lastStallUs;
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+// Append the lag, the stalls and the stalls of each activity in the
+// Prometheus text format
+void
+CLoopWatchdog::FormatPrometheus(std::string& text) {
+
+  char buf[256];
+  const CLatencyHistogram* histograms[] = { &m_lag, &m_stalls };
+  const char* const names[] = {
+    "filecache_main_loop_lag_seconds", "filecache_main_loop_stall_seconds"
+  };
+  const char* const helps[] = {
+    "How late the main loop ran its heartbeat.",
+    "Time the main loop was held up by each stall."
+  };
+  for (int i = 0; i < 2; i++) {
+    ::snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s summary\n",
+	       names[i], helps[i], names[i]);
+    text += buf;
+    for (size_t j = 0; j < CMetrics::s_numPercentiles; j++) {
+      ::snprintf(buf, sizeof(buf), "%s{quantile=\"%g\"} %.6f\n", names[i],
+		 CMetrics::s_percentiles[j],
+		 (double) histograms[i]->GetPercentile(CMetrics::s_percentiles[j]) / 1e6);
+      text += buf;
+    }
+    ::snprintf(buf, sizeof(buf), "%s_sum %.6f\n%s_count %llu\n", names[i],
+	       (double) histograms[i]->GetSum() / 1e6, names[i],
+	       (unsigned long long) histograms[i]->GetCount());
+    text += buf;
+  }
+
+  std::map<std::string, uint64_t> activities;
+  GetStallActivities(activities);
+  text += "# HELP filecache_main_loop_stalls_total Stalls of the main loop by the activity it was held up in.\n"
+    "# TYPE filecache_main_loop_stalls_total counter\n";
+  for (std::map<std::string, uint64_t>::const_iterator iter =
+	 activities.begin(); iter != activities.end(); ++iter) {
+    ::snprintf(buf, sizeof(buf),
+	       "filecache_main_loop_stalls_total{activity=\"%s\"} %llu\n",
+	       iter->first.c_str(), (unsigned long long) iter->second);
+    text += buf;
+  }
+}
+
+// The activity the main loop is running, or NULL
+const char*
+CLoopWatchdog::GetActivity() {
+
+  return s_loopActivity;
+}
+
+// Wakes every half threshold, so a loop held up for the threshold is
+// seen while it is, and notes the activity of the first wake that
+// finds it more than half the threshold late
+void*
+CLoopWatchdog::Run(void* data) {
+
+  CLoopWatchdog* watchdog = static_cast<CLoopWatchdog*>(data);
+  const uint64_t checkUs = (watchdog->m_thresholdUs > 1) ?
+    watchdog->m_thresholdUs / 2 : 1;
+
+  ::pthread_mutex_lock(&watchdog->m_mutex);
+  while (watchdog->m_running) {
+    struct timespec deadline;
+    ::clock_gettime(CLOCK_REALTIME, &deadline);
+    const uint64_t nsec = (uint64_t) deadline.tv_nsec + checkUs * 1000;
+    deadline.tv_sec += (time_t) (nsec / 1000000000);
+    deadline.tv_nsec = (long) (nsec % 1000000000);
+    ::pthread_cond_timedwait(&watchdog->m_cond, &watchdog->m_mutex,
+			     &deadline);
+    if (!watchdog->m_running || (watchdog->m_lastBeat == 0) ||
+	(watchdog->m_stallActivity != NULL)) {
+      continue;
+    }
+    const uint64_t now = CMetrics::Now();
+    if (now - watchdog->m_lastBeat >= watchdog->m_intervalUs + checkUs) {
+      watchdog->m_stallActivity = GetActivity();
+    }
+  }
+  ::pthread_mutex_unlock(&watchdog->m_mutex);
+
+  return NULL;
+}
+
+CLoopActivity::CLoopActivity(const char* name)
+  : m_prevName(s_loopActivity)
+{
+
+  s_loopActivity = name;
+}
+
+CLoopActivity::~CLoopActivity() {
+
+  s_loopActivity = m_prevName;
+}
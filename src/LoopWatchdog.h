@@ -0,0 +1,120 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __LOOP_WATCHDOG_H__
+#define __LOOP_WATCHDOG_H__
+
+#include "CacheBase.h"
+#include "Metrics.h"
+#include <map>
+#include <pthread.h>
+
+// How often, in milliseconds, the main loop beats while it is watched
+static const int s_loopHeartbeatInterval = 50;
+
+// The activity a stall is put down to when the main loop wasn't
+// running one that was named
+static const char* const s_loopUnknownActivity = "unknown";
+
+// Watches the thread running the main loop for stalls, where one
+// handler or timer keeps every other request waiting.  The loop calls
+// Beat every interval and how late each beat is, its lag, is kept in a
+// histogram.  A beat at least the threshold late ends a stall, whose
+// time is kept in a second histogram.  While the loop is held up a
+// helper thread notes the CLoopActivity it is running, which the stall
+// is counted against and logged with once it ends.
+class CLoopWatchdog {
+ public:
+  CLoopWatchdog();
+  ~CLoopWatchdog();
+
+  // Expect a beat every intervalUs and count those at least
+  // thresholdUs late as stalls.  Returns false if the helper thread
+  // can't be started, the stalls are still counted but not put down to
+  // any activity.
+  bool Start(uint64_t intervalUs, uint64_t thresholdUs);
+
+  // Stop the helper thread
+  void Stop();
+
+  bool isStarted() const { return m_thresholdUs > 0; }
+
+  // Called on the main loop every interval
+  void Beat();
+
+  const CLatencyHistogram& GetLag() const { return m_lag; }
+  const CLatencyHistogram& GetStalls() const { return m_stalls; }
+
+  // The stalls counted against each activity
+  void GetStallActivities(std::map<std::string, uint64_t>& activities);
+  // The activity and time of the last stall, an empty activity if
+  // there hasn't been one
+  void GetLastStall(std::string& activity, uint64_t& us);
+
+  // Append the lag, the stalls and the stalls of each activity in the
+  // Prometheus text format
+  void FormatPrometheus(std::string& text);
+
+  // The activity the main loop is running, or NULL
+  static const char* GetActivity();
+
+ private:
+  CLoopWatchdog& operator=(const CLoopWatchdog&);
+  CLoopWatchdog(const CLoopWatchdog&);
+
+  static void* Run(void* data);
+
+  uint64_t m_intervalUs;
+  uint64_t m_thresholdUs;
+  volatile bool m_running;
+  // Guards everything below up to the histograms, which are recorded
+  // atomically, and wakes the helper thread to stop
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  pthread_t m_thread;
+  // The time of the last beat, 0 until the loop first beats
+  uint64_t m_lastBeat;
+  // The activity the helper saw the loop held up in since the last
+  // beat, or NULL
+  const char* m_stallActivity;
+  std::map<std::string, uint64_t> m_activityStalls;
+  std::string m_lastStallActivity;
+  uint64_t m_lastStallUs;
+  CLatencyHistogram m_lag;
+  CLatencyHistogram m_stalls;
+  static MojLogger s_log;
+};
+
+// Names what the main loop is running for as long as it exists, so a
+// stall can be put down to it.  Activities may be nested, the inner
+// one is named until it ends.  Only used on the thread running the
+// main loop, and name has to stay valid for as long as any watchdog
+// does.
+class CLoopActivity {
+ public:
+  explicit CLoopActivity(const char* name);
+  ~CLoopActivity();
+
+ private:
+  CLoopActivity& operator=(const CLoopActivity&);
+  CLoopActivity(const CLoopActivity&);
+
+  const char* m_prevName;
+};
+
+#endif /* __LOOP_WATCHDOG_H__ */
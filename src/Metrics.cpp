@@ -0,0 +1,213 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+const double CMetrics::s_percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+const size_t CMetrics::s_numPercentiles = sizeof(s_percentiles) /
+  sizeof(s_percentiles[0]);
+
+CLatencyHistogram::CLatencyHistogram() : m_count(0), m_sum(0), m_max(0) {
+
+  for (int i = 0; i < s_histogramBuckets; i++) {
+    m_buckets[i] = 0;
+  }
+}
+
+void
+CLatencyHistogram::Record(uint64_t us) {
+
+  __sync_fetch_and_add(&m_buckets[GetBucket(us)], 1);
+  __sync_fetch_and_add(&m_count, 1);
+  __sync_fetch_and_add(&m_sum, us);
+  uint64_t max = m_max;
+  while (us > max) {
+    const uint64_t seen = __sync_val_compare_and_swap(&m_max, max, us);
+    if (seen == max) {
+      break;
+    }
+    max = seen;
+  }
+}
+
+// The smallest time that at least fraction of the times recorded are
+// no larger than, to within the width of its bucket.  0 if nothing has
+// been recorded.
+uint64_t
+CLatencyHistogram::GetPercentile(double fraction) const {
+
+  const uint64_t count = m_count;
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (fraction * (double) count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < s_histogramBuckets; i++) {
+    seen += m_buckets[i];
+    if (seen >= rank) {
+      const uint64_t limit = GetBucketLimit(i);
+      return (limit < m_max) ? limit : m_max;
+    }
+  }
+
+  return m_max;
+}
+
+// Times below 2^s_histogramSubBits each have a bucket of their own.
+// Above that the top s_histogramSubBits bits after the leading one
+// pick the bucket within the power of two.
+int
+CLatencyHistogram::GetBucket(uint64_t us) {
+
+  const uint64_t subBuckets = 1 << s_histogramSubBits;
+  if (us < subBuckets) {
+    return (int) us;
+  }
+  if (us > 0xffffffffULL) {
+    return s_histogramBuckets - 1;
+  }
+  const int top = 63 - __builtin_clzll(us);
+  const int shift = top - s_histogramSubBits;
+
+  return ((shift + 1) << s_histogramSubBits) +
+    (int) ((us >> shift) & (subBuckets - 1));
+}
+
+// The largest time counted in a bucket
+uint64_t
+CLatencyHistogram::GetBucketLimit(int bucket) {
+
+  const int subBuckets = 1 << s_histogramSubBits;
+  if (bucket < subBuckets) {
+    return (uint64_t) bucket;
+  }
+  const int shift = (bucket >> s_histogramSubBits) - 1;
+  const uint64_t low = (uint64_t) (subBuckets + (bucket & (subBuckets - 1)))
+    << shift;
+
+  return low + (1ULL << shift) - 1;
+}
+
+CMetrics::CMetrics() {
+}
+
+CMetrics::~CMetrics() {
+
+  for (size_t i = 0; i < m_paths.size(); i++) {
+    delete m_paths[i];
+  }
+}
+
+// Add a path and return the index it is recorded by
+size_t
+CMetrics::AddPath(const std::string& label, const std::string& name) {
+
+  CPath* path = new CPath;
+  path->m_label = label;
+  path->m_name = name;
+  path->m_failures = 0;
+  m_paths.push_back(path);
+
+  return m_paths.size() - 1;
+}
+
+void
+CMetrics::Record(size_t path, uint64_t us, bool failed) {
+
+  CPath* p = m_paths[path];
+  p->m_histogram.Record(us);
+  if (failed) {
+    __sync_fetch_and_add(&p->m_failures, 1);
+  }
+}
+
+// Write every path in the Prometheus text format to pathname,
+// followed by extra, replacing it in one step so a reader never sees
+// part of it.  Returns false if it can't be written.
+bool
+CMetrics::WritePrometheus(const std::string& pathname,
+			  const std::string& extra) const {
+
+  const std::string tmpName(pathname + ".tmp");
+  FILE* file = ::fopen(tmpName.c_str(), "w");
+  if (file == NULL) {
+    return false;
+  }
+
+  ::fprintf(file, "# HELP filecache_duration_seconds Time taken by each method and background task.\n"
+	    "# TYPE filecache_duration_seconds summary\n");
+  for (size_t i = 0; i < m_paths.size(); i++) {
+    const CPath* p = m_paths[i];
+    const char* label = p->m_label.c_str();
+    const char* name = p->m_name.c_str();
+    for (size_t j = 0; j < s_numPercentiles; j++) {
+      ::fprintf(file, "filecache_duration_seconds{%s=\"%s\",quantile=\"%g\"} %.6f\n",
+		label, name, s_percentiles[j],
+		(double) p->m_histogram.GetPercentile(s_percentiles[j]) / 1e6);
+    }
+    ::fprintf(file, "filecache_duration_seconds_sum{%s=\"%s\"} %.6f\n"
+	      "filecache_duration_seconds_count{%s=\"%s\"} %llu\n",
+	      label, name, (double) p->m_histogram.GetSum() / 1e6,
+	      label, name, (unsigned long long) p->m_histogram.GetCount());
+  }
+
+  ::fprintf(file, "# HELP filecache_duration_max_seconds Longest time taken by each method and background task.\n"
+	    "# TYPE filecache_duration_max_seconds gauge\n");
+  for (size_t i = 0; i < m_paths.size(); i++) {
+    const CPath* p = m_paths[i];
+    ::fprintf(file, "filecache_duration_max_seconds{%s=\"%s\"} %.6f\n",
+	      p->m_label.c_str(), p->m_name.c_str(),
+	      (double) p->m_histogram.GetMax() / 1e6);
+  }
+
+  ::fprintf(file, "# HELP filecache_failures_total Calls of each method and background task that failed.\n"
+	    "# TYPE filecache_failures_total counter\n");
+  for (size_t i = 0; i < m_paths.size(); i++) {
+    const CPath* p = m_paths[i];
+    ::fprintf(file, "filecache_failures_total{%s=\"%s\"} %llu\n",
+	      p->m_label.c_str(), p->m_name.c_str(),
+	      (unsigned long long) p->m_failures);
+  }
+  ::fputs(extra.c_str(), file);
+
+  const bool written = !::ferror(file);
+  if ((::fclose(file) != 0) || !written ||
+      (::rename(tmpName.c_str(), pathname.c_str()) != 0)) {
+    ::unlink(tmpName.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// A monotonic clock in microseconds
+uint64_t
+CMetrics::Now() {
+
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
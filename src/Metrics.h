@@ -0,0 +1,120 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Each power of two is split into 1 << s_histogramSubBits buckets, so
+// a percentile is within 12.5% of the true value.  Values from 0 to
+// 2^32 - 1 microseconds (about 71 minutes) are kept, larger ones are
+// counted in the last bucket.
+static const int s_histogramSubBits = 3;
+static const int s_histogramBuckets = (32 - s_histogramSubBits + 1) <<
+  s_histogramSubBits;
+
+// A histogram of times in microseconds with logarithmic buckets, like
+// an HDR histogram.  Any thread may record, the counts are changed
+// atomically, so a reader may see a time counted in one total and not
+// yet in another.
+class CLatencyHistogram {
+ public:
+  CLatencyHistogram();
+
+  void Record(uint64_t us);
+
+  uint64_t GetCount() const { return m_count; }
+  uint64_t GetSum() const { return m_sum; }
+  uint64_t GetMax() const { return m_max; }
+
+  // The smallest time that at least fraction of the times recorded are
+  // no larger than, to within the width of its bucket.  0 if nothing
+  // has been recorded.
+  uint64_t GetPercentile(double fraction) const;
+
+  static int GetBucket(uint64_t us);
+  // The largest time counted in a bucket
+  static uint64_t GetBucketLimit(int bucket);
+
+ private:
+  uint64_t m_buckets[s_histogramBuckets];
+  uint64_t m_count;
+  uint64_t m_sum;
+  uint64_t m_max;
+};
+
+// The calls, failures and times of a set of code paths, such as the
+// methods of the service and the work it does on its own.  Each path
+// is named by a label for Prometheus, such as method="DefineType".
+// Paths are only added before any are recorded, after that any thread
+// may record.
+class CMetrics {
+ public:
+  CMetrics();
+  ~CMetrics();
+
+  // Add a path and return the index it is recorded by
+  size_t AddPath(const std::string& label, const std::string& name);
+
+  void Record(size_t path, uint64_t us, bool failed);
+
+  size_t GetNumPaths() const { return m_paths.size(); }
+  const std::string& GetLabel(size_t path) const {
+    return m_paths[path]->m_label;
+  }
+  const std::string& GetName(size_t path) const {
+    return m_paths[path]->m_name;
+  }
+  uint64_t GetFailures(size_t path) const {
+    return m_paths[path]->m_failures;
+  }
+  const CLatencyHistogram& GetHistogram(size_t path) const {
+    return m_paths[path]->m_histogram;
+  }
+
+  // Write every path in the Prometheus text format to pathname,
+  // followed by extra, replacing it in one step so a reader never sees
+  // part of it.  Returns false if it can't be written.
+  bool WritePrometheus(const std::string& pathname,
+		       const std::string& extra = std::string()) const;
+
+  // A monotonic clock in microseconds
+  static uint64_t Now();
+
+  // The percentiles reported for each path
+  static const double s_percentiles[];
+  static const size_t s_numPercentiles;
+
+ private:
+  CMetrics& operator=(const CMetrics&);
+  CMetrics(const CMetrics&);
+
+  struct CPath {
+    std::string m_label;
+    std::string m_name;
+    uint64_t m_failures;
+    CLatencyHistogram m_histogram;
+  };
+
+  std::vector<CPath*> m_paths;
+};
+
+#endif /* __METRICS_H__ */
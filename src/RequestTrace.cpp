@@ -0,0 +1,287 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "RequestTrace.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+MojLogger CRequestTracer::s_log(_T("filecache.requesttracer"));
+
+// The trace of the request each thread is handling and the depth the
+// next stage it starts is at
+static __thread CRequestTrace* s_currentTrace = NULL;
+static __thread int s_currentDepth = 0;
+
+CRequestTrace::CRequestTrace(CRequestTracer& tracer, uint64_t id,
+			     const char* method)
+  : m_tracer(tracer)
+  , m_id(id)
+  , m_method(method)
+  , m_thread(::pthread_self())
+  , m_start(CMetrics::Now())
+  , m_refs(1)
+{
+}
+
+void
+CRequestTrace::AddRef() {
+
+  __sync_fetch_and_add(&m_refs, 1);
+}
+
+void
+CRequestTrace::Release() {
+
+  if (__sync_sub_and_fetch(&m_refs, 1) == 0) {
+    m_tracer.Done(this);
+  }
+}
+
+// Start a stage at depth, returning the index to end it with
+size_t
+CRequestTrace::BeginSpan(const char* name, int depth) {
+
+  CSpan span;
+  span.m_name = name;
+  span.m_depth = depth;
+  span.m_other = !::pthread_equal(::pthread_self(), m_thread);
+  span.m_start = CMetrics::Now();
+  span.m_us = 0;
+
+  CCacheMutexGuard guard(m_lock);
+  m_spans.push_back(span);
+
+  return m_spans.size() - 1;
+}
+
+void
+CRequestTrace::EndSpan(size_t span) {
+
+  const uint64_t now = CMetrics::Now();
+
+  CCacheMutexGuard guard(m_lock);
+  m_spans[span].m_us = now - m_spans[span].m_start;
+}
+
+// Add a stage timed elsewhere, such as the time a job waited for a
+// worker
+void
+CRequestTrace::AddSpan(const char* name, int depth, uint64_t start,
+		       uint64_t us) {
+
+  CSpan span;
+  span.m_name = name;
+  span.m_depth = depth;
+  span.m_other = !::pthread_equal(::pthread_self(), m_thread);
+  span.m_start = start;
+  span.m_us = us;
+
+  CCacheMutexGuard guard(m_lock);
+  m_spans.push_back(span);
+}
+
+// The time of the request in microseconds, up to now
+uint64_t
+CRequestTrace::GetTime() {
+
+  return CMetrics::Now() - m_start;
+}
+
+// Append the stages as "name 1.2ms [nested 1.0ms], next 0.1ms".  The
+// stages run on an I/O worker are marked with a '*'.
+void
+CRequestTrace::FormatSpans(std::string& text) {
+
+  CCacheMutexGuard guard(m_lock);
+
+  char buf[128];
+  int depth = 0;
+  for (size_t i = 0; i < m_spans.size(); i++) {
+    const CSpan& span = m_spans[i];
+    if (span.m_depth > depth) {
+      for (; depth < span.m_depth; depth++) {
+	text += " [";
+      }
+    } else {
+      for (; depth > span.m_depth; depth--) {
+	text += "]";
+      }
+      if (i > 0) {
+	text += ", ";
+      }
+    }
+    ::snprintf(buf, sizeof(buf), "%s%s %.1fms", span.m_other ? "*" : "",
+	       span.m_name, (double) span.m_us / 1000.0);
+    text += buf;
+  }
+  for (; depth > 0; depth--) {
+    text += "]";
+  }
+}
+
+// Append the request and its stages as Chrome trace events, one per
+// line and each followed by a comma.  The stages run on an I/O worker
+// are shown on a thread of their own.
+void
+CRequestTrace::FormatChrome(std::string& text) {
+
+  CCacheMutexGuard guard(m_lock);
+
+  char buf[256];
+  const int pid = (int) ::getpid();
+  ::snprintf(buf, sizeof(buf),
+	     "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":1,\"args\":{\"id\":%llu}},\n",
+	     m_method, (unsigned long long) m_start,
+	     (unsigned long long) GetTime(), pid, (unsigned long long) m_id);
+  text += buf;
+  for (size_t i = 0; i < m_spans.size(); i++) {
+    const CSpan& span = m_spans[i];
+    ::snprintf(buf, sizeof(buf),
+	       "{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"id\":%llu}},\n",
+	       span.m_name, (unsigned long long) span.m_start,
+	       (unsigned long long) span.m_us, pid, span.m_other ? 2 : 1,
+	       (unsigned long long) m_id);
+    text += buf;
+  }
+}
+
+// The trace of the request the calling thread is handling, or NULL
+CRequestTrace*
+CRequestTrace::GetCurrent() {
+
+  return s_currentTrace;
+}
+
+CRequestScope::CRequestScope(CRequestTrace* trace)
+  : m_prevTrace(s_currentTrace)
+  , m_prevDepth(s_currentDepth)
+{
+
+  s_currentTrace = trace;
+  s_currentDepth = 0;
+}
+
+CRequestScope::~CRequestScope() {
+
+  s_currentTrace = m_prevTrace;
+  s_currentDepth = m_prevDepth;
+}
+
+CTraceSpan::CTraceSpan(const char* name)
+  : m_trace(s_currentTrace)
+  , m_span(0)
+{
+
+  if (m_trace != NULL) {
+    m_span = m_trace->BeginSpan(name, s_currentDepth++);
+  }
+}
+
+CTraceSpan::~CTraceSpan() {
+
+  if (m_trace != NULL) {
+    m_trace->EndSpan(m_span);
+    s_currentDepth--;
+  }
+}
+
+CRequestTracer::CRequestTracer()
+  : m_slowUs(0)
+  , m_nextId(0)
+  , m_slowRequests(0)
+  , m_chromeFile(NULL)
+{
+}
+
+CRequestTracer::~CRequestTracer() {
+
+  if (m_chromeFile != NULL) {
+    ::fclose(m_chromeFile);
+  }
+}
+
+// Log requests that take at least slowUs, unless that is 0, and write
+// every trace to chromeFile, unless that is empty.  Returns false if
+// the file can't be opened, the slow requests are still logged.
+bool
+CRequestTracer::Start(uint64_t slowUs, const std::string& chromeFile) {
+
+  MojLogTrace(s_log);
+
+  m_slowUs = slowUs;
+  if (chromeFile.empty()) {
+    return true;
+  }
+
+  CCacheMutexGuard guard(m_fileLock);
+  m_chromeFile = ::fopen(chromeFile.c_str(), "a");
+  if (m_chromeFile == NULL) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("Start: Failed to open '%s' (%s)."),
+		chromeFile.c_str(), ::strerror(savedErrno));
+    return false;
+  }
+  // The events are added to an existing file, which already has the
+  // opening bracket
+  if (::ftell(m_chromeFile) == 0) {
+    ::fputs("[\n", m_chromeFile);
+  }
+  MojLogInfo(s_log, _T("Start: Writing request traces to '%s'."),
+	     chromeFile.c_str());
+
+  return true;
+}
+
+// A new trace the caller holds the one reference to, or NULL if
+// nothing is traced
+CRequestTrace*
+CRequestTracer::Begin(const char* method) {
+
+  if (!isEnabled()) {
+    return NULL;
+  }
+
+  return new CRequestTrace(*this, __sync_add_and_fetch(&m_nextId, 1),
+			   method);
+}
+
+// Called by the thread that releases the last reference to a trace
+void
+CRequestTracer::Done(CRequestTrace* trace) {
+
+  const uint64_t us = trace->GetTime();
+  if ((m_slowUs > 0) && (us >= m_slowUs)) {
+    __sync_fetch_and_add(&m_slowRequests, 1);
+    std::string spans;
+    trace->FormatSpans(spans);
+    MojLogWarning(s_log, _T("SlowRequest: %s #%llu took %.1fms: %s"),
+		  trace->GetMethod(), (unsigned long long) trace->GetId(),
+		  (double) us / 1000.0, spans.c_str());
+  }
+  if (m_chromeFile != NULL) {
+    std::string events;
+    trace->FormatChrome(events);
+    CCacheMutexGuard guard(m_fileLock);
+    ::fputs(events.c_str(), m_chromeFile);
+    ::fflush(m_chromeFile);
+  }
+
+  delete trace;
+}
@@ -0,0 +1,164 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __REQUEST_TRACE_H__
+#define __REQUEST_TRACE_H__
+
+#include "CacheBase.h"
+#include "CacheLock.h"
+
+class CRequestTracer;
+
+// The stages, or spans, one request went through and how long each
+// took.  A trace is made current on the thread handling the request
+// with a CRequestScope, and CTraceSpans anywhere below that add their
+// stage to it.  Work the request waits on, such as creating the file
+// of a new object on an I/O worker, holds a reference and makes the
+// trace current while it runs.  The request's time runs until the
+// last reference is released, when the trace is handed back to its
+// tracer.
+class CRequestTrace {
+ public:
+  void AddRef();
+  void Release();
+
+  uint64_t GetId() const { return m_id; }
+  const char* GetMethod() const { return m_method; }
+
+  // Start a stage at depth, returning the index to end it with
+  size_t BeginSpan(const char* name, int depth);
+  void EndSpan(size_t span);
+  // Add a stage timed elsewhere, such as the time a job waited for a
+  // worker
+  void AddSpan(const char* name, int depth, uint64_t start, uint64_t us);
+
+  // The time of the request in microseconds, up to now
+  uint64_t GetTime();
+
+  // Append the stages as "name 1.2ms [nested 1.0ms], next 0.1ms".  The
+  // stages run on an I/O worker are marked with a '*'.
+  void FormatSpans(std::string& text);
+  // Append the request and its stages as Chrome trace events, one per
+  // line and each followed by a comma
+  void FormatChrome(std::string& text);
+
+  // The trace of the request the calling thread is handling, or NULL
+  static CRequestTrace* GetCurrent();
+
+ private:
+  friend class CRequestTracer;
+
+  CRequestTrace(CRequestTracer& tracer, uint64_t id, const char* method);
+  ~CRequestTrace() {}
+  CRequestTrace& operator=(const CRequestTrace&);
+  CRequestTrace(const CRequestTrace&);
+
+  struct CSpan {
+    const char* m_name;
+    int m_depth;
+    // Whether it ran on a thread other than the one that started
+    // the request
+    bool m_other;
+    uint64_t m_start;
+    uint64_t m_us;
+  };
+
+  CRequestTracer& m_tracer;
+  const uint64_t m_id;
+  const char* m_method;
+  const pthread_t m_thread;
+  const uint64_t m_start;
+  int m_refs;
+  // Guards m_spans, they may be added by a worker while the request
+  // goes on
+  CCacheMutex m_lock;
+  std::vector<CSpan> m_spans;
+};
+
+// Makes a trace current on this thread for as long as it exists.  The
+// trace may be NULL, which makes no trace current.
+class CRequestScope {
+ public:
+  explicit CRequestScope(CRequestTrace* trace);
+  ~CRequestScope();
+
+ private:
+  CRequestScope& operator=(const CRequestScope&);
+  CRequestScope(const CRequestScope&);
+
+  CRequestTrace* m_prevTrace;
+  int m_prevDepth;
+};
+
+// Times a stage of the current request, if there is one
+class CTraceSpan {
+ public:
+  explicit CTraceSpan(const char* name);
+  ~CTraceSpan();
+
+ private:
+  CTraceSpan& operator=(const CTraceSpan&);
+  CTraceSpan(const CTraceSpan&);
+
+  CRequestTrace* m_trace;
+  size_t m_span;
+};
+
+// Starts the traces of requests and logs those slower than a threshold
+// with their stages.  Every trace may also be appended to a file in
+// the Chrome trace event format, which chrome://tracing and Perfetto
+// load even though the closing bracket is never written.
+class CRequestTracer {
+ public:
+  CRequestTracer();
+  ~CRequestTracer();
+
+  // Log requests that take at least slowUs, unless that is 0, and
+  // write every trace to chromeFile, unless that is empty.  Returns
+  // false if the file can't be opened, the slow requests are still
+  // logged.
+  bool Start(uint64_t slowUs, const std::string& chromeFile);
+
+  bool isEnabled() const { return (m_slowUs > 0) || (m_chromeFile != NULL); }
+
+  // A new trace the caller holds the one reference to, or NULL if
+  // nothing is traced
+  CRequestTrace* Begin(const char* method);
+
+  // The number of requests logged as slow
+  uint64_t GetSlowRequests() const { return m_slowRequests; }
+
+ private:
+  friend class CRequestTrace;
+
+  CRequestTracer& operator=(const CRequestTracer&);
+  CRequestTracer(const CRequestTracer&);
+
+  // Called by the thread that releases the last reference to a trace
+  void Done(CRequestTrace* trace);
+
+  uint64_t m_slowUs;
+  uint64_t m_nextId;
+  uint64_t m_slowRequests;
+  // Guards the file, traces may be done on any thread
+  CCacheMutex m_fileLock;
+  FILE* m_chromeFile;
+  static MojLogger s_log;
+};
+
+#endif /* __REQUEST_TRACE_H__ */
@@ -0,0 +1,465 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "SharedIndex.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t s_sharedIndexMagic = 0x46435849;
+
+// The space kept for filenames, per object
+static const uint32_t s_sharedIndexNameSpace = 32;
+
+// How many times a reader tries before giving up on an update
+static const int s_sharedIndexReadTries = 64;
+
+CSharedIndex::CSharedIndex() : m_fd(-1), m_length(0), m_header(NULL)
+  , m_types(NULL), m_slots(NULL), m_names(NULL), m_maxObjects(0)
+  , m_maxTypes(0), m_numSlots(0), m_namesSize(0) {
+}
+
+CSharedIndex::~CSharedIndex() {
+
+  Close();
+}
+
+// Create an empty index with room for maxObjects objects and maxTypes
+// types.  The shared memory has no name, other processes can only get
+// to it through the descriptor returned by GetFd, which is opened
+// read-only.
+bool
+CSharedIndex::Create(uint32_t maxObjects, uint32_t maxTypes) {
+
+  Close();
+
+  // Keep the table at most half full so the probes stay short
+  CHeader header;
+  ::memset(&header, 0, sizeof(header));
+  header.m_maxObjects = maxObjects;
+  header.m_maxTypes = maxTypes;
+  header.m_numSlots = 1;
+  while (header.m_numSlots < 2 * maxObjects) {
+    header.m_numSlots <<= 1;
+  }
+  header.m_namesSize = maxObjects * s_sharedIndexNameSpace;
+  const size_t len = Length(header.m_numSlots, maxTypes, header.m_namesSize);
+
+  // The name is only used until the memory is open
+  static int s_count = 0;
+  char name[64];
+  ::snprintf(name, sizeof(name), "/filecache-index-%d-%d", (int) ::getpid(),
+	     __sync_fetch_and_add(&s_count, 1));
+  // The memory is only readable so it can't be opened again for
+  // writing, the writer keeps its mapping from this descriptor
+  int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR);
+  if (fd < 0) {
+    return false;
+  }
+  ::shm_unlink(name);
+  if ((::ftruncate(fd, (off_t) len) != 0) ||
+      !Map(fd, len, true)) {
+    ::close(fd);
+    return false;
+  }
+
+  // The descriptor handed to the readers is opened again read-only,
+  // a reader given the writable one could map the index for writing
+  char path[64];
+  ::snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  const int readFd = ::open(path, O_RDONLY);
+  ::close(fd);
+  if (readFd < 0) {
+    Close();
+    return false;
+  }
+
+  m_fd = readFd;
+  SetLayout(header);
+  // Nothing has been published, so a miss can't be trusted yet
+  *m_header = header;
+  __sync_synchronize();
+  m_header->m_magic = s_sharedIndexMagic;
+
+  return true;
+}
+
+// Map an index created by another process for reading
+bool
+CSharedIndex::Attach(int fd) {
+
+  Close();
+
+  struct stat buf;
+  if ((::fstat(fd, &buf) != 0) || (buf.st_size < (off_t) sizeof(CHeader)) ||
+      !Map(fd, (size_t) buf.st_size, false)) {
+    return false;
+  }
+  CHeader header = *m_header;
+  if ((header.m_magic != s_sharedIndexMagic) || (header.m_numSlots == 0) ||
+      ((header.m_numSlots & (header.m_numSlots - 1)) != 0) ||
+      (header.m_maxTypes > 0xffff) ||
+      (Length(header.m_numSlots, header.m_maxTypes, header.m_namesSize) >
+       m_length)) {
+    Close();
+    return false;
+  }
+  SetLayout(header);
+
+  return true;
+}
+
+void
+CSharedIndex::Close() {
+
+  if (m_header != NULL) {
+    ::munmap(m_header, m_length);
+    m_header = NULL;
+    m_types = NULL;
+    m_slots = NULL;
+    m_names = NULL;
+    m_length = 0;
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_maxObjects = 0;
+  m_maxTypes = 0;
+  m_numSlots = 0;
+  m_namesSize = 0;
+}
+
+// Start changing the index.  Readers retry until EndUpdate.
+void
+CSharedIndex::BeginUpdate() {
+
+  __sync_fetch_and_add(&m_header->m_seq, 1);
+}
+
+// Empty the index so it can be rebuilt.  This also takes back the
+// space of the filenames left behind by RemoveObject.
+void
+CSharedIndex::Clear() {
+
+  m_header->m_numObjects = 0;
+  m_header->m_numTypes = 0;
+  m_header->m_namesUsed = 0;
+  m_header->m_complete = 1;
+  ::memset(m_slots, 0, m_numSlots * sizeof(CObjectEntry));
+}
+
+int
+CSharedIndex::AddType(const std::string& typeName, int64_t size,
+		      int64_t numObjects) {
+
+  if ((m_header->m_numTypes >= m_maxTypes) ||
+      (typeName.size() >= sizeof(m_types[0].m_name))) {
+    m_header->m_complete = 0;
+    return -1;
+  }
+
+  const uint32_t index = m_header->m_numTypes++;
+  CTypeEntry& entry = m_types[index];
+  ::memset(entry.m_name, 0, sizeof(entry.m_name));
+  ::memcpy(entry.m_name, typeName.data(), typeName.size());
+  entry.m_size = size;
+  entry.m_numObjects = numObjects;
+
+  return (int) index;
+}
+
+// Update the totals of a type already in the index
+bool
+CSharedIndex::SetType(int typeIndex, int64_t size, int64_t numObjects) {
+
+  if ((typeIndex < 0) || ((uint32_t) typeIndex >= m_header->m_numTypes)) {
+    m_header->m_complete = 0;
+    return false;
+  }
+
+  CTypeEntry& entry = m_types[typeIndex];
+  entry.m_size = size;
+  entry.m_numObjects = numObjects;
+
+  return true;
+}
+
+// Add an object, or replace it if it is already in the index.  The
+// filename of an object doesn't change so a replaced object keeps the
+// space its filename already has.
+bool
+CSharedIndex::AddObject(uint64_t objId, int typeIndex, int64_t size,
+			bool written, const std::string& filename) {
+
+  if ((objId == 0) || (typeIndex < 0) || (filename.size() > 0xffff)) {
+    m_header->m_complete = 0;
+    return false;
+  }
+
+  const uint32_t slot = FindSlot(objId);
+  if (slot >= m_numSlots) {
+    m_header->m_complete = 0;
+    return false;
+  }
+  CObjectEntry& entry = m_slots[slot];
+  const bool added = (entry.m_objId == 0);
+  const bool named = !added && (entry.m_nameLen == filename.size()) &&
+    (::memcmp(m_names + entry.m_nameOffset, filename.data(),
+	      filename.size()) == 0);
+  if ((added && (m_header->m_numObjects >= m_maxObjects)) ||
+      (!named &&
+       (filename.size() > (m_namesSize - m_header->m_namesUsed)))) {
+    m_header->m_complete = 0;
+    return false;
+  }
+
+  if (!named) {
+    entry.m_nameOffset = m_header->m_namesUsed;
+    entry.m_nameLen = (uint16_t) filename.size();
+    ::memcpy(m_names + m_header->m_namesUsed, filename.data(),
+	     filename.size());
+    m_header->m_namesUsed += (uint32_t) filename.size();
+  }
+  entry.m_size = size;
+  entry.m_type = (uint16_t) typeIndex;
+  entry.m_written = written ? 1 : 0;
+  if (added) {
+    entry.m_objId = objId;
+    m_header->m_numObjects++;
+  }
+
+  return true;
+}
+
+// Remove an object if it is in the index.  The entries after it in
+// its run are moved back so every object can still be reached from
+// its hash without crossing an empty slot.  The space of its filename
+// is only taken back by the next Clear.
+void
+CSharedIndex::RemoveObject(uint64_t objId) {
+
+  uint32_t slot = FindSlot(objId);
+  if ((objId == 0) || (slot >= m_numSlots) || (m_slots[slot].m_objId == 0)) {
+    return;
+  }
+
+  const uint32_t mask = m_numSlots - 1;
+  uint32_t next = slot;
+  for (uint32_t probes = 1; probes < m_numSlots; ++probes) {
+    next = (next + 1) & mask;
+    const uint64_t nextId = m_slots[next].m_objId;
+    if (nextId == 0) {
+      break;
+    }
+    // An entry whose home is cyclically after the hole, up to where
+    // it sits, has to stay where it is
+    const uint32_t home = Hash(nextId) & mask;
+    if (((next - home) & mask) < ((next - slot) & mask)) {
+      continue;
+    }
+    m_slots[slot] = m_slots[next];
+    slot = next;
+  }
+  ::memset(&m_slots[slot], 0, sizeof(m_slots[slot]));
+  m_header->m_numObjects--;
+}
+
+// Finish rewriting the index and let the readers at it
+void
+CSharedIndex::EndUpdate(uint64_t generation) {
+
+  m_header->m_generation = generation;
+  __sync_fetch_and_add(&m_header->m_seq, 1);
+}
+
+// Look an object up.  obj may be NULL if only presence is wanted.
+CSharedIndex::Result
+CSharedIndex::Lookup(uint64_t objId, CObject* obj) {
+
+  if ((m_header == NULL) || (objId == 0)) {
+    return Unknown;
+  }
+
+  const uint32_t mask = m_numSlots - 1;
+  for (int tries = 0; tries < s_sharedIndexReadTries; ++tries) {
+    const uint32_t seq = ReadSeq();
+    if ((seq & 1) != 0) {
+      ::sched_yield();
+      continue;
+    }
+
+    // Copy what is needed out before checking the sequence, the
+    // entries may be half written
+    Result result = (m_header->m_complete != 0) ? Missing : Unknown;
+    CObjectEntry found;
+    uint32_t slot = Hash(objId) & mask;
+    for (uint32_t probes = 0; probes < m_numSlots; ++probes) {
+      const uint64_t slotId = m_slots[slot].m_objId;
+      if (slotId == 0) {
+	break;
+      }
+      if (slotId == objId) {
+	found = m_slots[slot];
+	result = Found;
+	break;
+      }
+      slot = (slot + 1) & mask;
+    }
+    if ((result == Found) && (obj != NULL)) {
+      obj->m_size = found.m_size;
+      obj->m_written = (found.m_written != 0);
+      if ((found.m_type < m_maxTypes) &&
+	  (found.m_nameOffset <= m_namesSize) &&
+	  (found.m_nameLen <= (m_namesSize - found.m_nameOffset))) {
+	const CTypeEntry& type = m_types[found.m_type];
+	obj->m_typeName.assign(type.m_name,
+			       ::strnlen(type.m_name, sizeof(type.m_name)));
+	obj->m_filename.assign(m_names + found.m_nameOffset, found.m_nameLen);
+      } else {
+	obj->m_typeName.clear();
+	obj->m_filename.clear();
+      }
+    }
+
+    __sync_synchronize();
+    if (ReadSeq() == seq) {
+      return result;
+    }
+  }
+
+  return Unknown;
+}
+
+// Get the space and number of objects used by a type
+CSharedIndex::Result
+CSharedIndex::TypeStatus(const std::string& typeName, int64_t* size,
+			 int64_t* numObjects) {
+
+  if ((m_header == NULL) || (typeName.size() >= sizeof(m_types[0].m_name))) {
+    return Unknown;
+  }
+
+  for (int tries = 0; tries < s_sharedIndexReadTries; ++tries) {
+    const uint32_t seq = ReadSeq();
+    if ((seq & 1) != 0) {
+      ::sched_yield();
+      continue;
+    }
+
+    Result result = (m_header->m_complete != 0) ? Missing : Unknown;
+    uint32_t numTypes = m_header->m_numTypes;
+    if (numTypes > m_maxTypes) {
+      numTypes = m_maxTypes;
+    }
+    for (uint32_t i = 0; i < numTypes; ++i) {
+      const CTypeEntry& type = m_types[i];
+      if ((::strncmp(type.m_name, typeName.c_str(), sizeof(type.m_name)) ==
+	   0)) {
+	if (size != NULL) {
+	  *size = type.m_size;
+	}
+	if (numObjects != NULL) {
+	  *numObjects = type.m_numObjects;
+	}
+	result = Found;
+	break;
+      }
+    }
+
+    __sync_synchronize();
+    if (ReadSeq() == seq) {
+      return result;
+    }
+  }
+
+  return Unknown;
+}
+
+// The ids are handed out in order so mix the bits before using them
+// to pick a slot
+uint32_t
+CSharedIndex::Hash(uint64_t objId) {
+
+  objId ^= objId >> 33;
+  objId *= 0xff51afd7ed558ccdULL;
+  objId ^= objId >> 33;
+
+  return (uint32_t) objId;
+}
+
+// Returns the slot holding the object, or the empty slot it would go
+// in.  Returns m_numSlots if every slot holds some other object.
+uint32_t
+CSharedIndex::FindSlot(uint64_t objId) const {
+
+  const uint32_t mask = m_numSlots - 1;
+  uint32_t slot = Hash(objId) & mask;
+  for (uint32_t probes = 0; probes < m_numSlots; ++probes) {
+    const uint64_t slotId = m_slots[slot].m_objId;
+    if ((slotId == 0) || (slotId == objId)) {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return m_numSlots;
+}
+
+// Read the sequence, and keep the reads of the index after it
+uint32_t
+CSharedIndex::ReadSeq() const {
+
+  const uint32_t seq = *static_cast<volatile uint32_t*>(&m_header->m_seq);
+  __sync_synchronize();
+
+  return seq;
+}
+
+// Readers map the index read-only, which is all the descriptor they
+// were given allows
+bool
+CSharedIndex::Map(int fd, size_t len, bool writable) {
+
+  const int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void* addr = ::mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  m_length = len;
+  m_header = static_cast<CHeader*>(addr);
+
+  return true;
+}
+
+void
+CSharedIndex::SetLayout(const CHeader& header) {
+
+  m_maxObjects = header.m_maxObjects;
+  m_maxTypes = header.m_maxTypes;
+  m_numSlots = header.m_numSlots;
+  m_namesSize = header.m_namesSize;
+  m_types = reinterpret_cast<CTypeEntry*>(m_header + 1);
+  m_slots = reinterpret_cast<CObjectEntry*>(m_types + m_maxTypes);
+  m_names = reinterpret_cast<char*>(m_slots + m_numSlots);
+}
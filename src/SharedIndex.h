@@ -0,0 +1,178 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __SHARED_INDEX_H__
+#define __SHARED_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// A read-only copy of the object index in shared memory so clients
+// can check whether an object is cached, and its size, without
+// making a request.  The daemon updates it from the cache set's
+// snapshot when that changes, at most every s_localTouchInterval
+// milliseconds, and clients only ever read it.  The descriptor they
+// are given is read-only so they can't map it for writing.
+//
+// Consistency: each read sees one complete publication of the index,
+// never a mix of two.  A publication is a snapshot of the cache set
+// that may be up to one interval old, so an object can still be
+// found shortly after it expired or not yet be found shortly after
+// it was inserted.  Anything that needs the current state, or to
+// keep an object, has to make a request or subscribe.
+//
+// The region is a fixed size (see Length), about 3 MiB with the
+// default limits.  If the cache set holds more objects or types than
+// fit, the publication is marked incomplete and a miss is reported
+// as unknown rather than as not cached.
+//
+// The updates are protected by a sequence lock: the writer makes the
+// sequence odd while it changes the region and even again after, and
+// a reader retries if the sequence was odd or changed while it read.
+// A reader that can't get a clean read after a few tries reports the
+// answer as unknown.
+//
+// This is shared by the daemon and the client library so it must not
+// depend on anything else in the daemon.
+class CSharedIndex {
+ public:
+  // The answer to a lookup
+  enum Result {
+    Unknown = -1,
+    Missing = 0,
+    Found = 1
+  };
+
+  // What the index holds for an object
+  class CObject {
+   public:
+    CObject() : m_size(0), m_written(false) {}
+
+    int64_t m_size;
+    bool m_written;
+    std::string m_typeName;
+    std::string m_filename;
+  };
+
+  CSharedIndex();
+  ~CSharedIndex();
+
+  // Create an empty index with room for maxObjects objects and
+  // maxTypes types.  The shared memory has no name, other processes
+  // can only get to it through the descriptor returned by GetFd,
+  // which is opened read-only.
+  bool Create(uint32_t maxObjects, uint32_t maxTypes);
+
+  // Map an index created by another process for reading.  The
+  // descriptor can be closed afterwards.
+  bool Attach(int fd);
+
+  void Close();
+  bool isOpen() const { return m_header != NULL; }
+  int GetFd() const { return m_fd; }
+  uint32_t GetMaxObjects() const { return m_maxObjects; }
+
+  // Change the index.  Between BeginUpdate and EndUpdate the last
+  // publication can either be changed in place, or emptied with Clear
+  // and rebuilt by adding the types first and then their objects, by
+  // the type's index.  AddObject replaces an object that is already
+  // there.  The calls return -1 or false once the index is full,
+  // which leaves the publication incomplete until the next Clear.
+  void BeginUpdate();
+  void Clear();
+  int AddType(const std::string& typeName, int64_t size, int64_t numObjects);
+  bool SetType(int typeIndex, int64_t size, int64_t numObjects);
+  bool AddObject(uint64_t objId, int typeIndex, int64_t size, bool written,
+		 const std::string& filename);
+  void RemoveObject(uint64_t objId);
+  void EndUpdate(uint64_t generation);
+
+  // Whether the last publication, or the one being changed, holds
+  // everything that was added to it.  Only for the writer.
+  bool isComplete() const {
+    return (m_header != NULL) && (m_header->m_complete != 0);
+  }
+
+  // Look an object up.  obj may be NULL if only presence is wanted.
+  Result Lookup(uint64_t objId, CObject* obj);
+
+  // Get the space and number of objects used by a type
+  Result TypeStatus(const std::string& typeName, int64_t* size,
+		    int64_t* numObjects);
+
+ private:
+  CSharedIndex& operator=(const CSharedIndex&);
+  CSharedIndex(const CSharedIndex&);
+
+  struct CHeader {
+    uint32_t m_magic;
+    uint32_t m_seq;
+    uint32_t m_maxObjects;
+    uint32_t m_maxTypes;
+    uint32_t m_numSlots;
+    uint32_t m_namesSize;
+    uint32_t m_numObjects;
+    uint32_t m_numTypes;
+    uint32_t m_namesUsed;
+    uint32_t m_complete;
+    uint64_t m_generation;
+  };
+
+  struct CTypeEntry {
+    char m_name[64];
+    int64_t m_size;
+    int64_t m_numObjects;
+  };
+
+  // An empty slot has an id of 0, which is never a valid object id
+  struct CObjectEntry {
+    uint64_t m_objId;
+    int64_t m_size;
+    uint32_t m_nameOffset;
+    uint16_t m_nameLen;
+    uint16_t m_type;
+    uint32_t m_written;
+    uint32_t m_pad;
+  };
+
+  static size_t Length(uint32_t numSlots, uint32_t maxTypes,
+		       uint32_t namesSize) {
+    return sizeof(CHeader) + maxTypes * sizeof(CTypeEntry) +
+      numSlots * sizeof(CObjectEntry) + namesSize;
+  }
+  static uint32_t Hash(uint64_t objId);
+  uint32_t FindSlot(uint64_t objId) const;
+  uint32_t ReadSeq() const;
+  bool Map(int fd, size_t len, bool writable);
+  void SetLayout(const CHeader& header);
+
+  int m_fd;
+  size_t m_length;
+  CHeader* m_header;
+  CTypeEntry* m_types;
+  CObjectEntry* m_slots;
+  char* m_names;
+  // The layout, kept here rather than read from the shared memory
+  uint32_t m_maxObjects;
+  uint32_t m_maxTypes;
+  uint32_t m_numSlots;
+  uint32_t m_namesSize;
+};
+
+#endif /* __SHARED_INDEX_H__ */
@@ -0,0 +1,73 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "StartupProfile.h"
+
+#include <time.h>
+
+static const char* const s_phaseNames[StartupNumPhases] = {
+  "loadState",
+  "walk",
+  "readDir",
+  "stat",
+  "typeConfig",
+  "xattrWritten",
+  "xattrSize",
+  "xattrFilename",
+  "xattrCost",
+  "xattrLifetime",
+  "xattrKey",
+  "xattrMaxAge",
+  "chmod",
+  "remove",
+  "insert",
+  "cleanup"
+};
+
+CStartupProfile::CStartupProfile() : m_startTime(Now()), m_readyTime(0) {
+
+  for (int phase = 0; phase < StartupNumPhases; phase++) {
+    m_time[phase] = 0;
+    m_count[phase] = 0;
+  }
+}
+
+// Mark the daemon as ready to serve.  Only the first call counts.
+void
+CStartupProfile::SetReady() {
+
+  if (m_readyTime == 0) {
+    m_readyTime = Now() - m_startTime;
+  }
+}
+
+const char*
+CStartupProfile::GetPhaseName(StartupPhase phase) {
+
+  return s_phaseNames[phase];
+}
+
+// A monotonic clock in nanoseconds
+uint64_t
+CStartupProfile::Now() {
+
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
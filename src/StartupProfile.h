@@ -0,0 +1,99 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __STARTUP_PROFILE_H__
+#define __STARTUP_PROFILE_H__
+
+#include <stdint.h>
+
+// The phases of starting up that are timed.  StartupWalk is the whole
+// walk of the cache tree, the phases after it up to StartupInsert are
+// the parts of the walk, and so are included in it.
+enum StartupPhase {
+  StartupLoadState = 0,		// adopting the state of the last daemon
+  StartupWalk,			// walking the cache tree
+  StartupReadDir,		// reading the directories
+  StartupStat,			// stat of each entry
+  StartupTypeConfig,		// defining the types found
+  StartupXattrWritten,		// reading each attribute of the objects
+  StartupXattrSize,
+  StartupXattrFilename,
+  StartupXattrCost,
+  StartupXattrLifetime,
+  StartupXattrKey,
+  StartupXattrMaxAge,
+  StartupChmod,			// making written objects read only
+  StartupRemove,		// removing unwritten and stray files
+  StartupInsert,		// making the objects
+  StartupCleanup,		// CleanupAtStartup
+  StartupNumPhases
+};
+
+// The wall time spent in, and the number of calls made in, each
+// phase of starting up, kept for as long as the daemon runs so it can
+// be asked for later.  Only the thread starting the daemon adds to
+// it, so it does no locking.
+class CStartupProfile {
+ public:
+  CStartupProfile();
+
+  void Add(StartupPhase phase, uint64_t ns) {
+    m_time[phase] += ns;
+    m_count[phase]++;
+  }
+
+  // Mark the daemon as ready to serve.  Only the first call counts.
+  void SetReady();
+
+  uint64_t GetTime(StartupPhase phase) const { return m_time[phase]; }
+  uint64_t GetCount(StartupPhase phase) const { return m_count[phase]; }
+  // The time from the profile being made to the daemon being ready,
+  // or 0 if it isn't yet
+  uint64_t GetReadyTime() const { return m_readyTime; }
+
+  static const char* GetPhaseName(StartupPhase phase);
+
+  // A monotonic clock in nanoseconds
+  static uint64_t Now();
+
+ private:
+  uint64_t m_time[StartupNumPhases];
+  uint64_t m_count[StartupNumPhases];
+  uint64_t m_startTime;
+  uint64_t m_readyTime;
+};
+
+// Adds the time from its construction to its destruction to a phase
+class CStartupTimer {
+ public:
+  CStartupTimer(CStartupProfile& profile, StartupPhase phase)
+    : m_profile(profile), m_phase(phase), m_start(CStartupProfile::Now()) {}
+  ~CStartupTimer() {
+    m_profile.Add(m_phase, CStartupProfile::Now() - m_start);
+  }
+
+ private:
+  CStartupTimer& operator=(const CStartupTimer&);
+  CStartupTimer(const CStartupTimer&);
+
+  CStartupProfile& m_profile;
+  const StartupPhase m_phase;
+  const uint64_t m_start;
+};
+
+#endif /* __STARTUP_PROFILE_H__ */
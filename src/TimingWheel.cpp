@@ -0,0 +1,237 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "TimingWheel.h"
+
+// Moving the time on further than this in one go puts every entry
+// back in place rather than stepping through each second
+static const time_t s_maxAdvanceSteps = 1 << 18;
+
+CTimingWheel::CTimingWheel(time_t now) : m_now(now) {
+
+  for (unsigned int level = 0; level < s_numLevels; level++) {
+    for (unsigned int slot = 0; slot < s_numSlots; slot++) {
+      InitList(&m_slots[level][slot]);
+    }
+  }
+  InitList(&m_overflow);
+}
+
+CTimingWheel::~CTimingWheel() {
+}
+
+// Schedule objId to fire at due, replacing any deadline it already
+// had.  A deadline that has already passed fires on the next tick.
+void
+CTimingWheel::Schedule(const cachedObjectId_t objId, time_t due) {
+
+  std::pair<boost::unordered_map<cachedObjectId_t, CEntry>::iterator, bool>
+    result = m_entries.insert(std::make_pair(objId, CEntry()));
+  CEntry* entry = &result.first->second;
+  if (result.second) {
+    entry->m_id = objId;
+  } else {
+    Unlink(entry);
+  }
+  entry->m_due = due;
+  Place(entry, m_now + 1);
+}
+
+// Remove the deadline of objId.  Returns false if it didn't have one.
+bool
+CTimingWheel::Cancel(const cachedObjectId_t objId) {
+
+  boost::unordered_map<cachedObjectId_t, CEntry>::iterator iter =
+    m_entries.find(objId);
+  if (iter == m_entries.end()) {
+    return false;
+  }
+  Unlink(&iter->second);
+  m_entries.erase(iter);
+
+  return true;
+}
+
+// Move the time on to now and append the objects whose deadlines have
+// passed to fired.  Each second that passes fires one slot of the
+// first level, and at the start of a new group of a level the slot
+// for that group in the level above is emptied into the levels below.
+void
+CTimingWheel::Advance(time_t now, std::vector<cachedObjectId_t>& fired) {
+
+  if (now <= m_now) {
+    return;
+  }
+  if ((now - m_now) > s_maxAdvanceSteps) {
+    Rebuild(now, fired);
+    return;
+  }
+  while (m_now < now) {
+    m_now++;
+    const uint64_t tick = (uint64_t) m_now;
+    if ((tick & (s_numSlots - 1)) == 0) {
+      if ((tick >> (s_slotBits * s_numLevels) <<
+	   (s_slotBits * s_numLevels)) == tick) {
+	Cascade(&m_overflow);
+      }
+      for (unsigned int level = s_numLevels - 1; level > 0; level--) {
+	const unsigned int shift = s_slotBits * level;
+	if (((tick >> shift) << shift) == tick) {
+	  Cascade(&m_slots[level][(tick >> shift) & (s_numSlots - 1)]);
+	}
+      }
+    }
+    Fire(&m_slots[0][tick & (s_numSlots - 1)], fired);
+  }
+}
+
+// Returns a time no later than the earliest deadline, at which Advance
+// should next be called, or 0 if nothing is scheduled.  Every entry of
+// a level is due before any entry of the levels above it, so this is
+// the first occupied slot after the current time in the lowest level
+// that has one, or for the levels above the first, the time that slot
+// is emptied into the levels below.
+time_t
+CTimingWheel::NextDue() {
+
+  if (m_entries.empty()) {
+    return 0;
+  }
+  for (unsigned int level = 0; level < s_numLevels; level++) {
+    const unsigned int shift = s_slotBits * level;
+    const uint64_t group = (uint64_t) m_now >> shift;
+    for (uint64_t next = group + 1; (next >> s_slotBits) ==
+	   (group >> s_slotBits); next++) {
+      const CEntry* list = &m_slots[level][next & (s_numSlots - 1)];
+      if (list->m_next != list) {
+	return (time_t) (next << shift);
+      }
+    }
+  }
+  const unsigned int shift = s_slotBits * s_numLevels;
+
+  return (time_t) ((((uint64_t) m_now >> shift) + 1) << shift);
+}
+
+// Link an entry into the slot for its deadline, which is taken to be
+// no earlier than earliest
+void
+CTimingWheel::Place(CEntry* entry, time_t earliest) {
+
+  const uint64_t due = (uint64_t) ((entry->m_due < earliest) ?
+				   earliest : entry->m_due);
+  const uint64_t now = (uint64_t) m_now;
+  for (unsigned int level = 0; level < s_numLevels; level++) {
+    const unsigned int shift = s_slotBits * (level + 1);
+    if ((due >> shift) == (now >> shift)) {
+      const unsigned int slot = (unsigned int)
+	((due >> (s_slotBits * level)) & (s_numSlots - 1));
+      Link(&m_slots[level][slot], entry);
+      return;
+    }
+  }
+  Link(&m_overflow, entry);
+}
+
+// Put every entry of a list back in place for the current time.  The
+// slot for the current second hasn't fired yet so entries due now go
+// in it.
+void
+CTimingWheel::Cascade(CEntry* list) {
+
+  if (list->m_next == list) {
+    return;
+  }
+  CEntry moved;
+  moved.m_next = list->m_next;
+  moved.m_prev = list->m_prev;
+  moved.m_next->m_prev = &moved;
+  moved.m_prev->m_next = &moved;
+  InitList(list);
+  while (moved.m_next != &moved) {
+    CEntry* entry = moved.m_next;
+    Unlink(entry);
+    Place(entry, m_now);
+  }
+}
+
+void
+CTimingWheel::Fire(CEntry* list, std::vector<cachedObjectId_t>& fired) {
+
+  while (list->m_next != list) {
+    CEntry* entry = list->m_next;
+    const cachedObjectId_t objId = entry->m_id;
+    Unlink(entry);
+    fired.push_back(objId);
+    m_entries.erase(objId);
+  }
+}
+
+// After a long jump in time, such as a resume or the clock being set,
+// fire what is due and place everything else again
+void
+CTimingWheel::Rebuild(time_t now, std::vector<cachedObjectId_t>& fired) {
+
+  for (unsigned int level = 0; level < s_numLevels; level++) {
+    for (unsigned int slot = 0; slot < s_numSlots; slot++) {
+      InitList(&m_slots[level][slot]);
+    }
+  }
+  InitList(&m_overflow);
+  m_now = now;
+
+  std::vector<cachedObjectId_t> due;
+  boost::unordered_map<cachedObjectId_t, CEntry>::iterator iter;
+  for (iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+    if (iter->second.m_due <= now) {
+      due.push_back(iter->first);
+    } else {
+      Place(&iter->second, now + 1);
+    }
+  }
+  std::vector<cachedObjectId_t>::const_iterator dueIter;
+  for (dueIter = due.begin(); dueIter != due.end(); ++dueIter) {
+    m_entries.erase(*dueIter);
+    fired.push_back(*dueIter);
+  }
+}
+
+void
+CTimingWheel::InitList(CEntry* list) {
+
+  list->m_prev = list;
+  list->m_next = list;
+}
+
+void
+CTimingWheel::Link(CEntry* list, CEntry* entry) {
+
+  entry->m_prev = list->m_prev;
+  entry->m_next = list;
+  list->m_prev->m_next = entry;
+  list->m_prev = entry;
+}
+
+void
+CTimingWheel::Unlink(CEntry* entry) {
+
+  entry->m_prev->m_next = entry->m_next;
+  entry->m_next->m_prev = entry->m_prev;
+  entry->m_prev = entry;
+  entry->m_next = entry;
+}
@@ -0,0 +1,98 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __TIMING_WHEEL_H__
+#define __TIMING_WHEEL_H__
+
+#include "CacheBase.h"
+#include "boost/unordered_map.hpp"
+
+// Deadlines for objects in whole seconds, kept in a hierarchical
+// timing wheel so scheduling, rescheduling and cancelling an object
+// and firing it are all constant time however many objects are
+// scheduled.
+//
+// There are four levels of 64 slots.  The level of a deadline is the
+// highest group of six bits of the time in which it differs from the
+// current time, so the first level holds the rest of the current
+// minute or so, the next the rest of the current hour or so and so
+// on.  When the time moves into a new group, the slot for that group
+// in the level above is emptied into the levels below it.  Deadlines
+// further away than the top level reaches wait in an overflow list
+// that is looked at each time the top level wraps, about every 194
+// days.
+//
+// This does no locking.
+class CTimingWheel {
+ public:
+  CTimingWheel(time_t now);
+  ~CTimingWheel();
+
+  // Schedule objId to fire at due, replacing any deadline it already
+  // had.  A deadline that has already passed fires on the next tick.
+  void Schedule(const cachedObjectId_t objId, time_t due);
+
+  // Remove the deadline of objId.  Returns false if it didn't have
+  // one.
+  bool Cancel(const cachedObjectId_t objId);
+
+  // Move the time on to now and append the objects whose deadlines
+  // have passed to fired.  They are no longer scheduled.
+  void Advance(time_t now, std::vector<cachedObjectId_t>& fired);
+
+  // Returns a time no later than the earliest deadline, at which
+  // Advance should next be called, or 0 if nothing is scheduled.
+  // This only looks at the slots, not at the objects.
+  time_t NextDue();
+
+  size_t Size() const { return m_entries.size(); }
+  time_t Now() const { return m_now; }
+
+ private:
+  CTimingWheel& operator=(const CTimingWheel&);
+  CTimingWheel(const CTimingWheel&);
+
+  static const unsigned int s_slotBits = 6;
+  static const unsigned int s_numSlots = 1 << s_slotBits;
+  static const unsigned int s_numLevels = 4;
+
+  // A scheduled object, linked into the list of its slot
+  struct CEntry {
+    cachedObjectId_t m_id;
+    time_t m_due;
+    CEntry* m_prev;
+    CEntry* m_next;
+  };
+
+  void Place(CEntry* entry, time_t earliest);
+  void Cascade(CEntry* list);
+  void Fire(CEntry* list, std::vector<cachedObjectId_t>& fired);
+  void Rebuild(time_t now, std::vector<cachedObjectId_t>& fired);
+  static void InitList(CEntry* list);
+  static void Link(CEntry* list, CEntry* entry);
+  static void Unlink(CEntry* entry);
+
+  // The nodes of the map don't move when it grows so the entries can
+  // be linked into the slot lists where they are
+  boost::unordered_map<cachedObjectId_t, CEntry> m_entries;
+  CEntry m_slots[s_numLevels][s_numSlots];
+  CEntry m_overflow;
+  time_t m_now;
+};
+
+#endif /* __TIMING_WHEEL_H__ */
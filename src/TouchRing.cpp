@@ -0,0 +1,239 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "TouchRing.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t s_touchRingMagic = 0x46435452;
+
+CTouchRing::CTouchRing() : m_fd(-1), m_length(0), m_header(NULL)
+  , m_slots(NULL), m_capacity(0), m_tail(0), m_stalled(false) {
+}
+
+CTouchRing::~CTouchRing() {
+
+  Close();
+}
+
+// Create a ring with room for at least capacity records.  The shared
+// memory has no name, other processes can only get to it through the
+// descriptor returned by GetFd.
+bool
+CTouchRing::Create(unsigned int capacity) {
+
+  Close();
+
+  unsigned int cap = 1;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+
+  // The name is only used until the memory is open
+  static int s_count = 0;
+  char name[64];
+  ::snprintf(name, sizeof(name), "/filecache-touch-%d-%d", (int) ::getpid(),
+	     __sync_fetch_and_add(&s_count, 1));
+  int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return false;
+  }
+  ::shm_unlink(name);
+  if ((::ftruncate(fd, (off_t) Length(cap)) != 0) ||
+      !Map(fd, Length(cap))) {
+    ::close(fd);
+    return false;
+  }
+
+  m_fd = fd;
+  m_capacity = cap;
+  m_tail = 0;
+  m_stalled = false;
+  m_header->m_capacity = cap;
+  m_header->m_dropped = 0;
+  m_header->m_head = 0;
+  for (uint32_t i = 0; i < cap; ++i) {
+    m_slots[i].m_seq = i;
+  }
+  __sync_synchronize();
+  m_header->m_magic = s_touchRingMagic;
+
+  return true;
+}
+
+// Map a ring created by another process
+bool
+CTouchRing::Attach(int fd) {
+
+  Close();
+
+  struct stat buf;
+  if ((::fstat(fd, &buf) != 0) || (buf.st_size < (off_t) sizeof(CHeader)) ||
+      !Map(fd, (size_t) buf.st_size)) {
+    return false;
+  }
+  const uint32_t cap = m_header->m_capacity;
+  if ((m_header->m_magic != s_touchRingMagic) || (cap == 0) ||
+      ((cap & (cap - 1)) != 0) || (Length(cap) > m_length)) {
+    Close();
+    return false;
+  }
+  m_capacity = cap;
+
+  return true;
+}
+
+void
+CTouchRing::Close() {
+
+  if (m_header != NULL) {
+    ::munmap(m_header, m_length);
+    m_header = NULL;
+    m_slots = NULL;
+    m_length = 0;
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_capacity = 0;
+}
+
+// Record an access to an object.  Returns false if the ring was full
+// and the record was dropped.
+bool
+CTouchRing::Push(uint64_t objId) {
+
+  if (m_header == NULL) {
+    return false;
+  }
+
+  uint32_t pos = 0;
+
+  return Claim(pos) && Publish(pos, objId);
+}
+
+// Take the next position, or count a drop and return false if the
+// ring is full
+bool
+CTouchRing::Claim(uint32_t& pos) {
+
+  const uint32_t mask = m_capacity - 1;
+  pos = __sync_fetch_and_add(&m_header->m_head, 0);
+  for (;;) {
+    CSlot& slot = m_slots[pos & mask];
+    const uint32_t seq = __sync_fetch_and_add(&slot.m_seq, 0);
+    const int32_t dif = (int32_t) (seq - pos);
+    if (dif == 0) {
+      const uint32_t prev =
+	__sync_val_compare_and_swap(&m_header->m_head, pos, pos + 1);
+      if (prev == pos) {
+	return true;
+      }
+      pos = prev;
+    } else if (dif < 0) {
+      // The slot still holds a record from the last time round
+      break;
+    } else {
+      pos = __sync_fetch_and_add(&m_header->m_head, 0);
+    }
+  }
+  __sync_fetch_and_add(&m_header->m_dropped, 1);
+
+  return false;
+}
+
+// Fill the slot claimed at pos and hand it to the drain.  This only
+// fails if the drain gave up waiting for us, and it has counted the
+// record as dropped.
+bool
+CTouchRing::Publish(uint32_t pos, uint64_t objId) {
+
+  CSlot& slot = m_slots[pos & (m_capacity - 1)];
+  slot.m_objId = objId;
+
+  return __sync_bool_compare_and_swap(&slot.m_seq, pos, pos + 1);
+}
+
+// Append up to max records to objIds in the order they were pushed.
+// Returns the number appended.
+size_t
+CTouchRing::Drain(std::vector<uint64_t>& objIds, size_t max) {
+
+  if (m_header == NULL) {
+    return 0;
+  }
+
+  const uint32_t mask = m_capacity - 1;
+  size_t count = 0;
+  while (count < max) {
+    CSlot& slot = m_slots[m_tail & mask];
+    const uint32_t seq = __sync_fetch_and_add(&slot.m_seq, 0);
+    if (seq == m_tail + 1) {
+      objIds.push_back(slot.m_objId);
+      // Hand the slot to the writer one time round from here
+      __sync_fetch_and_add(&slot.m_seq, m_capacity - 1);
+      ++m_tail;
+      m_stalled = false;
+      ++count;
+    } else if ((seq == m_tail) &&
+	       (__sync_fetch_and_add(&m_header->m_head, 0) != m_tail)) {
+      // Claimed but not published yet.  Give the writer until the
+      // next drain before skipping the slot.
+      if (!m_stalled) {
+	m_stalled = true;
+	break;
+      }
+      if (__sync_bool_compare_and_swap(&slot.m_seq, m_tail,
+				       m_tail + m_capacity)) {
+	__sync_fetch_and_add(&m_header->m_dropped, 1);
+	++m_tail;
+	m_stalled = false;
+      }
+    } else {
+      break;
+    }
+  }
+
+  return count;
+}
+
+// The number of records dropped so far
+uint32_t
+CTouchRing::GetDropped() {
+
+  return (m_header != NULL) ? __sync_fetch_and_add(&m_header->m_dropped, 0) : 0;
+}
+
+bool
+CTouchRing::Map(int fd, size_t len) {
+
+  void* addr = ::mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  m_length = len;
+  m_header = static_cast<CHeader*>(addr);
+  m_slots = reinterpret_cast<CSlot*>(m_header + 1);
+
+  return true;
+}
@@ -0,0 +1,120 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __TOUCH_RING_H__
+#define __TOUCH_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A ring of object accesses in shared memory.  Clients that have been
+// given the ring record the objects they read in it without making a
+// request, and the daemon drains it from time to time and applies
+// the accesses the same way Touch does.  Any number of threads and
+// processes may push into the ring but only one may drain it.
+//
+// Each slot has a sequence number that says whose turn it is.  A
+// writer claims the next position, fills the slot and then publishes
+// it by moving the sequence on.  When the ring is full the record is
+// dropped and counted.  A writer that dies between claiming and
+// publishing a slot would stop the drain, so a slot that stays
+// unpublished for a whole drain interval is skipped and counted as
+// dropped as well.  A writer that was only slow then fails to publish
+// and leaves the count to the drain, so each drop is counted once.
+//
+// This is shared by the daemon and the client library so it must not
+// depend on anything else in the daemon.
+class CTouchRing {
+ public:
+  CTouchRing();
+  ~CTouchRing();
+
+  // Create a ring with room for at least capacity records.  The
+  // shared memory has no name, other processes can only get to it
+  // through the descriptor returned by GetFd.
+  bool Create(unsigned int capacity);
+
+  // Map a ring created by another process.  The descriptor can be
+  // closed afterwards.
+  bool Attach(int fd);
+
+  void Close();
+  bool isOpen() const { return m_header != NULL; }
+  int GetFd() const { return m_fd; }
+  unsigned int GetCapacity() const { return m_capacity; }
+
+  // Record an access to an object.  Returns false if the ring was
+  // full and the record was dropped.
+  bool Push(uint64_t objId);
+
+  // Append up to max records to objIds in the order they were
+  // pushed.  Returns the number appended.
+  size_t Drain(std::vector<uint64_t>& objIds, size_t max);
+
+  // The number of records dropped so far
+  uint32_t GetDropped();
+
+ protected:
+  // The two halves of Push, split so a test can hold a writer between
+  // them.  Claim takes the next position, or counts a drop and returns
+  // false if the ring is full.  Publish returns false if the drain
+  // already skipped the slot.
+  bool Claim(uint32_t& pos);
+  bool Publish(uint32_t pos, uint64_t objId);
+
+ private:
+  CTouchRing& operator=(const CTouchRing&);
+  CTouchRing(const CTouchRing&);
+
+  // The start of the shared memory.  The writers' position is kept
+  // on its own cache line.
+  struct CHeader {
+    uint32_t m_magic;
+    uint32_t m_capacity;
+    uint32_t m_dropped;
+    uint32_t m_pad[13];
+    uint32_t m_head;
+    uint32_t m_pad2[15];
+  };
+
+  struct CSlot {
+    uint32_t m_seq;
+    uint32_t m_pad;
+    uint64_t m_objId;
+  };
+
+  bool Map(int fd, size_t len);
+  static size_t Length(unsigned int capacity) {
+    return sizeof(CHeader) + capacity * sizeof(CSlot);
+  }
+
+  int m_fd;
+  size_t m_length;
+  CHeader* m_header;
+  CSlot* m_slots;
+  // Kept here rather than read from the shared memory, which the
+  // other processes could have changed
+  unsigned int m_capacity;
+  // The reader's position and the slot found unpublished by the last
+  // drain, only used by the process that drains
+  uint32_t m_tail;
+  bool m_stalled;
+};
+
+#endif /* __TOUCH_RING_H__ */
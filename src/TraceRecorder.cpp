@@ -0,0 +1,345 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include "TraceRecorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+MojLogger CTraceRecorder::s_log(_T("filecache.tracerecorder"));
+
+// The buffer of the calling thread and the recorder it belongs to.
+// Recorders are told apart by id, a new one may be at the address of
+// one that has been destroyed.
+static __thread void* s_traceBuffer = NULL;
+static __thread uint32_t s_traceBufferOwner = 0;
+static uint32_t s_traceRecorderCount = 0;
+
+// How often, in seconds, the flusher writes the buffers out
+static const time_t s_traceFlushInterval = 1;
+
+static uint64_t
+NowUs() {
+
+  struct timespec now;
+  ::clock_gettime(CLOCK_REALTIME, &now);
+
+  return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+CTraceRecorder::CTraceRecorder()
+  : m_id(__sync_add_and_fetch(&s_traceRecorderCount, 1)), m_recording(false)
+  , m_dropped(0), m_maxFileSize(0), m_fd(-1), m_fileSize(0), m_buffers(NULL) {
+
+  MojLogTrace(s_log);
+
+  ::pthread_mutex_init(&m_mutex, NULL);
+  ::pthread_cond_init(&m_cond, NULL);
+}
+
+CTraceRecorder::~CTraceRecorder() {
+
+  MojLogTrace(s_log);
+
+  Stop();
+  while (m_buffers != NULL) {
+    CBuffer* next = m_buffers->m_next;
+    delete m_buffers;
+    m_buffers = next;
+  }
+  ::pthread_cond_destroy(&m_cond);
+  ::pthread_mutex_destroy(&m_mutex);
+}
+
+// Start recording to pathname.  An existing trace there is added to.
+// Returns false if the file can't be opened.
+bool
+CTraceRecorder::Start(const std::string& pathname, off_t maxFileSize) {
+
+  MojLogTrace(s_log);
+
+  if (m_recording) {
+    return true;
+  }
+
+  m_pathname = pathname;
+  m_maxFileSize = maxFileSize;
+  if (!OpenFile()) {
+    return false;
+  }
+
+  // Anything recorded while the last recording was being stopped is
+  // left out
+  ::pthread_mutex_lock(&m_mutex);
+  for (CBuffer* buf = m_buffers; buf != NULL; buf = buf->m_next) {
+    buf->m_tail = buf->m_head;
+  }
+  __sync_fetch_and_and(&m_dropped, 0);
+  m_recording = true;
+  ::pthread_mutex_unlock(&m_mutex);
+
+  if (::pthread_create(&m_thread, NULL, &Run, this) != 0) {
+    MojLogError(s_log, _T("Start: Failed to start the flusher thread."));
+    m_recording = false;
+    CloseFile();
+    return false;
+  }
+  MojLogInfo(s_log, _T("Start: Recording to '%s'."), m_pathname.c_str());
+
+  return true;
+}
+
+// Stop recording, writing out what has been recorded
+void
+CTraceRecorder::Stop() {
+
+  MojLogTrace(s_log);
+
+  if (!m_recording) {
+    return;
+  }
+
+  ::pthread_mutex_lock(&m_mutex);
+  m_recording = false;
+  ::pthread_cond_signal(&m_cond);
+  ::pthread_mutex_unlock(&m_mutex);
+  ::pthread_join(m_thread, NULL);
+
+  // The flusher may have stopped before it got to the last records
+  Flush();
+  CloseFile();
+  MojLogInfo(s_log, _T("Stop: Stopped recording to '%s', '%u' records dropped."),
+	     m_pathname.c_str(), GetDropped());
+}
+
+void
+CTraceRecorder::Record(TraceOp op, uint64_t objId,
+		       const std::string& typeName, int64_t size,
+		       uint32_t caller, int result) {
+
+  if (!m_recording) {
+    return;
+  }
+
+  CBuffer* buf = static_cast<CBuffer*>(s_traceBuffer);
+  if (s_traceBufferOwner != m_id) {
+    buf = AddBuffer();
+  }
+
+  const uint32_t head = buf->m_head;
+  if (head - buf->m_tail >= s_traceBufferRecords) {
+    __sync_fetch_and_add(&m_dropped, 1);
+    return;
+  }
+  CTraceRecord& rec = buf->m_records[head & (s_traceBufferRecords - 1)];
+  rec.m_time = NowUs();
+  rec.m_objId = objId;
+  rec.m_size = size;
+  rec.m_typeId = typeName.empty() ? 0 : Hash(typeName);
+  rec.m_caller = caller;
+  rec.m_op = (uint16_t) op;
+  rec.m_result = (int16_t) result;
+  rec.m_pad = 0;
+  // The record has to be complete before the flusher can see it
+  __sync_synchronize();
+  buf->m_head = head + 1;
+}
+
+// A 32 bit FNV-1a hash, used for the type names and callers so the
+// records have a fixed size.  Tools replaying a trace hash the names
+// they know to match them up.
+uint32_t
+CTraceRecorder::Hash(const std::string& str) {
+
+  uint32_t hash = 2166136261U;
+  for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+    hash ^= (uint8_t) *it;
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+// Give the calling thread a buffer of its own.  Buffers are kept
+// until the recorder is destroyed, the thread may record again.
+CTraceRecorder::CBuffer*
+CTraceRecorder::AddBuffer() {
+
+  MojLogTrace(s_log);
+
+  CBuffer* buf = new CBuffer;
+  buf->m_head = 0;
+  buf->m_tail = 0;
+
+  ::pthread_mutex_lock(&m_mutex);
+  buf->m_next = m_buffers;
+  m_buffers = buf;
+  ::pthread_mutex_unlock(&m_mutex);
+  s_traceBuffer = buf;
+  s_traceBufferOwner = m_id;
+
+  return buf;
+}
+
+void*
+CTraceRecorder::Run(void* data) {
+
+  CTraceRecorder* recorder = static_cast<CTraceRecorder*>(data);
+
+  ::pthread_mutex_lock(&recorder->m_mutex);
+  while (recorder->m_recording) {
+    struct timespec deadline;
+    ::clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += s_traceFlushInterval;
+    ::pthread_cond_timedwait(&recorder->m_cond, &recorder->m_mutex,
+			     &deadline);
+    ::pthread_mutex_unlock(&recorder->m_mutex);
+    recorder->Flush();
+    ::pthread_mutex_lock(&recorder->m_mutex);
+  }
+  ::pthread_mutex_unlock(&recorder->m_mutex);
+
+  return NULL;
+}
+
+// Write out the records in all the buffers.  Only the flusher thread
+// calls this while it runs.
+void
+CTraceRecorder::Flush() {
+
+  MojLogTrace(s_log);
+
+  // Buffers are only ever added at the front, so the rest of the
+  // list can be walked without the lock
+  ::pthread_mutex_lock(&m_mutex);
+  CBuffer* first = m_buffers;
+  ::pthread_mutex_unlock(&m_mutex);
+
+  for (CBuffer* buf = first; buf != NULL; buf = buf->m_next) {
+    const uint32_t head = buf->m_head;
+    // The records up to head have to be read after head is
+    __sync_synchronize();
+    uint32_t tail = buf->m_tail;
+    while (tail != head) {
+      const uint32_t start = tail & (s_traceBufferRecords - 1);
+      uint32_t count = head - tail;
+      if (start + count > s_traceBufferRecords) {
+	count = s_traceBufferRecords - start;
+      }
+      if (!Write(&buf->m_records[start], count * sizeof(CTraceRecord))) {
+	// The records are dropped rather than left to fill the buffer
+	__sync_fetch_and_add(&m_dropped, head - tail);
+	tail = head;
+	break;
+      }
+      tail += count;
+    }
+    // The records have to be read before the thread can reuse them
+    __sync_synchronize();
+    buf->m_tail = tail;
+  }
+}
+
+// Write to the trace file, rotating it first if it has grown past its
+// maximum size
+bool
+CTraceRecorder::Write(const void* data, size_t len) {
+
+  if ((m_maxFileSize > 0) && (m_fileSize >= m_maxFileSize)) {
+    CloseFile();
+    const std::string rotated(m_pathname + ".1");
+    if (::rename(m_pathname.c_str(), rotated.c_str()) != 0) {
+      int savedErrno = errno;
+      MojLogError(s_log, _T("Write: Failed to rotate '%s' (%s)."),
+		  m_pathname.c_str(), ::strerror(savedErrno));
+    }
+    if (!OpenFile()) {
+      return false;
+    }
+  }
+  if (m_fd < 0) {
+    return false;
+  }
+
+  const char* p = static_cast<const char*>(data);
+  while (len > 0) {
+    ssize_t written = ::write(m_fd, p, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      int savedErrno = errno;
+      MojLogError(s_log, _T("Write: Failed to write to '%s' (%s)."),
+		  m_pathname.c_str(), ::strerror(savedErrno));
+      return false;
+    }
+    p += written;
+    len -= (size_t) written;
+    m_fileSize += written;
+  }
+
+  return true;
+}
+
+// Open the trace file for appending, starting it with a header if it
+// is new
+bool
+CTraceRecorder::OpenFile() {
+
+  MojLogTrace(s_log);
+
+  m_fd = ::open(m_pathname.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+		S_IRUSR | S_IWUSR | S_IRGRP);
+  if (m_fd < 0) {
+    int savedErrno = errno;
+    MojLogError(s_log, _T("OpenFile: Failed to open '%s' (%s)."),
+		m_pathname.c_str(), ::strerror(savedErrno));
+    return false;
+  }
+
+  struct stat st;
+  m_fileSize = (::fstat(m_fd, &st) == 0) ? st.st_size : 0;
+  if (m_fileSize == 0) {
+    CTraceFileHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.m_magic = s_traceMagic;
+    header.m_version = s_traceVersion;
+    header.m_recordSize = (uint16_t) sizeof(CTraceRecord);
+    header.m_startTime = NowUs();
+    if (!Write(&header, sizeof(header))) {
+      CloseFile();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void
+CTraceRecorder::CloseFile() {
+
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
@@ -0,0 +1,168 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __TRACE_RECORDER_H__
+#define __TRACE_RECORDER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include "core/MojLogEngine.h"
+
+// What a trace record is for.  The values are written to the trace
+// files so they must not change.
+enum TraceOp {
+  TraceDefineType = 1,
+  TraceChangeType = 2,
+  TraceDeleteType = 3,
+  TraceDescribeType = 4,
+  TraceInsertCacheObject = 5,
+  TraceResizeCacheObject = 6,
+  TraceExpireCacheObject = 7,
+  TraceSubscribeCacheObject = 8,
+  TraceLookupOrInsertCacheObject = 9,
+  TraceTouchCacheObject = 10,
+  TraceCopyCacheObject = 11,
+  TraceGetCacheStatus = 12,
+  TraceGetCacheTypeStatus = 13,
+  TraceListCacheObjects = 14,
+  TraceGetCacheObjectSize = 15,
+  TraceGetCacheObjectFilename = 16,
+  TraceGetCacheTypes = 17,
+  TraceGetVersion = 18,
+  TraceWatchCacheEvents = 19,
+  TraceSetTraceRecording = 20,
+  // A subscription released by its client
+  TraceUnsubscribe = 21,
+  // An object the cache set expired on its own, the result is the
+  // ExpireReason
+  TraceObjectExpired = 22,
+  TraceGetStartupProfile = 23,
+  TraceGetMetrics = 24
+};
+
+// The result of a request that failed before it was answered, such
+// as one missing a required parameter
+static const int16_t s_traceNoReply = -1;
+
+// The result of a LookupOrInsertCacheObject that didn't find the key
+// and inserted a new object
+static const int16_t s_traceInserted = 1;
+
+// A trace file is a CTraceFileHeader followed by CTraceRecords, in
+// native byte order.  The records of different threads are written in
+// batches, so they are only roughly in time order.
+static const uint32_t s_traceMagic = 0x46435446;
+static const uint16_t s_traceVersion = 1;
+
+struct CTraceFileHeader {
+  uint32_t m_magic;
+  uint16_t m_version;
+  uint16_t m_recordSize;
+  // When the file was started, in microseconds since the epoch
+  uint64_t m_startTime;
+};
+
+struct CTraceRecord {
+  // Microseconds since the epoch
+  uint64_t m_time;
+  uint64_t m_objId;
+  int64_t m_size;
+  // Hashes of the type name and the caller, see CTraceRecorder::Hash
+  uint32_t m_typeId;
+  uint32_t m_caller;
+  uint16_t m_op;
+  // 0 for success, otherwise the error code the caller was sent
+  // or one of the results above
+  int16_t m_result;
+  uint32_t m_pad;
+};
+
+// The records each thread can hold until the flusher writes them out,
+// a power of two
+static const uint32_t s_traceBufferRecords = 2048;
+
+// Records requests and evictions to a binary trace file so real
+// traffic can be replayed and studied.  Any thread may record.  Each
+// one writes to a buffer of its own without locking, and a flusher
+// thread writes the buffers out about once a second.  When a buffer
+// is full the record is dropped and counted.  The file is rotated to
+// pathname.1 once it grows past its maximum size.
+class CTraceRecorder {
+ public:
+  CTraceRecorder();
+  ~CTraceRecorder();
+
+  // Start recording to pathname.  An existing trace there is added
+  // to.  Returns false if the file can't be opened.
+  bool Start(const std::string& pathname, off_t maxFileSize);
+
+  // Stop recording, writing out what has been recorded
+  void Stop();
+
+  bool isRecording() const { return m_recording; }
+  const std::string& GetPathname() const { return m_pathname; }
+
+  // The number of records dropped since recording last started
+  uint32_t GetDropped() { return __sync_fetch_and_add(&m_dropped, 0); }
+
+  void Record(TraceOp op, uint64_t objId, const std::string& typeName,
+	      int64_t size, uint32_t caller, int result);
+
+  // A 32 bit FNV-1a hash, used for the type names and callers so the
+  // records have a fixed size.  Tools replaying a trace hash the
+  // names they know to match them up.
+  static uint32_t Hash(const std::string& str);
+
+ private:
+  CTraceRecorder& operator=(const CTraceRecorder&);
+  CTraceRecorder(const CTraceRecorder&);
+
+  // The records of one thread.  Only that thread moves the head and
+  // only the flusher moves the tail.
+  struct CBuffer {
+    CTraceRecord m_records[s_traceBufferRecords];
+    volatile uint32_t m_head;
+    volatile uint32_t m_tail;
+    CBuffer* m_next;
+  };
+
+  CBuffer* AddBuffer();
+  static void* Run(void* data);
+  void Flush();
+  bool Write(const void* data, size_t len);
+  bool OpenFile();
+  void CloseFile();
+
+  const uint32_t m_id;
+  volatile bool m_recording;
+  uint32_t m_dropped;
+  std::string m_pathname;
+  off_t m_maxFileSize;
+  int m_fd;
+  off_t m_fileSize;
+  // Guards the list of buffers and wakes the flusher
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  CBuffer* m_buffers;
+  pthread_t m_thread;
+  static MojLogger s_log;
+};
+
+#endif /* __TRACE_RECORDER_H__ */
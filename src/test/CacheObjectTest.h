@@ -247,6 +247,28 @@ class CacheObjectTest : public CxxTest::TestSuite {
     val = 9;
     FC_getxattr(pathname.c_str(), "user.d", &val, sizeof(val));
     TS_ASSERT_EQUALS(val, 0);
+
+    // No key was given so none should be stored
+    TS_ASSERT_EQUALS(FC_getxattr(pathname.c_str(), "user.k", fileName,
+				 maxLength), -1);
+  }
+
+  void testKeyInitialize() {
+    std::string key("http://example.com/image.jpg");
+    CCacheObject* co = new CCacheObject(fileCache, 135791, filename, 100,
+					0, 0, false, false, key);
+    TS_ASSERT_DIFFERS(co, (CCacheObject*) NULL);
+    TS_ASSERT_EQUALS(co->GetKey(), key);
+    TS_ASSERT_EQUALS(co->Initialize(true), true);
+
+    char keyValue[s_maxKeyLength];
+    memset(keyValue, 0, s_maxKeyLength);
+    FC_getxattr(co->GetPathname().c_str(), "user.k", keyValue,
+		s_maxKeyLength);
+    TS_ASSERT_EQUALS(std::string(keyValue), key);
+
+    TS_ASSERT_EQUALS(co->Expire(), true);
+    delete co;
   }
 
   void testDirInitialize() {
@@ -427,10 +449,11 @@ class CacheObjectTest : public CxxTest::TestSuite {
     // This time the resize should return the desired new size
     TS_ASSERT_EQUALS(co->Resize(10), 10);
 
-    // and the size attribute should be updated to reflect that.
+    // but the size attribute is only updated once the object is
+    // finalized.
     sz = 0;
     FC_getxattr(pathname.c_str(), "user.s", &sz, sizeof(sz));
-    TS_ASSERT_EQUALS(sz, 10);
+    TS_ASSERT_EQUALS(sz, 1);
 
     // Write to the file so it stays around
     FILE *fp = ::fopen(pathname.c_str(), "w");
@@ -468,6 +491,49 @@ class CacheObjectTest : public CxxTest::TestSuite {
     delete co;
   }
 
+  void testStreamingSubscribe() {
+    CCacheObject* co = new CCacheObject(fileCache, 246810, filename, 100);
+    TS_ASSERT_DIFFERS(co, (CCacheObject*) NULL);
+    TS_ASSERT_EQUALS(co->Initialize(true), true);
+    std::string pathname(co->GetPathname());
+
+    // Take the writer subscription, a second ordinary subscription
+    // should still fail but a streaming reader should be allowed.
+    TS_ASSERT_SAME_DATA(co->Subscribe(msgText).c_str(), pathname.c_str(),
+			(unsigned int) pathname.length());
+    TS_ASSERT_EQUALS(co->Subscribe(msgText).length(), (size_t) 0);
+    TS_ASSERT_SAME_DATA(co->Subscribe(msgText, true).c_str(),
+			pathname.c_str(), (unsigned int) pathname.length());
+    TS_ASSERT_EQUALS(co->GetSubscriptionCount(), 2);
+    TS_ASSERT_EQUALS(co->GetReaderCount(), 1);
+
+    // The writer can still resize with a reader present and the
+    // reader can see the data as it is written.
+    TS_ASSERT_EQUALS(co->Resize(200), 200);
+    TS_ASSERT_EQUALS(co->GetBytesAvailable(), 0);
+    FILE *fp = ::fopen(pathname.c_str(), "w");
+    TS_ASSERT(fp != NULL);
+    ::fwrite("0123456789", 10, 1, fp);
+    ::fclose(fp);
+    TS_ASSERT_EQUALS(co->GetBytesAvailable(), 10);
+
+    // A reader leaving doesn't finish the object, the writer does.
+    co->UnSubscribe(true);
+    TS_ASSERT_EQUALS(co->GetReaderCount(), 0);
+    TS_ASSERT_EQUALS(co->isWritten(), false);
+    TS_ASSERT_SAME_DATA(co->Subscribe(msgText, true).c_str(),
+			pathname.c_str(), (unsigned int) pathname.length());
+    co->UnSubscribe();
+    TS_ASSERT_EQUALS(co->isWritten(), true);
+    TS_ASSERT_EQUALS(co->GetSize(), 10);
+    TS_ASSERT_EQUALS(co->GetSubscriptionCount(), 1);
+    co->UnSubscribe(true);
+    TS_ASSERT_EQUALS(co->GetSubscriptionCount(), 0);
+
+    TS_ASSERT_EQUALS(co->Expire(), true);
+    delete co;
+  }
+
   void testGetCacheCost() {
     CCacheObject* co = new CCacheObject(fileCache, 564738, filename, 0);
     TS_ASSERT_DIFFERS(co, (CCacheObject*) NULL);
@@ -19,6 +19,7 @@
 #ifndef __FILECACHESETTEST_H__
 #define __FILECACHESETTEST_H__
 
+#include <sys/time.h>
 #include <cxxtest/TestSuite.h>
 #include "FileCache.h"
 #include "FileCacheSet.h"
@@ -152,6 +153,30 @@ class FileCacheSetTest : public CxxTest::TestSuite {
 		     GetFilesystemFileSize(4096));
   }
 
+  // A new object is being written until its writer lets it go
+  void testIsObjectBeingWritten() {
+    CCacheParamValues params(10000, 20000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, typeName, &params));
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, typeName,
+						     fileName, 123),
+		     curObjId);
+    TS_ASSERT(fileCacheSet->isObjectBeingWritten(typeName, curObjId));
+    const std::string pathname(fileCacheSet->SubscribeCacheObject(msgText, curObjId));
+    TS_ASSERT_LESS_THAN((size_t) 7, pathname.length());
+    TS_ASSERT(fileCacheSet->isObjectBeingWritten(typeName, curObjId));
+
+    FILE *fp = ::fopen(pathname.c_str(), "w");
+    TS_ASSERT(fp != NULL);
+    ::fwrite(&curObjId, sizeof(curObjId), 1, fp);
+    ::fclose(fp);
+
+    fileCacheSet->UnSubscribeCacheObject(typeName, curObjId);
+    TS_ASSERT(!fileCacheSet->isObjectBeingWritten(typeName, curObjId++));
+    TS_ASSERT(!fileCacheSet->isObjectBeingWritten(typeName, 0));
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, typeName),
+		     GetFilesystemFileSize(4096));
+  }
+
   void testResize() {
     CCacheParamValues params(10000, 20000, 100, 1, 1);
     TS_ASSERT(fileCacheSet->DefineType(msgText, typeName, &params));
@@ -312,6 +337,336 @@ class FileCacheSetTest : public CxxTest::TestSuite {
 		     GetFilesystemFileSize(1234));
   }
 
+  // The status and size queries read the snapshot, which has to be
+  // published by the time each change returns
+  void testSnapshotFollowsChanges() {
+    std::string type("snapshot");
+    cacheSize_t size;
+    paramValue_t numCacheObjects;
+
+    CCacheParamValues params(10000, 20000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, type, &params));
+    TS_ASSERT(fileCacheSet->GetCacheTypeStatus(type, &size,
+					       &numCacheObjects));
+    TS_ASSERT_EQUALS(numCacheObjects, 0);
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, type,
+						     fileName, 123),
+		     curObjId);
+    TS_ASSERT_EQUALS(fileCacheSet->CachedObjectSize(curObjId), 123);
+    TS_ASSERT_EQUALS(fileCacheSet->CachedObjectFilename(curObjId), fileName);
+
+    const std::string pathname(fileCacheSet->SubscribeCacheObject(msgText,
+								  curObjId));
+    TS_ASSERT_LESS_THAN((size_t) 7, pathname.length());
+    TS_ASSERT_EQUALS(fileCacheSet->Resize(curObjId, 5000), 5000);
+    TS_ASSERT_EQUALS(fileCacheSet->CachedObjectSize(curObjId), 5000);
+    TS_ASSERT(fileCacheSet->GetCacheTypeStatus(type, &size,
+					       &numCacheObjects));
+    TS_ASSERT_EQUALS(size, GetFilesystemFileSize(5000));
+    TS_ASSERT_EQUALS(numCacheObjects, 1);
+
+    // Expired while subscribed, it can't be found by id but still
+    // counts until it is let go and removed with the orphans
+    CTestListener listener;
+    fileCacheSet->AddListener(&listener);
+    TS_ASSERT(!fileCacheSet->ExpireCacheObject(curObjId));
+    TS_ASSERT_EQUALS(listener.m_orphaned.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(fileCacheSet->CleanupOrphans(), 1);
+    TS_ASSERT_EQUALS(fileCacheSet->CachedObjectSize(curObjId), -1);
+    TS_ASSERT(fileCacheSet->CachedObjectFilename(curObjId).empty());
+    TS_ASSERT(fileCacheSet->GetCacheTypeStatus(type, &size,
+					       &numCacheObjects));
+    TS_ASSERT_EQUALS(numCacheObjects, 1);
+
+    // Letting go of it is reported so it can be removed straight away
+    fileCacheSet->UnSubscribeCacheObject(type, curObjId++);
+    TS_ASSERT_EQUALS(listener.m_orphaned.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(fileCacheSet->CleanupOrphans(), 0);
+    fileCacheSet->RemoveListener(&listener);
+    TS_ASSERT(fileCacheSet->GetCacheTypeStatus(type, &size,
+					       &numCacheObjects));
+    TS_ASSERT_EQUALS(size, 0);
+    TS_ASSERT_EQUALS(numCacheObjects, 0);
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, type), 0);
+    TS_ASSERT(!fileCacheSet->GetCacheTypeStatus(type, &size,
+						&numCacheObjects));
+  }
+
+  // A change to one object only builds its chunk of the snapshot
+  // again, the others are shared with the last one
+  void testSnapshotSharesChunks() {
+    std::string type("chunks");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(512 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 256 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    std::vector<cachedObjectId_t> ids;
+    for (cachedObjectId_t i = 0; i <= s_snapshotChunkSize; i++) {
+      ids.push_back(cacheSet->InsertCacheObject(msgText, type, "chunk.dat",
+						100));
+      TS_ASSERT(ids.back() > 0);
+    }
+    TS_ASSERT(GetSnapshotChunk(ids.front()) != GetSnapshotChunk(ids.back()));
+
+    std::map<std::string, typeSnapshotPtr_t> before;
+    const uint64_t generation = cacheSet->GetSnapshotTypes(before);
+    TS_ASSERT(cacheSet->ExpireCacheObject(ids.back()));
+    std::map<std::string, typeSnapshotPtr_t> after;
+    TS_ASSERT(cacheSet->GetSnapshotTypes(after) > generation);
+    TS_ASSERT(before[type]->GetObject(ids.front()) != NULL);
+    TS_ASSERT_EQUALS(before[type]->GetObject(ids.front()),
+		     after[type]->GetObject(ids.front()));
+    TS_ASSERT(before[type]->GetObject(ids.back()) != NULL);
+    TS_ASSERT(after[type]->GetObject(ids.back()) == NULL);
+    TS_ASSERT_EQUALS(cacheSet->CachedObjectSize(ids.front()), 100);
+    TS_ASSERT_EQUALS(cacheSet->CachedObjectSize(ids.back()), -1);
+    TS_ASSERT(cacheSet->DeleteType(msgText, type) > 0);
+  }
+
+  void testListCacheObjects() {
+    CObjectQuery query;
+    std::vector<CCacheObjectInfo> objects;
+    std::string cursor;
+    std::string listType("listtype");
+
+    CCacheParamValues params(100000, 200000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, listType, &params));
+    cachedObjectId_t firstId = curObjId;
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, listType,
+						     fileName, 3000),
+		     curObjId++);
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, listType,
+						     fileName, 1000),
+		     curObjId++);
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, listType,
+						     fileName, 2000),
+		     curObjId++);
+
+    query.m_sortBy = SortBySize;
+    query.m_limit = 2;
+    TS_ASSERT(fileCacheSet->ListCacheObjects(msgText, listType, query,
+					     objects, cursor));
+    TS_ASSERT_EQUALS(objects.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(objects[0].m_id, firstId + 1);
+    TS_ASSERT_EQUALS(objects[1].m_id, firstId + 2);
+    TS_ASSERT(!cursor.empty());
+
+    query.m_cursor = cursor;
+    TS_ASSERT(fileCacheSet->ListCacheObjects(msgText, listType, query,
+					     objects, cursor));
+    TS_ASSERT_EQUALS(objects.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(objects[0].m_id, firstId);
+    TS_ASSERT_EQUALS(objects[0].m_size, 3000);
+    TS_ASSERT(cursor.empty());
+
+    query.m_cursor.clear();
+    query.m_descending = true;
+    query.m_minSize = 1500;
+    TS_ASSERT(fileCacheSet->ListCacheObjects(msgText, listType, query,
+					     objects, cursor));
+    TS_ASSERT_EQUALS(objects.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(objects[0].m_id, firstId);
+    TS_ASSERT_EQUALS(objects[1].m_id, firstId + 2);
+
+    query.m_minSize = -1;
+    query.m_written = 1;
+    TS_ASSERT(fileCacheSet->ListCacheObjects(msgText, listType, query,
+					     objects, cursor));
+    TS_ASSERT(objects.empty());
+
+    query.m_cursor = "foo";
+    TS_ASSERT(!fileCacheSet->ListCacheObjects(msgText, listType, query,
+					      objects, cursor));
+    TS_ASSERT(!fileCacheSet->ListCacheObjects(msgText, typeName + "foo", query,
+					      objects, cursor));
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, listType),
+		     GetFilesystemFileSize(1000) + GetFilesystemFileSize(2000) +
+		     GetFilesystemFileSize(3000));
+  }
+
+  void testListCacheObjectsVisitLimit() {
+    std::string type("visits");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(4096 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 4096 * s_blockSize, 1, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    for (paramValue_t i = 0; i <= CObjectQuery::s_maxEntriesVisited; i++) {
+      TS_ASSERT(cacheSet->InsertCacheObject(msgText, type, "visit.dat", 1) > 0);
+    }
+
+    // Nothing matches, so the first call stops at the visit limit and
+    // the second finishes the walk
+    CObjectQuery query;
+    query.m_written = 1;
+    std::vector<CCacheObjectInfo> objects;
+    std::string cursor;
+    TS_ASSERT(cacheSet->ListCacheObjects(msgText, type, query, objects,
+					 cursor));
+    TS_ASSERT(objects.empty());
+    TS_ASSERT(!cursor.empty());
+    query.m_cursor = cursor;
+    TS_ASSERT(cacheSet->ListCacheObjects(msgText, type, query, objects,
+					 cursor));
+    TS_ASSERT(objects.empty());
+    TS_ASSERT(cursor.empty());
+    TS_ASSERT(cacheSet->DeleteType(msgText, type) > 0);
+  }
+
+  void testLookupOrInsertCacheObject() {
+    bool inserted = false;
+    std::string key("http://example.com/video.mp4");
+
+    CCacheParamValues params(100000, 200000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, typeName, &params));
+    TS_ASSERT_EQUALS(fileCacheSet->FindCacheObjectByKey(typeName, key),
+		     (cachedObjectId_t) 0);
+
+    // The first lookup misses and inserts a new object for the key
+    cachedObjectId_t objId =
+      fileCacheSet->LookupOrInsertCacheObject(msgText, typeName, key,
+					      fileName, 1000, 0, 0, inserted);
+    TS_ASSERT_EQUALS(objId, curObjId++);
+    TS_ASSERT(inserted);
+    TS_ASSERT_EQUALS(fileCacheSet->FindCacheObjectByKey(typeName, key), objId);
+
+    // Later lookups find the same object
+    TS_ASSERT_EQUALS(fileCacheSet->LookupOrInsertCacheObject(msgText, typeName,
+							     key, fileName,
+							     1000, 0, 0,
+							     inserted),
+		     objId);
+    TS_ASSERT(!inserted);
+
+    // Once expired, the key is free for a new object
+    TS_ASSERT(fileCacheSet->ExpireCacheObject(objId));
+    TS_ASSERT_EQUALS(fileCacheSet->FindCacheObjectByKey(typeName, key),
+		     (cachedObjectId_t) 0);
+    TS_ASSERT_EQUALS(fileCacheSet->LookupOrInsertCacheObject(msgText, typeName,
+							     key, fileName,
+							     1000, 0, 0,
+							     inserted),
+		     curObjId++);
+    TS_ASSERT(inserted);
+
+    std::string type("foo");
+    TS_ASSERT_EQUALS(fileCacheSet->LookupOrInsertCacheObject(msgText, type,
+							     key, fileName,
+							     1000, 0, 0,
+							     inserted),
+		     (cachedObjectId_t) 0);
+    TS_ASSERT(!inserted);
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, typeName),
+		     GetFilesystemFileSize(1000));
+  }
+
+  void testCacheListener() {
+    CTestListener listener;
+    std::string eventType("eventtype");
+    fileCacheSet->AddListener(&listener);
+
+    CCacheParamValues params(10000, 20000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, eventType, &params));
+    TS_ASSERT(fileCacheSet->ChangeType(msgText, eventType, &params));
+    TS_ASSERT_EQUALS(listener.m_typeChanges.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(listener.m_typeChanges[0], TypeDefined);
+    TS_ASSERT_EQUALS(listener.m_typeChanges[1], TypeChanged);
+
+    // Going over the low watermark is reported once
+    cachedObjectId_t objId =
+      fileCacheSet->InsertCacheObject(msgText, eventType, fileName, 15000, 0);
+    TS_ASSERT_EQUALS(objId, curObjId++);
+    TS_ASSERT_EQUALS(listener.m_created.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(listener.m_created[0].first, objId);
+    TS_ASSERT(listener.m_created[0].second);
+    TS_ASSERT(!fileCacheSet->isObjectBeingCreated(eventType, objId));
+    TS_ASSERT_EQUALS(listener.m_thresholds.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(listener.m_thresholds[0].first, ThresholdLoWatermark);
+    TS_ASSERT(listener.m_thresholds[0].second);
+
+    // and so is going back under it when the object goes away
+    TS_ASSERT(fileCacheSet->ExpireCacheObject(objId));
+    TS_ASSERT_EQUALS(listener.m_expired.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(listener.m_expired[0].first, objId);
+    TS_ASSERT_EQUALS(listener.m_expired[0].second, ExpireExplicit);
+    TS_ASSERT_EQUALS(listener.m_thresholds.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(listener.m_thresholds[1].first, ThresholdLoWatermark);
+    TS_ASSERT(!listener.m_thresholds[1].second);
+
+    // Expiring it again isn't a new event
+    fileCacheSet->ExpireCacheObject(objId);
+    TS_ASSERT_EQUALS(listener.m_expired.size(), (size_t) 1);
+
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, eventType), 0);
+    TS_ASSERT_EQUALS(listener.m_typeChanges.size(), (size_t) 3);
+    TS_ASSERT_EQUALS(listener.m_typeChanges[2], TypeDeleted);
+
+    fileCacheSet->RemoveListener(&listener);
+  }
+
+  // Only the writer's subscription makes the file writable, and the
+  // listeners are told once it has been
+  void testObjectOpened() {
+    CTestListener listener;
+    fileCacheSet->AddListener(&listener);
+    CCacheParamValues params(10000, 20000, 100, 1, 1);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, typeName, &params));
+    const cachedObjectId_t objId =
+      fileCacheSet->InsertCacheObject(msgText, typeName, fileName, 123);
+    TS_ASSERT_EQUALS(objId, curObjId++);
+
+    TS_ASSERT(!fileCacheSet->SubscribeCacheObject(msgText, objId,
+						   true).empty());
+    TS_ASSERT(listener.m_opened.empty());
+    TS_ASSERT(!fileCacheSet->SubscribeCacheObject(msgText, objId).empty());
+    TS_ASSERT_EQUALS(listener.m_opened.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(listener.m_opened[0].first, objId);
+    TS_ASSERT(listener.m_opened[0].second);
+    TS_ASSERT(!fileCacheSet->isObjectBeingOpened(typeName, objId));
+
+    fileCacheSet->UnSubscribeCacheObject(typeName, objId, true);
+    fileCacheSet->UnSubscribeCacheObject(typeName, objId);
+    fileCacheSet->RemoveListener(&listener);
+    TS_ASSERT(fileCacheSet->DeleteType(msgText, typeName) >= 0);
+  }
+
+  void testMaxAge() {
+    CTestListener listener;
+    std::string ageType("agetype");
+    fileCacheSet->AddListener(&listener);
+
+    CCacheParamValues params(10000, 20000, 100, 1, 1, 60);
+    TS_ASSERT(fileCacheSet->DefineType(msgText, ageType, &params));
+    TS_ASSERT_EQUALS(fileCacheSet->DescribeType(ageType).GetMaxAge(), 60);
+
+    // The type default applies unless the object is given its own
+    const time_t start = ::time(0);
+    cachedObjectId_t typeAgeId = curObjId;
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, ageType,
+						     fileName, 100),
+		     curObjId++);
+    TS_ASSERT_EQUALS(listener.m_agingDue.size(), (size_t) 1);
+    cachedObjectId_t objAgeId = curObjId;
+    TS_ASSERT_EQUALS(fileCacheSet->InsertCacheObject(msgText, ageType,
+						     fileName, 100, 0, 0,
+						     std::string(), 600),
+		     curObjId++);
+    TS_ASSERT_EQUALS(listener.m_agingDue.size(), (size_t) 1);
+    TS_ASSERT(fileCacheSet->NextAgingDue() <= start + 60);
+
+    TS_ASSERT_EQUALS(fileCacheSet->ExpireAgedObjects(start + 59), 0);
+    TS_ASSERT_EQUALS(fileCacheSet->ExpireAgedObjects(::time(0) + 60), 1);
+    TS_ASSERT_EQUALS(listener.m_expired.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(listener.m_expired[0].first, typeAgeId);
+    TS_ASSERT_EQUALS(listener.m_expired[0].second, ExpireAged);
+    TS_ASSERT(fileCacheSet->CachedObjectSize(objAgeId) > 0);
+
+    TS_ASSERT_EQUALS(fileCacheSet->ExpireAgedObjects(::time(0) + 600), 1);
+    TS_ASSERT_EQUALS(listener.m_expired.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(listener.m_expired[1].first, objAgeId);
+    TS_ASSERT_EQUALS(fileCacheSet->NextAgingDue(), (time_t) 0);
+
+    fileCacheSet->RemoveListener(&listener);
+    TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, ageType), 0);
+  }
+
   void testIsTypeDirType() {
     CCacheParamValues params(10000, 20000, 100, 1, 1);
     TS_ASSERT(fileCacheSet->DefineType(msgText, typeName, &params));
@@ -322,6 +677,198 @@ class FileCacheSetTest : public CxxTest::TestSuite {
     TS_ASSERT(fileCacheSet->isTypeDirType(typeName));
     TS_ASSERT_EQUALS(fileCacheSet->DeleteType(msgText, typeName), 0);
   }
+
+  // Write an object so it is kept over a restart
+  static void WriteObject(CFileCacheSet* cacheSet, cachedObjectId_t objId) {
+    std::string msgText;
+    const std::string pathname(cacheSet->SubscribeCacheObject(msgText, objId));
+    TS_ASSERT(!pathname.empty());
+    FILE *fp = ::fopen(pathname.c_str(), "w");
+    TS_ASSERT(fp != NULL);
+    const std::string data(1000, 'x');
+    ::fwrite(data.data(), data.size(), 1, fp);
+    ::fclose(fp);
+    cacheSet->UnSubscribeCacheObject(cacheSet->GetTypeForObjectId(objId),
+				     objId);
+  }
+
+  void testSaveAndLoadState() {
+    const std::string stateFile("/tmp/filecache-test.state");
+    std::string warmType("warm");
+    CStressFileCacheSet* first = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 4 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(first->DefineType(msgText, warmType, &params));
+    const cachedObjectId_t firstId =
+      first->InsertCacheObject(msgText, warmType, "first.dat", 1000);
+    const cachedObjectId_t secondId =
+      first->InsertCacheObject(msgText, warmType, "second.dat", 1000);
+    WriteObject(first, firstId);
+    WriteObject(first, secondId);
+    TS_ASSERT(first->Touch(firstId));
+    // One that is never written is dropped, as a walk would.  It goes
+    // in a type of its own so it doesn't push the others out.
+    std::string otherType("warmother");
+    CCacheParamValues otherParams(s_blockSize, 8 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(first->DefineType(msgText, otherType, &otherParams));
+    const cachedObjectId_t unwrittenId =
+      first->InsertCacheObject(msgText, otherType, "unwritten.dat", 1000);
+    TS_ASSERT(unwrittenId > 0);
+    TS_ASSERT(first->SaveState(stateFile));
+
+    // The next cache set adopts it, keeping which object was used last
+    CStressFileCacheSet* second = new CStressFileCacheSet(64 * s_blockSize);
+    TS_ASSERT(second->LoadState(stateFile));
+    TS_ASSERT_EQUALS(::access(stateFile.c_str(), F_OK), -1);
+    TS_ASSERT(second->TypeExists(warmType));
+    TS_ASSERT_EQUALS(second->CachedObjectSize(firstId), 1000);
+    TS_ASSERT_EQUALS(second->CachedObjectFilename(secondId),
+		     std::string("second.dat"));
+    TS_ASSERT_EQUALS(second->CachedObjectSize(unwrittenId), -1);
+    // so the second object is the first to go
+    TS_ASSERT(second->CleanupAllTypes(1) > 0);
+    TS_ASSERT_EQUALS(second->CachedObjectSize(firstId), 1000);
+    TS_ASSERT_EQUALS(second->CachedObjectSize(secondId), -1);
+
+    // A state is only adopted once
+    TS_ASSERT(second->SaveState(stateFile));
+    const std::string copyFile(stateFile + ".copy");
+    {
+      std::ifstream infile(stateFile.c_str(), std::ios::binary);
+      std::ofstream outfile(copyFile.c_str(), std::ios::binary);
+      outfile << infile.rdbuf();
+    }
+    CStressFileCacheSet* third = new CStressFileCacheSet(64 * s_blockSize);
+    TS_ASSERT(third->LoadState(stateFile));
+    TS_ASSERT(!third->LoadState(copyFile));
+    TS_ASSERT_EQUALS(::access(copyFile.c_str(), F_OK), -1);
+
+    // and not once a file has changed since
+    TS_ASSERT(third->SaveState(stateFile));
+    const std::string pathname(BuildPathname(firstId, s_baseTestDirName,
+					     warmType, "first.dat"));
+    TS_ASSERT_EQUALS(::utimes(pathname.c_str(), NULL), 0);
+    CStressFileCacheSet* changed = new CStressFileCacheSet(64 * s_blockSize);
+    TS_ASSERT(!changed->LoadState(stateFile));
+    TS_ASSERT(!changed->TypeExists(warmType));
+    TS_ASSERT(third->DeleteType(msgText, warmType) > 0);
+    TS_ASSERT_EQUALS(third->DeleteType(msgText, otherType), 0);
+  }
+
+  void testStartupProfile() {
+    std::string coldType("cold");
+    CStressFileCacheSet* first = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 4 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(first->DefineType(msgText, coldType, &params));
+    const cachedObjectId_t objId =
+      first->InsertCacheObject(msgText, coldType, "cold.dat", 1000);
+    WriteObject(first, objId);
+
+    // Walking the tree accounts for each object found
+    CStressFileCacheSet* second = new CStressFileCacheSet(64 * s_blockSize);
+    second->WalkDirTree();
+    second->CleanupAtStartup();
+    TS_ASSERT_EQUALS(second->CachedObjectSize(objId), 1000);
+    const CStartupProfile& profile = second->GetStartupProfile();
+    TS_ASSERT_EQUALS(profile.GetCount(StartupWalk), 1U);
+    TS_ASSERT_EQUALS(profile.GetCount(StartupCleanup), 1U);
+    TS_ASSERT_EQUALS(profile.GetCount(StartupLoadState), 0U);
+    TS_ASSERT(profile.GetCount(StartupInsert) >= 1U);
+    TS_ASSERT(profile.GetCount(StartupReadDir) > 0U);
+    TS_ASSERT(profile.GetCount(StartupStat) > 0U);
+    TS_ASSERT_EQUALS(profile.GetCount(StartupXattrMaxAge),
+		     profile.GetCount(StartupInsert));
+    TS_ASSERT(profile.GetCount(StartupChmod) >= 1U);
+    TS_ASSERT(profile.GetTime(StartupWalk) >= profile.GetTime(StartupStat));
+    TS_ASSERT_EQUALS(profile.GetReadyTime(), 0U);
+    second->GetStartupProfile().SetReady();
+    TS_ASSERT(profile.GetReadyTime() > 0U);
+    TS_ASSERT(second->DeleteType(msgText, coldType) > 0);
+  }
+
+  void testTypeStats() {
+    std::string statsType("stats");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 4 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, statsType, &params));
+    const cachedObjectId_t firstId =
+      cacheSet->InsertCacheObject(msgText, statsType, "first.dat", 1000, 0, 0,
+				  "first");
+    const cachedObjectId_t secondId =
+      cacheSet->InsertCacheObject(msgText, statsType, "second.dat", 1000, 0,
+				  0, "second");
+    WriteObject(cacheSet, firstId);
+    WriteObject(cacheSet, secondId);
+
+    // Only reading a written object is a hit, writing it isn't
+    CTypeStats stats;
+    TS_ASSERT(cacheSet->GetCacheTypeStats(statsType, stats));
+    TS_ASSERT_EQUALS(stats.m_hits, 0U);
+    TS_ASSERT_EQUALS(stats.m_inserts, 2U);
+    TS_ASSERT_EQUALS(stats.m_insertBytes, 2000U);
+    std::string subText;
+    TS_ASSERT(!cacheSet->SubscribeCacheObject(subText, firstId).empty());
+    cacheSet->UnSubscribeCacheObject(statsType, firstId);
+
+    // A lookup that misses inserts an object, which evicts the least
+    // recently used one for space
+    bool inserted = false;
+    TS_ASSERT(cacheSet->LookupOrInsertCacheObject(msgText, statsType, "third",
+						  "third.dat", 1000, 0, 0,
+						  inserted) > 0);
+    TS_ASSERT(inserted);
+    TS_ASSERT_EQUALS(cacheSet->CachedObjectSize(secondId), -1);
+    TS_ASSERT(cacheSet->GetCacheTypeStats(statsType, stats));
+    TS_ASSERT_EQUALS(stats.m_hits, 1U);
+    TS_ASSERT_EQUALS(stats.m_misses, 1U);
+    TS_ASSERT_EQUALS(stats.m_evictions[ExpireCapacity], 1U);
+    TS_ASSERT_EQUALS(stats.m_evictionBytes[ExpireCapacity], 1000U);
+    TS_ASSERT_EQUALS(stats.m_evictionAge.GetCount(), 1U);
+    TS_ASSERT_EQUALS(stats.m_reinserts, 0U);
+
+    // Asking for the evicted object again is a reinsert
+    const cachedObjectId_t againId =
+      cacheSet->LookupOrInsertCacheObject(msgText, statsType, "second",
+					  "second.dat", 1000, 0, 0, inserted);
+    TS_ASSERT(againId > 0);
+    TS_ASSERT(inserted);
+    TS_ASSERT(cacheSet->ExpireCacheObject(againId));
+    TS_ASSERT(cacheSet->GetCacheTypeStats(statsType, stats));
+    TS_ASSERT_EQUALS(stats.m_misses, 2U);
+    TS_ASSERT_EQUALS(stats.m_inserts, 4U);
+    TS_ASSERT_EQUALS(stats.m_reinserts, 1U);
+    TS_ASSERT_EQUALS(stats.m_evictions[ExpireExplicit], 1U);
+
+    cacheSet->RecordMiss("nosuchtype");
+    TS_ASSERT(!cacheSet->GetCacheTypeStats("nosuchtype", stats));
+    TS_ASSERT(cacheSet->DeleteType(msgText, statsType) > 0);
+  }
+
+  void testDeleteTypeWithIOWorkers() {
+    std::string removedType("removed");
+    CStressFileCacheSet* cacheSet =
+      new CStressFileCacheSet(64 * s_blockSize, s_baseTestDirName, 2);
+    CCacheParamValues params(s_blockSize, 16 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, removedType, &params));
+    for (int i = 0; i < 8; i++) {
+      const cachedObjectId_t objId =
+	cacheSet->InsertCacheObject(msgText, removedType, "removed.dat", 1000);
+      TS_ASSERT(objId > 0);
+      WriteObject(cacheSet, objId);
+    }
+    const std::string typeDir(cacheSet->GetBaseDirName() + "/" + removedType);
+
+    // The objects are written in line, only their removals are handed
+    // to the workers, spread across them ahead of the directory's
+    TS_ASSERT(cacheSet->StartIOWorkers());
+    TS_ASSERT(cacheSet->DeleteType(msgText, removedType) > 0);
+
+    // Stopping the workers completes the removal, so the directory is
+    // gone and the type can be defined again
+    cacheSet->StopIOWorkers();
+    TS_ASSERT_EQUALS(::access(typeDir.c_str(), F_OK), -1);
+    TS_ASSERT(cacheSet->DefineType(msgText, removedType, &params));
+    TS_ASSERT_EQUALS(cacheSet->DeleteType(msgText, removedType), 0);
+  }
 };
 
 #endif
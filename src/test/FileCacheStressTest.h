@@ -0,0 +1,248 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __FILECACHESTRESSTEST_H__
+#define __FILECACHESTRESSTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "FileCacheSet.h"
+#include "TestObjects.h"
+
+static const int s_stressThreads = 8;
+static const int s_stressTypes = 4;
+static const int s_stressOps = 500;
+
+// The state shared by the threads of one stress run.  The ids of the
+// objects inserted are kept so any thread can work on them.
+class CStressRun {
+ public:
+
+  CStressRun(CFileCacheSet* cacheSet) : m_cacheSet(cacheSet)
+    , m_failures(0), m_running(s_stressThreads) {
+    ::pthread_mutex_init(&m_mutex, NULL);
+  }
+
+  ~CStressRun() {
+    ::pthread_mutex_destroy(&m_mutex);
+  }
+
+  void AddId(const cachedObjectId_t objId) {
+    ::pthread_mutex_lock(&m_mutex);
+    m_ids.push_back(objId);
+    ::pthread_mutex_unlock(&m_mutex);
+  }
+
+  cachedObjectId_t PickId(unsigned int* seed) {
+    cachedObjectId_t objId = 0;
+    ::pthread_mutex_lock(&m_mutex);
+    if (!m_ids.empty()) {
+      objId = m_ids[rand_r(seed) % m_ids.size()];
+    }
+    ::pthread_mutex_unlock(&m_mutex);
+    return objId;
+  }
+
+  void Failed() {
+    __sync_add_and_fetch(&m_failures, 1);
+  }
+
+  // Called by each thread once it is done
+  void Finished() {
+    __sync_sub_and_fetch(&m_running, 1);
+  }
+
+  bool isRunning() {
+    return __sync_add_and_fetch(&m_running, 0) > 0;
+  }
+
+  CFileCacheSet* m_cacheSet;
+  int m_failures;
+  int m_running;
+
+ private:
+  pthread_mutex_t m_mutex;
+  std::vector<cachedObjectId_t> m_ids;
+};
+
+// Subscribe to an object and, if this ends up being the writer, write
+// some data before letting it go
+static void
+StressSubscribe(CStressRun* run, const cachedObjectId_t objId) {
+
+  std::string msgText;
+  const std::string typeName(run->m_cacheSet->GetTypeForObjectId(objId));
+  const std::string pathName(run->m_cacheSet->SubscribeCacheObject(msgText,
+								    objId));
+  if (pathName.empty() || !msgText.empty()) {
+    // Expired or being written by another thread
+    return;
+  }
+  if (run->m_cacheSet->isObjectBeingWritten(typeName, objId)) {
+    // The main loop completes the job making the file writable
+    while (run->m_cacheSet->isObjectBeingOpened(typeName, objId)) {
+      ::usleep(100);
+    }
+    FILE* fp = ::fopen(pathName.c_str(), "w");
+    if (fp != NULL) {
+      ::fputs("stress", fp);
+      ::fclose(fp);
+    } else {
+      run->Failed();
+    }
+  }
+  run->m_cacheSet->UnSubscribeCacheObject(typeName, objId);
+}
+
+static void*
+StressThread(void* data) {
+
+  CStressRun* run = static_cast<CStressRun*>(data);
+  unsigned int seed = (unsigned int) (size_t) &seed;
+  std::string msgText;
+
+  for (int i = 0; i < s_stressOps; ++i) {
+    const int op = rand_r(&seed) % 5;
+    if (op == 0) {
+      std::stringstream typeName;
+      typeName << "stress" << (rand_r(&seed) % s_stressTypes);
+      const cachedObjectId_t objId =
+	run->m_cacheSet->InsertCacheObject(msgText, typeName.str(),
+					   "stress.dat", 100 * (1 + i % 20));
+      if (objId > 0) {
+	run->AddId(objId);
+	StressSubscribe(run, objId);
+      }
+      continue;
+    }
+    const cachedObjectId_t objId = run->PickId(&seed);
+    if (objId == 0) {
+      continue;
+    }
+    if (op == 1) {
+      StressSubscribe(run, objId);
+    } else if (op == 2) {
+      run->m_cacheSet->Touch(objId);
+    } else if (op == 3) {
+      run->m_cacheSet->ExpireCacheObject(objId);
+    } else {
+      // These read the snapshot while the other threads change it
+      const std::string filename(run->m_cacheSet->CachedObjectFilename(objId));
+      if (!filename.empty() && (filename != "stress.dat")) {
+	run->Failed();
+      }
+      cacheSize_t size = 0;
+      paramValue_t numObjects = 0;
+      if ((run->m_cacheSet->CachedObjectSize(objId) < -1) ||
+	  (run->m_cacheSet->GetCacheStatus(&size, &numObjects, NULL) !=
+	   s_stressTypes) || (size < 0) || (numObjects < 0)) {
+	run->Failed();
+      }
+    }
+  }
+  run->Finished();
+
+  return NULL;
+}
+
+class FileCacheStressTest : public CxxTest::TestSuite {
+
+ public:
+
+  // Runs inserts, subscribes, touches and expires from several
+  // threads at once.  The types together can hold more than the
+  // cache set so the inserts have to clean up across types.
+  void testConcurrentOperations() {
+    RunStress(new CStressFileCacheSet(64 * s_blockSize), false);
+  }
+
+  // The same with the filesystem work handed to the I/O workers.
+  // This thread stands in for the main loop, completing their jobs
+  // while the others run.
+  void testConcurrentOperationsWithIOWorkers() {
+    RunStress(new CStressFileCacheSet(64 * s_blockSize, s_baseTestDirName,
+				      2), true);
+  }
+
+ private:
+
+  void RunStress(CStressFileCacheSet* cacheSet, bool ioWorkers) {
+    std::string msgText;
+    for (int i = 0; i < s_stressTypes; ++i) {
+      std::stringstream typeName;
+      typeName << "stress" << i;
+      CCacheParamValues params(4 * s_blockSize, 32 * s_blockSize, 100, 1, 1);
+      TS_ASSERT(cacheSet->DefineType(msgText, typeName.str(), &params));
+    }
+    if (ioWorkers) {
+      TS_ASSERT(cacheSet->StartIOWorkers());
+    }
+
+    CStressRun run(cacheSet);
+    pthread_t threads[s_stressThreads];
+    for (int i = 0; i < s_stressThreads; ++i) {
+      TS_ASSERT_EQUALS(::pthread_create(&threads[i], NULL, StressThread,
+					&run), 0);
+    }
+    while (run.isRunning()) {
+      if (!g_main_context_iteration(NULL, FALSE)) {
+	::usleep(1000);
+      }
+    }
+    for (int i = 0; i < s_stressThreads; ++i) {
+      ::pthread_join(threads[i], NULL);
+    }
+    TS_ASSERT_EQUALS(run.m_failures, 0);
+
+    // Stopping the workers completes the jobs left, so nothing is
+    // waiting on them
+    if (ioWorkers) {
+      cacheSet->StopIOWorkers();
+      TS_ASSERT(!g_main_context_pending(NULL));
+    }
+
+    // The running total has to match the types and stay in bounds
+    cacheSize_t sumOfSizes = 0;
+    for (int i = 0; i < s_stressTypes; ++i) {
+      std::stringstream typeName;
+      typeName << "stress" << i;
+      cacheSize_t size = -1;
+      paramValue_t numObjects = -1;
+      TS_ASSERT(cacheSet->GetCacheTypeStatus(typeName.str(), &size,
+					     &numObjects));
+      TS_ASSERT(size >= 0);
+      TS_ASSERT(numObjects >= 0);
+      sumOfSizes += size;
+    }
+    TS_ASSERT_EQUALS(cacheSet->SumOfCacheSizes(), sumOfSizes);
+    TS_ASSERT(sumOfSizes <= cacheSet->TotalCacheSpace());
+
+    // Nothing is subscribed any more so every type can be deleted
+    for (int i = 0; i < s_stressTypes; ++i) {
+      std::stringstream typeName;
+      typeName << "stress" << i;
+      TS_ASSERT(cacheSet->DeleteType(msgText, typeName.str()) >= 0);
+    }
+    TS_ASSERT_EQUALS(cacheSet->SumOfCacheSizes(), 0);
+  }
+};
+
+#endif
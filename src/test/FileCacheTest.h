@@ -388,6 +388,39 @@ class FileCacheTest : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(::access(dirname.c_str(), F_OK), -1);
   }
 
+  void testTouchObjects() {
+    std::string type9(typeName + "9");
+    CFileCache* fc9 = new CFileCache(fileCacheSet, type9);
+    CCacheParamValues params(100, 20000, 100, 1, 1);
+    TS_ASSERT_EQUALS(fc9->Configure(&params), true);
+
+    for (int i = 1; i <= 4; i++) {
+      CCacheObject* co = new CCacheObject(fc9, (objId + i), filename,
+					  (s_blockSize + i));
+      TS_ASSERT(co->Initialize(true));
+      TS_ASSERT_EQUALS(fc9->Insert(co), i);
+    }
+    // A batch has the same effect as touching each object in turn,
+    // so only the last touch of the first object counts and the
+    // unknown id is ignored
+    std::vector<cachedObjectId_t> objIds;
+    objIds.push_back(objId + 1);
+    objIds.push_back(objId + 2);
+    objIds.push_back(objId + 99);
+    objIds.push_back(objId + 1);
+    TS_ASSERT_EQUALS(fc9->TouchObjects(objIds), 2);
+    TS_ASSERT_EQUALS(fc9->GetCleanupCandidate(), (objId + 3));
+    TS_ASSERT(fc9->Expire(objId + 3));
+    TS_ASSERT_EQUALS(fc9->GetCleanupCandidate(), (objId + 4));
+    TS_ASSERT(fc9->Expire(objId + 4));
+    TS_ASSERT_EQUALS(fc9->GetCleanupCandidate(), (objId + 2));
+    TS_ASSERT(fc9->Expire(objId + 2));
+    TS_ASSERT_EQUALS(fc9->GetCleanupCandidate(), (objId + 1));
+    TS_ASSERT(fc9->Expire(objId + 1));
+    TS_ASSERT_EQUALS(fc9->TouchObjects(std::vector<cachedObjectId_t>()), 0);
+    delete fc9;
+  }
+
   void testConfig() {
     // Create a cache, configure it, delete the cache with a file
     // existing so the cache directory can't be deleted, then
@@ -0,0 +1,114 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __FSSTATSTEST_H__
+#define __FSSTATSTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "FsStats.h"
+
+static const std::string s_fsStatsTestDir("/tmp/filecache-fsstats");
+
+class FsStatsTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testRecord() {
+    // A type's calls are counted in the cache set's stats too, and
+    // only those keep the time of each call
+    CFsStats total;
+    CFsStats type(&total);
+    TS_ASSERT(total.GetLatency(FsSync) != NULL);
+    TS_ASSERT(type.GetLatency(FsSync) == NULL);
+
+    type.Record(FsSync, 2000, false, 3 * s_blockSize);
+    type.Record(FsSync, 10, true, 3 * s_blockSize);
+    total.Record(FsRename, 5, false, s_fsMetadataBytes);
+
+    CFsCounts counts;
+    type.GetCounts(counts);
+    TS_ASSERT_EQUALS(counts.m_calls[FsSync], (uint64_t) 2);
+    TS_ASSERT_EQUALS(counts.m_failures[FsSync], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_us[FsSync], (uint64_t) 2010);
+    // A failed call isn't counted as writing anything
+    TS_ASSERT_EQUALS(counts.m_bytes[FsSync], (uint64_t) 3 * s_blockSize);
+    TS_ASSERT_EQUALS(counts.m_calls[FsRename], (uint64_t) 0);
+
+    total.GetCounts(counts);
+    TS_ASSERT_EQUALS(counts.m_calls[FsSync], (uint64_t) 2);
+    TS_ASSERT_EQUALS(counts.m_calls[FsRename], (uint64_t) 1);
+    TS_ASSERT_EQUALS(total.GetLatency(FsSync)->GetMax(), (uint64_t) 2000);
+  }
+
+  void testCalls() {
+    CFsStats total;
+    CFsStats type(&total);
+    const std::string filename(s_fsStatsTestDir + "/object");
+    const std::string renamed(s_fsStatsTestDir + "/renamed");
+
+    TS_ASSERT_EQUALS(FsMkdirCall(&type, s_fsStatsTestDir, 0755), 0);
+    TS_ASSERT_EQUALS(FsCreateCall(&type, filename), 0);
+    TS_ASSERT_EQUALS(FsChmodCall(&type, filename, 0444), 0);
+    std::string msgText;
+    TS_ASSERT(FsSyncCall(&type, filename, 1, msgText));
+    TS_ASSERT_EQUALS(FsRenameCall(&type, filename, renamed), 0);
+    TS_ASSERT_EQUALS(FsUnlinkCall(&type, renamed), 0);
+    // The error of a failed call is left for the caller to report
+    TS_ASSERT_EQUALS(FsUnlinkCall(&type, renamed), -1);
+    TS_ASSERT_EQUALS(errno, ENOENT);
+    TS_ASSERT_EQUALS(FsRmdirCall(&type, s_fsStatsTestDir), 0);
+    // And nothing is recorded without stats
+    TS_ASSERT_EQUALS(FsUnlinkCall(NULL, renamed), -1);
+
+    CFsCounts counts;
+    type.GetCounts(counts);
+    TS_ASSERT_EQUALS(counts.m_calls[FsMkdir], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_calls[FsCreate], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_calls[FsChmod], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_calls[FsRename], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_calls[FsUnlink], (uint64_t) 2);
+    TS_ASSERT_EQUALS(counts.m_failures[FsUnlink], (uint64_t) 1);
+    TS_ASSERT_EQUALS(counts.m_bytes[FsUnlink], s_fsMetadataBytes);
+    TS_ASSERT_EQUALS(counts.m_calls[FsRmdir], (uint64_t) 1);
+    // A sync writes the data rounded up to a block as well
+    TS_ASSERT_EQUALS(counts.m_bytes[FsSync],
+		     s_fsMetadataBytes + s_blockSize);
+  }
+
+  void testFormatPrometheus() {
+    CFsStats total;
+    CFsStats type(&total);
+    type.Record(FsSetxattr, 300, false, s_fsMetadataBytes);
+    std::map<std::string, CFsCounts> typeCounts;
+    type.GetCounts(typeCounts["com.palm.test"]);
+
+    std::string text;
+    FormatFsPrometheus(total, typeCounts, text);
+    TS_ASSERT(text.find("filecache_fs_duration_seconds_count{op=\"setxattr\"} 1\n") !=
+	      std::string::npos);
+    TS_ASSERT(text.find("filecache_fs_calls_total{type=\"com.palm.test\",op=\"setxattr\"} 1\n") !=
+	      std::string::npos);
+    TS_ASSERT(text.find("filecache_fs_bytes_written_total{type=\"com.palm.test\",op=\"setxattr\"} 4096\n") !=
+	      std::string::npos);
+    // Calls a type hasn't made aren't listed
+    TS_ASSERT(text.find("filecache_fs_calls_total{type=\"com.palm.test\",op=\"mkdir\"}") ==
+	      std::string::npos);
+  }
+};
+
+#endif /* __FSSTATSTEST_H__ */
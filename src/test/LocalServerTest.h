@@ -0,0 +1,232 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __LOCALSERVERTEST_H__
+#define __LOCALSERVERTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "FileCacheClient.h"
+#include "FileCacheSet.h"
+#include "LocalServer.h"
+#include "TestObjects.h"
+
+static const std::string s_testSocketPath(s_baseTestDirName + "/local.sock");
+
+class LocalServerTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testRequests() {
+    std::string msgText;
+    std::string type("local");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(4 * s_blockSize, 32 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    const cachedObjectId_t objId =
+      cacheSet->InsertCacheObject(msgText, type, "local.dat", 1000);
+    TS_ASSERT(objId > 0);
+
+    CLocalServer server(cacheSet);
+    TS_ASSERT(server.Start(s_testSocketPath));
+
+    CFileCacheClient client;
+    TS_ASSERT(client.Connect(s_testSocketPath));
+    TS_ASSERT_EQUALS(client.ObjectSize(objId), 1000);
+    TS_ASSERT_EQUALS(client.ObjectFilename(objId), std::string("local.dat"));
+    TS_ASSERT(client.Touch(objId));
+
+    long long size = 0;
+    long long numObjects = 0;
+    long long availSpace = 0;
+    TS_ASSERT(client.TypeStatus(type, &size, &numObjects));
+    TS_ASSERT_EQUALS(size, GetFilesystemFileSize(1000));
+    TS_ASSERT_EQUALS(numObjects, 1);
+    TS_ASSERT_EQUALS(client.CacheStatus(&size, &numObjects, &availSpace), 1);
+    TS_ASSERT_EQUALS(size, GetFilesystemFileSize(1000));
+    TS_ASSERT_EQUALS(numObjects, 1);
+    TS_ASSERT_EQUALS(availSpace, cacheSet->SumOfLoWatermarks() - size);
+
+    // Misses are answered without dropping the connection
+    TS_ASSERT_EQUALS(client.ObjectSize(0), -1);
+    TS_ASSERT(client.ObjectFilename(0).empty());
+    TS_ASSERT(!client.Touch(0));
+    TS_ASSERT(!client.TypeStatus("nosuchtype", &size, &numObjects));
+    TS_ASSERT(client.isConnected());
+
+    // An expired object is gone for the client straight away
+    TS_ASSERT(cacheSet->ExpireCacheObject(objId));
+    TS_ASSERT_EQUALS(client.ObjectSize(objId), -1);
+
+    server.Stop();
+    TS_ASSERT_EQUALS(::access(s_testSocketPath.c_str(), F_OK), -1);
+    TS_ASSERT_EQUALS(client.ObjectSize(objId), -1);
+    TS_ASSERT(!client.isConnected());
+    TS_ASSERT(!client.Connect(s_testSocketPath));
+    TS_ASSERT_EQUALS(cacheSet->DeleteType(msgText, type), 0);
+  }
+
+  void testBatches() {
+    std::string msgText;
+    std::string type("localbatch");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(4 * s_blockSize, 32 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    const cachedObjectId_t objId =
+      cacheSet->InsertCacheObject(msgText, type, "batch.dat", 1000, 1, 1,
+				  "batchkey");
+    TS_ASSERT(objId > 0);
+
+    CLocalServer server(cacheSet);
+    TS_ASSERT(server.Start(s_testSocketPath));
+    CFileCacheClient client;
+    TS_ASSERT(client.Connect(s_testSocketPath));
+
+    // The writer's subscription is only given out on the bus
+    TS_ASSERT(client.Subscribe(objId).empty());
+    const std::string pathname(cacheSet->SubscribeCacheObject(msgText, objId));
+    TS_ASSERT(!pathname.empty());
+    cacheSet->UnSubscribeCacheObject(type, objId);
+    TS_ASSERT(!cacheSet->isObjectBeingWritten(type, objId));
+    const long long size = cacheSet->CachedObjectSize(objId);
+
+    CFileCacheBatch batch;
+    TS_ASSERT_EQUALS(batch.AddLookup(type, "batchkey"), 0);
+    TS_ASSERT_EQUALS(batch.AddSize(objId), 1);
+    TS_ASSERT_EQUALS(batch.AddTouch(objId), 2);
+    TS_ASSERT_EQUALS(batch.AddSubscribe(objId), 3);
+    TS_ASSERT_EQUALS(batch.AddLookup(type, "nosuchkey"), 4);
+    TS_ASSERT(client.Call(batch));
+    TS_ASSERT(batch.isOk(0));
+    TS_ASSERT_EQUALS(batch.GetValue(0, 0), (long long) objId);
+    TS_ASSERT_EQUALS(batch.GetValue(0, 1), size);
+    TS_ASSERT_EQUALS(batch.GetValue(1, 0), size);
+    TS_ASSERT(batch.isOk(2));
+    TS_ASSERT(batch.isOk(3));
+    TS_ASSERT_EQUALS(batch.GetText(3), pathname);
+    TS_ASSERT_EQUALS(batch.GetStatus(4), LocalStatusNotFound);
+
+    // Batches sent together are answered in order
+    CFileCacheBatch first;
+    CFileCacheBatch second;
+    first.AddSize(objId);
+    second.AddFilename(objId);
+    second.AddCacheStatus();
+    TS_ASSERT(client.Send(first));
+    TS_ASSERT(client.Send(second));
+    TS_ASSERT(client.Receive(first));
+    TS_ASSERT(client.Receive(second));
+    TS_ASSERT_EQUALS(first.GetValue(0, 0), size);
+    TS_ASSERT_EQUALS(second.GetText(0), std::string("batch.dat"));
+    TS_ASSERT_EQUALS(second.GetValue(1, 0), 1);
+
+    CFileCacheBatch full;
+    for (unsigned int i = 0; i < s_localMaxBatch; ++i) {
+      TS_ASSERT_EQUALS(full.AddTouch(objId), (int) i);
+    }
+    TS_ASSERT_EQUALS(full.AddTouch(objId), -1);
+    TS_ASSERT(client.Call(full));
+    TS_ASSERT(full.isOk(s_localMaxBatch - 1));
+
+    // Only the client's own subscriptions can be released
+    TS_ASSERT(client.UnSubscribe(objId));
+    TS_ASSERT(!client.UnSubscribe(objId));
+    TS_ASSERT(client.isConnected());
+
+    // and any it still holds go when it does
+    TS_ASSERT(!client.Subscribe(objId).empty());
+    client.Disconnect();
+    server.Stop();
+    TS_ASSERT(cacheSet->ExpireCacheObject(objId));
+    TS_ASSERT_EQUALS(cacheSet->DeleteType(msgText, type), 0);
+  }
+
+  void testTouchRing() {
+    std::string msgText;
+    std::string type("localtouch");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(s_blockSize, 4 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    const cachedObjectId_t firstId =
+      cacheSet->InsertCacheObject(msgText, type, "first.dat", 1000);
+    const cachedObjectId_t secondId =
+      cacheSet->InsertCacheObject(msgText, type, "second.dat", 1000);
+    TS_ASSERT((firstId > 0) && (secondId > 0));
+
+    CLocalServer server(cacheSet);
+    TS_ASSERT(server.Start(s_testSocketPath));
+    CFileCacheClient client;
+    TS_ASSERT(!client.RecordTouch(firstId));
+    TS_ASSERT(client.Connect(s_testSocketPath));
+    TS_ASSERT(client.OpenTouchRing());
+    TS_ASSERT(client.RecordTouch(firstId));
+
+    // Stopping drains what is left in the ring, which makes the
+    // first object the most recently used so the second is the one
+    // to make way
+    server.Stop();
+    client.Disconnect();
+    TS_ASSERT(!client.RecordTouch(firstId));
+    TS_ASSERT(cacheSet->InsertCacheObject(msgText, type, "third.dat", 1000) > 0);
+    TS_ASSERT(cacheSet->CachedObjectSize(firstId) >= 0);
+    TS_ASSERT_EQUALS(cacheSet->CachedObjectSize(secondId), -1);
+    // Both objects that are left go with the type
+    TS_ASSERT(cacheSet->DeleteType(msgText, type) > 0);
+  }
+
+  void testIndex() {
+    std::string msgText;
+    std::string type("localindex");
+    CStressFileCacheSet* cacheSet = new CStressFileCacheSet(64 * s_blockSize);
+    CCacheParamValues params(4 * s_blockSize, 32 * s_blockSize, 100, 1, 1);
+    TS_ASSERT(cacheSet->DefineType(msgText, type, &params));
+    const cachedObjectId_t objId =
+      cacheSet->InsertCacheObject(msgText, type, "index.dat", 1000);
+    TS_ASSERT(objId > 0);
+
+    CLocalServer server(cacheSet);
+    TS_ASSERT(server.Start(s_testSocketPath));
+    CFileCacheClient client;
+    TS_ASSERT_EQUALS(client.IndexLookup(objId), -1);
+    TS_ASSERT(client.Connect(s_testSocketPath));
+    TS_ASSERT(client.OpenIndex());
+
+    long long size = 0;
+    long long numObjects = 0;
+    std::string filename;
+    TS_ASSERT_EQUALS(client.IndexLookup(objId, &size, &filename), 1);
+    TS_ASSERT_EQUALS(size, 1000);
+    TS_ASSERT_EQUALS(filename, std::string("index.dat"));
+    TS_ASSERT_EQUALS(client.IndexLookup(objId + 1000), 0);
+    TS_ASSERT_EQUALS(client.IndexTypeStatus(type, &size, &numObjects), 1);
+    TS_ASSERT_EQUALS(size, GetFilesystemFileSize(1000));
+    TS_ASSERT_EQUALS(numObjects, 1);
+    TS_ASSERT_EQUALS(client.IndexTypeStatus("nosuchtype", &size,
+					    &numObjects), 0);
+
+    // Stopping publishes the last change, and the client's mapping
+    // stays valid until it disconnects
+    TS_ASSERT(cacheSet->ExpireCacheObject(objId));
+    server.Stop();
+    TS_ASSERT_EQUALS(client.IndexLookup(objId), 0);
+    client.Disconnect();
+    TS_ASSERT_EQUALS(client.IndexLookup(objId), -1);
+    TS_ASSERT_EQUALS(cacheSet->DeleteType(msgText, type), 0);
+  }
+};
+
+#endif
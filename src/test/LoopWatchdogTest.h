@@ -0,0 +1,109 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __LOOPWATCHDOGTEST_H__
+#define __LOOPWATCHDOGTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "LoopWatchdog.h"
+#include <unistd.h>
+
+class LoopWatchdogTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testActivity() {
+    TS_ASSERT(CLoopWatchdog::GetActivity() == NULL);
+    {
+      CLoopActivity outer("worker");
+      {
+	CLoopActivity inner("completeJob");
+	TS_ASSERT_EQUALS(std::string(CLoopWatchdog::GetActivity()),
+			 std::string("completeJob"));
+      }
+      TS_ASSERT_EQUALS(std::string(CLoopWatchdog::GetActivity()),
+		       std::string("worker"));
+    }
+    TS_ASSERT(CLoopWatchdog::GetActivity() == NULL);
+  }
+
+  void testLag() {
+    CLoopWatchdog watchdog;
+    TS_ASSERT(watchdog.Start(1000, 10000000));
+    // The first beat only starts the watch
+    watchdog.Beat();
+    TS_ASSERT_EQUALS(watchdog.GetLag().GetCount(), (uint64_t) 0);
+    ::usleep(5000);
+    watchdog.Beat();
+    TS_ASSERT_EQUALS(watchdog.GetLag().GetCount(), (uint64_t) 1);
+    TS_ASSERT(watchdog.GetLag().GetMax() >= 4000);
+    TS_ASSERT_EQUALS(watchdog.GetStalls().GetCount(), (uint64_t) 0);
+  }
+
+  void testStall() {
+    CLoopWatchdog watchdog;
+    TS_ASSERT(watchdog.Start(1000, 20000));
+    watchdog.Beat();
+    {
+      CLoopActivity activity("DefineType");
+      ::usleep(60000);
+    }
+    watchdog.Beat();
+    TS_ASSERT_EQUALS(watchdog.GetStalls().GetCount(), (uint64_t) 1);
+    TS_ASSERT(watchdog.GetStalls().GetMax() >= 20000);
+
+    std::map<std::string, uint64_t> activities;
+    watchdog.GetStallActivities(activities);
+    TS_ASSERT_EQUALS(activities.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(activities["DefineType"], (uint64_t) 1);
+    std::string activity;
+    uint64_t us = 0;
+    watchdog.GetLastStall(activity, us);
+    TS_ASSERT_EQUALS(activity, std::string("DefineType"));
+    TS_ASSERT(us >= 20000);
+
+    // A stall nothing was named for is counted all the same
+    ::usleep(60000);
+    watchdog.Beat();
+    watchdog.GetStallActivities(activities);
+    TS_ASSERT_EQUALS(activities[s_loopUnknownActivity], (uint64_t) 1);
+    watchdog.Stop();
+  }
+
+  void testFormatPrometheus() {
+    CLoopWatchdog watchdog;
+    TS_ASSERT(watchdog.Start(1000, 20000));
+    watchdog.Beat();
+    {
+      CLoopActivity activity("cleaner");
+      ::usleep(40000);
+    }
+    watchdog.Beat();
+
+    std::string text;
+    watchdog.FormatPrometheus(text);
+    TS_ASSERT(text.find("filecache_main_loop_lag_seconds_count 1\n") !=
+	      std::string::npos);
+    TS_ASSERT(text.find("filecache_main_loop_stall_seconds_count 1\n") !=
+	      std::string::npos);
+    TS_ASSERT(text.find("filecache_main_loop_stalls_total{activity=\"cleaner\"} 1\n") !=
+	      std::string::npos);
+  }
+};
+
+#endif /* __LOOPWATCHDOGTEST_H__ */
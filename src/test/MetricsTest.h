@@ -0,0 +1,99 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __METRICSTEST_H__
+#define __METRICSTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "Metrics.h"
+#include <fstream>
+#include <unistd.h>
+
+static const std::string s_metricsTestFile("/tmp/filecache-test.prom");
+
+class MetricsTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testBuckets() {
+    // Every time is counted in a bucket whose limit is no smaller
+    // than it and within an eighth of it
+    uint64_t lastLimit = 0;
+    for (int bucket = 0; bucket < s_histogramBuckets; bucket++) {
+      const uint64_t limit = CLatencyHistogram::GetBucketLimit(bucket);
+      TS_ASSERT(bucket == 0 || limit > lastLimit);
+      TS_ASSERT_EQUALS(CLatencyHistogram::GetBucket(limit), bucket);
+      TS_ASSERT_EQUALS(CLatencyHistogram::GetBucket(lastLimit + 1),
+		       (bucket == 0) ? 1 : bucket);
+      TS_ASSERT(limit - lastLimit <= 1 + limit / 8);
+      lastLimit = limit;
+    }
+    TS_ASSERT_EQUALS(lastLimit, 0xffffffffULL);
+    TS_ASSERT_EQUALS(CLatencyHistogram::GetBucket(1ULL << 40),
+		     s_histogramBuckets - 1);
+  }
+
+  void testPercentiles() {
+    CLatencyHistogram histogram;
+    TS_ASSERT_EQUALS(histogram.GetPercentile(0.5), (uint64_t) 0);
+    for (uint64_t us = 1; us <= 1000; us++) {
+      histogram.Record(us);
+    }
+    histogram.Record(1000000);
+    TS_ASSERT_EQUALS(histogram.GetCount(), (uint64_t) 1001);
+    TS_ASSERT_EQUALS(histogram.GetMax(), (uint64_t) 1000000);
+    TS_ASSERT_EQUALS(histogram.GetSum(), (uint64_t) (500500 + 1000000));
+
+    const uint64_t p50 = histogram.GetPercentile(0.5);
+    TS_ASSERT(p50 >= 500 && p50 <= 500 + 500 / 8);
+    const uint64_t p99 = histogram.GetPercentile(0.99);
+    TS_ASSERT(p99 >= 990 && p99 <= 990 + 990 / 8);
+    // The slowest time is reported exactly
+    TS_ASSERT_EQUALS(histogram.GetPercentile(1.0), (uint64_t) 1000000);
+  }
+
+  void testWritePrometheus() {
+    CMetrics metrics;
+    const size_t method = metrics.AddPath("method", "DefineType");
+    const size_t task = metrics.AddPath("task", "worker");
+    TS_ASSERT_EQUALS(metrics.GetNumPaths(), (size_t) 2);
+    metrics.Record(method, 100, false);
+    metrics.Record(method, 300, true);
+    metrics.Record(task, 2000, false);
+    TS_ASSERT_EQUALS(metrics.GetFailures(method), (uint64_t) 1);
+    TS_ASSERT_EQUALS(metrics.GetHistogram(task).GetCount(), (uint64_t) 1);
+
+    TS_ASSERT(metrics.WritePrometheus(s_metricsTestFile));
+    std::ifstream infile(s_metricsTestFile.c_str());
+    std::string contents((std::istreambuf_iterator<char>(infile)),
+			 std::istreambuf_iterator<char>());
+    TS_ASSERT(contents.find("filecache_duration_seconds_count{method=\"DefineType\"} 2\n") !=
+	      std::string::npos);
+    TS_ASSERT(contents.find("filecache_duration_seconds{task=\"worker\",quantile=\"0.99\"} 0.002000\n") !=
+	      std::string::npos);
+    TS_ASSERT(contents.find("filecache_failures_total{method=\"DefineType\"} 1\n") !=
+	      std::string::npos);
+    TS_ASSERT(::access((s_metricsTestFile + ".tmp").c_str(), F_OK) != 0);
+    ::unlink(s_metricsTestFile.c_str());
+
+    // A file that can't be written is reported
+    TS_ASSERT(!metrics.WritePrometheus("/nonexistent/filecache.prom"));
+  }
+};
+
+#endif /* __METRICSTEST_H__ */
@@ -0,0 +1,102 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __REQUESTTRACETEST_H__
+#define __REQUESTTRACETEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "RequestTrace.h"
+#include <fstream>
+#include <unistd.h>
+
+static const std::string s_requestTraceTestFile("/tmp/filecache-test.json");
+
+class RequestTraceTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testDisabled() {
+    // Nothing is traced until the tracer is started, and stages with
+    // no current request are ignored
+    CRequestTracer tracer;
+    TS_ASSERT(!tracer.isEnabled());
+    TS_ASSERT(tracer.Begin("InsertCacheObject") == NULL);
+    CRequestScope scope(NULL);
+    CTraceSpan span("space");
+    TS_ASSERT(CRequestTrace::GetCurrent() == NULL);
+  }
+
+  void testSpans() {
+    CRequestTracer tracer;
+    TS_ASSERT(tracer.Start(1000000, std::string()));
+    CRequestTrace* trace = tracer.Begin("InsertCacheObject");
+    TS_ASSERT(trace != NULL);
+    {
+      CRequestScope scope(trace);
+      TS_ASSERT_EQUALS(CRequestTrace::GetCurrent(), trace);
+      {
+	CTraceSpan space("space");
+	CTraceSpan evict("evict");
+      }
+      CTraceSpan insert("insert");
+    }
+    TS_ASSERT(CRequestTrace::GetCurrent() == NULL);
+
+    std::string text;
+    trace->FormatSpans(text);
+    TS_ASSERT_EQUALS(text.substr(0, 6), std::string("space "));
+    TS_ASSERT(text.find(" [evict ") != std::string::npos);
+    TS_ASSERT(text.find("], insert ") != std::string::npos);
+
+    // The request isn't slow, so it isn't counted once done
+    trace->Release();
+    TS_ASSERT_EQUALS(tracer.GetSlowRequests(), (uint64_t) 0);
+  }
+
+  void testSlowRequest() {
+    CRequestTracer tracer;
+    ::unlink(s_requestTraceTestFile.c_str());
+    TS_ASSERT(tracer.Start(1, s_requestTraceTestFile));
+    CRequestTrace* trace = tracer.Begin("DefineType");
+    const uint64_t id = trace->GetId();
+    // Work the request waits on keeps it going
+    trace->AddRef();
+    trace->AddSpan("queued", 0, 0, 5);
+    trace->Release();
+    TS_ASSERT_EQUALS(tracer.GetSlowRequests(), (uint64_t) 0);
+    ::usleep(1000);
+    trace->Release();
+    TS_ASSERT_EQUALS(tracer.GetSlowRequests(), (uint64_t) 1);
+
+    std::ifstream infile(s_requestTraceTestFile.c_str());
+    std::string contents((std::istreambuf_iterator<char>(infile)),
+			 std::istreambuf_iterator<char>());
+    TS_ASSERT_EQUALS(contents.substr(0, 2), std::string("[\n"));
+    TS_ASSERT(contents.find("{\"name\":\"DefineType\",\"cat\":\"request\",\"ph\":\"X\"") !=
+	      std::string::npos);
+    char idText[32];
+    ::snprintf(idText, sizeof(idText), "\"args\":{\"id\":%llu}",
+	       (unsigned long long) id);
+    TS_ASSERT(contents.find(std::string("{\"name\":\"queued\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":0,\"dur\":5,")) !=
+	      std::string::npos);
+    TS_ASSERT(contents.find(idText) != std::string::npos);
+    ::unlink(s_requestTraceTestFile.c_str());
+  }
+};
+
+#endif /* __REQUESTTRACETEST_H__ */
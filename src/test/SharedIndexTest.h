@@ -0,0 +1,182 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __SHAREDINDEXTEST_H__
+#define __SHAREDINDEXTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "SharedIndex.h"
+
+class SharedIndexTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testLookup() {
+    CSharedIndex index;
+    TS_ASSERT_EQUALS(index.Lookup(1, NULL), CSharedIndex::Unknown);
+    TS_ASSERT(index.Create(4, 2));
+    TS_ASSERT_EQUALS(index.GetMaxObjects(), 4U);
+
+    // Nothing is known until the first publication
+    CSharedIndex client;
+    TS_ASSERT(client.Attach(index.GetFd()));
+    TS_ASSERT_EQUALS(client.Lookup(1, NULL), CSharedIndex::Unknown);
+
+    index.BeginUpdate();
+    index.Clear();
+    const int typeIndex = index.AddType("images", 8192, 2);
+    TS_ASSERT_EQUALS(typeIndex, 0);
+    TS_ASSERT(index.AddObject(1, typeIndex, 1000, true, "one.jpg"));
+    TS_ASSERT(index.AddObject(2, typeIndex, 2000, false, "two.jpg"));
+    TS_ASSERT_EQUALS(client.Lookup(1, NULL), CSharedIndex::Unknown);
+    index.EndUpdate(1);
+
+    CSharedIndex::CObject obj;
+    TS_ASSERT_EQUALS(client.Lookup(2, &obj), CSharedIndex::Found);
+    TS_ASSERT_EQUALS(obj.m_size, 2000);
+    TS_ASSERT(!obj.m_written);
+    TS_ASSERT_EQUALS(obj.m_typeName, std::string("images"));
+    TS_ASSERT_EQUALS(obj.m_filename, std::string("two.jpg"));
+    TS_ASSERT_EQUALS(client.Lookup(3, &obj), CSharedIndex::Missing);
+
+    int64_t size = 0;
+    int64_t numObjects = 0;
+    TS_ASSERT_EQUALS(client.TypeStatus("images", &size, &numObjects),
+		     CSharedIndex::Found);
+    TS_ASSERT_EQUALS(size, 8192);
+    TS_ASSERT_EQUALS(numObjects, 2);
+    TS_ASSERT_EQUALS(client.TypeStatus("music", &size, &numObjects),
+		     CSharedIndex::Missing);
+
+    // A rebuilt publication replaces the last one completely
+    index.BeginUpdate();
+    index.Clear();
+    TS_ASSERT_EQUALS(index.AddType("music", 4096, 1), 0);
+    TS_ASSERT(index.AddObject(3, 0, 3000, true, "three.mp3"));
+    index.EndUpdate(2);
+    TS_ASSERT_EQUALS(client.Lookup(1, NULL), CSharedIndex::Missing);
+    TS_ASSERT_EQUALS(client.Lookup(3, &obj), CSharedIndex::Found);
+    TS_ASSERT_EQUALS(obj.m_typeName, std::string("music"));
+    TS_ASSERT(obj.m_written);
+    TS_ASSERT_EQUALS(client.TypeStatus("images", &size, &numObjects),
+		     CSharedIndex::Missing);
+
+    // Once it is full a miss can't be trusted
+    index.BeginUpdate();
+    index.Clear();
+    TS_ASSERT_EQUALS(index.AddType("images", 0, 5), 0);
+    for (uint64_t i = 1; i <= 4; ++i) {
+      TS_ASSERT(index.AddObject(i, 0, 1, true, "x"));
+    }
+    TS_ASSERT(!index.AddObject(5, 0, 1, true, "x"));
+    index.EndUpdate(3);
+    TS_ASSERT_EQUALS(client.Lookup(4, NULL), CSharedIndex::Found);
+    TS_ASSERT_EQUALS(client.Lookup(5, NULL), CSharedIndex::Unknown);
+
+    client.Close();
+    TS_ASSERT_EQUALS(client.Lookup(4, NULL), CSharedIndex::Unknown);
+    TS_ASSERT(!client.Attach(-1));
+  }
+
+  void testChangeInPlace() {
+    CSharedIndex index;
+    TS_ASSERT(index.Create(8, 2));
+    CSharedIndex client;
+    TS_ASSERT(client.Attach(index.GetFd()));
+
+    index.BeginUpdate();
+    index.Clear();
+    TS_ASSERT_EQUALS(index.AddType("images", 8000, 8), 0);
+    for (uint64_t i = 1; i <= 8; ++i) {
+      TS_ASSERT(index.AddObject(i, 0, 1000, false, "img"));
+    }
+    index.EndUpdate(1);
+
+    // Removing objects keeps the ones that probed past them reachable
+    index.BeginUpdate();
+    TS_ASSERT(index.SetType(0, 4000, 4));
+    for (uint64_t i = 1; i <= 8; i += 2) {
+      index.RemoveObject(i);
+    }
+    index.RemoveObject(100);
+    TS_ASSERT(index.AddObject(2, 0, 2000, true, "img"));
+    index.EndUpdate(2);
+    TS_ASSERT(index.isComplete());
+    CSharedIndex::CObject obj;
+    for (uint64_t i = 1; i <= 8; ++i) {
+      TS_ASSERT_EQUALS(client.Lookup(i, NULL),
+		       ((i % 2) == 0) ? CSharedIndex::Found :
+		       CSharedIndex::Missing);
+    }
+    TS_ASSERT_EQUALS(client.Lookup(2, &obj), CSharedIndex::Found);
+    TS_ASSERT_EQUALS(obj.m_size, 2000);
+    TS_ASSERT(obj.m_written);
+    TS_ASSERT_EQUALS(obj.m_filename, std::string("img"));
+    int64_t size = 0;
+    int64_t numObjects = 0;
+    TS_ASSERT_EQUALS(client.TypeStatus("images", &size, &numObjects),
+		     CSharedIndex::Found);
+    TS_ASSERT_EQUALS(size, 4000);
+    TS_ASSERT_EQUALS(numObjects, 4);
+
+    // The filenames of removed objects take space until the next
+    // Clear, so the index can fill up before its slots do
+    index.BeginUpdate();
+    index.Clear();
+    TS_ASSERT(index.isComplete());
+    TS_ASSERT_EQUALS(index.AddType("images", 0, 1), 0);
+    const std::string name(8 * 32, 'n');
+    TS_ASSERT(index.AddObject(1, 0, 1, true, name));
+    index.EndUpdate(3);
+    index.BeginUpdate();
+    index.RemoveObject(1);
+    TS_ASSERT(!index.AddObject(2, 0, 1, true, "x"));
+    TS_ASSERT(!index.SetType(1, 0, 0));
+    index.EndUpdate(4);
+    TS_ASSERT(!index.isComplete());
+    TS_ASSERT_EQUALS(client.Lookup(1, NULL), CSharedIndex::Unknown);
+  }
+
+  void testReadOnly() {
+    CSharedIndex index;
+    TS_ASSERT(index.Create(4, 2));
+
+    // The descriptor handed to readers can't be mapped for writing
+    const int fd = index.GetFd();
+    TS_ASSERT_EQUALS(::fcntl(fd, F_GETFL) & O_ACCMODE, O_RDONLY);
+    void* addr = ::mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+    TS_ASSERT_EQUALS(addr, MAP_FAILED);
+    TS_ASSERT_EQUALS(errno, EACCES);
+
+    // The writer's own mapping still works
+    index.BeginUpdate();
+    index.Clear();
+    TS_ASSERT_EQUALS(index.AddType("images", 0, 0), 0);
+    index.EndUpdate(1);
+    CSharedIndex client;
+    TS_ASSERT(client.Attach(fd));
+    TS_ASSERT_EQUALS(client.TypeStatus("images", NULL, NULL),
+		     CSharedIndex::Found);
+  }
+};
+
+#endif
@@ -81,4 +81,81 @@ class CTestFileCacheSet : public CFileCacheSet {
   cacheSize_t m_cacheSizes;
 };
 
+// Keeps the real accounting of the cache set, so the space checks and
+// the cleanup across types are exercised, but uses the test directory
+// or the one given and the number of I/O workers given
+class CStressFileCacheSet : public CFileCacheSet {
+ public:
+
+  CStressFileCacheSet(cacheSize_t cacheSpace,
+		      const std::string& dirName = s_baseTestDirName,
+		      int ioWorkers = 0)
+    : CFileCacheSet(false)
+    , m_dirName(dirName)
+    , m_cacheSpace(cacheSpace) {
+    SetIOWorkerCount(ioWorkers);
+  }
+
+  std::string& GetBaseDirName() { return m_dirName; }
+  cacheSize_t TotalCacheSpace() { return m_cacheSpace; }
+
+ private:
+  std::string m_dirName;
+  cacheSize_t m_cacheSpace;
+};
+
+// Records the events it is told about so tests can check them
+class CTestListener : public CFileCacheListener {
+ public:
+
+  void ObjectExpired(const std::string& typeName,
+		     const cachedObjectId_t objId,
+		     const std::string& filename, ExpireReason reason) {
+    m_expired.push_back(std::make_pair(objId, reason));
+  }
+
+  void TypeModified(const std::string& typeName, TypeChange change) {
+    m_typeChanges.push_back(change);
+  }
+
+  void ObjectCreated(const std::string& typeName,
+		     const cachedObjectId_t objId, bool created) {
+    m_created.push_back(std::make_pair(objId, created));
+  }
+
+  void ObjectOpened(const std::string& typeName,
+		    const cachedObjectId_t objId, bool opened) {
+    m_opened.push_back(std::make_pair(objId, opened));
+  }
+
+  void ObjectWritten(const std::string& typeName,
+		     const cachedObjectId_t objId, bool written) {
+    m_written.push_back(std::make_pair(objId, written));
+  }
+
+  void ObjectOrphaned(const std::string& typeName,
+		      const cachedObjectId_t objId) {
+    m_orphaned.push_back(objId);
+  }
+
+  void AgingScheduled(time_t due) {
+    m_agingDue.push_back(due);
+  }
+
+  void ThresholdCrossed(const std::string& typeName,
+			CacheThreshold threshold, bool above,
+			cacheSize_t size) {
+    m_thresholds.push_back(std::make_pair(threshold, above));
+  }
+
+  std::vector<std::pair<cachedObjectId_t, ExpireReason> > m_expired;
+  std::vector<TypeChange> m_typeChanges;
+  std::vector<std::pair<cachedObjectId_t, bool> > m_created;
+  std::vector<std::pair<cachedObjectId_t, bool> > m_opened;
+  std::vector<std::pair<cachedObjectId_t, bool> > m_written;
+  std::vector<cachedObjectId_t> m_orphaned;
+  std::vector<time_t> m_agingDue;
+  std::vector<std::pair<CacheThreshold, bool> > m_thresholds;
+};
+
 #endif
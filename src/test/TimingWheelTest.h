@@ -0,0 +1,90 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __TIMINGWHEELTEST_H__
+#define __TIMINGWHEELTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "TimingWheel.h"
+
+class TimingWheelTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testScheduleAndFire() {
+    const time_t start = 1000000;
+    CTimingWheel wheel(start);
+    std::vector<cachedObjectId_t> fired;
+    TS_ASSERT_EQUALS(wheel.NextDue(), (time_t) 0);
+
+    // Deadlines in each level and beyond the top one all fire on time
+    const time_t delays[] = { 1, 63, 64, 65, 4095, 4097, 300000,
+			      20000000 };
+    const size_t numDelays = sizeof(delays) / sizeof(delays[0]);
+    for (size_t i = 0; i < numDelays; i++) {
+      wheel.Schedule(i + 1, start + delays[i]);
+    }
+    TS_ASSERT_EQUALS(wheel.Size(), numDelays);
+    for (size_t i = 0; i < numDelays; i++) {
+      // The next due time may be early but never late
+      const time_t next = wheel.NextDue();
+      TS_ASSERT(next <= start + delays[i]);
+      wheel.Advance(start + delays[i] - 1, fired);
+      TS_ASSERT(fired.empty());
+      wheel.Advance(start + delays[i], fired);
+      TS_ASSERT_EQUALS(fired.size(), (size_t) 1);
+      if (!fired.empty()) {
+	TS_ASSERT_EQUALS(fired[0], (cachedObjectId_t) (i + 1));
+      }
+      fired.clear();
+    }
+    TS_ASSERT_EQUALS(wheel.Size(), (size_t) 0);
+  }
+
+  void testRescheduleAndCancel() {
+    const time_t start = 5000;
+    CTimingWheel wheel(start);
+    std::vector<cachedObjectId_t> fired;
+    wheel.Schedule(1, start + 10);
+    wheel.Schedule(2, start + 10);
+    wheel.Schedule(3, start - 10);
+    TS_ASSERT_EQUALS(wheel.NextDue(), start + 1);
+
+    // Moving a deadline on, as a touch does, replaces the old one
+    wheel.Schedule(1, start + 100);
+    TS_ASSERT(wheel.Cancel(2));
+    TS_ASSERT(!wheel.Cancel(2));
+    wheel.Advance(start + 99, fired);
+    TS_ASSERT_EQUALS(fired.size(), (size_t) 1);
+    TS_ASSERT_EQUALS(fired[0], (cachedObjectId_t) 3);
+    TS_ASSERT_EQUALS(wheel.Size(), (size_t) 1);
+
+    // A long jump fires whatever is due
+    wheel.Schedule(4, start + 10000000);
+    wheel.Advance(start + 5000000, fired);
+    TS_ASSERT_EQUALS(fired.size(), (size_t) 2);
+    TS_ASSERT_EQUALS(fired[1], (cachedObjectId_t) 1);
+    TS_ASSERT_EQUALS(wheel.Size(), (size_t) 1);
+    TS_ASSERT(wheel.NextDue() <= start + 10000000);
+    wheel.Advance(start + 10000000, fired);
+    TS_ASSERT_EQUALS(fired.size(), (size_t) 3);
+    TS_ASSERT_EQUALS(wheel.Size(), (size_t) 0);
+  }
+};
+
+#endif
@@ -0,0 +1,114 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef __TOUCHRINGTEST_H__
+#define __TOUCHRINGTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "TouchRing.h"
+
+// Lets a test hold a writer between claiming a slot and publishing it
+class CTestTouchRing : public CTouchRing {
+ public:
+  bool Claim(uint32_t& pos) { return CTouchRing::Claim(pos); }
+  bool Publish(uint32_t pos, uint64_t objId) {
+    return CTouchRing::Publish(pos, objId);
+  }
+};
+
+class TouchRingTest : public CxxTest::TestSuite {
+
+ public:
+
+  void testPushAndDrain() {
+    CTouchRing ring;
+    TS_ASSERT(!ring.Push(1));
+    TS_ASSERT(ring.Create(3));
+    TS_ASSERT_EQUALS(ring.GetCapacity(), 4U);
+
+    // Another mapping of the same memory sees the same ring
+    CTouchRing client;
+    TS_ASSERT(client.Attach(ring.GetFd()));
+    TS_ASSERT_EQUALS(client.GetCapacity(), 4U);
+
+    std::vector<uint64_t> objIds;
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 0);
+    for (uint64_t i = 1; i <= 4; ++i) {
+      TS_ASSERT(client.Push(i));
+    }
+    // Full, so this one is dropped and counted
+    TS_ASSERT(!client.Push(5));
+    TS_ASSERT_EQUALS(ring.GetDropped(), 1U);
+
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 3), (size_t) 3);
+    TS_ASSERT(client.Push(6));
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 2);
+    TS_ASSERT_EQUALS(objIds.size(), (size_t) 5);
+    TS_ASSERT_EQUALS(objIds[0], 1U);
+    TS_ASSERT_EQUALS(objIds[3], 4U);
+    TS_ASSERT_EQUALS(objIds[4], 6U);
+
+    // Going round the ring many times keeps the order
+    objIds.clear();
+    for (uint64_t i = 0; i < 100; ++i) {
+      TS_ASSERT(client.Push(i));
+      TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 1);
+      TS_ASSERT_EQUALS(objIds.back(), i);
+    }
+    TS_ASSERT_EQUALS(ring.GetDropped(), 1U);
+
+    client.Close();
+    TS_ASSERT(!client.Push(1));
+    TS_ASSERT(!client.Attach(-1));
+  }
+
+  // A slow writer whose slot the drain skipped is only counted once
+  void testSkippedSlot() {
+    CTouchRing ring;
+    TS_ASSERT(ring.Create(4));
+    CTestTouchRing client;
+    TS_ASSERT(client.Attach(ring.GetFd()));
+
+    uint32_t pos = 0;
+    TS_ASSERT(client.Claim(pos));
+    TS_ASSERT(client.Push(2));
+    std::vector<uint64_t> objIds;
+    // The first drain waits for the writer, the next skips its slot
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 0);
+    TS_ASSERT_EQUALS(ring.GetDropped(), 0U);
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 1);
+    TS_ASSERT_EQUALS(objIds.back(), 2U);
+    TS_ASSERT_EQUALS(ring.GetDropped(), 1U);
+
+    // Too late to publish, and the drop isn't counted again
+    TS_ASSERT(!client.Publish(pos, 1));
+    TS_ASSERT_EQUALS(ring.GetDropped(), 1U);
+
+    // The ring goes on from there
+    objIds.clear();
+    for (uint64_t i = 3; i <= 6; ++i) {
+      TS_ASSERT(client.Push(i));
+    }
+    TS_ASSERT_EQUALS(ring.Drain(objIds, 10), (size_t) 4);
+    TS_ASSERT_EQUALS(objIds.front(), 3U);
+    TS_ASSERT_EQUALS(objIds.back(), 6U);
+    TS_ASSERT_EQUALS(ring.GetDropped(), 1U);
+  }
+};
+
+#endif
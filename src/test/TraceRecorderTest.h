@@ -0,0 +1,140 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __TRACERECORDERTEST_H__
+#define __TRACERECORDERTEST_H__
+
+#include <cxxtest/TestSuite.h>
+#include "TraceRecorder.h"
+#include <fstream>
+#include <vector>
+#include <unistd.h>
+
+static const std::string s_traceTestFile("/tmp/filecache-test.trace");
+
+class TraceRecorderTest : public CxxTest::TestSuite {
+
+ public:
+
+  void setUp() {
+    ::unlink(s_traceTestFile.c_str());
+    ::unlink((s_traceTestFile + ".1").c_str());
+  }
+
+  void tearDown() {
+    setUp();
+  }
+
+  void testRecord() {
+    CTraceRecorder recorder;
+    // Nothing is kept while not recording
+    recorder.Record(TraceTouchCacheObject, 1, "type", 10, 0, 0);
+    TS_ASSERT(!recorder.isRecording());
+
+    TS_ASSERT(recorder.Start(s_traceTestFile, 0));
+    TS_ASSERT(recorder.isRecording());
+    for (uint64_t i = 1; i <= 100; ++i) {
+      recorder.Record(TraceInsertCacheObject, i, "type", (int64_t) i,
+		      CTraceRecorder::Hash("caller"), 0);
+    }
+    // Another thread records into a buffer of its own
+    pthread_t thread;
+    TS_ASSERT_EQUALS(::pthread_create(&thread, NULL, &RecordOther,
+				      &recorder), 0);
+    ::pthread_join(thread, NULL);
+    recorder.Stop();
+    TS_ASSERT(!recorder.isRecording());
+    TS_ASSERT_EQUALS(recorder.GetDropped(), 0U);
+
+    CTraceFileHeader header;
+    std::vector<CTraceRecord> records;
+    TS_ASSERT(ReadTrace(s_traceTestFile, header, records));
+    TS_ASSERT_EQUALS(header.m_magic, s_traceMagic);
+    TS_ASSERT_EQUALS(header.m_recordSize, sizeof(CTraceRecord));
+    TS_ASSERT_EQUALS(records.size(), (size_t) 101);
+
+    size_t inserts = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+      TS_ASSERT_EQUALS(records[i].m_typeId, CTraceRecorder::Hash("type"));
+      if (records[i].m_op == TraceInsertCacheObject) {
+	++inserts;
+	TS_ASSERT_EQUALS((int64_t) records[i].m_objId, records[i].m_size);
+	TS_ASSERT_EQUALS(records[i].m_caller, CTraceRecorder::Hash("caller"));
+      } else {
+	TS_ASSERT_EQUALS(records[i].m_op, TraceObjectExpired);
+	TS_ASSERT_EQUALS(records[i].m_result, 2);
+      }
+    }
+    TS_ASSERT_EQUALS(inserts, (size_t) 100);
+
+    // Starting again adds to the same file
+    TS_ASSERT(recorder.Start(s_traceTestFile, 0));
+    recorder.Record(TraceGetVersion, 0, "", 0, 0, s_traceNoReply);
+    recorder.Stop();
+    TS_ASSERT(ReadTrace(s_traceTestFile, header, records));
+    TS_ASSERT_EQUALS(records.size(), (size_t) 102);
+    TS_ASSERT_EQUALS(records.back().m_typeId, 0U);
+    TS_ASSERT_EQUALS(records.back().m_result, s_traceNoReply);
+  }
+
+  void testDropAndRotate() {
+    CTraceRecorder recorder;
+    // Small enough that every flush rotates the file
+    TS_ASSERT(recorder.Start(s_traceTestFile, 1));
+    for (uint32_t i = 0; i < s_traceBufferRecords + 10; ++i) {
+      recorder.Record(TraceTouchCacheObject, i, "type", 0, 0, 0);
+    }
+    recorder.Stop();
+    TS_ASSERT(recorder.GetDropped() > 0U);
+    TS_ASSERT(recorder.GetDropped() <= 10U);
+
+    CTraceFileHeader header;
+    std::vector<CTraceRecord> records;
+    TS_ASSERT(ReadTrace(s_traceTestFile + ".1", header, records));
+    TS_ASSERT(ReadTrace(s_traceTestFile, header, records));
+
+    // A file that can't be opened isn't recorded to
+    TS_ASSERT(!recorder.Start("/nonexistent/filecache.trace", 0));
+    TS_ASSERT(!recorder.isRecording());
+  }
+
+ private:
+
+  static void* RecordOther(void* data) {
+    static_cast<CTraceRecorder*>(data)->Record(TraceObjectExpired, 7, "type",
+					       0, 0, 2);
+    return NULL;
+  }
+
+  static bool ReadTrace(const std::string& pathname, CTraceFileHeader& header,
+			std::vector<CTraceRecord>& records) {
+    records.clear();
+    std::ifstream infile(pathname.c_str(), std::ios::binary);
+    if (!infile.read((char*) &header, sizeof(header))) {
+      return false;
+    }
+    CTraceRecord rec;
+    while (infile.read((char*) &rec, sizeof(rec))) {
+      records.push_back(rec);
+    }
+
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,512 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+// Times the cache engine's operations on caches holding different
+// numbers of objects spread over different numbers of types.  The
+// engine is driven directly, without the bus, and the filesystem work
+// is done inline, so the times include the file creates, attribute
+// writes and removes.  The scratch directory should be on a tmpfs to
+// keep the storage device out of the results.
+//
+// For every combination of object and type counts a cache set is
+// filled with that many objects, which is reported as "populate", and
+// then each operation is run a fixed number of times on randomly
+// chosen objects:
+//
+//   insert      InsertCacheObject of a new object
+//   resize      Resize of a new object while it is being written
+//   subscribe   SubscribeCacheObject and UnSubscribeCacheObject
+//   touch       Touch
+//   status      GetCacheStatus
+//   cleanup     one CleanupAllTypes call, counted per object freed
+//   expire      ExpireCacheObject
+//
+// Each result is printed as a line of JSON, for example
+//
+//   {"bench":"touch","objects":1000,"types":10,"ops":1000,"failed":0,
+//    "seconds":0.001234,"nsPerOp":1234}
+//
+// so runs can be compared by script.
+//
+// Every object is accounted for as at least two filesystem blocks and
+// a cache set can account for less than 2 GiB, so a million objects
+// can't be cached at once.  Combinations that don't fit are skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "core/MojLogEngine.h"
+#include "FileCacheSet.h"
+#include "TestObjects.h"
+
+namespace fs = boost::filesystem;
+
+// Counts the objects the cache set evicts to make room
+class CBenchListener : public CFileCacheListener {
+ public:
+  CBenchListener() : m_evicted(0) {}
+
+  void ObjectExpired(const std::string& typeName,
+		     const cachedObjectId_t objId,
+		     const std::string& filename, ExpireReason reason) {
+    if (reason == ExpireCapacity) {
+      m_evicted++;
+    }
+  }
+  void TypeModified(const std::string& typeName, TypeChange change) {}
+  void ObjectCreated(const std::string& typeName,
+		     const cachedObjectId_t objId, bool created) {}
+  void ObjectOpened(const std::string& typeName,
+		    const cachedObjectId_t objId, bool opened) {}
+  void ObjectWritten(const std::string& typeName,
+		     const cachedObjectId_t objId, bool written) {}
+  void ObjectOrphaned(const std::string& typeName,
+		      const cachedObjectId_t objId) {}
+  void AgingScheduled(time_t due) {}
+  void ThresholdCrossed(const std::string& typeName,
+			CacheThreshold threshold, bool above,
+			cacheSize_t size) {}
+
+  uint64_t m_evicted;
+};
+
+static double
+Now() {
+
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (double) now.tv_sec + (double) now.tv_nsec / 1000000000.0;
+}
+
+static void
+Report(const char* bench, uint64_t numObjects, int numTypes, uint64_t ops,
+       uint64_t failed, double seconds) {
+
+  printf("{\"bench\":\"%s\",\"objects\":%llu,\"types\":%d,\"ops\":%llu,"
+	 "\"failed\":%llu,\"seconds\":%.6f,\"nsPerOp\":%.0f}\n", bench,
+	 (unsigned long long) numObjects, numTypes, (unsigned long long) ops,
+	 (unsigned long long) failed, seconds,
+	 (ops > 0) ? seconds * 1000000000.0 / (double) ops : 0.0);
+  fflush(stdout);
+}
+
+static void
+Usage() {
+
+  fprintf(stderr,
+	  "Usage: filecache-bench [-o objects,...] [-y types,...] [-n ops]\n"
+	  "                       [-S size] [-d dir] [-s seed]\n");
+  exit(1);
+}
+
+// Parse a comma separated list of positive numbers
+static bool
+ParseList(const char* value, std::vector<uint64_t>& list) {
+
+  list.clear();
+  std::stringstream values(value);
+  std::string field;
+  while (std::getline(values, field, ',')) {
+    char* end = NULL;
+    const unsigned long long n = ::strtoull(field.c_str(), &end, 10);
+    if ((end == field.c_str()) || (*end != '\0') || (n == 0)) {
+      return false;
+    }
+    list.push_back(n);
+  }
+
+  return !list.empty();
+}
+
+class CBench {
+ public:
+  CBench(const std::string& dirName, uint64_t numObjects, int numTypes,
+	 uint64_t numOps, cacheSize_t size)
+    : m_cacheSet(s_benchCacheSpace, dirName), m_numObjects(numObjects),
+      m_numTypes(numTypes), m_numOps(numOps), m_size(size), m_next(0) {
+    m_cacheSet.AddListener(&m_listener);
+  }
+  ~CBench() {
+    m_cacheSet.RemoveListener(&m_listener);
+  }
+
+  // Whether the objects fit in the most space a cache set can
+  // account for
+  static bool Fits(uint64_t numObjects, int numTypes, uint64_t numOps,
+		   cacheSize_t size) {
+    return (numObjects + numOps + 2 * (uint64_t) numTypes) *
+      (uint64_t) GetFilesystemFileSize(size) <= (uint64_t) s_benchCacheSpace;
+  }
+
+  bool Run();
+
+ private:
+  // The most the cache set is told it may use
+  static const cacheSize_t s_benchCacheSpace = 0x7fffffff;
+
+  bool DefineTypes();
+  void Populate();
+  void BenchInsert();
+  void BenchSubscribe();
+  void BenchTouch();
+  void BenchStatus();
+  void BenchCleanup();
+  void BenchExpire();
+
+  // Insert an object into the next type in turn
+  cachedObjectId_t Insert() {
+    std::string msgText;
+    return m_cacheSet.InsertCacheObject(msgText, m_typeNames[m_next++ %
+							   m_typeNames.size()],
+					"bench.dat", m_size);
+  }
+
+  // Write an object as its writer would, which completes it
+  bool Write(const cachedObjectId_t objId) {
+    std::string msgText;
+    if (m_cacheSet.SubscribeCacheObject(msgText, objId).empty()) {
+      return false;
+    }
+    m_cacheSet.UnSubscribeCacheObject(m_cacheSet.GetTypeForObjectId(objId),
+				      objId);
+    return true;
+  }
+
+  cachedObjectId_t Pick() {
+    return m_objIds[(size_t) (::drand48() * (double) m_objIds.size())];
+  }
+
+  void Report(const char* bench, uint64_t ops, uint64_t failed,
+	      double seconds) {
+    ::Report(bench, m_numObjects, m_numTypes, ops, failed, seconds);
+  }
+
+  CStressFileCacheSet m_cacheSet;
+  CBenchListener m_listener;
+  const uint64_t m_numObjects;
+  const int m_numTypes;
+  const uint64_t m_numOps;
+  const cacheSize_t m_size;
+  std::vector<std::string> m_typeNames;
+  // The objects in the cache, as far as the benchmarks know
+  std::vector<cachedObjectId_t> m_objIds;
+  uint64_t m_next;
+};
+
+bool
+CBench::Run() {
+
+  if (!DefineTypes()) {
+    return false;
+  }
+  Populate();
+  if (m_objIds.empty()) {
+    fprintf(stderr, "No objects could be inserted\n");
+    return false;
+  }
+  BenchInsert();
+  BenchSubscribe();
+  BenchTouch();
+  BenchStatus();
+  BenchCleanup();
+  BenchExpire();
+
+  return true;
+}
+
+// Every type has room for its share of the objects and of the ones
+// the benchmarks add, with a loWatermark of half of that so the cleanup
+// has something to free
+bool
+CBench::DefineTypes() {
+
+  const cacheSize_t perType = (cacheSize_t)
+    (((m_numObjects + m_numOps) / (uint64_t) m_numTypes + 2) *
+     (uint64_t) GetFilesystemFileSize(m_size));
+  CCacheParamValues params(perType / 2, perType, m_size, 0, 0, 0);
+  for (int i = 0; i < m_numTypes; i++) {
+    std::stringstream typeName;
+    typeName << "bench" << i;
+    std::string msgText;
+    if (!m_cacheSet.DefineType(msgText, typeName.str(), &params)) {
+      fprintf(stderr, "%s\n", msgText.c_str());
+      return false;
+    }
+    m_typeNames.push_back(typeName.str());
+  }
+
+  return true;
+}
+
+// Fill the cache.  This is done in one snapshot batch, otherwise
+// large caches would take far too long to set up.
+void
+CBench::Populate() {
+
+  uint64_t failed = 0;
+  const double start = Now();
+  {
+    CSnapshotBatch batch(&m_cacheSet);
+    for (uint64_t i = 0; i < m_numObjects; i++) {
+      const cachedObjectId_t objId = Insert();
+      if ((objId > 0) && Write(objId)) {
+	m_objIds.push_back(objId);
+      } else {
+	failed++;
+      }
+    }
+  }
+  Report("populate", m_numObjects, failed, Now() - start);
+}
+
+// Insert new objects, then resize them while they are being written
+// as a client writing a file of unknown length would
+void
+CBench::BenchInsert() {
+
+  std::vector<cachedObjectId_t> inserted;
+  uint64_t failed = 0;
+  double start = Now();
+  for (uint64_t i = 0; i < m_numOps; i++) {
+    const cachedObjectId_t objId = Insert();
+    if (objId > 0) {
+      inserted.push_back(objId);
+    } else {
+      failed++;
+    }
+  }
+  Report("insert", m_numOps, failed, Now() - start);
+
+  std::string msgText;
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = inserted.begin(); iter != inserted.end(); ++iter) {
+    m_cacheSet.SubscribeCacheObject(msgText, *iter);
+  }
+  failed = 0;
+  start = Now();
+  for (iter = inserted.begin(); iter != inserted.end(); ++iter) {
+    if (m_cacheSet.Resize(*iter, m_size / 2) != m_size / 2) {
+      failed++;
+    }
+  }
+  Report("resize", inserted.size(), failed, Now() - start);
+  for (iter = inserted.begin(); iter != inserted.end(); ++iter) {
+    m_cacheSet.UnSubscribeCacheObject(m_cacheSet.GetTypeForObjectId(*iter),
+				      *iter);
+    m_objIds.push_back(*iter);
+  }
+}
+
+void
+CBench::BenchSubscribe() {
+
+  std::vector<cachedObjectId_t> picked;
+  for (uint64_t i = 0; i < m_numOps; i++) {
+    picked.push_back(Pick());
+  }
+  uint64_t failed = 0;
+  std::string msgText;
+  const double start = Now();
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = picked.begin(); iter != picked.end(); ++iter) {
+    if (m_cacheSet.SubscribeCacheObject(msgText, *iter).empty()) {
+      failed++;
+    } else {
+      m_cacheSet.UnSubscribeCacheObject(m_cacheSet.GetTypeForObjectId(*iter),
+					*iter);
+    }
+  }
+  Report("subscribe", picked.size(), failed, Now() - start);
+}
+
+void
+CBench::BenchTouch() {
+
+  std::vector<cachedObjectId_t> picked;
+  for (uint64_t i = 0; i < m_numOps; i++) {
+    picked.push_back(Pick());
+  }
+  uint64_t failed = 0;
+  const double start = Now();
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = picked.begin(); iter != picked.end(); ++iter) {
+    if (!m_cacheSet.Touch(*iter)) {
+      failed++;
+    }
+  }
+  Report("touch", picked.size(), failed, Now() - start);
+}
+
+void
+CBench::BenchStatus() {
+
+  cacheSize_t size = 0;
+  paramValue_t numObjects = 0;
+  cacheSize_t space = 0;
+  const double start = Now();
+  for (uint64_t i = 0; i < m_numOps; i++) {
+    m_cacheSet.GetCacheStatus(&size, &numObjects, &space);
+  }
+  Report("status", m_numOps, 0, Now() - start);
+}
+
+// Ask for the space of up to numOps objects, or half the cache if
+// that is less
+void
+CBench::BenchCleanup() {
+
+  uint64_t count = m_numOps;
+  if (count > m_objIds.size() / 2) {
+    count = m_objIds.size() / 2;
+  }
+  const uint64_t evicted = m_listener.m_evicted;
+  const double start = Now();
+  m_cacheSet.CleanupAllTypes((cacheSize_t)
+			     (count * (uint64_t) GetFilesystemFileSize(m_size)));
+  const double elapsed = Now() - start;
+  Report("cleanup", m_listener.m_evicted - evicted, 0, elapsed);
+
+  // Forget the objects that were freed
+  std::vector<cachedObjectId_t> remaining;
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = m_objIds.begin(); iter != m_objIds.end(); ++iter) {
+    if (m_cacheSet.CachedObjectSize(*iter) >= 0) {
+      remaining.push_back(*iter);
+    }
+  }
+  m_objIds.swap(remaining);
+}
+
+void
+CBench::BenchExpire() {
+
+  // Each object can only be expired once
+  std::vector<cachedObjectId_t> picked;
+  for (uint64_t i = 0; (i < m_numOps) && !m_objIds.empty(); i++) {
+    const size_t index = (size_t) (::drand48() * (double) m_objIds.size());
+    picked.push_back(m_objIds[index]);
+    m_objIds[index] = m_objIds.back();
+    m_objIds.pop_back();
+  }
+  uint64_t failed = 0;
+  const double start = Now();
+  std::vector<cachedObjectId_t>::const_iterator iter;
+  for (iter = picked.begin(); iter != picked.end(); ++iter) {
+    if (!m_cacheSet.ExpireCacheObject(*iter)) {
+      failed++;
+    }
+  }
+  Report("expire", picked.size(), failed, Now() - start);
+}
+
+int
+main(int argc, char* argv[]) {
+
+  std::vector<uint64_t> objectCounts;
+  std::vector<uint64_t> typeCounts;
+  ParseList("1000,10000,100000", objectCounts);
+  ParseList("1,10,100,500", typeCounts);
+  uint64_t numOps = 1000;
+  cacheSize_t size = 512;
+  std::string parentDir("/tmp");
+  long seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string thisArg(argv[i]);
+    if (i + 1 >= argc) {
+      Usage();
+    }
+    const char* value = argv[++i];
+    if (thisArg == "-o") {
+      if (!ParseList(value, objectCounts)) {
+	Usage();
+      }
+    } else if (thisArg == "-y") {
+      if (!ParseList(value, typeCounts)) {
+	Usage();
+      }
+    } else if (thisArg == "-n") {
+      numOps = ::strtoull(value, NULL, 10);
+    } else if (thisArg == "-S") {
+      size = (cacheSize_t) ::strtol(value, NULL, 10);
+    } else if (thisArg == "-d") {
+      parentDir = value;
+    } else if (thisArg == "-s") {
+      seed = ::strtol(value, NULL, 10);
+    } else {
+      Usage();
+    }
+  }
+  if ((numOps == 0) || (size <= 0)) {
+    Usage();
+  }
+
+  // The engine logs every operation, which would be timed as well
+  MojLogEngine::instance()->reset(MojLogger::LevelError);
+
+  const std::string dirTemplate(parentDir + "/filecache-bench.XXXXXX");
+  std::vector<char> dirName(dirTemplate.begin(), dirTemplate.end());
+  dirName.push_back('\0');
+  if (::mkdtemp(&dirName[0]) == NULL) {
+    fprintf(stderr, "Failed to create a scratch directory in '%s'\n",
+	    parentDir.c_str());
+    return 1;
+  }
+  const std::string scratchDir(&dirName[0]);
+
+  int retVal = 0;
+  std::vector<uint64_t>::const_iterator objects;
+  std::vector<uint64_t>::const_iterator types;
+  for (objects = objectCounts.begin();
+       (objects != objectCounts.end()) && (retVal == 0); ++objects) {
+    for (types = typeCounts.begin();
+	 (types != typeCounts.end()) && (retVal == 0); ++types) {
+      if (*types > *objects) {
+	continue;
+      }
+      if (!CBench::Fits(*objects, (int) *types, numOps, size)) {
+	fprintf(stderr, "Skipping %llu objects in %llu types, they don't fit in a cache set\n",
+		(unsigned long long) *objects, (unsigned long long) *types);
+	continue;
+      }
+      std::stringstream runDir;
+      runDir << scratchDir << "/o" << *objects << "-t" << *types;
+      boost::system::error_code error;
+      fs::create_directories(runDir.str(), error);
+      ::srand48(seed);
+      {
+	CBench bench(runDir.str(), *objects, (int) *types, numOps, size);
+	if (!bench.Run()) {
+	  retVal = 1;
+	}
+      }
+      fs::remove_all(runDir.str(), error);
+    }
+  }
+  boost::system::error_code error;
+  fs::remove_all(scratchDir, error);
+
+  return retVal;
+}
@@ -0,0 +1,587 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+// Replays an access trace against the real cache engine with the
+// filesystem and the clock simulated, and reports how well the types
+// would have done.  Nothing is written for the objects so a trace
+// runs as fast as the engine can account for it, which makes it
+// practical to try a trace against many watermark and cost settings.
+//
+// A trace is a text file with one event per line:
+//
+//   type <name> <loWatermark> <hiWatermark> [size [cost [lifetime [maxAge]]]]
+//   <seconds> get <type> <key> <size>
+//   <seconds> insert <type> <key> <size>
+//   <seconds> touch <type> <key>
+//   <seconds> expire <type> <key>
+//
+// A get is a client looking for an object by its key and writing it
+// if it isn't cached, an insert writes a new object for the key
+// whether or not there is one already.  Lines starting with '#' are
+// ignored.  The times are in seconds from any starting point and
+// must not go backwards.  Types given with -t are defined before the
+// trace is read and a type line for one of them is ignored, so the
+// settings in a trace can be overridden from the command line.
+//
+// With -z no trace is read and the events are generated instead:
+// gets of keys whose popularity follows a Zipf distribution.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "core/MojLogEngine.h"
+#include "FileCacheSet.h"
+
+namespace fs = boost::filesystem;
+
+// Runs the cache engine with every filesystem job taken as having
+// succeeded and with time only moving on as the trace says
+class CSimFileCacheSet : public CFileCacheSet {
+ public:
+  CSimFileCacheSet(const std::string& dirName, cacheSize_t cacheSpace)
+    : CFileCacheSet(false)
+    , m_dirName(dirName)
+    , m_cacheSpace(cacheSpace)
+    , m_now(::time(0))
+    , m_nextId(1) {
+  }
+
+  std::string& GetBaseDirName() { return m_dirName; }
+  cacheSize_t TotalCacheSpace() { return m_cacheSpace; }
+
+  void SubmitIO(CIOJob* job) {
+    job->Simulate();
+    job->Complete();
+    delete job;
+  }
+  time_t Now() { return m_now; }
+
+  // Nothing here reads the snapshot, so it isn't worth rebuilding
+  // after every event
+  void PublishSnapshot() {}
+
+  void SetNow(time_t now) { m_now = now; }
+
+ protected:
+  cachedObjectId_t GetNextCachedObjectId() { return m_nextId++; }
+
+ private:
+  std::string m_dirName;
+  cacheSize_t m_cacheSpace;
+  time_t m_now;
+  cachedObjectId_t m_nextId;
+};
+
+// What happened to one type over the run
+struct CSimTypeStats {
+  CSimTypeStats() : m_gets(0), m_hits(0), m_getBytes(0), m_hitBytes(0),
+		    m_writes(0), m_writtenBytes(0), m_failedWrites(0),
+		    m_evicted(0), m_evictedBytes(0), m_aged(0) {}
+
+  uint64_t m_gets;
+  uint64_t m_hits;
+  uint64_t m_getBytes;
+  uint64_t m_hitBytes;
+  uint64_t m_writes;
+  uint64_t m_writtenBytes;
+  uint64_t m_failedWrites;
+  uint64_t m_evicted;
+  uint64_t m_evictedBytes;
+  uint64_t m_aged;
+};
+
+typedef std::map<std::string, CSimTypeStats> TypeStatsMap;
+
+// Counts the objects that leave the cache by the reason they went
+class CSimListener : public CFileCacheListener {
+ public:
+  CSimListener(TypeStatsMap& stats) : m_stats(stats) {}
+
+  void ObjectExpired(const std::string& typeName,
+		     const cachedObjectId_t objId,
+		     const std::string& filename, ExpireReason reason) {
+    CSimTypeStats& stats = m_stats[typeName];
+    if (reason == ExpireCapacity) {
+      stats.m_evicted++;
+      stats.m_evictedBytes += GetSize(objId);
+    } else if (reason == ExpireAged) {
+      stats.m_aged++;
+    }
+    m_sizes.erase(objId);
+  }
+  void TypeModified(const std::string& typeName, TypeChange change) {}
+  void ObjectCreated(const std::string& typeName,
+		     const cachedObjectId_t objId, bool created) {}
+  void ObjectOpened(const std::string& typeName,
+		    const cachedObjectId_t objId, bool opened) {}
+  void ObjectWritten(const std::string& typeName,
+		     const cachedObjectId_t objId, bool written) {}
+  void ObjectOrphaned(const std::string& typeName,
+		      const cachedObjectId_t objId) {}
+  void AgingScheduled(time_t due) {}
+  void ThresholdCrossed(const std::string& typeName,
+			CacheThreshold threshold, bool above,
+			cacheSize_t size) {}
+
+  void ObjectInserted(const cachedObjectId_t objId, cacheSize_t size) {
+    m_sizes[objId] = size;
+  }
+
+  cacheSize_t GetSize(const cachedObjectId_t objId) {
+    std::map<cachedObjectId_t, cacheSize_t>::const_iterator iter =
+      m_sizes.find(objId);
+    return (iter != m_sizes.end()) ? iter->second : 0;
+  }
+
+ private:
+  TypeStatsMap& m_stats;
+  std::map<cachedObjectId_t, cacheSize_t> m_sizes;
+};
+
+static double
+WallTime() {
+
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+static void
+Usage() {
+
+  fprintf(stderr,
+	  "Usage: filecachesim [-c totalspace] [-t name:lo:hi[:size[:cost[:lifetime[:maxAge]]]]]...\n"
+	  "                    (-f tracefile | -z keys [-n events] [-a alpha]\n"
+	  "                     [-r rate] [-S size] [-T type] [-s seed])\n");
+  exit(1);
+}
+
+// Parse name:lo:hi[:size[:cost[:lifetime[:maxAge]]]]
+static bool
+ParseType(const std::string& spec, std::string& typeName,
+	  CCacheParamValues& params) {
+
+  std::vector<std::string> fields;
+  std::string::size_type start = 0;
+  for (;;) {
+    std::string::size_type colon = spec.find(':', start);
+    fields.push_back(spec.substr(start, colon - start));
+    if (colon == std::string::npos) {
+      break;
+    }
+    start = colon + 1;
+  }
+  if ((fields.size() < 3) || (fields.size() > 7) || fields[0].empty()) {
+    return false;
+  }
+  long long values[6] = { 0, 0, 0, 0, 0, 0 };
+  for (size_t i = 1; i < fields.size(); i++) {
+    char* end = NULL;
+    values[i - 1] = ::strtoll(fields[i].c_str(), &end, 10);
+    if ((end == fields[i].c_str()) || (*end != '\0') || (values[i - 1] < 0)) {
+      return false;
+    }
+  }
+  typeName = fields[0];
+  params = CCacheParamValues((cacheSize_t) values[0], (cacheSize_t) values[1],
+			     (cacheSize_t) values[2], (paramValue_t) values[3],
+			     (paramValue_t) values[4],
+			     (paramValue_t) values[5]);
+
+  return true;
+}
+
+class CSimulator {
+ public:
+  CSimulator(CSimFileCacheSet& cacheSet)
+    : m_cacheSet(cacheSet), m_listener(m_stats), m_start(cacheSet.Now()),
+      m_first(-1), m_events(0), m_badLines(0) {
+    m_cacheSet.AddListener(&m_listener);
+  }
+  ~CSimulator() {
+    m_cacheSet.RemoveListener(&m_listener);
+  }
+
+  bool DefineType(const std::string& typeName, CCacheParamValues& params) {
+    std::string msgText;
+    if (!m_cacheSet.DefineType(msgText, typeName, &params)) {
+      fprintf(stderr, "%s\n", msgText.c_str());
+      return false;
+    }
+    m_stats[typeName];
+
+    return true;
+  }
+
+  // Move the clock on to the time of the next event, expiring the
+  // objects that have reached their maximum age on the way
+  void SetTime(double seconds) {
+    if (m_first < 0) {
+      m_first = seconds;
+    }
+    const time_t now = m_start + (time_t) (seconds - m_first);
+    if (now > m_cacheSet.Now()) {
+      m_cacheSet.SetNow(now);
+      m_cacheSet.ExpireAgedObjects(now);
+    }
+  }
+
+  void Get(const std::string& typeName, const std::string& key,
+	   cacheSize_t size) {
+    CSimTypeStats& stats = m_stats[typeName];
+    stats.m_gets++;
+    stats.m_getBytes += size;
+    const cachedObjectId_t objId =
+      m_cacheSet.FindCacheObjectByKey(typeName, key);
+    if (objId != 0) {
+      std::string msgText;
+      if (!m_cacheSet.SubscribeCacheObject(msgText, objId).empty()) {
+	stats.m_hits++;
+	stats.m_hitBytes += m_listener.GetSize(objId);
+	m_cacheSet.UnSubscribeCacheObject(typeName, objId);
+	return;
+      }
+    }
+    Write(typeName, key, size);
+  }
+
+  void Insert(const std::string& typeName, const std::string& key,
+	      cacheSize_t size) {
+    const cachedObjectId_t objId =
+      m_cacheSet.FindCacheObjectByKey(typeName, key);
+    if (objId != 0) {
+      m_cacheSet.ExpireCacheObject(objId);
+    }
+    Write(typeName, key, size);
+  }
+
+  void Touch(const std::string& typeName, const std::string& key) {
+    const cachedObjectId_t objId =
+      m_cacheSet.FindCacheObjectByKey(typeName, key);
+    if (objId != 0) {
+      m_cacheSet.Touch(objId);
+    }
+  }
+
+  void Expire(const std::string& typeName, const std::string& key) {
+    const cachedObjectId_t objId =
+      m_cacheSet.FindCacheObjectByKey(typeName, key);
+    if (objId != 0) {
+      m_cacheSet.ExpireCacheObject(objId);
+    }
+  }
+
+  bool ReadTrace(FILE* trace, const std::set<std::string>& fixedTypes);
+  void Generate(const std::string& typeName, uint64_t numKeys,
+		uint64_t numEvents, double alpha, double rate,
+		cacheSize_t size);
+  void Report(double elapsed);
+
+ private:
+  // A writer inserts the object, subscribes to write it and lets go
+  // once it is written, as a client would
+  void Write(const std::string& typeName, const std::string& key,
+	     cacheSize_t size) {
+    CSimTypeStats& stats = m_stats[typeName];
+    std::string msgText;
+    bool inserted = false;
+    const cachedObjectId_t objId =
+      m_cacheSet.LookupOrInsertCacheObject(msgText, typeName, key, key,
+					   size, 0, 0, inserted);
+    if ((objId == 0) || !inserted ||
+	m_cacheSet.SubscribeCacheObject(msgText, objId).empty()) {
+      stats.m_failedWrites++;
+      return;
+    }
+    m_listener.ObjectInserted(objId, size);
+    m_cacheSet.UnSubscribeCacheObject(typeName, objId);
+    stats.m_writes++;
+    stats.m_writtenBytes += size;
+  }
+
+  CSimFileCacheSet& m_cacheSet;
+  TypeStatsMap m_stats;
+  CSimListener m_listener;
+  const time_t m_start;
+  double m_first;
+  uint64_t m_events;
+  uint64_t m_badLines;
+};
+
+bool
+CSimulator::ReadTrace(FILE* trace, const std::set<std::string>& fixedTypes) {
+
+  char line[2048];
+  char op[32];
+  char typeName[256];
+  char key[1024];
+  while (::fgets(line, sizeof(line), trace) != NULL) {
+    if ((line[0] == '#') || (line[0] == '\n')) {
+      continue;
+    }
+    if (::strncmp(line, "type ", 5) == 0) {
+      long long values[6] = { 0, 0, 0, 0, 0, 0 };
+      int fields = ::sscanf(line + 5, "%255s %lld %lld %lld %lld %lld %lld",
+			    typeName, &values[0], &values[1], &values[2],
+			    &values[3], &values[4], &values[5]);
+      if (fields < 3) {
+	m_badLines++;
+	continue;
+      }
+      if (fixedTypes.find(typeName) == fixedTypes.end()) {
+	CCacheParamValues params((cacheSize_t) values[0],
+				 (cacheSize_t) values[1],
+				 (cacheSize_t) values[2],
+				 (paramValue_t) values[3],
+				 (paramValue_t) values[4],
+				 (paramValue_t) values[5]);
+	if (!DefineType(typeName, params)) {
+	  return false;
+	}
+      }
+      continue;
+    }
+
+    double seconds = 0;
+    long long size = 0;
+    int fields = ::sscanf(line, "%lf %31s %255s %1023s %lld", &seconds, op,
+			  typeName, key, &size);
+    if (fields < 4) {
+      m_badLines++;
+      continue;
+    }
+    SetTime(seconds);
+    m_events++;
+    if ((::strcmp(op, "get") == 0) && (fields == 5)) {
+      Get(typeName, key, (cacheSize_t) size);
+    } else if ((::strcmp(op, "insert") == 0) && (fields == 5)) {
+      Insert(typeName, key, (cacheSize_t) size);
+    } else if (::strcmp(op, "touch") == 0) {
+      Touch(typeName, key);
+    } else if (::strcmp(op, "expire") == 0) {
+      Expire(typeName, key);
+    } else {
+      m_events--;
+      m_badLines++;
+    }
+  }
+
+  return true;
+}
+
+// Generate gets of numKeys keys, the nth most popular of which is
+// asked for in proportion to 1/n^alpha, at rate events a second.
+// The sizes vary between half and one and a half times size.
+void
+CSimulator::Generate(const std::string& typeName, uint64_t numKeys,
+		     uint64_t numEvents, double alpha, double rate,
+		     cacheSize_t size) {
+
+  std::vector<double> cdf(numKeys);
+  double sum = 0;
+  for (uint64_t i = 0; i < numKeys; i++) {
+    sum += 1.0 / ::pow((double) (i + 1), alpha);
+    cdf[i] = sum;
+  }
+  char key[32];
+  for (uint64_t i = 0; i < numEvents; i++) {
+    const double target = ::drand48() * sum;
+    const uint64_t rank = (uint64_t)
+      (std::lower_bound(cdf.begin(), cdf.end(), target) - cdf.begin());
+    ::snprintf(key, sizeof(key), "k%llu", (unsigned long long) rank);
+    const cacheSize_t keySize = size / 2 +
+      (cacheSize_t) ((rank * 2654435761ULL) % (uint64_t) (size + 1));
+    SetTime((double) i / rate);
+    m_events++;
+    Get(typeName, key, keySize);
+  }
+}
+
+void
+CSimulator::Report(double elapsed) {
+
+  printf("%-16s %10s %10s %7s %7s %10s %14s %10s %8s %8s\n", "type", "gets",
+	 "hits", "hit%", "bytehit%", "writes", "written", "evicted", "aged",
+	 "failed");
+  CSimTypeStats total;
+  TypeStatsMap::const_iterator iter;
+  for (iter = m_stats.begin(); iter != m_stats.end(); ++iter) {
+    const CSimTypeStats& stats = iter->second;
+    printf("%-16s %10llu %10llu %7.2f %7.2f %10llu %14llu %10llu %8llu %8llu\n",
+	   iter->first.c_str(), (unsigned long long) stats.m_gets,
+	   (unsigned long long) stats.m_hits,
+	   stats.m_gets ? 100.0 * stats.m_hits / stats.m_gets : 0.0,
+	   stats.m_getBytes ? 100.0 * stats.m_hitBytes / stats.m_getBytes : 0.0,
+	   (unsigned long long) stats.m_writes,
+	   (unsigned long long) stats.m_writtenBytes,
+	   (unsigned long long) stats.m_evicted,
+	   (unsigned long long) stats.m_aged,
+	   (unsigned long long) stats.m_failedWrites);
+    total.m_gets += stats.m_gets;
+    total.m_hits += stats.m_hits;
+    total.m_getBytes += stats.m_getBytes;
+    total.m_hitBytes += stats.m_hitBytes;
+    total.m_writes += stats.m_writes;
+    total.m_writtenBytes += stats.m_writtenBytes;
+    total.m_evicted += stats.m_evicted;
+    total.m_aged += stats.m_aged;
+    total.m_failedWrites += stats.m_failedWrites;
+  }
+  printf("%-16s %10llu %10llu %7.2f %7.2f %10llu %14llu %10llu %8llu %8llu\n",
+	 "total", (unsigned long long) total.m_gets,
+	 (unsigned long long) total.m_hits,
+	 total.m_gets ? 100.0 * total.m_hits / total.m_gets : 0.0,
+	 total.m_getBytes ? 100.0 * total.m_hitBytes / total.m_getBytes : 0.0,
+	 (unsigned long long) total.m_writes,
+	 (unsigned long long) total.m_writtenBytes,
+	 (unsigned long long) total.m_evicted,
+	 (unsigned long long) total.m_aged,
+	 (unsigned long long) total.m_failedWrites);
+  printf("%llu events in %.3f s (%.0f events/s), %llu lines skipped\n",
+	 (unsigned long long) m_events, elapsed,
+	 (elapsed > 0) ? (double) m_events / elapsed : 0.0,
+	 (unsigned long long) m_badLines);
+}
+
+int
+main(int argc, char* argv[]) {
+
+  cacheSize_t cacheSpace = 1024 * 1024 * 1024;
+  std::vector<std::string> typeSpecs;
+  std::string traceFile;
+  std::string genType;
+  uint64_t numKeys = 0;
+  uint64_t numEvents = 1000000;
+  double alpha = 0.8;
+  double rate = 100;
+  cacheSize_t size = 64 * 1024;
+  long seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string thisArg(argv[i]);
+    if (i + 1 >= argc) {
+      Usage();
+    }
+    const char* value = argv[++i];
+    if (thisArg == "-c") {
+      cacheSpace = (cacheSize_t) ::strtoll(value, NULL, 10);
+    } else if (thisArg == "-t") {
+      typeSpecs.push_back(value);
+    } else if (thisArg == "-f") {
+      traceFile = value;
+    } else if (thisArg == "-z") {
+      numKeys = ::strtoull(value, NULL, 10);
+    } else if (thisArg == "-n") {
+      numEvents = ::strtoull(value, NULL, 10);
+    } else if (thisArg == "-a") {
+      alpha = ::strtod(value, NULL);
+    } else if (thisArg == "-r") {
+      rate = ::strtod(value, NULL);
+    } else if (thisArg == "-S") {
+      size = (cacheSize_t) ::strtoll(value, NULL, 10);
+    } else if (thisArg == "-T") {
+      genType = value;
+    } else if (thisArg == "-s") {
+      seed = ::strtol(value, NULL, 10);
+    } else {
+      Usage();
+    }
+  }
+  if ((traceFile.empty() == (numKeys == 0)) || (cacheSpace <= 0) ||
+      (rate <= 0) || (size <= 0)) {
+    Usage();
+  }
+
+  // The engine logs every operation, which would swamp the run
+  MojLogEngine::instance()->reset(MojLogger::LevelError);
+
+  // Only the type configurations are written, to a scratch directory
+  char dirTemplate[] = "/tmp/filecachesim.XXXXXX";
+  if (::mkdtemp(dirTemplate) == NULL) {
+    fprintf(stderr, "Failed to create a scratch directory\n");
+    return 1;
+  }
+  const std::string dirName(dirTemplate);
+  int retVal = 0;
+  {
+    CSimFileCacheSet cacheSet(dirName, cacheSpace);
+    CSimulator sim(cacheSet);
+    std::set<std::string> fixedTypes;
+    std::vector<std::string>::const_iterator iter;
+    for (iter = typeSpecs.begin(); iter != typeSpecs.end(); ++iter) {
+      std::string typeName;
+      CCacheParamValues params;
+      if (!ParseType(*iter, typeName, params)) {
+	fprintf(stderr, "Invalid type '%s'\n", iter->c_str());
+	Usage();
+      }
+      if (!sim.DefineType(typeName, params)) {
+	retVal = 1;
+      }
+      fixedTypes.insert(typeName);
+      if (genType.empty()) {
+	genType = typeName;
+      }
+    }
+
+    const double start = WallTime();
+    if (retVal != 0) {
+      // A type couldn't be defined
+    } else if (numKeys > 0) {
+      if (genType.empty()) {
+	fprintf(stderr, "A type is needed to generate events\n");
+	retVal = 1;
+      } else {
+	::srand48(seed);
+	sim.Generate(genType, numKeys, numEvents, alpha, rate, size);
+      }
+    } else {
+      FILE* trace = (traceFile == "-") ? stdin :
+	::fopen(traceFile.c_str(), "r");
+      if (trace == NULL) {
+	fprintf(stderr, "Failed to open '%s'\n", traceFile.c_str());
+	retVal = 1;
+      } else {
+	if (!sim.ReadTrace(trace, fixedTypes)) {
+	  retVal = 1;
+	}
+	if (trace != stdin) {
+	  ::fclose(trace);
+	}
+      }
+    }
+    if (retVal == 0) {
+      sim.Report(WallTime() - start);
+    }
+  }
+  boost::system::error_code error;
+  fs::remove_all(dirName, error);
+
+  return retVal;
+}
@@ -0,0 +1,1277 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2009-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+// Drives a running daemon with a number of simulated clients at once
+// and reports the throughput and the latency of each method called.
+//
+// Each client runs in a thread with a bus handle of its own and
+// makes one request at a time, waiting a think time between them.
+// The requests are picked at random in the proportions given by -m:
+//
+//   get        LookupOrInsertCacheObject of a key, writing the object
+//              if it was inserted and reading it otherwise
+//   write      InsertCacheObject of a new object, which is written and
+//              its subscription released
+//   insert     InsertCacheObject of a new object without subscribing
+//   subscribe  SubscribeCacheObject of a known object, which is read
+//   touch      TouchCacheObject of a known object
+//   expire     ExpireCacheObject of a known object
+//   copy       CopyCacheObject of a known object, the copy is removed
+//
+// Keys are picked from -o of them with a Zipf popularity, in turns by
+// each client (scan) or uniformly, and every key has a size of its
+// own drawn from -z.  A new object takes the place of the key it was
+// picked for, so the known objects are the ones last written or
+// looked up for each key.  A request for a known object that isn't
+// known yet is skipped.
+//
+// With -l, lookups, subscriptions and touches are made over the
+// daemon's local socket instead, falling back to the bus for a
+// lookup that misses since the socket can't insert.
+//
+// With -e, no daemon is needed.  The clients drive a cache set in
+// this process instead, kept in the directory given, which should be
+// empty, and every request is a call to it.  Its total space is the
+// type's hiWatermark and its filesystem work is done in line, or with
+// -j on that many I/O workers whose jobs this thread completes as the
+// daemon's main loop would.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <lunaservice.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CacheBase.h"
+#include "FileCacheClient.h"
+#include "FileCacheSet.h"
+
+#define FILECACHE_SERVICE_URI	"palm://com.palm.filecache"
+
+enum LoadOp {
+  LoadGet = 0,
+  LoadWrite,
+  LoadInsert,
+  LoadSubscribe,
+  LoadTouch,
+  LoadExpire,
+  LoadCopy,
+  LoadNumOps
+};
+
+static const char* const s_opNames[LoadNumOps] = {
+  "get", "write", "insert", "subscribe", "touch", "expire", "copy"
+};
+
+static const size_t s_ioChunk = 65536;
+
+static double
+Now() {
+
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+// Find the value of a member of a reply.  The replies are flat so
+// the first match is the member.
+static std::string::size_type
+FindJsonValue(const std::string& json, const char* name) {
+
+  const std::string quoted(std::string("\"") + name + "\"");
+  std::string::size_type pos = json.find(quoted);
+  if (pos == std::string::npos) {
+    return pos;
+  }
+  pos = json.find(':', pos + quoted.size());
+  if (pos == std::string::npos) {
+    return pos;
+  }
+
+  return json.find_first_not_of(" \t\r\n", pos + 1);
+}
+
+static std::string
+GetJsonString(const std::string& json, const char* name) {
+
+  std::string value;
+  std::string::size_type pos = FindJsonValue(json, name);
+  if ((pos == std::string::npos) || (json[pos] != '"')) {
+    return value;
+  }
+  for (pos++; (pos < json.size()) && (json[pos] != '"'); pos++) {
+    if ((json[pos] == '\\') && (pos + 1 < json.size())) {
+      pos++;
+    }
+    value += json[pos];
+  }
+
+  return value;
+}
+
+static bool
+GetJsonBool(const std::string& json, const char* name) {
+
+  std::string::size_type pos = FindJsonValue(json, name);
+
+  return (pos != std::string::npos) && (json.compare(pos, 4, "true") == 0);
+}
+
+// Latencies of one method, in seconds
+class CMethodStats {
+ public:
+  CMethodStats() : m_failed(0) { }
+
+  std::vector<double> m_latencies;
+  unsigned long long m_failed;
+};
+
+typedef std::map<std::string, CMethodStats> MethodStatsMap;
+
+// The cache set the clients drive in this process with -e
+class CLoadCacheSet : public CFileCacheSet {
+ public:
+  CLoadCacheSet(const std::string& dirName, cacheSize_t cacheSpace,
+		int ioWorkers)
+    : CFileCacheSet(false)
+    , m_dirName(dirName)
+    , m_cacheSpace(cacheSpace) {
+    SetIOWorkerCount(ioWorkers);
+  }
+
+  std::string& GetBaseDirName() { return m_dirName; }
+  cacheSize_t TotalCacheSpace() { return m_cacheSpace; }
+
+ private:
+  std::string m_dirName;
+  cacheSize_t m_cacheSpace;
+};
+
+// The settings shared by all the clients, and the objects they know of
+class CLoadState {
+ public:
+  CLoadState();
+  ~CLoadState();
+
+  bool ParseMix(const std::string& spec);
+  bool ParsePopularity(const std::string& spec);
+  bool ParseSizes(const std::string& spec);
+
+  LoadOp PickOp(unsigned short rand[3]) const;
+  size_t PickKey(unsigned short rand[3], size_t& scanNext) const;
+  long long GetSize(size_t key) const;
+
+  std::string GetPath(size_t key);
+  void SetPath(size_t key, const std::string& pathName);
+
+  std::string m_typeName;
+  std::string m_socketPath;
+  std::string m_copyDir;
+  // Set with -e, when no daemon is used
+  CFileCacheSet* m_cacheSet;
+  int m_numClients;
+  size_t m_numKeys;
+  int m_numRequests;
+  double m_thinkTime;
+  long m_seed;
+
+  // The cumulative weights of the ops and, for Zipf, of the keys
+  std::vector<double> m_opCdf;
+  std::vector<double> m_keyCdf;
+  bool m_scan;
+
+  // fixed, uniform or exp
+  std::string m_sizeDist;
+  long long m_sizeA;
+  long long m_sizeB;
+
+  pthread_barrier_t m_start;
+  // The clients still making requests
+  int m_running;
+
+ private:
+  CLoadState& operator=(const CLoadState&);
+  CLoadState(const CLoadState&);
+
+  pthread_mutex_t m_mutex;
+  std::vector<std::string> m_paths;
+};
+
+CLoadState::CLoadState()
+  : m_typeName()
+  , m_socketPath()
+  , m_copyDir("/tmp")
+  , m_cacheSet(NULL)
+  , m_numClients(4)
+  , m_numKeys(10000)
+  , m_numRequests(1000)
+  , m_thinkTime(0)
+  , m_seed(1)
+  , m_scan(false)
+  , m_sizeDist("fixed")
+  , m_sizeA(4096)
+  , m_sizeB(0)
+  , m_running(0) {
+
+  ::pthread_mutex_init(&m_mutex, NULL);
+}
+
+CLoadState::~CLoadState() {
+
+  ::pthread_mutex_destroy(&m_mutex);
+}
+
+// Parse op:weight[,op:weight]...
+bool
+CLoadState::ParseMix(const std::string& spec) {
+
+  std::vector<double> weights(LoadNumOps, 0.0);
+  std::string::size_type start = 0;
+  while (start < spec.size()) {
+    std::string::size_type comma = spec.find(',', start);
+    if (comma == std::string::npos) {
+      comma = spec.size();
+    }
+    const std::string item(spec.substr(start, comma - start));
+    const std::string::size_type colon = item.find(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    int op = 0;
+    while ((op < LoadNumOps) && (item.compare(0, colon, s_opNames[op]) != 0)) {
+      op++;
+    }
+    const double weight = ::strtod(item.c_str() + colon + 1, NULL);
+    if ((op == LoadNumOps) || (weight < 0)) {
+      return false;
+    }
+    weights[op] = weight;
+    start = comma + 1;
+  }
+
+  m_opCdf.clear();
+  double sum = 0;
+  for (int op = 0; op < LoadNumOps; op++) {
+    sum += weights[op];
+    m_opCdf.push_back(sum);
+  }
+
+  return sum > 0;
+}
+
+// Parse zipf[:alpha], scan or uniform
+bool
+CLoadState::ParsePopularity(const std::string& spec) {
+
+  m_scan = false;
+  m_keyCdf.clear();
+  if (spec == "scan") {
+    m_scan = true;
+  } else if (spec.compare(0, 4, "zipf") == 0) {
+    const double alpha = (spec.size() > 5) ?
+      ::strtod(spec.c_str() + 5, NULL) : 0.8;
+    if (alpha <= 0) {
+      return false;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < m_numKeys; i++) {
+      sum += 1.0 / ::pow((double) (i + 1), alpha);
+      m_keyCdf.push_back(sum);
+    }
+  } else if (spec != "uniform") {
+    return false;
+  }
+
+  return true;
+}
+
+// Parse fixed:size, uniform:min:max or exp:mean
+bool
+CLoadState::ParseSizes(const std::string& spec) {
+
+  const std::string::size_type colon = spec.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  m_sizeDist = spec.substr(0, colon);
+  char* end = NULL;
+  m_sizeA = ::strtoll(spec.c_str() + colon + 1, &end, 10);
+  m_sizeB = 0;
+  if (m_sizeDist == "uniform") {
+    if (*end != ':') {
+      return false;
+    }
+    m_sizeB = ::strtoll(end + 1, &end, 10);
+    if (m_sizeB < m_sizeA) {
+      return false;
+    }
+  } else if ((m_sizeDist != "fixed") && (m_sizeDist != "exp")) {
+    return false;
+  }
+
+  return (*end == '\0') && (m_sizeA > 0);
+}
+
+LoadOp
+CLoadState::PickOp(unsigned short rand[3]) const {
+
+  const double target = ::erand48(rand) * m_opCdf.back();
+
+  return (LoadOp) std::min((long) LoadNumOps - 1, (long)
+			   (std::upper_bound(m_opCdf.begin(), m_opCdf.end(),
+					     target) - m_opCdf.begin()));
+}
+
+size_t
+CLoadState::PickKey(unsigned short rand[3], size_t& scanNext) const {
+
+  if (m_scan) {
+    const size_t key = scanNext;
+    scanNext = (scanNext + 1) % m_numKeys;
+    return key;
+  }
+  if (m_keyCdf.empty()) {
+    return std::min(m_numKeys - 1, (size_t) (::erand48(rand) *
+					     (double) m_numKeys));
+  }
+  const double target = ::erand48(rand) * m_keyCdf.back();
+
+  return std::min(m_numKeys - 1, (size_t)
+		  (std::lower_bound(m_keyCdf.begin(), m_keyCdf.end(), target) -
+		   m_keyCdf.begin()));
+}
+
+// The size of a key's objects, which is the same whenever it is
+// written
+long long
+CLoadState::GetSize(size_t key) const {
+
+  unsigned short rand[3] = { (unsigned short) m_seed,
+			     (unsigned short) key,
+			     (unsigned short) (key >> 16) };
+  const double u = ::erand48(rand);
+  if (m_sizeDist == "uniform") {
+    return m_sizeA + (long long) (u * (double) (m_sizeB - m_sizeA + 1));
+  } else if (m_sizeDist == "exp") {
+    return std::max(1LL, (long long) (-(double) m_sizeA * ::log(1.0 - u)));
+  }
+
+  return m_sizeA;
+}
+
+std::string
+CLoadState::GetPath(size_t key) {
+
+  ::pthread_mutex_lock(&m_mutex);
+  const std::string pathName((key < m_paths.size()) ? m_paths[key] : "");
+  ::pthread_mutex_unlock(&m_mutex);
+
+  return pathName;
+}
+
+void
+CLoadState::SetPath(size_t key, const std::string& pathName) {
+
+  ::pthread_mutex_lock(&m_mutex);
+  if (m_paths.size() < m_numKeys) {
+    m_paths.resize(m_numKeys);
+  }
+  m_paths[key] = pathName;
+  ::pthread_mutex_unlock(&m_mutex);
+}
+
+// A simulated client.  Its bus handle is attached to a main context
+// of its own so the clients' replies don't wait for one another.
+class CLoadClient {
+ public:
+  CLoadClient(CLoadState& state, int index);
+  ~CLoadClient();
+
+  bool Register();
+  bool DefineType(long long hiWatermark);
+  static void* Run(void* data);
+
+  MethodStatsMap m_stats;
+  unsigned long long m_ops[LoadNumOps];
+  unsigned long long m_skipped;
+  unsigned long long m_gets;
+  unsigned long long m_hits;
+
+ private:
+  CLoadClient& operator=(const CLoadClient&);
+  CLoadClient(const CLoadClient&);
+
+  static bool ReplyCb(LSHandle* sh, LSMessage* message, void* ctx);
+
+  void DoOp(LoadOp op);
+  void Get(size_t key);
+  void Write(size_t key, bool subscribe);
+  void Subscribe(size_t key);
+  void Touch(size_t key);
+  void Expire(size_t key);
+  void Copy(size_t key);
+  std::string Access(const cachedObjectId_t objId, long long size);
+  void WaitForFile(const cachedObjectId_t objId);
+
+  bool Call(const char* method, const std::string& payload,
+	    LSMessageToken* token = NULL);
+  void Cancel(LSMessageToken token);
+  void Record(const std::string& method, double start, bool ok);
+  bool WriteFile(const std::string& pathName, long long size);
+  bool ReadFile(const std::string& pathName);
+  bool CopyFile(const std::string& source, const std::string& destination);
+  std::string NewFileName();
+
+  CLoadState& m_state;
+  const int m_index;
+  unsigned short m_rand[3];
+  size_t m_scanNext;
+  unsigned long long m_nextFile;
+
+  LSHandle* m_handle;
+  GMainContext* m_context;
+  GMainLoop* m_loop;
+  LSMessageToken m_token;
+  bool m_replied;
+  std::string m_reply;
+
+  CFileCacheClient m_local;
+};
+
+CLoadClient::CLoadClient(CLoadState& state, int index)
+  : m_skipped(0)
+  , m_gets(0)
+  , m_hits(0)
+  , m_state(state)
+  , m_index(index)
+  , m_scanNext(0)
+  , m_nextFile(0)
+  , m_handle(NULL)
+  , m_context(NULL)
+  , m_loop(NULL)
+  , m_token(0)
+  , m_replied(false) {
+
+  for (int op = 0; op < LoadNumOps; op++) {
+    m_ops[op] = 0;
+  }
+  m_rand[0] = (unsigned short) state.m_seed;
+  m_rand[1] = (unsigned short) index;
+  m_rand[2] = 0x330e;
+  // Scanning clients start spread over the keys
+  m_scanNext = (state.m_numKeys * (size_t) std::max(index, 0) /
+	       (size_t) state.m_numClients) % state.m_numKeys;
+}
+
+CLoadClient::~CLoadClient() {
+
+  if (m_handle != NULL) {
+    LSError lserror;
+    LSErrorInit(&lserror);
+    if (!LSUnregister(m_handle, &lserror)) {
+      LSErrorFree(&lserror);
+    }
+  }
+  if (m_loop != NULL) {
+    g_main_loop_unref(m_loop);
+  }
+  if (m_context != NULL) {
+    g_main_context_unref(m_context);
+  }
+}
+
+bool
+CLoadClient::Register() {
+
+  if (m_state.m_cacheSet != NULL) {
+    return true;
+  }
+
+  m_context = g_main_context_new();
+  m_loop = g_main_loop_new(m_context, FALSE);
+
+  LSError lserror;
+  LSErrorInit(&lserror);
+  if (!LSRegister(NULL, &m_handle, &lserror) ||
+      !LSGmainAttach(m_handle, m_loop, &lserror)) {
+    LSErrorFree(&lserror);
+    fprintf(stderr, "Client %d failed to register on the bus\n", m_index);
+    return false;
+  }
+  if (!m_state.m_socketPath.empty() &&
+      !m_local.Connect(m_state.m_socketPath)) {
+    fprintf(stderr, "Client %d failed to connect to '%s'\n", m_index,
+	    m_state.m_socketPath.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// Define the type the clients use.  It is left as it is if it exists,
+// which DescribeType tells.
+bool
+CLoadClient::DefineType(long long hiWatermark) {
+
+  if (m_state.m_cacheSet != NULL) {
+    std::string msgText;
+    CCacheParamValues params((cacheSize_t) (hiWatermark / 2),
+			     (cacheSize_t) hiWatermark,
+			     (cacheSize_t) m_state.m_sizeA, 1, 100000);
+    if (!m_state.m_cacheSet->DefineType(msgText, m_state.m_typeName,
+					&params)) {
+      fprintf(stderr, "Failed to define type '%s': %s\n",
+	      m_state.m_typeName.c_str(), msgText.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  char payload[512];
+  ::snprintf(payload, sizeof(payload),
+	     "{\"typeName\":\"%s\", \"loWatermark\": %lld, \"hiWatermark\": %lld, \"size\": %lld, \"cost\": 1, \"lifetime\": 100000, \"dirType\": false}",
+	     m_state.m_typeName.c_str(), hiWatermark / 2, hiWatermark,
+	     m_state.m_sizeA);
+  if (!Call("DefineType", payload) && !Call("DescribeType", payload)) {
+    fprintf(stderr, "Failed to define type '%s': %s\n",
+	    m_state.m_typeName.c_str(), m_reply.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void*
+CLoadClient::Run(void* data) {
+
+  CLoadClient* client = static_cast<CLoadClient*>(data);
+  CLoadState& state = client->m_state;
+
+  const bool registered = client->Register();
+  ::pthread_barrier_wait(&state.m_start);
+  for (int i = 0; registered && (i < state.m_numRequests); i++) {
+    client->DoOp(state.PickOp(client->m_rand));
+    if (state.m_thinkTime > 0) {
+      const double think = -state.m_thinkTime *
+	::log(1.0 - ::erand48(client->m_rand));
+      ::usleep((useconds_t) (think * 1000.0));
+    }
+  }
+  __sync_sub_and_fetch(&state.m_running, 1);
+
+  return NULL;
+}
+
+void
+CLoadClient::DoOp(LoadOp op) {
+
+  m_ops[op]++;
+  const size_t key = m_state.PickKey(m_rand, m_scanNext);
+  switch (op) {
+  case LoadGet:
+    Get(key);
+    break;
+  case LoadWrite:
+    Write(key, true);
+    break;
+  case LoadInsert:
+    Write(key, false);
+    break;
+  case LoadSubscribe:
+    Subscribe(key);
+    break;
+  case LoadTouch:
+    Touch(key);
+    break;
+  case LoadExpire:
+    Expire(key);
+    break;
+  default:
+    Copy(key);
+    break;
+  }
+}
+
+// Look a key up as a client reading through the cache would, writing
+// the object if it isn't there
+void
+CLoadClient::Get(size_t key) {
+
+  m_gets++;
+  char keyStr[32];
+  ::snprintf(keyStr, sizeof(keyStr), "k%lu", (unsigned long) key);
+  const long long size = m_state.GetSize(key);
+
+  if (m_state.m_cacheSet != NULL) {
+    std::string msgText;
+    bool inserted = false;
+    const double start = Now();
+    const cachedObjectId_t objId =
+      m_state.m_cacheSet->LookupOrInsertCacheObject(msgText,
+						    m_state.m_typeName,
+						    keyStr,
+						    std::string(keyStr) + ".dat",
+						    (cacheSize_t) size, 0, 0,
+						    inserted);
+    if (inserted) {
+      WaitForFile(objId);
+    }
+    Record("LookupOrInsertCacheObject", start, objId != 0);
+    const std::string pathName((objId != 0) ? Access(objId, size) : "");
+    if (!pathName.empty()) {
+      if (!inserted) {
+	m_hits++;
+      }
+      m_state.SetPath(key, pathName);
+    }
+    return;
+  }
+
+  if (m_local.isConnected()) {
+    double start = Now();
+    const unsigned long long objId = m_local.Lookup(m_state.m_typeName,
+						    keyStr);
+    Record("local Lookup", start, m_local.isConnected());
+    if (objId != 0) {
+      start = Now();
+      const std::string pathName(m_local.Subscribe(objId));
+      Record("local Subscribe", start, !pathName.empty());
+      if (!pathName.empty()) {
+	m_hits++;
+	ReadFile(pathName);
+	m_local.UnSubscribe(objId);
+	m_state.SetPath(key, pathName);
+	return;
+      }
+    }
+  }
+
+  char payload[512];
+  ::snprintf(payload, sizeof(payload),
+	     "{\"typeName\":\"%s\", \"fileName\":\"%s.dat\", \"key\":\"%s\", \"size\": %lld, \"subscribe\": true}",
+	     m_state.m_typeName.c_str(), keyStr, keyStr, size);
+  LSMessageToken token = 0;
+  if (Call("LookupOrInsertCacheObject", payload, &token)) {
+    const std::string pathName(GetJsonString(m_reply, "pathName"));
+    if (GetJsonBool(m_reply, "inserted")) {
+      WriteFile(pathName, size);
+    } else {
+      m_hits++;
+      ReadFile(pathName);
+    }
+    m_state.SetPath(key, pathName);
+  }
+  if (token != 0) {
+    Cancel(token);
+  }
+}
+
+// Insert a new object in place of a key's, writing it if subscribe
+// is set as a client downloading something would
+void
+CLoadClient::Write(size_t key, bool subscribe) {
+
+  const long long size = m_state.GetSize(key);
+  if (m_state.m_cacheSet != NULL) {
+    std::string msgText;
+    const std::string fileName(NewFileName());
+    const double start = Now();
+    const cachedObjectId_t objId =
+      m_state.m_cacheSet->InsertCacheObject(msgText, m_state.m_typeName,
+					    fileName, (cacheSize_t) size);
+    WaitForFile(objId);
+    Record("InsertCacheObject", start, objId != 0);
+    if (objId == 0) {
+      return;
+    }
+    const std::string pathName(subscribe ? Access(objId, size) :
+			       BuildPathname(objId,
+					     m_state.m_cacheSet->GetBaseDirName(),
+					     m_state.m_typeName, fileName));
+    if (!pathName.empty()) {
+      m_state.SetPath(key, pathName);
+    }
+    return;
+  }
+
+  char payload[512];
+  ::snprintf(payload, sizeof(payload),
+	     "{\"typeName\":\"%s\", \"fileName\":\"%s\", \"size\": %lld, \"subscribe\": %s}",
+	     m_state.m_typeName.c_str(), NewFileName().c_str(), size,
+	     subscribe ? "true" : "false");
+  LSMessageToken token = 0;
+  if (Call("InsertCacheObject", payload, subscribe ? &token : NULL)) {
+    const std::string pathName(GetJsonString(m_reply, "pathName"));
+    if (subscribe) {
+      WriteFile(pathName, size);
+    }
+    m_state.SetPath(key, pathName);
+  }
+  if (token != 0) {
+    Cancel(token);
+  }
+}
+
+void
+CLoadClient::Subscribe(size_t key) {
+
+  const std::string pathName(m_state.GetPath(key));
+  if (pathName.empty()) {
+    m_skipped++;
+    return;
+  }
+
+  if (m_state.m_cacheSet != NULL) {
+    if (Access(GetObjectIdFromPath(pathName.c_str()),
+	       m_state.GetSize(key)).empty()) {
+      m_state.SetPath(key, "");
+    }
+    return;
+  }
+
+  if (m_local.isConnected()) {
+    const unsigned long long objId = GetObjectIdFromPath(pathName.c_str());
+    const double start = Now();
+    const std::string localPath(m_local.Subscribe(objId));
+    Record("local Subscribe", start, !localPath.empty());
+    if (localPath.empty()) {
+      m_state.SetPath(key, "");
+    } else {
+      ReadFile(localPath);
+      m_local.UnSubscribe(objId);
+    }
+    return;
+  }
+
+  const std::string payload("{\"pathName\":\"" + pathName +
+			    "\", \"subscribe\": true}");
+  LSMessageToken token = 0;
+  if (Call("SubscribeCacheObject", payload, &token)) {
+    ReadFile(pathName);
+  } else {
+    m_state.SetPath(key, "");
+  }
+  if (token != 0) {
+    Cancel(token);
+  }
+}
+
+void
+CLoadClient::Touch(size_t key) {
+
+  const std::string pathName(m_state.GetPath(key));
+  if (pathName.empty()) {
+    m_skipped++;
+    return;
+  }
+
+  bool ok = false;
+  if (m_state.m_cacheSet != NULL) {
+    const double start = Now();
+    ok = m_state.m_cacheSet->Touch(GetObjectIdFromPath(pathName.c_str()));
+    Record("TouchCacheObject", start, ok);
+  } else if (m_local.isConnected()) {
+    const double start = Now();
+    ok = m_local.Touch(GetObjectIdFromPath(pathName.c_str()));
+    Record("local Touch", start, ok);
+  } else {
+    ok = Call("TouchCacheObject", "{\"pathName\":\"" + pathName + "\"}");
+  }
+  if (!ok) {
+    m_state.SetPath(key, "");
+  }
+}
+
+void
+CLoadClient::Expire(size_t key) {
+
+  const std::string pathName(m_state.GetPath(key));
+  if (pathName.empty()) {
+    m_skipped++;
+    return;
+  }
+
+  if (m_state.m_cacheSet != NULL) {
+    const double start = Now();
+    const bool ok =
+      m_state.m_cacheSet->ExpireCacheObject(GetObjectIdFromPath(pathName.c_str()));
+    Record("ExpireCacheObject", start, ok);
+  } else {
+    Call("ExpireCacheObject", "{\"pathName\":\"" + pathName + "\"}");
+  }
+  m_state.SetPath(key, "");
+}
+
+void
+CLoadClient::Copy(size_t key) {
+
+  const std::string pathName(m_state.GetPath(key));
+  if (pathName.empty()) {
+    m_skipped++;
+    return;
+  }
+
+  const std::string fileName(NewFileName());
+  if (m_state.m_cacheSet != NULL) {
+    CFileCacheSet* cacheSet = m_state.m_cacheSet;
+    const cachedObjectId_t objId = GetObjectIdFromPath(pathName.c_str());
+    const std::string typeName(cacheSet->GetTypeForObjectId(objId));
+    const std::string copied(m_state.m_copyDir + "/" + fileName);
+    std::string msgText;
+    const double start = Now();
+    const std::string source(cacheSet->SubscribeCacheObject(msgText, objId));
+    bool ok = !source.empty() && msgText.empty();
+    if (ok) {
+      ok = CopyFile(source, copied);
+      cacheSet->UnSubscribeCacheObject(typeName, objId);
+    }
+    Record("CopyCacheObject", start, ok);
+    ::unlink(copied.c_str());
+    if (!ok) {
+      m_state.SetPath(key, "");
+    }
+    return;
+  }
+
+  const std::string payload("{\"pathName\":\"" + pathName +
+			    "\", \"destination\":\"" + m_state.m_copyDir +
+			    "\", \"fileName\":\"" + fileName + "\"}");
+  if (Call("CopyCacheObject", payload)) {
+    std::string copied(GetJsonString(m_reply, "newPathName"));
+    if (copied.empty()) {
+      copied = m_state.m_copyDir + "/" + fileName;
+    }
+    ::unlink(copied.c_str());
+  } else {
+    m_state.SetPath(key, "");
+  }
+}
+
+bool
+CLoadClient::ReplyCb(LSHandle* sh, LSMessage* message, void* ctx) {
+
+  CLoadClient* client = static_cast<CLoadClient*>(ctx);
+  // Only the first reply to the call being waited for is wanted, a
+  // subscription may be sent more
+  if (!client->m_replied &&
+      (LSMessageGetResponseToken(message) == client->m_token)) {
+    client->m_reply = LSMessageGetPayload(message);
+    client->m_replied = true;
+  }
+
+  return true;
+}
+
+// Call a method and wait for its first reply.  If token is given the
+// call is left open, as a subscription, and has to be cancelled.
+bool
+CLoadClient::Call(const char* method, const std::string& payload,
+		  LSMessageToken* token) {
+
+  const std::string uri(std::string(FILECACHE_SERVICE_URI) + "/" + method);
+  LSError lserror;
+  LSErrorInit(&lserror);
+
+  const double start = Now();
+  m_replied = false;
+  m_reply.clear();
+  m_token = 0;
+  const bool sent = (token != NULL) ?
+    LSCall(m_handle, uri.c_str(), payload.c_str(), &ReplyCb, this, &m_token,
+	   &lserror) :
+    LSCallOneReply(m_handle, uri.c_str(), payload.c_str(), &ReplyCb, this,
+		   &m_token, &lserror);
+  if (!sent) {
+    LSErrorFree(&lserror);
+    Record(method, start, false);
+    return false;
+  }
+  while (!m_replied) {
+    g_main_context_iteration(m_context, TRUE);
+  }
+  if (token != NULL) {
+    *token = m_token;
+  }
+  const bool ok = GetJsonBool(m_reply, "returnValue");
+  Record(method, start, ok);
+
+  return ok;
+}
+
+void
+CLoadClient::Cancel(LSMessageToken token) {
+
+  LSError lserror;
+  LSErrorInit(&lserror);
+  if (!LSCallCancel(m_handle, token, &lserror)) {
+    LSErrorFree(&lserror);
+  }
+}
+
+void
+CLoadClient::Record(const std::string& method, double start, bool ok) {
+
+  CMethodStats& stats = m_stats[method];
+  if (ok) {
+    stats.m_latencies.push_back(Now() - start);
+  } else {
+    stats.m_failed++;
+  }
+}
+
+bool
+CLoadClient::WriteFile(const std::string& pathName, long long size) {
+
+  static const std::vector<char> zeros(s_ioChunk, 0);
+  int fd = ::open(pathName.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = true;
+  while (ok && (size > 0)) {
+    const size_t len = (size_t) std::min(size, (long long) s_ioChunk);
+    const ssize_t written = ::write(fd, &zeros[0], len);
+    if (written < 0) {
+      ok = (errno == EINTR);
+    } else {
+      size -= written;
+    }
+  }
+  ::close(fd);
+
+  return ok;
+}
+
+bool
+CLoadClient::ReadFile(const std::string& pathName) {
+
+  std::vector<char> buf(s_ioChunk);
+  int fd = ::open(pathName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  ssize_t len;
+  while (((len = ::read(fd, &buf[0], buf.size())) > 0) ||
+	 ((len < 0) && (errno == EINTR))) {
+  }
+  ::close(fd);
+
+  return len == 0;
+}
+
+bool
+CLoadClient::CopyFile(const std::string& source,
+		      const std::string& destination) {
+
+  std::vector<char> buf(s_ioChunk);
+  int in = ::open(source.c_str(), O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  int out = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    ::close(in);
+    return false;
+  }
+  bool ok = true;
+  ssize_t len;
+  while (ok && (((len = ::read(in, &buf[0], buf.size())) > 0) ||
+		((len < 0) && (errno == EINTR)))) {
+    ok = (len < 0) || (::write(out, &buf[0], (size_t) len) == len);
+  }
+  ::close(in);
+  ::close(out);
+
+  return ok && (len == 0);
+}
+
+// Subscribe to an object in the cache set driven in this process and
+// write it if this is its writer, as the first subscriber of a new
+// object is, or read it otherwise.  Returns the object's path, or an
+// empty string if it couldn't be subscribed.
+std::string
+CLoadClient::Access(const cachedObjectId_t objId, long long size) {
+
+  CFileCacheSet* cacheSet = m_state.m_cacheSet;
+  const std::string typeName(cacheSet->GetTypeForObjectId(objId));
+  std::string msgText;
+  const double start = Now();
+  const std::string pathName(cacheSet->SubscribeCacheObject(msgText, objId));
+  const bool ok = !pathName.empty() && msgText.empty();
+  if (ok) {
+    WaitForFile(objId);
+  }
+  Record("SubscribeCacheObject", start, ok);
+  if (!ok) {
+    // Expired, or being written by another client
+    return std::string();
+  }
+  if (cacheSet->isObjectBeingWritten(typeName, objId)) {
+    WriteFile(pathName, size);
+  } else {
+    ReadFile(pathName);
+  }
+  cacheSet->UnSubscribeCacheObject(typeName, objId);
+
+  return pathName;
+}
+
+// With I/O workers the file of a new object is created, and made
+// writable for its writer, after the call returns.  The daemon only
+// replies once that is done, so the wait is counted in the call's
+// latency here as well.
+void
+CLoadClient::WaitForFile(const cachedObjectId_t objId) {
+
+  CFileCacheSet* cacheSet = m_state.m_cacheSet;
+  while ((objId != 0) &&
+	 (cacheSet->isObjectBeingCreated(m_state.m_typeName, objId) ||
+	  cacheSet->isObjectBeingOpened(m_state.m_typeName, objId))) {
+    ::usleep(100);
+  }
+}
+
+std::string
+CLoadClient::NewFileName() {
+
+  char fileName[64];
+  ::snprintf(fileName, sizeof(fileName), "load%d-%llu.dat", m_index,
+	     ++m_nextFile);
+
+  return fileName;
+}
+
+static double
+Percentile(const std::vector<double>& sorted, double fraction) {
+
+  if (sorted.empty()) {
+    return 0;
+  }
+
+  return sorted[std::min(sorted.size() - 1,
+			 (size_t) (fraction * (double) sorted.size()))];
+}
+
+static void
+Report(std::vector<CLoadClient*>& clients, double elapsed) {
+
+  MethodStatsMap total;
+  unsigned long long ops[LoadNumOps] = { 0, 0, 0, 0, 0, 0, 0 };
+  unsigned long long skipped = 0;
+  unsigned long long gets = 0;
+  unsigned long long hits = 0;
+  std::vector<CLoadClient*>::const_iterator client;
+  for (client = clients.begin(); client != clients.end(); ++client) {
+    MethodStatsMap::const_iterator iter;
+    for (iter = (*client)->m_stats.begin(); iter != (*client)->m_stats.end();
+	 ++iter) {
+      CMethodStats& stats = total[iter->first];
+      stats.m_latencies.insert(stats.m_latencies.end(),
+			       iter->second.m_latencies.begin(),
+			       iter->second.m_latencies.end());
+      stats.m_failed += iter->second.m_failed;
+    }
+    for (int op = 0; op < LoadNumOps; op++) {
+      ops[op] += (*client)->m_ops[op];
+    }
+    skipped += (*client)->m_skipped;
+    gets += (*client)->m_gets;
+    hits += (*client)->m_hits;
+  }
+
+  printf("%-26s %9s %7s %10s %9s %9s %9s %9s\n", "method", "requests",
+	 "failed", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  unsigned long long requests = 0;
+  MethodStatsMap::iterator iter;
+  for (iter = total.begin(); iter != total.end(); ++iter) {
+    std::vector<double>& latencies = iter->second.m_latencies;
+    std::sort(latencies.begin(), latencies.end());
+    const unsigned long long count = latencies.size() + iter->second.m_failed;
+    requests += count;
+    printf("%-26s %9llu %7llu %10.0f %9.3f %9.3f %9.3f %9.3f\n",
+	   iter->first.c_str(), count, iter->second.m_failed,
+	   (elapsed > 0) ? (double) count / elapsed : 0.0,
+	   Percentile(latencies, 0.50) * 1000.0,
+	   Percentile(latencies, 0.90) * 1000.0,
+	   Percentile(latencies, 0.99) * 1000.0,
+	   latencies.empty() ? 0.0 : latencies.back() * 1000.0);
+  }
+
+  printf("ops:");
+  for (int op = 0; op < LoadNumOps; op++) {
+    printf(" %s %llu", s_opNames[op], ops[op]);
+  }
+  printf(", %llu skipped for want of a known object\n", skipped);
+  printf("%d clients, %llu requests in %.3f s (%.0f requests/s), %.2f%% of gets hit\n",
+	 (int) clients.size(), requests, elapsed,
+	 (elapsed > 0) ? (double) requests / elapsed : 0.0,
+	 gets ? 100.0 * (double) hits / (double) gets : 0.0);
+}
+
+static void
+Usage() {
+
+  fprintf(stderr,
+	  "Usage: loadgen -t typename [-k clients] [-n requests] [-m op:weight,...]\n"
+	  "               [-p zipf[:alpha]|scan|uniform] [-o keys]\n"
+	  "               [-z fixed:size|uniform:min:max|exp:mean] [-w thinkms]\n"
+	  "               [-c hiwatermark] [-l socket | -e basedir [-j ioworkers]]\n"
+	  "               [-d copydir] [-s seed]\n"
+	  "ops: get write insert subscribe touch expire copy\n");
+  exit(1);
+}
+
+int
+main(int argc, char* argv[]) {
+
+  CLoadState state;
+  long long hiWatermark = 100 * 1024 * 1024;
+  std::string mix("get:60,write:5,subscribe:15,touch:15,expire:3,copy:2");
+  std::string popularity("zipf:0.8");
+  std::string sizes("fixed:4096");
+  std::string baseDir;
+  int ioWorkers = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string thisArg(argv[i]);
+    if (i == (argc - 1)) {
+      Usage();
+    }
+    const char* value = argv[++i];
+    if (thisArg == "-t") {
+      state.m_typeName = value;
+    } else if (thisArg == "-k") {
+      state.m_numClients = atoi(value);
+    } else if (thisArg == "-n") {
+      state.m_numRequests = atoi(value);
+    } else if (thisArg == "-m") {
+      mix = value;
+    } else if (thisArg == "-p") {
+      popularity = value;
+    } else if (thisArg == "-o") {
+      state.m_numKeys = (size_t) ::strtoul(value, NULL, 10);
+    } else if (thisArg == "-z") {
+      sizes = value;
+    } else if (thisArg == "-w") {
+      state.m_thinkTime = ::strtod(value, NULL);
+    } else if (thisArg == "-c") {
+      hiWatermark = ::strtoll(value, NULL, 10);
+    } else if (thisArg == "-l") {
+      state.m_socketPath = value;
+    } else if (thisArg == "-e") {
+      baseDir = value;
+    } else if (thisArg == "-j") {
+      ioWorkers = atoi(value);
+    } else if (thisArg == "-d") {
+      state.m_copyDir = value;
+    } else if (thisArg == "-s") {
+      state.m_seed = ::strtol(value, NULL, 10);
+    } else {
+      Usage();
+    }
+  }
+  if (state.m_typeName.empty() || (state.m_numClients <= 0) ||
+      (state.m_numRequests <= 0) || (state.m_numKeys == 0) ||
+      (state.m_thinkTime < 0) || (hiWatermark <= 0) ||
+      (!baseDir.empty() && !state.m_socketPath.empty()) ||
+      (ioWorkers < 0) || ((ioWorkers > 0) && baseDir.empty())) {
+    Usage();
+  }
+  if (!state.ParseMix(mix)) {
+    fprintf(stderr, "Invalid mix '%s'\n", mix.c_str());
+    Usage();
+  }
+  if (!state.ParsePopularity(popularity)) {
+    fprintf(stderr, "Invalid popularity '%s'\n", popularity.c_str());
+    Usage();
+  }
+  if (!state.ParseSizes(sizes)) {
+    fprintf(stderr, "Invalid sizes '%s'\n", sizes.c_str());
+    Usage();
+  }
+
+  if (!baseDir.empty()) {
+    if ((::mkdir(baseDir.c_str(), 0700) != 0) && (errno != EEXIST)) {
+      fprintf(stderr, "Failed to create '%s': %s\n", baseDir.c_str(),
+	      ::strerror(errno));
+      exit(1);
+    }
+    state.m_cacheSet = new CLoadCacheSet(baseDir, (cacheSize_t) hiWatermark,
+					 ioWorkers);
+    if ((ioWorkers > 0) && !state.m_cacheSet->StartIOWorkers()) {
+      fprintf(stderr, "Failed to start %d I/O workers\n", ioWorkers);
+      exit(1);
+    }
+  }
+
+  {
+    CLoadClient setup(state, -1);
+    if (!setup.Register() || !setup.DefineType(hiWatermark)) {
+      exit(1);
+    }
+  }
+
+  const int numClients = state.m_numClients;
+  std::vector<CLoadClient*> clients;
+  std::vector<pthread_t> threads((size_t) numClients);
+  ::pthread_barrier_init(&state.m_start, NULL, (unsigned) numClients + 1);
+  state.m_running = numClients;
+  for (int i = 0; i < numClients; i++) {
+    clients.push_back(new CLoadClient(state, i));
+    if (::pthread_create(&threads[(size_t) i], NULL, &CLoadClient::Run,
+			 clients.back()) != 0) {
+      fprintf(stderr, "Failed to start client %d\n", i);
+      exit(1);
+    }
+  }
+  ::pthread_barrier_wait(&state.m_start);
+  const double start = Now();
+  while ((ioWorkers > 0) && (__sync_add_and_fetch(&state.m_running, 0) > 0)) {
+    if (!g_main_context_iteration(NULL, FALSE)) {
+      ::usleep(100);
+    }
+  }
+  for (int i = 0; i < numClients; i++) {
+    ::pthread_join(threads[(size_t) i], NULL);
+  }
+  Report(clients, Now() - start);
+  if (ioWorkers > 0) {
+    state.m_cacheSet->StopIOWorkers();
+  }
+
+  for (size_t i = 0; i < clients.size(); i++) {
+    delete clients[i];
+  }
+  ::pthread_barrier_destroy(&state.m_start);
+
+  exit(0);
+}
@@ -0,0 +1,176 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+// Compares the rate of GetCacheTypeStatus requests answered over the
+// bus with the same requests over the local socket, one at a time and
+// in batches.  The daemon has to be running with its local socket
+// enabled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lunaservice.h>
+
+#include <string>
+
+#include "CacheBase.h"
+#include "FileCacheClient.h"
+#include "LocalProtocol.h"
+
+#define FILECACHE_SERVICE_URI	"palm://com.palm.filecache"
+
+static int s_replies = 0;
+
+static bool
+FilecacheServiceCb(LSHandle* sh, LSMessage* message, void* ctx) {
+
+  s_replies++;
+
+  return true;
+}
+
+static double
+Now() {
+
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+static void
+Report(const char* path, int count, double elapsed) {
+
+  printf("%-12s %8d requests %10.3f s %12.0f requests/s\n", path, count,
+	 elapsed, (elapsed > 0) ? (double) count / elapsed : 0.0);
+}
+
+static void
+Usage() {
+
+  fprintf(stderr,
+	  "Usage: localbench -t typename [-n requests] [-b batchsize] [-s socket]\n");
+  exit(1);
+}
+
+int
+main(int argc, char* argv[]) {
+
+  std::string typeName;
+  std::string socketPath(s_defaultLocalSocket);
+  int count = 10000;
+  int batchSize = (int) s_localMaxBatch;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string thisArg(argv[i]);
+    if (i == (argc - 1)) {
+      Usage();
+    }
+    if (thisArg == "-t") {
+      typeName = argv[++i];
+    } else if (thisArg == "-n") {
+      count = atoi(argv[++i]);
+    } else if (thisArg == "-b") {
+      batchSize = atoi(argv[++i]);
+    } else if (thisArg == "-s") {
+      socketPath = argv[++i];
+    } else {
+      Usage();
+    }
+  }
+  if (typeName.empty() || (count <= 0) || (batchSize <= 0) ||
+      (batchSize > (int) s_localMaxBatch)) {
+    Usage();
+  }
+
+  LSError lserror;
+  LSErrorInit(&lserror);
+  LSHandle* filecacheService = NULL;
+  GMainLoop* mainLoop = g_main_loop_new(NULL, FALSE);
+  if (!LSRegister(NULL, &filecacheService, &lserror) ||
+      !LSGmainAttach(filecacheService, mainLoop, &lserror)) {
+    fprintf(stderr, "Failed to register on the bus\n");
+    exit(1);
+  }
+
+  // The bus, one request at a time as a service would make them
+  const std::string uri(std::string(FILECACHE_SERVICE_URI) +
+			"/GetCacheTypeStatus");
+  const std::string payload("{\"typeName\":\"" + typeName + "\"}");
+  double start = Now();
+  for (int i = 0; i < count; i++) {
+    const int expected = s_replies + 1;
+    if (!LSCallOneReply(filecacheService, uri.c_str(), payload.c_str(),
+			FilecacheServiceCb, NULL, NULL, &lserror)) {
+      fprintf(stderr, "GetCacheTypeStatus failed\n");
+      exit(1);
+    }
+    while (s_replies < expected) {
+      g_main_context_iteration(NULL, true);
+    }
+  }
+  Report("bus", count, Now() - start);
+
+  CFileCacheClient client;
+  if (!client.Connect(socketPath)) {
+    fprintf(stderr, "Failed to connect to '%s'\n", socketPath.c_str());
+    exit(1);
+  }
+  long long size = 0;
+  long long numObjects = 0;
+  if (!client.TypeStatus(typeName, &size, &numObjects)) {
+    fprintf(stderr, "Type '%s' is not defined\n", typeName.c_str());
+    exit(1);
+  }
+
+  // The local socket, one request at a time
+  start = Now();
+  for (int i = 0; i < count; i++) {
+    if (!client.TypeStatus(typeName, &size, &numObjects)) {
+      fprintf(stderr, "TypeStatus failed\n");
+      exit(1);
+    }
+  }
+  Report("local", count, Now() - start);
+
+  // The local socket in batches, with the next batch sent before the
+  // replies to the last one are read
+  CFileCacheBatch batches[2];
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < batchSize; j++) {
+      batches[i].AddTypeStatus(typeName);
+    }
+  }
+  const int numBatches = (count + batchSize - 1) / batchSize;
+  start = Now();
+  bool ok = client.Send(batches[0]);
+  for (int i = 1; ok && (i <= numBatches); i++) {
+    if (i < numBatches) {
+      ok = client.Send(batches[i % 2]);
+    }
+    ok = ok && client.Receive(batches[(i - 1) % 2]);
+  }
+  if (!ok) {
+    fprintf(stderr, "Batch failed\n");
+    exit(1);
+  }
+  Report("local batch", numBatches * batchSize, Now() - start);
+
+  exit(0);
+}
@@ -0,0 +1,359 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2014 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+// Times how long a daemon takes to be ready to serve a cache tree of
+// a given shape.  For every combination of object and type counts a
+// tree is made with the cache engine, some of the types being
+// directory types, and then a new cache set is started on it the way
+// the daemon starts: the saved state of the last daemon is looked
+// for, the tree is walked and the cache cleaned up.  With -a the
+// state is saved and adopted instead of the tree being walked.
+//
+// The objects' files are extended to their sizes rather than written,
+// so making a large tree doesn't take much longer than walking it.
+// For the walk to be of a cold cache the page cache has to be dropped
+// between making the tree and walking it, which -C does when run as
+// root.
+//
+// Each run is printed as a line of JSON with the time to ready and
+// the time and calls of each phase of starting up, see
+// StartupProfile.h, for example
+//
+//   {"bench":"walk","objects":1000,"types":10,"dirTypes":1,
+//    "readyUs":51234,"phases":{"walk":{"us":50011,"calls":1},...}}
+//
+// As with filecache-bench, combinations that don't fit in a cache set
+// are skipped.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "core/MojLogEngine.h"
+#include "FileCacheSet.h"
+#include "TestObjects.h"
+
+namespace fs = boost::filesystem;
+
+// The most a cache set is told it may use
+static const cacheSize_t s_benchCacheSpace = 0x7fffffff;
+
+static void
+Usage() {
+
+  fprintf(stderr,
+	  "Usage: filecache-startupbench [-o objects,...] [-y types,...] [-D dirtypes]\n"
+	  "                              [-z fixed:size|uniform:min:max] [-r runs]\n"
+	  "                              [-a] [-C] [-d dir] [-s seed]\n");
+  exit(1);
+}
+
+// Parse a comma separated list of positive numbers
+static bool
+ParseList(const char* value, std::vector<uint64_t>& list) {
+
+  list.clear();
+  std::stringstream values(value);
+  std::string field;
+  while (std::getline(values, field, ',')) {
+    char* end = NULL;
+    const unsigned long long n = ::strtoull(field.c_str(), &end, 10);
+    if ((end == field.c_str()) || (*end != '\0') || (n == 0)) {
+      return false;
+    }
+    list.push_back(n);
+  }
+
+  return !list.empty();
+}
+
+// Parse fixed:size or uniform:min:max
+static bool
+ParseSizes(const std::string& spec, cacheSize_t& minSize,
+	   cacheSize_t& maxSize) {
+
+  char* end = NULL;
+  if (spec.compare(0, 6, "fixed:") == 0) {
+    minSize = maxSize = (cacheSize_t) ::strtol(spec.c_str() + 6, &end, 10);
+  } else if (spec.compare(0, 8, "uniform:") == 0) {
+    minSize = (cacheSize_t) ::strtol(spec.c_str() + 8, &end, 10);
+    if (*end != ':') {
+      return false;
+    }
+    maxSize = (cacheSize_t) ::strtol(end + 1, &end, 10);
+  } else {
+    return false;
+  }
+
+  return (*end == '\0') && (minSize > 0) && (maxSize >= minSize);
+}
+
+// Write the profile of a start
+static void
+Report(const char* bench, uint64_t numObjects, int numTypes, int numDirTypes,
+       const CStartupProfile& profile) {
+
+  printf("{\"bench\":\"%s\",\"objects\":%llu,\"types\":%d,\"dirTypes\":%d,"
+	 "\"readyUs\":%llu,\"phases\":{", bench,
+	 (unsigned long long) numObjects, numTypes, numDirTypes,
+	 (unsigned long long) (profile.GetReadyTime() / 1000));
+  for (int i = 0; i < StartupNumPhases; i++) {
+    const StartupPhase phase = (StartupPhase) i;
+    printf("%s\"%s\":{\"us\":%llu,\"calls\":%llu}", (i > 0) ? "," : "",
+	   CStartupProfile::GetPhaseName(phase),
+	   (unsigned long long) (profile.GetTime(phase) / 1000),
+	   (unsigned long long) profile.GetCount(phase));
+  }
+  printf("}}\n");
+  fflush(stdout);
+}
+
+// Make a cache tree of numObjects objects spread over numTypes types,
+// the first numDirTypes of which are directory types.  Returns false
+// if it couldn't be made.
+static bool
+MakeTree(const std::string& dirName, uint64_t numObjects, int numTypes,
+	 int numDirTypes, cacheSize_t minSize, cacheSize_t maxSize,
+	 const std::string& stateFile) {
+
+  CStressFileCacheSet cacheSet(s_benchCacheSpace, dirName);
+  const cacheSize_t perType = (cacheSize_t)
+    ((numObjects / (uint64_t) numTypes + 2) *
+     (uint64_t) GetFilesystemFileSize(maxSize));
+  CCacheParamValues params(perType / 2, perType, minSize, 0, 0, 0);
+  std::vector<std::string> typeNames;
+  for (int i = 0; i < numTypes; i++) {
+    std::stringstream typeName;
+    typeName << "startup" << i;
+    std::string msgText;
+    if (!cacheSet.DefineType(msgText, typeName.str(), &params,
+			     i < numDirTypes)) {
+      fprintf(stderr, "%s\n", msgText.c_str());
+      return false;
+    }
+    typeNames.push_back(typeName.str());
+  }
+
+  uint64_t failed = 0;
+  {
+    CSnapshotBatch batch(&cacheSet);
+    for (uint64_t i = 0; i < numObjects; i++) {
+      const int type = (int) (i % (uint64_t) numTypes);
+      const cacheSize_t size = minSize + (cacheSize_t)
+	(::drand48() * (double) (maxSize - minSize + 1));
+      std::string msgText;
+      const cachedObjectId_t objId =
+	cacheSet.InsertCacheObject(msgText, typeNames[(size_t) type],
+				   "startup.dat", size);
+      const std::string pathname((objId > 0) ?
+				 cacheSet.SubscribeCacheObject(msgText,
+							       objId) : "");
+      if (pathname.empty()) {
+	failed++;
+	continue;
+      }
+      if ((type >= numDirTypes) &&
+	  (::truncate(pathname.c_str(), (off_t) size) != 0)) {
+	failed++;
+      }
+      cacheSet.UnSubscribeCacheObject(typeNames[(size_t) type], objId);
+    }
+  }
+  if (failed > 0) {
+    fprintf(stderr, "%llu objects couldn't be made\n",
+	    (unsigned long long) failed);
+    return false;
+  }
+
+  return stateFile.empty() || cacheSet.SaveState(stateFile);
+}
+
+// Drop the page, dentry and inode caches so the walk reads from the
+// storage device.  Only root can.
+static void
+DropCaches() {
+
+  ::sync();
+  int fd = ::open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if ((fd < 0) || (::write(fd, "3\n", 2) != 2)) {
+    fprintf(stderr, "Failed to drop the caches, the walk may be warm\n");
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+// Start a cache set on the tree as the daemon does and report how
+// long it took
+static void
+Start(const std::string& dirName, uint64_t numObjects, int numTypes,
+      int numDirTypes, const std::string& stateFile) {
+
+  CStressFileCacheSet cacheSet(s_benchCacheSpace, dirName);
+  if (!cacheSet.LoadState(stateFile)) {
+    cacheSet.WalkDirTree();
+  }
+  cacheSet.CleanupAtStartup();
+  cacheSet.GetStartupProfile().SetReady();
+
+  cacheSize_t size = 0;
+  paramValue_t cached = 0;
+  cacheSize_t space = 0;
+  cacheSet.GetCacheStatus(&size, &cached, &space);
+  if ((uint64_t) cached != numObjects) {
+    fprintf(stderr, "Only %lld of %llu objects were found\n",
+	    (long long) cached, (unsigned long long) numObjects);
+  }
+  Report(stateFile.empty() ? "walk" : "adopt", numObjects, numTypes,
+	 numDirTypes, cacheSet.GetStartupProfile());
+}
+
+int
+main(int argc, char* argv[]) {
+
+  std::vector<uint64_t> objectCounts;
+  std::vector<uint64_t> typeCounts;
+  ParseList("1000,10000,100000", objectCounts);
+  ParseList("1,10,100", typeCounts);
+  int numDirTypes = 0;
+  cacheSize_t minSize = 4096;
+  cacheSize_t maxSize = 4096;
+  int numRuns = 1;
+  bool adopt = false;
+  bool dropCaches = false;
+  std::string parentDir("/tmp");
+  long seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string thisArg(argv[i]);
+    if (thisArg == "-a") {
+      adopt = true;
+      continue;
+    } else if (thisArg == "-C") {
+      dropCaches = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      Usage();
+    }
+    const char* value = argv[++i];
+    if (thisArg == "-o") {
+      if (!ParseList(value, objectCounts)) {
+	Usage();
+      }
+    } else if (thisArg == "-y") {
+      if (!ParseList(value, typeCounts)) {
+	Usage();
+      }
+    } else if (thisArg == "-D") {
+      numDirTypes = atoi(value);
+    } else if (thisArg == "-z") {
+      if (!ParseSizes(value, minSize, maxSize)) {
+	Usage();
+      }
+    } else if (thisArg == "-r") {
+      numRuns = atoi(value);
+    } else if (thisArg == "-d") {
+      parentDir = value;
+    } else if (thisArg == "-s") {
+      seed = ::strtol(value, NULL, 10);
+    } else {
+      Usage();
+    }
+  }
+  if ((numDirTypes < 0) || (numRuns <= 0)) {
+    Usage();
+  }
+
+  // The engine logs every object it finds, which would be timed as
+  // well
+  MojLogEngine::instance()->reset(MojLogger::LevelError);
+
+  const std::string dirTemplate(parentDir + "/filecache-startupbench.XXXXXX");
+  std::vector<char> dirName(dirTemplate.begin(), dirTemplate.end());
+  dirName.push_back('\0');
+  if (::mkdtemp(&dirName[0]) == NULL) {
+    fprintf(stderr, "Failed to create a scratch directory in '%s'\n",
+	    parentDir.c_str());
+    return 1;
+  }
+  const std::string scratchDir(&dirName[0]);
+  const std::string stateFile(adopt ? scratchDir + "/filecache.state" : "");
+
+  int retVal = 0;
+  std::vector<uint64_t>::const_iterator objects;
+  std::vector<uint64_t>::const_iterator types;
+  for (objects = objectCounts.begin();
+       (objects != objectCounts.end()) && (retVal == 0); ++objects) {
+    for (types = typeCounts.begin();
+	 (types != typeCounts.end()) && (retVal == 0); ++types) {
+      if (*types > *objects) {
+	continue;
+      }
+      if ((*objects + 2 * *types) * (uint64_t) GetFilesystemFileSize(maxSize) >
+	  (uint64_t) s_benchCacheSpace) {
+	fprintf(stderr, "Skipping %llu objects in %llu types, they don't fit in a cache set\n",
+		(unsigned long long) *objects, (unsigned long long) *types);
+	continue;
+      }
+      const int dirTypes = std::min(numDirTypes, (int) *types);
+      std::stringstream runDir;
+      runDir << scratchDir << "/o" << *objects << "-t" << *types;
+      boost::system::error_code error;
+      fs::create_directories(runDir.str(), error);
+      ::srand48(seed);
+      if (!MakeTree(runDir.str(), *objects, (int) *types, dirTypes, minSize,
+		    maxSize, "")) {
+	retVal = 1;
+      }
+      for (int run = 0; (run < numRuns) && (retVal == 0); run++) {
+	if (dropCaches) {
+	  DropCaches();
+	}
+	Start(runDir.str(), *objects, (int) *types, dirTypes, "");
+	if (adopt) {
+	  // The walked tree is saved again for the next daemon
+	  {
+	    CStressFileCacheSet cacheSet(s_benchCacheSpace, runDir.str());
+	    cacheSet.WalkDirTree();
+	    if (!cacheSet.SaveState(stateFile)) {
+	      fprintf(stderr, "Failed to save the state\n");
+	      retVal = 1;
+	      break;
+	    }
+	  }
+	  if (dropCaches) {
+	    DropCaches();
+	  }
+	  Start(runDir.str(), *objects, (int) *types, dirTypes, stateFile);
+	}
+      }
+      fs::remove_all(runDir.str(), error);
+    }
+  }
+  boost::system::error_code error;
+  fs::remove_all(scratchDir, error);
+
+  return retVal;
+}